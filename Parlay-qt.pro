@@ -203,6 +203,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/bitcoinaddressvalidator.h \
     src/alert.h \
     src/allocators.h \
+    src/addrindex.h \
     src/addrman.h \
     src/base58.h \
     src/bignum.h \
@@ -218,11 +219,13 @@ HEADERS += src/qt/bitcoingui.h \
     src/kernel.h \
     src/pbkdf2.h \
     src/serialize.h \
+    src/prevector.h \
     src/support/cleanse.h \
     src/core.h \
     src/main.h \
     src/miner.h \
     src/net.h \
+    src/orphanpool.h \
     src/ecwrapper.h \
     src/key.h \
     src/pubkey.h \
@@ -230,6 +233,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/txdb.h \
     src/txmempool.h \
     src/walletdb.h \
+    src/walletlog.h \
     src/script.h \
     src/scrypt.h \
     src/init.h \
@@ -306,6 +310,10 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/adrenalinenodeconfigdialog.h \
     src/qt/qcustomplot.h \
     src/smessage.h \
+    src/smessage-store.h \
+    src/smessage-scan.h \
+    src/smessage-pow.h \
+    src/workqueue.h \
     src/qt/messagepage.h \
     src/qt/messagemodel.h \
     src/qt/sendmessagesdialog.h \
@@ -348,10 +356,13 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/miner.cpp \
     src/init.cpp \
     src/net.cpp \
+    src/orphanpool.cpp \
     src/checkpoints.cpp \
+    src/addrindex.cpp \
     src/addrman.cpp \
     src/db.cpp \
     src/walletdb.cpp \
+    src/walletlog.cpp \
     src/qt/clientmodel.cpp \
     src/qt/guiutil.cpp \
     src/qt/transactionrecord.cpp \
@@ -379,6 +390,7 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/rpcwallet.cpp \
     src/rpcblockchain.cpp \
     src/rpcrawtransaction.cpp \
+    src/rest.cpp \
     src/qt/overviewpage.cpp \
     src/qt/csvmodelwriter.cpp \
     src/crypter.cpp \
@@ -419,6 +431,9 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/qt/adrenalinenodeconfigdialog.cpp \
     src/qt/qcustomplot.cpp \
     src/smessage.cpp \
+    src/smessage-store.cpp \
+    src/smessage-scan.cpp \
+    src/smessage-pow.cpp \
     src/qt/messagepage.cpp \
     src/qt/messagemodel.cpp \
     src/qt/sendmessagesdialog.cpp \
@@ -0,0 +1,183 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addrindex.h"
+
+#include "init.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+#include "workqueue.h"
+
+using namespace std;
+
+static CCriticalSection cs_addrIndexRebuild;
+static CAddrIndexRebuildStatus statusRebuild;
+
+/** Blocks [nBegin, nEnd) of the main chain and the transactions found in them */
+class CAddrIndexRange
+{
+public:
+    int nBegin;
+    int nEnd;
+    MapAddrIndex mapAddrIndex;
+};
+
+static bool IndexRange(const CChainSnapshot* pchain, vector<CAddrIndexRange>* pvRanges, size_t i)
+{
+    CAddrIndexRange& range = (*pvRanges)[i];
+    CTxDB txdb("r");
+    for (int nHeight = range.nBegin; nHeight < range.nEnd; nHeight++)
+    {
+        if (ShutdownRequested())
+            return false;
+
+        CBlockIndex* pindex = (*pchain)[nHeight];
+        CBlock block;
+        if (!pindex || !block.ReadFromDisk(pindex, true))
+            return error("IndexRange() : failed to read block at height %d", nHeight);
+        if (!block.GetAddressIndex(txdb, range.mapAddrIndex))
+            LogPrintf("IndexRange() : block %s at height %d is only partly indexed\n", pindex->GetBlockHash().ToString(), nHeight);
+    }
+    return true;
+}
+
+static void SetRebuildRunning(bool fRunning)
+{
+    LOCK(cs_addrIndexRebuild);
+    statusRebuild.fRunning = fRunning;
+}
+
+static void ThreadAddrIndexRebuild(int nHeightStart)
+{
+    RenameThread("parlay-addrindex");
+
+    // This thread takes part in every round, so one less worker
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), ADDRINDEX_MAX_THREADS));
+    CWorkQueue queue("addrindex");
+    queue.Start(nThreads - 1);
+
+    int nHeightNext = nHeightStart;
+    int64_t nLastLog = GetTime();
+    try
+    {
+        while (true)
+        {
+            boost::this_thread::interruption_point();
+
+            // Blocks connected in the meantime move the target, the rebuild
+            // is done once it has caught up with the tip
+            CChainSnapshotRef chain = GetChainSnapshot();
+            int nHeightTarget = chain->Height();
+            {
+                LOCK(cs_addrIndexRebuild);
+                statusRebuild.nHeightTarget = nHeightTarget;
+            }
+            if (nHeightNext > nHeightTarget)
+            {
+                LOCK(cs_main);
+                if (nBestHeight >= nHeightNext)
+                    continue;
+                CTxDB txdb("r+");
+                txdb.EraseAddrIndexHeight();
+                LogPrintf("Address index rebuilt up to height %d in %ds\n", nHeightTarget, GetTime() - GetAddrIndexRebuildStatus().nTimeStart);
+                break;
+            }
+
+            vector<CAddrIndexRange> vRanges;
+            for (int nBegin = nHeightNext; nBegin <= nHeightTarget && (int)vRanges.size() < nThreads; nBegin += ADDRINDEX_RANGE_SIZE)
+            {
+                vRanges.resize(vRanges.size() + 1);
+                vRanges.back().nBegin = nBegin;
+                vRanges.back().nEnd = std::min(nBegin + ADDRINDEX_RANGE_SIZE, nHeightTarget + 1);
+            }
+
+            bool fOk;
+            {
+                // The workers use vRanges until Run returns
+                boost::this_thread::disable_interruption di;
+                fOk = queue.Run(vRanges.size(), boost::bind(&IndexRange, chain.get(), &vRanges, _1));
+            }
+            if (!fOk)
+            {
+                if (!ShutdownRequested())
+                    LogPrintf("Address index rebuild stopped at height %d, restart to continue\n", nHeightNext);
+                break;
+            }
+
+            MapAddrIndex& mapAddrIndex = vRanges[0].mapAddrIndex;
+            for (unsigned int i = 1; i < vRanges.size(); i++)
+            {
+                for (MapAddrIndex::const_iterator it = vRanges[i].mapAddrIndex.begin(); it != vRanges[i].mapAddrIndex.end(); ++it)
+                {
+                    vector<uint256>& txHashes = mapAddrIndex[it->first];
+                    txHashes.insert(txHashes.end(), it->second.begin(), it->second.end());
+                }
+            }
+            nHeightNext = vRanges.back().nEnd;
+
+            {
+                // ConnectBlock updates the same entries with cs_main held
+                LOCK(cs_main);
+                CTxDB txdb("r+");
+                if (!txdb.WriteAddrIndexRange(mapAddrIndex, nHeightNext))
+                {
+                    LogPrintf("Address index rebuild failed to write up to height %d\n", nHeightNext);
+                    break;
+                }
+            }
+            {
+                LOCK(cs_addrIndexRebuild);
+                statusRebuild.nHeightNext = nHeightNext;
+            }
+
+            if (GetTime() - nLastLog >= 60)
+            {
+                LogPrintf("Rebuilding address index, height %d of %d\n", nHeightNext, nHeightTarget);
+                nLastLog = GetTime();
+            }
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+        SetRebuildRunning(false);
+        throw;
+    }
+    SetRebuildRunning(false);
+}
+
+void StartAddrIndexRebuild(boost::thread_group& threadGroup, bool fRestart)
+{
+    int nHeightStart = 0;
+    {
+        CTxDB txdb("r+");
+        if (txdb.ReadAddrIndexHeight(nHeightStart))
+            LogPrintf("Continuing address index rebuild from height %d\n", nHeightStart);
+        else if (fRestart)
+        {
+            nHeightStart = 0;
+            txdb.WriteAddrIndexHeight(nHeightStart);
+            LogPrintf("Rebuilding address index\n");
+        }
+        else
+            return;
+    }
+    if (!GetBoolArg("-addrindex", false))
+        LogPrintf("Warning: blocks are added to the address index only with -addrindex\n");
+
+    {
+        LOCK(cs_addrIndexRebuild);
+        statusRebuild.fRunning = true;
+        statusRebuild.nHeightStart = nHeightStart;
+        statusRebuild.nHeightNext = nHeightStart;
+        statusRebuild.nTimeStart = GetTime();
+    }
+    threadGroup.create_thread(boost::bind(&ThreadAddrIndexRebuild, nHeightStart));
+}
+
+CAddrIndexRebuildStatus GetAddrIndexRebuildStatus()
+{
+    LOCK(cs_addrIndexRebuild);
+    return statusRebuild;
+}
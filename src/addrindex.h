@@ -0,0 +1,40 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRINDEX_H
+#define BITCOIN_ADDRINDEX_H
+
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+
+/** Blocks one worker of the address index rebuild reads before handing them over */
+static const int ADDRINDEX_RANGE_SIZE = 250;
+static const int ADDRINDEX_MAX_THREADS = 8;
+
+/** Progress of the background address index rebuild, see GetAddrIndexRebuildStatus */
+class CAddrIndexRebuildStatus
+{
+public:
+    bool fRunning;
+    int nHeightStart;       // first block indexed by this run
+    int nHeightNext;        // blocks below this height are indexed
+    int nHeightTarget;      // tip of the chain when the current ranges were handed out
+    int64_t nTimeStart;
+
+    CAddrIndexRebuildStatus() : fRunning(false), nHeightStart(0), nHeightNext(0), nHeightTarget(-1), nTimeStart(0) {}
+};
+
+/** Rebuild the address index in the background while the node runs.
+ *
+ *  Block ranges are indexed in parallel and each round of ranges is merged
+ *  into the index in one LevelDB batch, together with the height reached.
+ *  An interrupted rebuild continues from there on the next start. fRestart
+ *  (-reindexaddr) starts over from the genesis block unless a rebuild is
+ *  already under way.
+ */
+void StartAddrIndexRebuild(boost::thread_group& threadGroup, bool fRestart);
+CAddrIndexRebuildStatus GetAddrIndexRebuildStatus();
+
+#endif // BITCOIN_ADDRINDEX_H
@@ -7,10 +7,13 @@
 #include "hash.h"
 #include "uint256.h"
 #include "chainparams.h"
+#include "sync.h"
 
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
+#include <deque>
+#include <map>
 #include <vector>
 #include <string>
 #include <boost/variant/apply_visitor.hpp>
@@ -19,12 +22,31 @@
 /* All alphanumeric characters except for "0", "I", "O", and "l" */
 static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
 
+// Digit value of each character, -1 if it is not a base58 digit
+static const int8_t mapBase58[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8,-1,-1,-1,-1,-1,-1,
+    -1, 9,10,11,12,13,14,15,16,-1,17,18,19,20,21,-1,
+    22,23,24,25,26,27,28,29,30,31,32,-1,-1,-1,-1,-1,
+    -1,33,34,35,36,37,38,39,40,41,42,43,-1,44,45,46,
+    47,48,49,50,51,52,53,54,55,56,57,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+// Encoded and decoded sizes up to this are worked on in a stack buffer
+static const size_t BASE58_STACK_SIZE = 128;
+
 bool DecodeBase58(const char* psz, std::vector<unsigned char>& vchRet) {
-    CAutoBN_CTX pctx;
     vchRet.clear();
-    CBigNum bn58 = 58;
-    CBigNum bn = 0;
-    CBigNum bnChar;
     // Skip leading spaces.
     while (*psz && isspace(*psz))
         psz++;
@@ -34,56 +56,33 @@ bool DecodeBase58(const char* psz, std::vector<unsigned char>& vchRet) {
         zeroes++;
         psz++;
     }
-    // Convert big endian string to bignum
-    for (const char* p = psz; *p; p++)
-    {
-        const char* p1 = strchr(pszBase58, *p);
-        if (p1 == NULL)
-        {
-            while (isspace(*p))
-                p++;
-            if (*p != '\0')
-                return false;
-            break;
-        }
-        bnChar.setulong(p1 - pszBase58);
-        if (!BN_mul(&bn, &bn, &bn58, pctx))
-            throw bignum_error("DecodeBase58 : BN_mul failed");
-        bn += bnChar;
-    }
-
-     // Get bignum as little endian data
-    std::vector<unsigned char> vchTmp = bn.getvch();
-
-    // Trim off sign byte if present
-    if (vchTmp.size() >= 2 && vchTmp.end()[-1] == 0 && vchTmp.end()[-2] >= 0x80)
-        vchTmp.erase(vchTmp.end()-1);
-
-    // Restore leading zeros
-    int nLeadingZeros = 0;
-    for (const char* p = psz; *p == pszBase58[0]; p++)
-        nLeadingZeros++;
-    vchRet.assign(nLeadingZeros + vchTmp.size(), 0);
-
-    // Convert little endian data to big endian
-    reverse_copy(vchTmp.begin(), vchTmp.end(), vchRet.end() - vchTmp.size());
-    return true;
     // Allocate enough space in big-endian base256 representation.
-    std::vector<unsigned char> b256(strlen(psz) * 733 / 1000 + 1); // log(58) / log(256), rounded up.
-    // Process the characters.
+    size_t size = strlen(psz) * 733 / 1000 + 1; // log(58) / log(256), rounded up.
+    unsigned char b256Stack[BASE58_STACK_SIZE];
+    std::vector<unsigned char> b256Heap;
+    unsigned char* b256 = b256Stack;
+    if (size > BASE58_STACK_SIZE) {
+        b256Heap.resize(size);
+        b256 = &b256Heap[0];
+    } else {
+        memset(b256, 0, size);
+    }
+    // Process the characters, length is the number of significant bytes so far.
+    size_t length = 0;
     while (*psz && !isspace(*psz)) {
         // Decode base58 character
-        const char *ch = strchr(pszBase58, *psz);
-        if (ch == NULL)
+        int carry = mapBase58[(uint8_t)*psz];
+        if (carry == -1)
             return false;
         // Apply "b256 = b256 * 58 + ch".
-        int carry = ch - pszBase58;
-        for (std::vector<unsigned char>::reverse_iterator it = b256.rbegin(); it != b256.rend(); it++) {
-            carry += 58 * (*it);
-            *it = carry % 256;
+        size_t i = 0;
+        for (size_t j = size; j > 0 && (carry != 0 || i < length); j--, i++) {
+            carry += 58 * b256[j - 1];
+            b256[j - 1] = carry % 256;
             carry /= 256;
         }
         assert(carry == 0);
+        length = i;
         psz++;
     }
     // Skip trailing spaces.
@@ -92,14 +91,13 @@ bool DecodeBase58(const char* psz, std::vector<unsigned char>& vchRet) {
     if (*psz != 0)
         return false;
     // Skip leading zeroes in b256.
-    std::vector<unsigned char>::iterator it = b256.begin();
-    while (it != b256.end() && *it == 0)
+    const unsigned char* it = b256 + size - length;
+    while (it != b256 + size && *it == 0)
         it++;
     // Copy result into output vector.
-    vchRet.reserve(zeroes + (b256.end() - it));
+    vchRet.reserve(zeroes + (b256 + size - it));
     vchRet.assign(zeroes, 0x00);
-    while (it != b256.end())
-      vchRet.push_back(*(it++));
+    vchRet.insert(vchRet.end(), it, (const unsigned char*)b256 + size);
     return true;
 }
 
@@ -111,29 +109,39 @@ std::string EncodeBase58(const unsigned char* pbegin, const unsigned char* pend)
         zeroes++;
     }
     // Allocate enough space in big-endian base58 representation.
-    std::vector<unsigned char> b58((pend - pbegin) * 138 / 100 + 1); // log(256) / log(58), rounded up.
-    // Process the bytes.
+    size_t size = (pend - pbegin) * 138 / 100 + 1; // log(256) / log(58), rounded up.
+    unsigned char b58Stack[BASE58_STACK_SIZE];
+    std::vector<unsigned char> b58Heap;
+    unsigned char* b58 = b58Stack;
+    if (size > BASE58_STACK_SIZE) {
+        b58Heap.resize(size);
+        b58 = &b58Heap[0];
+    } else {
+        memset(b58, 0, size);
+    }
+    // Process the bytes, length is the number of significant digits so far.
+    size_t length = 0;
     while (pbegin != pend) {
         int carry = *pbegin;
         // Apply "b58 = b58 * 256 + ch".
-        for (std::vector<unsigned char>::reverse_iterator it = b58.rbegin(); it != b58.rend(); it++) {
-            carry += 256 * (*it);
-            *it = carry % 58;
+        size_t i = 0;
+        for (size_t j = size; j > 0 && (carry != 0 || i < length); j--, i++) {
+            carry += 256 * b58[j - 1];
+            b58[j - 1] = carry % 58;
             carry /= 58;
         }
         assert(carry == 0);
+        length = i;
         pbegin++;
     }
     // Skip leading zeroes in base58 result.
-    std::vector<unsigned char>::iterator it = b58.begin();
-    while (it != b58.end() && *it == 0)
+    const unsigned char* it = b58 + size - length;
+    while (it != b58 + size && *it == 0)
         it++;
     // Translate the result into a string.
-    std::string str;
-    str.reserve(zeroes + (b58.end() - it));
-    str.assign(zeroes, '1');
-    while (it != b58.end())
-        str += pszBase58[*(it++)];
+    std::string str(zeroes + (b58 + size - it), '1');
+    for (std::string::iterator itStr = str.begin() + zeroes; itStr != str.end(); ++itStr)
+        *itStr = pszBase58[*(it++)];
     return str;
 }
 
@@ -297,6 +305,48 @@ bool CParlayAddress::IsScript() const {
     return IsValid() && vchVersion == Params().Base58Prefix(CChainParams::SCRIPT_ADDRESS);
 }
 
+// Scripts whose address string ExtractAddressString remembers, oldest dropped first
+static const size_t ADDRESS_CACHE_SIZE = 20000;
+
+static CCriticalSection cs_addressCache;
+typedef std::map<CScript, std::string> AddressCacheMap;
+static AddressCacheMap mapAddressCache;
+static std::deque<AddressCacheMap::iterator> dequeAddressCache;
+// Network the cached strings were made for
+static const CChainParams* pAddressCacheParams = NULL;
+
+bool ExtractAddressString(const CScript& scriptPubKey, std::string& strAddress) {
+    {
+        LOCK(cs_addressCache);
+        if (pAddressCacheParams != &Params()) {
+            mapAddressCache.clear();
+            dequeAddressCache.clear();
+            pAddressCacheParams = &Params();
+        }
+        AddressCacheMap::const_iterator mi = mapAddressCache.find(scriptPubKey);
+        if (mi != mapAddressCache.end()) {
+            strAddress = mi->second;
+            return true;
+        }
+    }
+
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest))
+        return false;
+    strAddress = CParlayAddress(dest).ToString();
+
+    LOCK(cs_addressCache);
+    std::pair<AddressCacheMap::iterator, bool> ret = mapAddressCache.insert(std::make_pair(scriptPubKey, strAddress));
+    if (ret.second) {
+        dequeAddressCache.push_back(ret.first);
+        if (dequeAddressCache.size() > ADDRESS_CACHE_SIZE) {
+            mapAddressCache.erase(dequeAddressCache.front());
+            dequeAddressCache.pop_front();
+        }
+    }
+    return true;
+}
+
 void CParlaySecret::SetKey(const CKey& vchSecret) {
     assert(vchSecret.IsValid());
     SetData(Params().Base58Prefix(CChainParams::SECRET_KEY), vchSecret.begin(), vchSecret.size());
@@ -115,6 +115,14 @@ public:
     bool IsScript() const;
 };
 
+/**
+ * Address string of the destination scriptPubKey pays to, the same as
+ * CParlayAddress(dest).ToString() after ExtractDestination. The wallet and
+ * RPC tables ask for the same scripts over and over, so a bounded number of
+ * them is remembered. Returns false if the script has no address.
+ */
+bool ExtractAddressString(const CScript& scriptPubKey, std::string& strAddress);
+
 /**
  * A base58-encoded secret key
  */
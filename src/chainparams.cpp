@@ -64,7 +64,7 @@ public:
         vAlertPubKey = ParseHex("04ac1f0b7d2bc73c5eb8f057fd2ab32b6d2f14b270a87e2ba7ca622a6f362ef951cf3056369d70c807bc65346e0cd37b0ac16310400a586dd3dfc8c6ab6d949c44");
         nDefaultPort = 9000;
         nRPCPort = 9001;
-        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 16);
+        bnProofOfWorkLimit = ~uint256(0) >> 16;
 
         const char* pszTimestamp = "ParlayChain starts on May 8, a month before Russian World Cup.";
         std::vector<CTxIn> vin;
@@ -134,7 +134,7 @@ public:
         pchMessageStart[1] = 0xc4;
         pchMessageStart[2] = 0xa4;
         pchMessageStart[3] = 0x31;
-        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 16);
+        bnProofOfWorkLimit = ~uint256(0) >> 16;
         vAlertPubKey = ParseHex("04ac1f0b7d2bc73c5eb8f057fd2ab32b6d2f14b270a87e2ba7ca622a6f362ef951cf3056369d70c807bc65346e0cd37b0ac16310400a586dd3dfc8c6ab6d949c44");
         nDefaultPort = 8000;
         nRPCPort = 8001;
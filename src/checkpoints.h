@@ -4,13 +4,10 @@
 #ifndef BITCOIN_CHECKPOINT_H
 #define  BITCOIN_CHECKPOINT_H
 
-#include <map>
+#include "main.h"
 #include "net.h"
 #include "util.h"
 
-class uint256;
-class CBlockIndex;
-
 /** Block-chain checkpoints are compiled-in sanity checks.
  * They are updated every release or three.
  */
@@ -24,7 +21,7 @@ namespace Checkpoints
     int GetTotalBlocksEstimate();
 
     // Returns last CBlockIndex* in mapBlockIndex that is a checkpoint
-    CBlockIndex* GetLastCheckpoint(const std::map<uint256, CBlockIndex*>& mapBlockIndex);
+    CBlockIndex* GetLastCheckpoint(const BlockMap& mapBlockIndex);
 
     const CBlockIndex* AutoSelectSyncCheckpoint();
     bool CheckSync(int nHeight);
@@ -228,6 +228,7 @@ bool CCryptoKeyStore::LockKeyStore()
     {
         LOCK(cs_KeyStore);
         vMasterKey.clear();
+        mapKeyCache.clear();
     }
 
     NotifyStatusChanged(this);
@@ -258,6 +259,18 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
             return false;
         }
         vMasterKey = vMasterKeyIn;
+
+        if (fKeyCache && fKeyCachePrefill)
+        {
+            int64_t nStart = GetTimeMillis();
+            for (mi = mapCryptedKeys.begin(); mi != mapCryptedKeys.end(); ++mi)
+            {
+                CKey key;
+                if (DecryptKey((*mi).second.first, (*mi).second.second, key))
+                    mapKeyCache[(*mi).first] = key;
+            }
+            LogPrint("wallet", "CCryptoKeyStore::Unlock : decrypted %u keys in %dms\n", mapKeyCache.size(), GetTimeMillis() - nStart);
+        }
     }
     NotifyStatusChanged(this);
     return true;
@@ -297,6 +310,26 @@ bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<
     return true;
 }
 
+bool CCryptoKeyStore::DecryptKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret, CKey& keyOut) const
+{
+    CKeyingMaterial vchSecret;
+    if (!DecryptSecret(vMasterKey, vchCryptedSecret, vchPubKey.GetHash(), vchSecret))
+        return false;
+    if (vchSecret.size() != 32)
+        return false;
+    keyOut.Set(vchSecret.begin(), vchSecret.end(), vchPubKey.IsCompressed());
+    return true;
+}
+
+void CCryptoKeyStore::SetKeyCache(bool fEnable, bool fPrefill)
+{
+    LOCK(cs_KeyStore);
+    fKeyCache = fEnable;
+    fKeyCachePrefill = fEnable && fPrefill;
+    if (!fKeyCache)
+        mapKeyCache.clear();
+}
+
 bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
 {
     {
@@ -304,17 +337,20 @@ bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
         if (!IsCrypted())
             return CBasicKeyStore::GetKey(address, keyOut);
 
+        std::map<CKeyID, CKey>::const_iterator it = mapKeyCache.find(address);
+        if (it != mapKeyCache.end())
+        {
+            keyOut = it->second;
+            return true;
+        }
+
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.find(address);
         if (mi != mapCryptedKeys.end())
         {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            CKeyingMaterial vchSecret;
-            if (!DecryptSecret(vMasterKey, vchCryptedSecret, vchPubKey.GetHash(), vchSecret))
-                return false;
-            if (vchSecret.size() != 32)
+            if (!DecryptKey((*mi).second.first, (*mi).second.second, keyOut))
                 return false;
-            keyOut.Set(vchSecret.begin(), vchSecret.end(), vchPubKey.IsCompressed());
+            if (fKeyCache)
+                mapKeyCache[address] = keyOut;
             return true;
         }
     }
@@ -142,6 +142,15 @@ protected:
     CryptedKeyMap mapCryptedKeys;
     CKeyingMaterial vMasterKey;
 
+    // Keys already decrypted while unlocked, so staking and message
+    // decryption don't pay for AES on every lookup. CKey keeps its secret
+    // in locked pages; the cache is wiped whenever the key store is locked.
+    bool fKeyCache;
+    bool fKeyCachePrefill;
+    mutable std::map<CKeyID, CKey> mapKeyCache;
+
+    bool DecryptKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret, CKey& keyOut) const;
+
     bool SetCrypted();
 
     // will encrypt previously unencrypted keys
@@ -150,10 +159,13 @@ protected:
     bool Unlock(const CKeyingMaterial& vMasterKeyIn);
 
 public:
-    CCryptoKeyStore() : fUseCrypto(false)
+    CCryptoKeyStore() : fUseCrypto(false), fKeyCache(true), fKeyCachePrefill(false)
     {
     }
 
+    // fPrefill decrypts every key into the cache as soon as the store is unlocked
+    void SetKeyCache(bool fEnable, bool fPrefill);
+
     bool IsCrypted() const
     {
         return fUseCrypto;
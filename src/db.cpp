@@ -231,7 +231,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 
 
 CDB::CDB(const std::string& strFilename, const char* pszMode) :
-    pdb(NULL), activeTxn(NULL)
+    pdb(NULL), activeTxn(NULL), plog(NULL), plogTxn(NULL)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -239,6 +239,21 @@ CDB::CDB(const std::string& strFilename, const char* pszMode) :
         return;
 
     bool fCreate = strchr(pszMode, 'c');
+
+    plog = GetWalletLog(strFilename);
+    if (plog)
+    {
+        strFile = strFilename;
+        if (fCreate && !Exists(string("version")))
+        {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(CLIENT_VERSION);
+            fReadOnly = fTmp;
+        }
+        return;
+    }
+
     unsigned int nFlags = DB_THREAD;
     if (fCreate)
         nFlags |= DB_CREATE;
@@ -295,6 +310,13 @@ CDB::CDB(const std::string& strFilename, const char* pszMode) :
 
 void CDB::Close()
 {
+    if (plog)
+    {
+        delete plogTxn;
+        plogTxn = NULL;
+        plog = NULL;
+        return;
+    }
     if (!pdb)
         return;
     if (activeTxn)
@@ -341,6 +363,9 @@ bool CDBEnv::RemoveDb(const string& strFile)
 
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
+    if (CWalletLog* plog = GetWalletLog(strFile))
+        return plog->Compact(pszSkip);
+
     while (true)
     {
         {
@@ -371,7 +396,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess)
                         {
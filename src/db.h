@@ -9,6 +9,7 @@
 #include "serialize.h"
 #include "sync.h"
 #include "version.h"
+#include "walletlog.h"
 
 #include <map>
 #include <string>
@@ -89,6 +90,27 @@ public:
 extern CDBEnv bitdb;
 
 
+/** Cursor returned by CDB::GetCursor, over a Berkeley DB or a wallet log */
+class CDBCursor
+{
+public:
+    Dbc* pdbc;
+    CWalletLog* plog;
+    std::vector<unsigned char> vchKey;  // last key read from plog
+    bool fStarted;
+
+    CDBCursor(Dbc* pdbcIn, CWalletLog* plogIn) : pdbc(pdbcIn), plog(plogIn), fStarted(false) {}
+
+    // Release the cursor, like Dbc::close
+    void close()
+    {
+        if (pdbc)
+            pdbc->close();
+        delete this;
+    }
+};
+
+
 /** RAII class that provides access to a Berkeley database */
 class CDB
 {
@@ -97,6 +119,8 @@ protected:
     std::string strFile;
     DbTxn *activeTxn;
     bool fReadOnly;
+    CWalletLog* plog;           // set instead of pdb when strFile is a wallet log
+    CWalletLogBatch* plogTxn;
 
     explicit CDB(const std::string& strFilename, const char* pszMode="r+");
     ~CDB() { Close(); }
@@ -112,13 +136,27 @@ protected:
     template<typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog)
+        {
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            if (!plog->Read(ssKey, ssValue, plogTxn))
+                return false;
+            try {
+                ssValue >> value;
+            }
+            catch (std::exception &e) {
+                return false;
+            }
+            return true;
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Read
@@ -147,7 +185,7 @@ protected:
     template<typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite=true)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
@@ -162,6 +200,21 @@ protected:
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
+
+        if (plog)
+        {
+            if (!fOverwrite && plog->Exists(ssKey, plogTxn))
+                return false;
+            if (plogTxn)
+            {
+                plogTxn->Write(ssKey, ssValue);
+                return true;
+            }
+            CWalletLogBatch batch;
+            batch.Write(ssKey, ssValue);
+            return plog->Commit(batch);
+        }
+
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
@@ -176,7 +229,7 @@ protected:
     template<typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -185,6 +238,20 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog)
+        {
+            if (!plog->Exists(ssKey, plogTxn))
+                return true;
+            if (plogTxn)
+            {
+                plogTxn->Erase(ssKey);
+                return true;
+            }
+            CWalletLogBatch batch;
+            batch.Erase(ssKey);
+            return plog->Commit(batch);
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
@@ -198,13 +265,16 @@ protected:
     template<typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog)
+            return plog->Exists(ssKey, plogTxn);
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
@@ -215,19 +285,45 @@ protected:
         return (ret == 0);
     }
 
-    Dbc* GetCursor()
+    CDBCursor* GetCursor()
     {
+        if (plog)
+            return new CDBCursor(NULL, plog);
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
         int ret = pdb->cursor(NULL, &pcursor, 0);
         if (ret != 0)
             return NULL;
-        return pcursor;
+        return new CDBCursor(pcursor, NULL);
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
+    int ReadAtCursor(CDBCursor* pdbcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
     {
+        if (pdbcursor->plog)
+        {
+            // The log cursor only remembers the last key, so it stays valid across writes
+            bool fInclusive = false;
+            if (fFlags == DB_SET_RANGE)
+            {
+                pdbcursor->vchKey.assign(ssKey.begin(), ssKey.end());
+                fInclusive = true;
+            }
+            else if (fFlags != DB_NEXT)
+                return 99999;
+            else if (!pdbcursor->fStarted)
+                fInclusive = true;
+            pdbcursor->fStarted = true;
+
+            ssKey.SetType(SER_DISK);
+            ssValue.SetType(SER_DISK);
+            if (!pdbcursor->plog->ReadNext(pdbcursor->vchKey, fInclusive, ssKey, ssValue))
+                return DB_NOTFOUND;
+            pdbcursor->vchKey.assign(ssKey.begin(), ssKey.end());
+            return 0;
+        }
+
+        Dbc* pcursor = pdbcursor->pdbc;
         // Read at cursor
         Dbt datKey;
         if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
@@ -268,6 +364,13 @@ protected:
 public:
     bool TxnBegin()
     {
+        if (plog)
+        {
+            if (plogTxn)
+                return false;
+            plogTxn = new CWalletLogBatch();
+            return true;
+        }
         if (!pdb || activeTxn)
             return false;
         DbTxn* ptxn = bitdb.TxnBegin();
@@ -279,6 +382,15 @@ public:
 
     bool TxnCommit()
     {
+        if (plog)
+        {
+            if (!plogTxn)
+                return false;
+            bool fOk = plog->Commit(*plogTxn, true);
+            delete plogTxn;
+            plogTxn = NULL;
+            return fOk;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->commit(0);
@@ -288,6 +400,14 @@ public:
 
     bool TxnAbort()
     {
+        if (plog)
+        {
+            if (!plogTxn)
+                return false;
+            delete plogTxn;
+            plogTxn = NULL;
+            return true;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->abort();
@@ -5,6 +5,7 @@
 
 #include "init.h"
 
+#include "addrindex.h"
 #include "addrman.h"
 #include "main.h"
 #include "chainparams.h"
@@ -140,10 +141,12 @@ void Shutdown()
 #ifdef ENABLE_WALLET
     delete pwalletMain;
     pwalletMain = NULL;
+    CloseWalletLogs();
 #endif
     globalVerifyHandle.reset();
     ECC_Stop();
     LogPrintf("Shutdown : done\n");
+    FlushDebugLog();
 }
 
 //
@@ -192,6 +195,8 @@ std::string HelpMessage()
     strUsage += "  -pid=<file>            " + _("Specify pid file (default: Parlayd.pid)") + "\n";
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n";
+    strUsage += "  -walletbackend=<type>  " + _("Store the wallet in Berkeley DB (bdb) or in an append-only record log (log) (default: bdb)") + "\n";
+    strUsage += "  -migratewallet=<file>  " + _("Berkeley DB wallet to copy into the wallet log when the log does not exist yet (default: wallet.dat)") + "\n";
     strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 10)") + "\n";
     strUsage += "  -dbwalletcache=<n>     " + _("Set wallet database cache size in megabytes (default: 1)") + "\n";
     strUsage += "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n";
@@ -244,6 +249,9 @@ std::string HelpMessage()
     }
     strUsage += "  -logtimestamps         " + _("Prepend debug output with timestamp") + "\n";
     strUsage += "  -shrinkdebugfile       " + _("Shrink debug.log file on client startup (default: 1 when no -debug)") + "\n";
+    strUsage += "  -logasync              " + _("Write debug.log from a background thread (default: 1)") + "\n";
+    strUsage += "  -logrotatesize=<n>     " + _("Move debug.log to debug.log.1 when it grows past <n> MB, 0 = never (default: 0)") + "\n";
+    strUsage += "  -lockstats             " + _("Record lock wait and hold times for getlockstats (default: 0)") + "\n";
     strUsage += "  -printtoconsole        " + _("Send trace/debug info to console instead of debug.log file") + "\n";
     strUsage += "  -regtest               " + _("Enter regression test mode, which uses a special chain in which blocks can be "
                                                 "solved instantly. This is intended for regression testing tools and app development.") + "\n";
@@ -256,6 +264,7 @@ std::string HelpMessage()
         strUsage += "  -rpcwait               " + _("Wait for RPC server to start") + "\n";
     }
     strUsage += "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC calls (default: 4)") + "\n";
+    strUsage += "  -rest                  " + _("Accept public REST requests (default: 0)") + "\n";
     strUsage += "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n";
     strUsage += "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n";
     strUsage += "  -confchange            " + _("Require a confirmations for change (default: 0)") + "\n";
@@ -263,11 +272,17 @@ std::string HelpMessage()
     strUsage += "  -upgradewallet         " + _("Upgrade wallet to latest format") + "\n";
     strUsage += "  -createwalletbackups=<n> " + _("Number of automatic wallet backups (default: 10)") + "\n";
     strUsage += "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100) (litemode: 10)") + "\n";
+    strUsage += "  -keycache              " + _("Keep decrypted keys in memory while the wallet is unlocked (default: 1)") + "\n";
+    strUsage += "  -keycacheprefill       " + _("Decrypt all keys into the key cache when the wallet is unlocked (default: 0)") + "\n";
     strUsage += "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n";
-    strUsage += "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n";
+    strUsage += "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat, or keep the undamaged start of a wallet log") + "\n";
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 500, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n";
+    strUsage += "  -addrindex             " + _("Maintain an index of the transactions of each address (default: 0)") + "\n";
+    strUsage += "  -reindexaddr           " + _("Rebuild the address index in the background") + "\n";
+    strUsage += "  -coindb                " + _("Keep a database of unspent outputs, needed to prune block files (default: 0)") + "\n";
+    strUsage += "  -prune=<n>             " + strprintf(_("Delete old block files to keep them under <n> MiB, implies -coindb (default: 0 = off, minimum: %u)"), MIN_PRUNE_TARGET_MB) + "\n";
     strUsage += "  -maxorphanblocks=<n>   " + strprintf(_("Keep at most <n> unconnectable blocks in memory (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n";
 
     strUsage += "\n" + _("Block creation options:") + "\n";
@@ -302,6 +317,8 @@ strUsage += "\n" + _("Primenode options:") + "\n";
         "  -nosmsg                                  " + _("Disable secure messaging.") + "\n" +
         "  -debugsmsg                               " + _("Log extra debug messages.") + "\n" +
         "  -smsgscanchain                           " + _("Scan the block chain for public key addresses on startup.") + "\n" +
+        "  -smsgscanthreads=<n>                     " + _("Number of extra threads used to scan incoming messages for owned addresses (default: cores - 1, at most 7)") + "\n" +
+        "  -smsgpowthreads=<n>                      " + _("Number of threads used for the proof of work of sent messages (default: number of cores)") + "\n" +
     strUsage += "  -stakethreshold=<n> " + _("This will set the output size of your stakes to never be below this number (default: 100)") + "\n";
 
     return strUsage;
@@ -469,6 +486,7 @@ bool AppInit2(boost::thread_group& threadGroup)
        fServer = true;
     fPrintToConsole = GetBoolArg("-printtoconsole", false);
     fLogTimestamps = GetBoolArg("-logtimestamps", true);
+    fLockStats = GetBoolArg("-lockstats", false);
 #ifdef ENABLE_WALLET
     bool fDisableWallet = GetBoolArg("-disablewallet", false);
 #endif
@@ -492,6 +510,23 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     fConfChange = GetBoolArg("-confchange", false);
 
+    if (mapArgs.count("-prune"))
+    {
+        int64_t nPruneMB = GetArg("-prune", 0);
+        if (nPruneMB < 0)
+            return InitError(_("Invalid value for -prune"));
+        if (nPruneMB > 0)
+        {
+            if ((uint64_t)nPruneMB < MIN_PRUNE_TARGET_MB)
+                return InitError(strprintf(_("-prune must be at least %u MiB"), MIN_PRUNE_TARGET_MB));
+            if (GetBoolArg("-reindexaddr", false))
+                return InitError(_("-reindexaddr needs all block files and cannot be used with -prune"));
+            nPruneTarget = (uint64_t)nPruneMB * 1024 * 1024;
+            // Peers can no longer download the whole chain from us
+            nLocalServices &= ~NODE_NETWORK;
+        }
+    }
+
 #ifdef ENABLE_WALLET
     if (mapArgs.count("-mininput"))
     {
@@ -512,7 +547,8 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     std::string strDataDir = GetDataDir().string();
 #ifdef ENABLE_WALLET
-    std::string strWalletFileName = GetArg("-wallet", "wallet.dat");
+    bool fWalletLog = GetArg("-walletbackend", "bdb") == "log";
+    std::string strWalletFileName = GetArg("-wallet", fWalletLog ? "wallet.log" : "wallet.dat");
 
     // strWalletFileName must be a plain filename without a directory
     if (strWalletFileName != boost::filesystem::basename(strWalletFileName) + boost::filesystem::extension(strWalletFileName))
@@ -528,6 +564,7 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     if (GetBoolArg("-shrinkdebugfile", !fDebug))
         ShrinkDebugFile();
+    StartDebugLogWriter();
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Parlay version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
@@ -648,14 +685,30 @@ bool AppInit2(boost::thread_group& threadGroup)
             }
         }
 
-        if (GetBoolArg("-salvagewallet", false))
+        if (fWalletLog)
+        {
+            if (!filesystem::exists(GetDataDir() / strWalletFileName))
+            {
+                std::string strMigrateFile = GetArg("-migratewallet", "wallet.dat");
+                if (filesystem::exists(GetDataDir() / strMigrateFile))
+                {
+                    uiInterface.InitMessage(_("Migrating wallet..."));
+                    if (!CWalletDB::MigrateToLog(strMigrateFile, strWalletFileName))
+                        return InitError(strprintf(_("Error migrating %s to %s"), strMigrateFile, strWalletFileName));
+                }
+            }
+            if (!OpenWalletLog(strWalletFileName, GetBoolArg("-salvagewallet", false)))
+                return InitError(strprintf(_("Error loading wallet log %s"), strWalletFileName));
+        }
+
+        if (GetBoolArg("-salvagewallet", false) && !fWalletLog)
         {
             // Recover readable keypairs:
             if (!CWalletDB::Recover(bitdb, strWalletFileName, true))
                 return false;
         }
 
-        if (filesystem::exists(GetDataDir() / strWalletFileName))
+        if (filesystem::exists(GetDataDir() / strWalletFileName) && !fWalletLog)
         {
             CDBEnv::VerifyResult r = bitdb.Verify(strWalletFileName, CWalletDB::Recover);
             if (r == CDBEnv::RECOVER_OK)
@@ -811,6 +864,24 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // Once files have been pruned, their spent outputs only exist in the coin database
+    bool fWantCoinDB = GetBoolArg("-coindb", false) || nPruneTarget > 0 || HavePrunedBlockFiles();
+    if (fWantCoinDB && !fCoinDB)
+    {
+        uiInterface.InitMessage(_("Building coin database..."));
+        nStart = GetTimeMillis();
+        if (!BuildCoinDB())
+            return InitError(_("Error building the coin database"));
+        LogPrintf(" coin db     %15dms\n", GetTimeMillis() - nStart);
+    }
+    else if (!fWantCoinDB && fCoinDB)
+        DisableCoinDB();
+    if (nPruneTarget > 0)
+    {
+        LOCK(cs_main);
+        PruneBlockFiles();
+    }
+
     if (GetBoolArg("-printblockindex", false) || GetBoolArg("-printblocktree", false))
     {
         PrintBlockTree();
@@ -821,7 +892,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -850,6 +921,7 @@ bool AppInit2(boost::thread_group& threadGroup)
         nStart = GetTimeMillis();
         bool fFirstRun = true;
         pwalletMain = new CWallet(strWalletFileName);
+        pwalletMain->SetKeyCache(GetBoolArg("-keycache", true), GetBoolArg("-keycacheprefill", false));
         DBErrors nLoadWalletRet = pwalletMain->LoadWallet(fFirstRun);
         if (nLoadWalletRet != DB_LOAD_OK)
         {
@@ -921,12 +993,21 @@ bool AppInit2(boost::thread_group& threadGroup)
             else
                 pindexRescan = pindexGenesisBlock;
         }
+        if (pindexBest != pindexRescan && pindexBest && pindexRescan && pindexBest->nHeight > pindexRescan->nHeight &&
+            IsBlockFilePruned(pindexRescan->nFile))
+        {
+            // A new wallet has nothing to find in the old blocks
+            if (!fFirstRun)
+                return InitError(_("Error: the wallet needs to rescan blocks that have been pruned"));
+            pindexRescan = pindexBest;
+        }
         if (pindexBest != pindexRescan && pindexBest && pindexRescan && pindexBest->nHeight > pindexRescan->nHeight)
         {
             uiInterface.InitMessage(_("Rescanning..."));
             LogPrintf("Rescanning last %i blocks (from block %i)...\n", pindexBest->nHeight - pindexRescan->nHeight, pindexRescan->nHeight);
             nStart = GetTimeMillis();
-            pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+            if (pwalletMain->ScanForWalletTransactions(pindexRescan, true) < 0)
+                return InitError(_("Error: a block could not be read while rescanning the wallet"));
             LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
             nWalletDBUpdated++;
@@ -1091,22 +1172,8 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     RandAddSeedPerfmon();
 
-    // reindex addresses found in blockchain
-    if(GetBoolArg("-reindexaddr", false))
-    {
-        uiInterface.InitMessage(_("Rebuilding address index..."));
-        CBlockIndex *pblockAddrIndex = pindexBest;
-	CTxDB txdbAddr("rw");
-	while(pblockAddrIndex)
-	{
-	    uiInterface.InitMessage(strprintf("Rebuilding address index, block %i", pblockAddrIndex->nHeight));
-	    bool ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions=true);
-	    CBlock pblockAddr;
-	    if(pblockAddr.ReadFromDisk(pblockAddrIndex, true))
-	        pblockAddr.RebuildAddressIndex(txdbAddr);
-	    pblockAddrIndex = pblockAddrIndex->pprev;
-	}
-    }
+    // rebuild the address index in the background, or finish an interrupted rebuild
+    StartAddrIndexRebuild(threadGroup, GetBoolArg("-reindexaddr", false));
 
     //// debug print
     LogPrintf("mapBlockIndex.size() = %u\n",   mapBlockIndex.size());
@@ -1144,6 +1211,9 @@ bool AppInit2(boost::thread_group& threadGroup)
 
         // Run a thread to flush wallet periodically
         threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
+
+        // Run a thread to push balance changes to the GUI
+        threadGroup.create_thread(boost::bind(&ThreadNotifyBalances, pwalletMain));
     }
 #endif
 
@@ -199,15 +199,19 @@ bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, unsigned
         return error("CheckStakeKernelHash() : min age violation");
 
     // Base target
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    uint256 bnBaseTarget;
+    bnBaseTarget.SetCompact(nBits, &fNegative, &fOverflow);
+    if (fNegative || fOverflow)
+        return error("CheckStakeKernelHash() : nBits out of range");
 
-    // Weighted target
+    // Weighted target, which can need more than 256 bits
     int64_t nValueIn = txPrev.vout[prevout.n].nValue;
-    CBigNum bnWeight = CBigNum(nValueIn);
-    bnTarget *= bnWeight;
+    if (nValueIn < 0)
+        return error("CheckStakeKernelHash() : negative prevout value");
+    uint512 bnTarget = uint512(bnBaseTarget) * uint512(nValueIn);
 
-    targetProofOfStake = bnTarget.getuint256();
+    targetProofOfStake = bnTarget.trim256();
 
     uint64_t nStakeModifier = pindexPrev->nStakeModifier;
     int nStakeModifierHeight = pindexPrev->nHeight;
@@ -232,7 +236,7 @@ bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, unsigned
     }
 
     // Now check if proof-of-stake hash meets target protocol
-    if (CBigNum(hashProofOfStake) > bnTarget){
+    if (uint512(hashProofOfStake) > bnTarget){
          return false;
     }
 
@@ -264,11 +268,11 @@ bool CheckProofOfStake(CBlockIndex* pindexPrev, const CTransaction& tx, unsigned
     CTxDB txdb("r");
     CTransaction txPrev;
     CTxIndex txindex;
-    if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
+    if (!txPrev.ReadPrevTx(txdb, txin.prevout, txindex))
         return tx.DoS(1, error("CheckProofOfStake() : INFO: read txPrev failed"));  // previous transaction not in main chain, may occur during initial download
 
     // Verify signature
-    if (!VerifySignature(txPrev, tx, 0, SCRIPT_VERIFY_NONE, 0))
+    if (!VerifySignature(txPrev.vout[txin.prevout.n], tx, 0, SCRIPT_VERIFY_NONE, 0))
         return tx.DoS(100, error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString()));
 
     // Read block header
@@ -295,7 +299,7 @@ bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, con
     CTxDB txdb("r");
     CTransaction txPrev;
     CTxIndex txindex;
-    if (!txPrev.ReadFromDisk(txdb, prevout, txindex))
+    if (!txPrev.ReadPrevTx(txdb, prevout, txindex))
         return false;
 
     // Read block header
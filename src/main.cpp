@@ -13,6 +13,7 @@
 #include "init.h"
 #include "kernel.h"
 #include "net.h"
+#include "orphanpool.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -28,6 +29,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/shared_mutex.hpp>
 using namespace std;
 using namespace boost;
 
@@ -42,10 +44,10 @@ CCriticalSection cs_main;
 
 CTxMemPool mempool;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+BlockMap mapBlockIndex;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
 
-CBigNum bnProofOfStakeLimit(~uint256(0) >> 20);
+uint256 bnProofOfStakeLimit(~uint256(0) >> 20);
 
 unsigned int nStakeMinAge = 24 * 60 * 60; // 24 hours
 unsigned int nModifierInterval = 8 * 60; // time to elapse before new modifier is computed
@@ -63,21 +65,10 @@ int64_t nTimeBestReceived = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fAddrIndex = false;
+bool fCoinDB = false;
+uint64_t nPruneTarget = 0;
 bool fHaveGUI = false;
 
-struct COrphanBlock {
-	uint256 hashBlock;
-	uint256 hashPrev;
-	std::pair<COutPoint, unsigned int> stake;
-	vector<unsigned char> vchBlock;
-};
-map<uint256, COrphanBlock*> mapOrphanBlocks;
-multimap<uint256, COrphanBlock*> mapOrphanBlocksByPrev;
-set<pair<COutPoint, unsigned int> > setStakeSeenOrphan;
-
-map<uint256, CTransaction> mapOrphanTransactions;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
-
 // Constant stuff for coinbase transactions we create:
 CScript COINBASE_FLAGS;
 
@@ -103,6 +94,8 @@ namespace {
 		boost::signals2::signal<void(const uint256 &)> UpdatedTransaction;
 		// Notifies listeners of a new active block chain.
 		boost::signals2::signal<void(const CBlockLocator &)> SetBestChain;
+		// Notifies listeners of a new best block.
+		boost::signals2::signal<void(int)> UpdatedBlockTip;
 		// Notifies listeners about an inventory item being seen on the network.
 		boost::signals2::signal<void(const uint256 &)> Inventory;
 		// Tells listeners to broadcast their data.
@@ -115,6 +108,7 @@ void RegisterWallet(CWalletInterface* pwalletIn) {
 	g_signals.EraseTransaction.connect(boost::bind(&CWalletInterface::EraseFromWallet, pwalletIn, _1));
 	g_signals.UpdatedTransaction.connect(boost::bind(&CWalletInterface::UpdatedTransaction, pwalletIn, _1));
 	g_signals.SetBestChain.connect(boost::bind(&CWalletInterface::SetBestChain, pwalletIn, _1));
+	g_signals.UpdatedBlockTip.connect(boost::bind(&CWalletInterface::UpdatedBlockTip, pwalletIn, _1));
 	g_signals.Inventory.connect(boost::bind(&CWalletInterface::Inventory, pwalletIn, _1));
 	g_signals.Broadcast.connect(boost::bind(&CWalletInterface::ResendWalletTransactions, pwalletIn, _1));
 }
@@ -122,6 +116,7 @@ void RegisterWallet(CWalletInterface* pwalletIn) {
 void UnregisterWallet(CWalletInterface* pwalletIn) {
 	g_signals.Broadcast.disconnect(boost::bind(&CWalletInterface::ResendWalletTransactions, pwalletIn, _1));
 	g_signals.Inventory.disconnect(boost::bind(&CWalletInterface::Inventory, pwalletIn, _1));
+	g_signals.UpdatedBlockTip.disconnect(boost::bind(&CWalletInterface::UpdatedBlockTip, pwalletIn, _1));
 	g_signals.SetBestChain.disconnect(boost::bind(&CWalletInterface::SetBestChain, pwalletIn, _1));
 	g_signals.UpdatedTransaction.disconnect(boost::bind(&CWalletInterface::UpdatedTransaction, pwalletIn, _1));
 	g_signals.EraseTransaction.disconnect(boost::bind(&CWalletInterface::EraseFromWallet, pwalletIn, _1));
@@ -131,6 +126,7 @@ void UnregisterWallet(CWalletInterface* pwalletIn) {
 void UnregisterAllWallets() {
 	g_signals.Broadcast.disconnect_all_slots();
 	g_signals.Inventory.disconnect_all_slots();
+	g_signals.UpdatedBlockTip.disconnect_all_slots();
 	g_signals.SetBestChain.disconnect_all_slots();
 	g_signals.UpdatedTransaction.disconnect_all_slots();
 	g_signals.EraseTransaction.disconnect_all_slots();
@@ -197,6 +193,7 @@ namespace {
 	void FinalizeNode(NodeId nodeid) {
 		LOCK(cs_main);
 		mapNodeState.erase(nodeid);
+		orphanTxPool.EraseForPeer(nodeid);
 	}
 
 }
@@ -241,97 +238,80 @@ bool AbortNode(const std::string &strMessage, const std::string &userMessage) {
 
 //////////////////////////////////////////////////////////////////////////////
 //
-// mapOrphanTransactions
+// CTransaction and CTxIndex
 //
 
-bool AddOrphanTx(const CTransaction& tx)
+bool CTransaction::ReadFromDisk(CTxDB& txdb, const uint256& hash, CTxIndex& txindexRet)
 {
-	uint256 hash = tx.GetHash();
-	if (mapOrphanTransactions.count(hash))
+	SetNull();
+	if (!txdb.ReadTxIndex(hash, txindexRet))
 		return false;
-
-	// Ignore big transactions, to avoid a
-	// send-big-orphans memory exhaustion attack. If a peer has a legitimate
-	// large transaction with a missing parent then we assume
-	// it will rebroadcast it later, after the parent transaction(s)
-	// have been mined or received.
-	// 10,000 orphans, each of which is at most 5,000 bytes big is
-	// at most 500 megabytes of orphans:
-
-	size_t nSize = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
-
-	if (nSize > 5000)
-	{
-		LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", nSize, hash.ToString());
+	if (!ReadFromDisk(txindexRet.pos))
 		return false;
-	}
-
-	mapOrphanTransactions[hash] = tx;
-	BOOST_FOREACH(const CTxIn& txin, tx.vin)
-		mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
-
-	LogPrint("mempool", "stored orphan tx %s (mapsz %u)\n", hash.ToString(),
-		mapOrphanTransactions.size());
 	return true;
 }
 
-void static EraseOrphanTx(uint256 hash)
+bool CTransaction::ReadFromDisk(CTxDB& txdb, COutPoint prevout, CTxIndex& txindexRet)
 {
-	map<uint256, CTransaction>::iterator it = mapOrphanTransactions.find(hash);
-	if (it == mapOrphanTransactions.end())
-		return;
-	BOOST_FOREACH(const CTxIn& txin, it->second.vin)
+	if (!ReadFromDisk(txdb, prevout.hash, txindexRet))
+		return false;
+	if (prevout.n >= vout.size())
 	{
-		map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
-		if (itPrev == mapOrphanTransactionsByPrev.end())
-			continue;
-		itPrev->second.erase(hash);
-		if (itPrev->second.empty())
-			mapOrphanTransactionsByPrev.erase(itPrev);
+		SetNull();
+		return false;
 	}
-	mapOrphanTransactions.erase(it);
+	return true;
 }
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
-{
-	unsigned int nEvicted = 0;
-	while (mapOrphanTransactions.size() > nMaxOrphans)
-	{
-		// Evict a random orphan:
-		uint256 randomhash = GetRandHash();
-		map<uint256, CTransaction>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-		if (it == mapOrphanTransactions.end())
-			it = mapOrphanTransactions.begin();
-		EraseOrphanTx(it->first);
-		++nEvicted;
-	}
-	return nEvicted;
-}
-
-//////////////////////////////////////////////////////////////////////////////
-//
-// CTransaction and CTxIndex
-//
-
-bool CTransaction::ReadFromDisk(CTxDB& txdb, const uint256& hash, CTxIndex& txindexRet)
+bool CTransaction::ReadPrevTx(CTxDB& txdb, COutPoint prevout, CTxIndex& txindexRet)
 {
 	SetNull();
-	if (!txdb.ReadTxIndex(hash, txindexRet))
+	if (!txdb.ReadTxIndex(prevout.hash, txindexRet))
 		return false;
-	if (!ReadFromDisk(txindexRet.pos))
+	if (!ReadPrevTx(txdb, prevout.hash, txindexRet))
+		return false;
+	if (prevout.n >= vout.size())
+	{
+		SetNull();
 		return false;
+	}
 	return true;
 }
 
-bool CTransaction::ReadFromDisk(CTxDB& txdb, COutPoint prevout, CTxIndex& txindexRet)
+bool CTransaction::ReadPrevTx(CTxDB& txdb, const uint256& hash, const CTxIndex& txindex)
 {
-	if (!ReadFromDisk(txdb, prevout.hash, txindexRet))
-		return false;
-	if (prevout.n >= vout.size())
+	if (!fCoinDB || !IsBlockFilePruned(txindex.pos.nFile))
+		return ReadFromDisk(txindex.pos);
+
+	// The block is gone, put the unspent outputs back together from the coin
+	// database. Spent outputs become unspendable placeholders.
+	SetNull();
+	bool fFound = false;
+	bool fCoinBase = false;
+	bool fCoinStake = false;
+	vout.resize(txindex.vSpent.size());
+	for (unsigned int n = 0; n < vout.size(); n++)
 	{
-		SetNull();
-		return false;
+		CCoin coin;
+		if (!txindex.vSpent[n].IsNull() || !txdb.ReadCoin(COutPoint(hash, n), coin))
+		{
+			vout[n].nValue = 0;
+			vout[n].scriptPubKey = CScript() << OP_RETURN;
+			continue;
+		}
+		vout[n] = coin.txout;
+		nTime = coin.nTime;
+		fCoinBase = coin.fCoinBase;
+		fCoinStake = coin.fCoinStake;
+		fFound = true;
 	}
+	if (!fFound)
+		return false;
+
+	// Same shape as the original for IsCoinBase() and IsCoinStake()
+	vin.push_back(fCoinBase ? CTxIn() : CTxIn(COutPoint(hash, 0)));
+	if (fCoinStake)
+		vout[0].SetEmpty();
 	return true;
 }
 
@@ -604,7 +584,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
 	}
 
 	// Is the tx in a block that's in the main chain
-	map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+	BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
 	if (mi == mapBlockIndex.end())
 		return 0;
 	CBlockIndex* pindex = (*mi).second;
@@ -1046,7 +1026,7 @@ int CMerkleTx::GetDepthInMainChainINTERNAL(CBlockIndex* &pindexRet) const
 	AssertLockHeld(cs_main);
 
 	// Find the block it claims to be in
-	map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+	BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
 	if (mi == mapBlockIndex.end())
 		return 0;
 	CBlockIndex* pindex = (*mi).second;
@@ -1212,7 +1192,7 @@ int CTxIndex::GetDepthInMainChain() const
 	if (!block.ReadFromDisk(pos.nFile, pos.nBlockPos, false))
 		return 0;
 	// Find the block in the index
-	map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+	BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
 	if (mi == mapBlockIndex.end())
 		return 0;
 	CBlockIndex* pindex = (*mi).second;
@@ -1222,15 +1202,14 @@ int CTxIndex::GetDepthInMainChain() const
 }
 
 // Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock
-bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
+bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fScanDisconnected)
 {
 	{
-		LOCK(cs_main);
+		// The mempool and the tx index have their own locking, only the
+		// scan of disconnected blocks below needs cs_main
+		if (mempool.lookup(hash, tx))
 		{
-			if (mempool.lookup(hash, tx))
-			{
-				return true;
-			}
+			return true;
 		}
 		CTxDB txdb("r");
 		CTxIndex txindex;
@@ -1241,7 +1220,10 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 				hashBlock = block.GetHash();
 			return true;
 		}
+		if (!fScanDisconnected)
+			return false;
 		// look for transaction in disconnected blocks to find orphaned CoinBase and CoinStake transactions
+		LOCK(cs_main);
 		BOOST_FOREACH(PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex)
 		{
 			CBlockIndex* pindex = item.second;
@@ -1263,11 +1245,120 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 	return false;
 }
 
+bool GetTransactionOutputs(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
+{
+	if (GetTransaction(hash, tx, hashBlock))
+		return true;
+
+	// The block file may have been pruned, the unspent outputs are still in the coin database
+	CTxDB txdb("r");
+	CTxIndex txindex;
+	if (!fCoinDB || !txdb.ReadTxIndex(hash, txindex) || !IsBlockFilePruned(txindex.pos.nFile))
+		return false;
+	if (!tx.ReadPrevTx(txdb, hash, txindex))
+		return false;
+	CBlock block;
+	if (ReadPrunedBlockHeader(txindex.pos.nFile, txindex.pos.nBlockPos, block))
+		hashBlock = block.GetHash();
+	return true;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // CBlock and CBlockIndex
 //
 
+// Lets LookupBlockIndex run without cs_main: inserts into mapBlockIndex
+// take it exclusively, lock-free lookups take it shared.
+static boost::shared_mutex cs_mapBlockIndex;
+
+static CCriticalSection cs_chainSnapshot;
+static CChainSnapshotRef pchainSnapshot(new CChainSnapshot());
+
+CChainSnapshot::CChainSnapshot(const CChainSnapshot& prev, CBlockIndex* pindexTip)
+{
+	// Walk back to where the new chain joins the previous one
+	vector<CBlockIndex*> vConnect;
+	CBlockIndex* pfork = pindexTip;
+	while (pfork && !prev.Contains(pfork))
+	{
+		vConnect.push_back(pfork);
+		pfork = pfork->pprev;
+	}
+	int nKeep = pfork ? pfork->nHeight + 1 : 0;
+
+	// Share the chunks below the fork, copy the one it falls inside
+	vChunks.assign(prev.vChunks.begin(), prev.vChunks.begin() + nKeep / CHUNK_SIZE);
+	if (nKeep % CHUNK_SIZE)
+	{
+		const vector<CBlockIndex*>& chunk = *prev.vChunks[nKeep / CHUNK_SIZE];
+		vChunks.push_back(boost::shared_ptr<vector<CBlockIndex*> >(new vector<CBlockIndex*>(chunk.begin(), chunk.begin() + nKeep % CHUNK_SIZE)));
+	}
+
+	BOOST_REVERSE_FOREACH(CBlockIndex* pindex, vConnect)
+	{
+		if (vChunks.empty() || vChunks.back()->size() == (size_t)CHUNK_SIZE)
+		{
+			vChunks.push_back(boost::shared_ptr<vector<CBlockIndex*> >(new vector<CBlockIndex*>()));
+			vChunks.back()->reserve(CHUNK_SIZE);
+		}
+		vChunks.back()->push_back(pindex);
+	}
+	nHeight = nKeep + (int)vConnect.size() - 1;
+}
+
+CChainSnapshotRef GetChainSnapshot()
+{
+	LOCK(cs_chainSnapshot);
+	return pchainSnapshot;
+}
+
+void UpdateChainSnapshot(CBlockIndex* pindexTip)
+{
+	// Only cs_main holders publish, so the previous snapshot can be read unlocked
+	CChainSnapshotRef pnew(new CChainSnapshot(*pchainSnapshot, pindexTip));
+	LOCK(cs_chainSnapshot);
+	pchainSnapshot = pnew;
+}
+
+CBlockIndex* LookupBlockIndex(const uint256& hash)
+{
+	boost::shared_lock<boost::shared_mutex> lock(cs_mapBlockIndex);
+	BlockMap::const_iterator mi = mapBlockIndex.find(hash);
+	return mi == mapBlockIndex.end() ? NULL : mi->second;
+}
+
+// Block index entries are never freed, so rather than a heap block each they
+// are carved out of 1MB chunks. That saves the allocator overhead per entry
+// and keeps entries that were loaded or connected together close in memory.
+static const size_t BLOCKINDEX_CHUNK_SIZE = 1 << 20;
+static CCriticalSection cs_blockIndexArena;
+static char* pBlockIndexArena = NULL;
+static size_t nBlockIndexArenaLeft = 0;
+
+void* CBlockIndex::operator new(size_t nSize)
+{
+	nSize = (nSize + 7) & ~(size_t)7;
+	LOCK(cs_blockIndexArena);
+	if (nSize > nBlockIndexArenaLeft)
+	{
+		nBlockIndexArenaLeft = std::max(nSize, BLOCKINDEX_CHUNK_SIZE);
+		pBlockIndexArena = static_cast<char*>(::operator new(nBlockIndexArenaLeft));
+	}
+	void* p = pBlockIndexArena;
+	pBlockIndexArena += nSize;
+	nBlockIndexArenaLeft -= nSize;
+	return p;
+}
+
+BlockMap::iterator InsertBlockIndexEntry(const uint256& hash, CBlockIndex* pindex)
+{
+	boost::unique_lock<boost::shared_mutex> lock(cs_mapBlockIndex);
+	BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindex)).first;
+	pindex->phashBlock = &((*mi).first);
+	return mi;
+}
+
 static CBlockIndex* pblockindexFBBHLast;
 CBlockIndex* FindBlockByHeight(int nHeight)
 {
@@ -1300,57 +1391,7 @@ bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
 	return true;
 }
 
-uint256 static GetOrphanRoot(const uint256& hash)
-{
-	map<uint256, COrphanBlock*>::iterator it = mapOrphanBlocks.find(hash);
-	if (it == mapOrphanBlocks.end())
-		return hash;
-
-	// Work back to the first block in the orphan chain
-	do {
-		map<uint256, COrphanBlock*>::iterator it2 = mapOrphanBlocks.find(it->second->hashPrev);
-		if (it2 == mapOrphanBlocks.end())
-			return it->first;
-		it = it2;
-	} while (true);
-}
-
-// ppcoin: find block wanted by given orphan block
-uint256 WantedByOrphan(const COrphanBlock* pblockOrphan)
-{
-	// Work back to the first block in the orphan chain
-	while (mapOrphanBlocks.count(pblockOrphan->hashPrev))
-		pblockOrphan = mapOrphanBlocks[pblockOrphan->hashPrev];
-	return pblockOrphan->hashPrev;
-}
-
-// Remove a random orphan block (which does not have any dependent orphans).
-void static PruneOrphanBlocks()
-{
-	if (mapOrphanBlocksByPrev.size() <= (size_t)std::max((int64_t)0, GetArg("-maxorphanblocks", DEFAULT_MAX_ORPHAN_BLOCKS)))
-		return;
-
-	// Pick a random orphan block.
-	int pos = insecure_rand() % mapOrphanBlocksByPrev.size();
-	std::multimap<uint256, COrphanBlock*>::iterator it = mapOrphanBlocksByPrev.begin();
-	while (pos--) it++;
-
-	// As long as this block has other orphans depending on it, move to one of those successors.
-	do {
-		std::multimap<uint256, COrphanBlock*>::iterator it2 = mapOrphanBlocksByPrev.find(it->second->hashBlock);
-		if (it2 == mapOrphanBlocksByPrev.end())
-			break;
-		it = it2;
-	} while (1);
-
-	setStakeSeenOrphan.erase(it->second->stake);
-	uint256 hash = it->second->hashBlock;
-	delete it->second;
-	mapOrphanBlocksByPrev.erase(it);
-	mapOrphanBlocks.erase(hash);
-}
-
-static CBigNum GetProofOfStakeLimit(int nHeight)
+static uint256 GetProofOfStakeLimit(int nHeight)
 {
 	return bnProofOfStakeLimit;
 }
@@ -1402,7 +1443,7 @@ const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfSta
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake)
 {
 
-	CBigNum bnTargetLimit = fProofOfStake ? GetProofOfStakeLimit(pindexLast->nHeight) : Params().ProofOfWorkLimit();
+	uint256 bnTargetLimit = fProofOfStake ? GetProofOfStakeLimit(pindexLast->nHeight) : Params().ProofOfWorkLimit();
 
 	if (pindexLast == NULL)
 		return bnTargetLimit.GetCompact(); // genesis block
@@ -1422,29 +1463,35 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
 
 	// ppcoin: target change every block
 	// ppcoin: retarget with exponential moving toward target spacing
-	CBigNum bnNew;
-	bnNew.SetCompact(pindexPrev->nBits);
+	// The product can exceed 256 bits for a large nActualSpacing, so widen before scaling
+	bool fNegative, fOverflow;
+	uint256 bnPrev;
+	bnPrev.SetCompact(pindexPrev->nBits, &fNegative, &fOverflow);
+	if (fNegative || fOverflow)
+		return bnTargetLimit.GetCompact();
+	uint512 bnNew(bnPrev);
 	int64_t nInterval = nTargetTimespan / TARGET_SPACING;
-	bnNew *= ((nInterval - 1) * TARGET_SPACING + nActualSpacing + nActualSpacing);
-	bnNew /= ((nInterval + 1) * TARGET_SPACING);
+	bnNew *= uint512((nInterval - 1) * TARGET_SPACING + nActualSpacing + nActualSpacing);
+	bnNew /= uint512((nInterval + 1) * TARGET_SPACING);
 
-	if (bnNew <= 0 || bnNew > bnTargetLimit)
-		bnNew = bnTargetLimit;
+	if (bnNew == 0 || bnNew > uint512(bnTargetLimit))
+		return bnTargetLimit.GetCompact();
 
-	return bnNew.GetCompact();
+	return bnNew.trim256().GetCompact();
 }
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits)
 {
-	CBigNum bnTarget;
-	bnTarget.SetCompact(nBits);
+	bool fNegative, fOverflow;
+	uint256 bnTarget;
+	bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
 	// Check range
-	if (bnTarget <= 0 || bnTarget > Params().ProofOfWorkLimit())
+	if (fNegative || fOverflow || bnTarget == 0 || bnTarget > Params().ProofOfWorkLimit())
 		return error("CheckProofOfWork() : nBits below minimum work");
 
 	// Check proof of work matches claimed amount
-	if (hash > bnTarget.getuint256())
+	if (hash > bnTarget)
 		return error("CheckProofOfWork() : hash doesn't match nBits");
 
 	return true;
@@ -1590,7 +1637,7 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
 		else
 		{
 			// Get prev tx from disk
-			if (!txPrev.ReadFromDisk(txindex.pos))
+			if (!txPrev.ReadPrevTx(txdb, prevout.hash, txindex))
 				return error("FetchInputs() : %s ReadFromDisk prev tx %s failed", GetHash().ToString(), prevout.hash.ToString());
 		}
 	}
@@ -1704,7 +1751,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
 				if (!(fBlock && !IsInitialBlockDownload()))
 				{
 					// Verify signature
-					if (!VerifySignature(txPrev, *this, i, flags, 0))
+					if (!VerifySignature(txPrev.vout[prevout.n], *this, i, flags, 0))
 					{
 						if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
 							// Check whether the failure was caused by a
@@ -1713,7 +1760,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
 							// if so, don't trigger DoS protection to
 							// avoid splitting the network between upgraded and
 							// non-upgraded nodes.
-							if (VerifySignature(txPrev, *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0))
+							if (VerifySignature(txPrev.vout[prevout.n], *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0))
 								return error("ConnectInputs() : %s non-mandatory VerifySignature failed", GetHash().ToString());
 						}
 						// Failures of other flags indicate a transaction that is
@@ -1757,6 +1804,60 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
 	return true;
 }
 
+// Spend the inputs and add the outputs of block to the coin database, and
+// keep the coins spent so DisconnectCoins can put them back
+bool static ConnectCoins(CTxDB& txdb, const CBlock& block, const CBlockIndex* pindex)
+{
+	map<COutPoint, CCoin> mapCreated;
+	vector<pair<COutPoint, CCoin> > vUndo;
+	BOOST_FOREACH(const CTransaction& tx, block.vtx)
+	{
+		if (!tx.IsCoinBase())
+		{
+			BOOST_FOREACH(const CTxIn& txin, tx.vin)
+			{
+				// Created and spent within the block, nothing to undo
+				if (mapCreated.erase(txin.prevout))
+					continue;
+
+				CCoin coin;
+				if (!txdb.ReadCoin(txin.prevout, coin))
+				{
+					return error("ConnectCoins() : %s missing from the coin database", txin.prevout.ToString());
+				}
+				vUndo.push_back(make_pair(txin.prevout, coin));
+				txdb.EraseCoin(txin.prevout);
+			}
+		}
+		uint256 hashTx = tx.GetHash();
+		for (unsigned int n = 0; n < tx.vout.size(); n++)
+			mapCreated[COutPoint(hashTx, n)] = CCoin(tx, n, pindex->nHeight);
+	}
+
+	for (map<COutPoint, CCoin>::const_iterator mi = mapCreated.begin(); mi != mapCreated.end(); ++mi)
+		if (!txdb.WriteCoin(mi->first, mi->second))
+			return false;
+	return txdb.WriteCoinUndo(pindex->GetBlockHash(), vUndo);
+}
+
+bool static DisconnectCoins(CTxDB& txdb, const CBlock& block, const CBlockIndex* pindex)
+{
+	vector<pair<COutPoint, CCoin> > vUndo;
+	if (!txdb.ReadCoinUndo(pindex->GetBlockHash(), vUndo))
+		return error("DisconnectCoins() : no undo record for block %s", pindex->GetBlockHash().ToString());
+
+	BOOST_FOREACH(const CTransaction& tx, block.vtx)
+	{
+		uint256 hashTx = tx.GetHash();
+		for (unsigned int n = 0; n < tx.vout.size(); n++)
+			txdb.EraseCoin(COutPoint(hashTx, n));
+	}
+	for (unsigned int i = 0; i < vUndo.size(); i++)
+		if (!txdb.WriteCoin(vUndo[i].first, vUndo[i].second))
+			return false;
+	return txdb.EraseCoinUndo(pindex->GetBlockHash());
+}
+
 bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 {
 	// Disconnect in reverse order
@@ -1764,6 +1865,9 @@ bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 		if (!vtx[i].DisconnectInputs(txdb))
 			return false;
 
+	if (fCoinDB && !DisconnectCoins(txdb, *this, pindex))
+		return error("DisconnectBlock() : DisconnectCoins failed");
+
 	// Update block index on disk without changing it in memory.
 	// The memory index structure will be changed after the db commits.
 	if (pindex->pprev)
@@ -1832,7 +1936,6 @@ bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint2
 		return false;
 	}
 
-	LOCK(cs_main);
 	CTxDB txdb("r");
 	if (!txdb.ReadAddrIndex(addrid, vtxhash))
 	{
@@ -1842,11 +1945,13 @@ bool FindTransactionsByDestination(const CTxDestination &dest, std::vector<uint2
 	return true;
 }
 
-void CBlock::RebuildAddressIndex(CTxDB& txdb)
+bool CBlock::GetAddressIndex(CTxDB& txdb, MapAddrIndex& mapAddrIndex)
 {
+	bool fOk = true;
 	BOOST_FOREACH(CTransaction& tx, vtx)
 	{
 		uint256 hashTx = tx.GetHash();
+		std::vector<uint160> addrIds;
 		// inputs
 		if (!tx.IsCoinBase())
 		{
@@ -1854,38 +1959,28 @@ void CBlock::RebuildAddressIndex(CTxDB& txdb)
 			map<uint256, CTxIndex> mapQueuedChangesT;
 			bool fInvalid;
 			if (!tx.FetchInputs(txdb, mapQueuedChangesT, true, false, mapInputs, fInvalid))
-				return;
+			{
+				LogPrintf("GetAddressIndex(): FetchInputs failed for tx %s\n", hashTx.ToString());
+				fOk = false;
+				continue;
+			}
 
-			MapPrevTx::const_iterator mi;
 			for (MapPrevTx::const_iterator mi = mapInputs.begin(); mi != mapInputs.end(); ++mi)
-			{
 				BOOST_FOREACH(const CTxOut &atxout, (*mi).second.second.vout)
-				{
-					std::vector<uint160> addrIds;
-					if (BuildAddrIndex(atxout.scriptPubKey, addrIds))
-					{
-						BOOST_FOREACH(uint160 addrId, addrIds)
-						{
-							if (!txdb.WriteAddrIndex(addrId, hashTx))
-								LogPrintf("RebuildAddressIndex(): txins WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString().c_str(), hashTx.ToString().c_str());
-						}
-					}
-				}
-			}
+					BuildAddrIndex(atxout.scriptPubKey, addrIds);
 		}
 		// outputs
-		BOOST_FOREACH(const CTxOut &atxout, tx.vout) {
-			std::vector<uint160> addrIds;
-			if (BuildAddrIndex(atxout.scriptPubKey, addrIds))
-			{
-				BOOST_FOREACH(uint160 addrId, addrIds)
-				{
-					if (!txdb.WriteAddrIndex(addrId, hashTx))
-						LogPrintf("RebuildAddressIndex(): txouts WriteAddrIndex failed addrId: %s txhash: %s\n", addrId.ToString().c_str(), hashTx.ToString().c_str());
-				}
-			}
+		BOOST_FOREACH(const CTxOut &atxout, tx.vout)
+			BuildAddrIndex(atxout.scriptPubKey, addrIds);
+
+		BOOST_FOREACH(const uint160& addrId, addrIds)
+		{
+			std::vector<uint256>& txHashes = mapAddrIndex[addrId];
+			if (txHashes.empty() || txHashes.back() != hashTx)
+				txHashes.push_back(hashTx);
 		}
 	}
+	return fOk;
 }
 
 bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
@@ -1999,6 +2094,9 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
 			return error("ConnectBlock() : UpdateTxIndex failed");
 	}
 
+	if (fCoinDB && !ConnectCoins(txdb, *this, pindex))
+		return error("ConnectBlock() : ConnectCoins failed");
+
 	if (GetBoolArg("-addrindex", false))
 	{
 		// Write Address Index
@@ -2269,10 +2367,14 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
 	pindexBest = pindexNew;
 	pblockindexFBBHLast = NULL;
 	nBestHeight = pindexBest->nHeight;
+	UpdateChainSnapshot(pindexBest);
 	nBestChainTrust = pindexNew->nChainTrust;
 	nTimeBestReceived = GetTime();
 	mempool.AddTransactionsUpdated(1);
 
+	g_signals.UpdatedBlockTip(nBestHeight);
+	uiInterface.NotifyBlockTip(nBestHeight, pindexBest->GetBlockTime());
+
 	uint256 nBestBlockTrust = pindexBest->nHeight != 0 ? (pindexBest->nChainTrust - pindexBest->pprev->nChainTrust) : pindexBest->nChainTrust;
 
 	LogPrintf("SetBestChain: new best=%s  height=%d  trust=%s  blocktrust=%d  date=%s\n",
@@ -2330,7 +2432,7 @@ bool CTransaction::GetCoinAge(CTxDB& txdb, const CBlockIndex* pindexPrev, uint64
 		// First try finding the previous transaction in database
 		CTransaction txPrev;
 		CTxIndex txindex;
-		if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
+		if (!txPrev.ReadPrevTx(txdb, txin.prevout, txindex))
 			continue;  // previous transaction not in main chain
 		if (nTime < txPrev.nTime)
 			return false;  // Transaction timestamp violation
@@ -2368,7 +2470,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
 	if (!pindexNew)
 		return error("AddToBlockIndex() : new CBlockIndex failed");
 	pindexNew->phashBlock = &hash;
-	map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
+	BlockMap::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
 	if (miPrev != mapBlockIndex.end())
 	{
 		pindexNew->pprev = (*miPrev).second;
@@ -2393,10 +2495,9 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
 	pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
 
 	// Add to mapBlockIndex
-	map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+	InsertBlockIndexEntry(hash, pindexNew);
 	if (pindexNew->IsProofOfStake())
 		setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-	pindexNew->phashBlock = &((*mi).first);
 
 	// Write to disk block index
 	CTxDB txdb;
@@ -2612,7 +2713,7 @@ bool CBlock::AcceptBlock()
 		return error("AcceptBlock() : block already in mapBlockIndex");
 
 	// Get prev block index
-	map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
+	BlockMap::iterator mi = mapBlockIndex.find(hashPrevBlock);
 	if (mi == mapBlockIndex.end())
 		return DoS(10, error("AcceptBlock() : prev block not found"));
 	CBlockIndex* pindexPrev = (*mi).second;
@@ -2703,13 +2804,17 @@ bool CBlock::AcceptBlock()
 
 uint256 CBlockIndex::GetBlockTrust() const
 {
-	CBigNum bnTarget;
-	bnTarget.SetCompact(nBits);
+	bool fNegative, fOverflow;
+	uint256 bnTarget;
+	bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
-	if (bnTarget <= 0)
+	if (fNegative || fOverflow || bnTarget == 0)
 		return 0;
 
-	return ((CBigNum(1) << 256) / (bnTarget + 1)).getuint256();
+	// 2**256 / (bnTarget+1) doesn't fit in 256 bits, but as bnTarget+1 is at
+	// most 2**256 it equals (2**256 - bnTarget - 1) / (bnTarget+1) + 1, which
+	// is ~bnTarget / (bnTarget+1) + 1.
+	return (~bnTarget / (bnTarget + 1)) + 1;
 }
 
 void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd)
@@ -2759,13 +2864,13 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
 	uint256 hash = pblock->GetHash();
 	if (mapBlockIndex.count(hash))
 		return error("ProcessBlock() : already have block %d %s", mapBlockIndex[hash]->nHeight, hash.ToString());
-	if (mapOrphanBlocks.count(hash))
+	if (orphanBlockPool.Exists(hash))
 		return error("ProcessBlock() : already have block (orphan) %s", hash.ToString());
 
 	// ppcoin: check proof-of-stake
 	// Limited duplicity on stake: prevents block flood attack
 	// Duplicate stake allowed only when there is orphan child block
-	if (!fReindex && !fImporting && pblock->IsProofOfStake() && setStakeSeen.count(pblock->GetProofOfStake()) && !mapOrphanBlocksByPrev.count(hash))
+	if (!fReindex && !fImporting && pblock->IsProofOfStake() && setStakeSeen.count(pblock->GetProofOfStake()) && !orphanBlockPool.HasChildren(hash))
 		return error("ProcessBlock() : duplicate proof-of-stake (%s, %d) for block %s", pblock->GetProofOfStake().first.ToString(), pblock->GetProofOfStake().second, hash.ToString());
 
 	if (pblock->hashPrevBlock != hashBestChain)
@@ -2794,7 +2899,7 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
 	// If we don't already have its previous block, shunt it off to holding area until we get it
 	if (!mapBlockIndex.count(pblock->hashPrevBlock))
 	{
-		LogPrintf("ProcessBlock: ORPHAN BLOCK %lu, prev=%s\n", (unsigned long)mapOrphanBlocks.size(), pblock->hashPrevBlock.ToString());
+		LogPrintf("ProcessBlock: ORPHAN BLOCK %lu, prev=%s\n", (unsigned long)orphanBlockPool.Size(), pblock->hashPrevBlock.ToString());
 
 		// Accept orphans as long as there is a node to request its parents from
 		if (pfrom) {
@@ -2803,30 +2908,18 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
 			{
 				// Limited duplicity on stake: prevents block flood attack
 				// Duplicate stake allowed only when there is orphan child block
-				if (setStakeSeenOrphan.count(pblock->GetProofOfStake()) && !mapOrphanBlocksByPrev.count(hash))
+				if (orphanBlockPool.StakeSeen(pblock->GetProofOfStake()) && !orphanBlockPool.HasChildren(hash))
 					return error("ProcessBlock() : duplicate proof-of-stake (%s, %d) for orphan block %s", pblock->GetProofOfStake().first.ToString(), pblock->GetProofOfStake().second, hash.ToString());
 			}
-			PruneOrphanBlocks();
-			COrphanBlock* pblock2 = new COrphanBlock();
-			{
-				CDataStream ss(SER_DISK, CLIENT_VERSION);
-				ss << *pblock;
-				pblock2->vchBlock = std::vector<unsigned char>(ss.begin(), ss.end());
-			}
-			pblock2->hashBlock = hash;
-			pblock2->hashPrev = pblock->hashPrevBlock;
-			pblock2->stake = pblock->GetProofOfStake();
-			mapOrphanBlocks.insert(make_pair(hash, pblock2));
-			mapOrphanBlocksByPrev.insert(make_pair(pblock2->hashPrev, pblock2));
-			if (pblock->IsProofOfStake())
-				setStakeSeenOrphan.insert(pblock->GetProofOfStake());
+			orphanBlockPool.Limit(std::max((int64_t)0, GetArg("-maxorphanblocks", DEFAULT_MAX_ORPHAN_BLOCKS)), MAX_ORPHAN_BLOCKS_SIZE);
+			orphanBlockPool.Add(*pblock, pfrom->GetId());
 
 			// Ask this guy to fill in what we're missing
-			PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(hash));
+			PushGetBlocks(pfrom, pindexBest, orphanBlockPool.GetRoot(hash));
 			// ppcoin: getblocks may not obtain the ancestor block rejected
 			// earlier by duplicate-stake check so we ask for it again directly
 			if (!IsInitialBlockDownload())
-				pfrom->AskFor(CInv(MSG_BLOCK, WantedByOrphan(pblock2)));
+				pfrom->AskFor(CInv(MSG_BLOCK, orphanBlockPool.GetWanted(hash)));
 		}
 		return true;
 	}
@@ -2835,31 +2928,30 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
 	if (!pblock->AcceptBlock())
 		return error("ProcessBlock() : AcceptBlock FAILED");
 
-	// Recursively process any orphan blocks that depended on this one
+	// Process any orphan blocks that depended on this one, each orphan is
+	// taken out of the pool once, when its parent has been accepted
 	vector<uint256> vWorkQueue;
 	vWorkQueue.push_back(hash);
 	for (unsigned int i = 0; i < vWorkQueue.size(); i++)
 	{
-		uint256 hashPrev = vWorkQueue[i];
-		for (multimap<uint256, COrphanBlock*>::iterator mi = mapOrphanBlocksByPrev.lower_bound(hashPrev);
-			mi != mapOrphanBlocksByPrev.upper_bound(hashPrev);
-			++mi)
+		vector<COrphanBlock> vChildren;
+		orphanBlockPool.TakeChildren(vWorkQueue[i], vChildren);
+		BOOST_FOREACH(const COrphanBlock& orphan, vChildren)
 		{
 			CBlock block;
 			{
-				CDataStream ss(mi->second->vchBlock, SER_DISK, CLIENT_VERSION);
+				CSpanReader ss(orphan.vchBlock, SER_DISK, CLIENT_VERSION);
 				ss >> block;
 			}
 			block.BuildMerkleTree();
 			if (block.AcceptBlock())
-				vWorkQueue.push_back(mi->second->hashBlock);
-			mapOrphanBlocks.erase(mi->second->hashBlock);
-			setStakeSeenOrphan.erase(block.GetProofOfStake());
-			delete mi->second;
+				vWorkQueue.push_back(orphan.hashBlock);
 		}
-		mapOrphanBlocksByPrev.erase(hashPrev);
 	}
 
+	if (nPruneTarget > 0)
+		PruneBlockFiles();
+
 	if (!IsInitialBlockDownload()) {
 
 		CScript payee;
@@ -3032,13 +3124,21 @@ FILE* AppendBlockFile(unsigned int& nFileRet)
 	nFileRet = 0;
 	while (true)
 	{
+		// Blocks of pruned files are still in the index, their numbers are not reused
+		if (IsBlockFilePruned(nCurrentBlockFile))
+		{
+			nCurrentBlockFile++;
+			continue;
+		}
 		FILE* file = OpenBlockFile(nCurrentBlockFile, 0, "ab");
 		if (!file)
 			return NULL;
 		if (fseek(file, 0, SEEK_END) != 0)
 			return NULL;
-		// FAT32 file size max 4GB, fseek and ftell max 2GB, so we must stay under 2GB
-		if (ftell(file) < (long)(0x7F000000 - MAX_SIZE))
+		// FAT32 file size max 4GB, fseek and ftell max 2GB, so we must stay under 2GB.
+		// With -prune files are kept small, so that old blocks go in small steps.
+		long nMaxSize = nPruneTarget > 0 ? (long)PRUNE_BLOCKFILE_SIZE : (long)(0x7F000000 - MAX_SIZE);
+		if (ftell(file) < nMaxSize)
 		{
 			nFileRet = nCurrentBlockFile;
 			return file;
@@ -3048,6 +3148,152 @@ FILE* AppendBlockFile(unsigned int& nFileRet)
 	}
 }
 
+static CCriticalSection cs_prunedFiles;
+// Block index entries of every pruned block file, sorted by position
+static map<unsigned int, vector<CBlockIndex*> > mapPrunedFiles;
+
+struct CompareBlockPos
+{
+	bool operator()(const CBlockIndex* a, const CBlockIndex* b) const { return a->nBlockPos < b->nBlockPos; }
+	bool operator()(const CBlockIndex* pindex, unsigned int nBlockPos) const { return pindex->nBlockPos < nBlockPos; }
+};
+
+void LoadPrunedBlockFiles(const set<unsigned int>& setFiles)
+{
+	LOCK(cs_prunedFiles);
+	mapPrunedFiles.clear();
+	BOOST_FOREACH(unsigned int nFile, setFiles)
+		mapPrunedFiles[nFile];
+	BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+	{
+		map<unsigned int, vector<CBlockIndex*> >::iterator mi = mapPrunedFiles.find(item.second->nFile);
+		if (mi != mapPrunedFiles.end())
+			mi->second.push_back(item.second);
+	}
+	for (map<unsigned int, vector<CBlockIndex*> >::iterator mi = mapPrunedFiles.begin(); mi != mapPrunedFiles.end(); ++mi)
+		sort(mi->second.begin(), mi->second.end(), CompareBlockPos());
+}
+
+bool IsBlockFilePruned(unsigned int nFile)
+{
+	LOCK(cs_prunedFiles);
+	return mapPrunedFiles.count(nFile) != 0;
+}
+
+bool HavePrunedBlockFiles()
+{
+	LOCK(cs_prunedFiles);
+	return !mapPrunedFiles.empty();
+}
+
+bool ReadPrunedBlockHeader(unsigned int nFile, unsigned int nBlockPos, CBlock& block)
+{
+	LOCK(cs_prunedFiles);
+	map<unsigned int, vector<CBlockIndex*> >::const_iterator mi = mapPrunedFiles.find(nFile);
+	if (mi == mapPrunedFiles.end())
+		return false;
+	vector<CBlockIndex*>::const_iterator it = lower_bound(mi->second.begin(), mi->second.end(), nBlockPos, CompareBlockPos());
+	if (it == mi->second.end() || (*it)->nBlockPos != nBlockPos)
+		return false;
+	block = (*it)->GetBlockHeader();
+	return true;
+}
+
+void PruneBlockFiles()
+{
+	AssertLockHeld(cs_main);
+	if (nPruneTarget == 0)
+		return;
+
+	// Nothing new to prune until another block file has been started
+	static unsigned int nCheckedFile = 0;
+	if (nCheckedFile == nCurrentBlockFile)
+		return;
+	nCheckedFile = nCurrentBlockFile;
+
+	// Highest block in each block file still on disk
+	map<unsigned int, int> mapMaxHeight;
+	{
+		LOCK(cs_prunedFiles);
+		BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+		{
+			const CBlockIndex* pindex = item.second;
+			if (mapPrunedFiles.count(pindex->nFile))
+				continue;
+			int& nMaxHeight = mapMaxHeight[pindex->nFile];
+			nMaxHeight = std::max(nMaxHeight, pindex->nHeight);
+		}
+	}
+
+	uint64_t nTotal = 0;
+	map<unsigned int, uint64_t> mapSize;
+	for (map<unsigned int, int>::const_iterator mi = mapMaxHeight.begin(); mi != mapMaxHeight.end(); ++mi)
+	{
+		boost::system::error_code ec;
+		uint64_t nSize = filesystem::file_size(BlockFilePath(mi->first), ec);
+		mapSize[mi->first] = ec ? 0 : nSize;
+		nTotal += mapSize[mi->first];
+	}
+
+	// Oldest files first, never the one being written or any with recent blocks
+	set<unsigned int> setPrune;
+	for (map<unsigned int, int>::const_iterator mi = mapMaxHeight.begin(); mi != mapMaxHeight.end() && nTotal > nPruneTarget; ++mi)
+	{
+		if (mi->first >= nCurrentBlockFile || mi->second > nBestHeight - MIN_BLOCKS_TO_KEEP)
+			break;
+		setPrune.insert(mi->first);
+		nTotal -= mapSize[mi->first];
+	}
+	if (setPrune.empty())
+		return;
+
+	// Recorded before the files go, so a crash in between only leaves files behind
+	CTxDB txdb("r+");
+	set<unsigned int> setPruned;
+	txdb.ReadPrunedFiles(setPruned);
+	setPruned.insert(setPrune.begin(), setPrune.end());
+	if (!txdb.WritePrunedFiles(setPruned))
+	{
+		LogPrintf("PruneBlockFiles() : WritePrunedFiles failed\n");
+		return;
+	}
+	LoadPrunedBlockFiles(setPruned);
+
+	BOOST_FOREACH(unsigned int nFile, setPrune)
+	{
+		vector<CBlockIndex*> vBlocks;
+		{
+			LOCK(cs_prunedFiles);
+			vBlocks = mapPrunedFiles[nFile];
+		}
+		// Too deep to be disconnected again
+		BOOST_FOREACH(const CBlockIndex* pindex, vBlocks)
+			txdb.EraseCoinUndo(pindex->GetBlockHash());
+
+		boost::system::error_code ec;
+		filesystem::remove(BlockFilePath(nFile), ec);
+		LogPrintf("PruneBlockFiles() : deleted %s, %u blocks\n", BlockFilePath(nFile).string(), vBlocks.size());
+	}
+}
+
+bool BuildCoinDB()
+{
+	LOCK(cs_main);
+	CTxDB txdb("r+");
+	if (!txdb.BuildCoinDB())
+		return false;
+	fCoinDB = true;
+	return true;
+}
+
+void DisableCoinDB()
+{
+	LOCK(cs_main);
+	CTxDB txdb("r+");
+	txdb.DisableCoinDB();
+	fCoinDB = false;
+}
+
 bool LoadBlockIndex(bool fAllowNew)
 {
 	LOCK(cs_main);
@@ -3092,7 +3338,7 @@ void PrintBlockTree()
 	AssertLockHeld(cs_main);
 	// pre-compute tree structure
 	map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-	for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+	for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
 	{
 		CBlockIndex* pindex = (*mi).second;
 		mapNext[pindex->pprev].push_back(pindex);
@@ -3166,65 +3412,260 @@ void PrintBlockTree()
 	}
 }
 
+// Blocks the importer may read and decode ahead of the one being connected
+static const unsigned int IMPORT_WINDOW = 1024;
+// Serialized size of the blocks it may hold at once
+static const size_t IMPORT_MAX_BYTES = 64 * 1024 * 1024;
+// Size of each sequential read from the block file
+static const size_t IMPORT_READ_SIZE = 4 * 1024 * 1024;
+static const int IMPORT_MAX_THREADS = 4;
+
+/** Read-ahead for LoadExternalBlockFile.
+
+	One thread reads the file front to back in large chunks and cuts it into
+	records at the message start markers. Worker threads deserialize the
+	records and hash the blocks. The importing thread connects the blocks in
+	file order, so reading, decoding and hashing overlap with ProcessBlock
+	instead of taking turns with it.
+*/
+class CBlockFileImport
+{
+public:
+	class CImportBlock
+	{
+	public:
+		std::vector<unsigned char> vchRaw;
+		unsigned int nSize;
+		CBlock block;
+		bool fFailed;
+		bool fReady;
+
+		CImportBlock() : nSize(0), fFailed(false), fReady(false) {}
+	};
+
+	CBlockFileImport(FILE* fileIn) : file(fileIn), vBuf(IMPORT_READ_SIZE), nBegin(0), nEnd(0), fEof(false),
+		vBlocks(IMPORT_WINDOW), nQueued(0), nDecoded(0), nConnected(0), nBytes(0), fEnd(false), fStop(false) {}
+
+	~CBlockFileImport()
+	{
+		{
+			boost::unique_lock<boost::mutex> lock(mutex);
+			fStop = true;
+		}
+		cond.notify_all();
+		threadGroup.join_all();
+	}
+
+	void Start(int nThreads)
+	{
+		threadGroup.create_thread(boost::bind(&CBlockFileImport::ReadThread, this));
+		for (int i = 0; i < nThreads; i++)
+			threadGroup.create_thread(boost::bind(&CBlockFileImport::DecodeThread, this));
+	}
+
+	/** Wait for the next block in file order, NULL at the end of the file. Release() it when done. */
+	CImportBlock* Next()
+	{
+		boost::unique_lock<boost::mutex> lock(mutex);
+		while (true)
+		{
+			if (nConnected < nQueued)
+			{
+				CImportBlock& slot = vBlocks[nConnected % IMPORT_WINDOW];
+				if (slot.fReady)
+					return &slot;
+			}
+			else if (fEnd)
+				return NULL;
+			cond.wait(lock);
+		}
+	}
+
+	void Release()
+	{
+		boost::unique_lock<boost::mutex> lock(mutex);
+		CImportBlock& slot = vBlocks[nConnected % IMPORT_WINDOW];
+		slot.block.SetNull();
+		slot.fReady = false;
+		nBytes -= slot.nSize;
+		nConnected++;
+		cond.notify_all();
+	}
+
+private:
+	// -- reader state, only touched by the reader thread
+	FILE* file;
+	std::vector<unsigned char> vBuf;
+	size_t nBegin;
+	size_t nEnd;
+	bool fEof;
+
+	boost::thread_group threadGroup;
+	boost::mutex mutex;
+	boost::condition_variable cond;
+	std::vector<CImportBlock> vBlocks;
+	size_t nQueued;
+	size_t nDecoded;
+	size_t nConnected;
+	size_t nBytes;
+	bool fEnd;
+	bool fStop;
+
+	/** Make at least nNeed unread bytes available in vBuf, false at the end of the file */
+	bool Fill(size_t nNeed)
+	{
+		if (nEnd - nBegin >= nNeed)
+			return true;
+		if (fEof)
+			return false;
+		memmove(&vBuf[0], &vBuf[0] + nBegin, nEnd - nBegin);
+		nEnd -= nBegin;
+		nBegin = 0;
+		if (vBuf.size() < nNeed)
+			vBuf.resize(nNeed);
+		while (nEnd < nNeed && !fEof)
+		{
+			size_t nRead = fread(&vBuf[nEnd], 1, vBuf.size() - nEnd, file);
+			nEnd += nRead;
+			if (nRead == 0)
+				fEof = true;
+		}
+		return nEnd >= nNeed;
+	}
+
+	/** Hand a record to the decoders, waits while the window is full. False when stopping. */
+	bool Push(const unsigned char* pch, unsigned int nSize)
+	{
+		boost::unique_lock<boost::mutex> lock(mutex);
+		while (!fStop && (nQueued - nConnected >= IMPORT_WINDOW || (nBytes > 0 && nBytes + nSize > IMPORT_MAX_BYTES)))
+			cond.wait(lock);
+		if (fStop)
+			return false;
+
+		// -- the slot is ours until nQueued moves past it, block n - IMPORT_WINDOW has been released
+		CImportBlock& slot = vBlocks[nQueued % IMPORT_WINDOW];
+		slot.vchRaw.assign(pch, pch + nSize);
+		slot.nSize = nSize;
+		slot.fFailed = false;
+		nQueued++;
+		nBytes += nSize;
+		cond.notify_all();
+		return true;
+	}
+
+	void Read()
+	{
+		const unsigned char* pchMessageStart = (const unsigned char*)Params().MessageStart();
+		while (Fill(MESSAGE_START_SIZE))
+		{
+			unsigned char* pbegin = &vBuf[nBegin];
+			unsigned char* pFind = (unsigned char*)memchr(pbegin, pchMessageStart[0], nEnd - nBegin + 1 - MESSAGE_START_SIZE);
+			if (!pFind)
+			{
+				nBegin = nEnd + 1 - MESSAGE_START_SIZE;
+				continue;
+			}
+			nBegin += pFind - pbegin;
+			if (memcmp(pFind, pchMessageStart, MESSAGE_START_SIZE) != 0)
+			{
+				nBegin++;
+				continue;
+			}
+			nBegin += MESSAGE_START_SIZE;
+
+			if (!Fill(sizeof(unsigned int)))
+				break;
+			unsigned int nSize;
+			memcpy(&nSize, &vBuf[nBegin], sizeof(nSize));
+			if (nSize == 0 || nSize > MAX_BLOCK_SIZE)
+				continue;
+			nBegin += sizeof(nSize);
+
+			if (!Fill(nSize))
+				break;
+			if (!Push(&vBuf[nBegin], nSize))
+				break;
+			nBegin += nSize;
+		}
+	}
+
+	void ReadThread()
+	{
+		RenameThread("parlay-loadblk-read");
+		Read();
+		boost::unique_lock<boost::mutex> lock(mutex);
+		fEnd = true;
+		cond.notify_all();
+	}
+
+	void Decode(CImportBlock& slot)
+	{
+		try {
+			CSpanReader ss(slot.vchRaw, SER_DISK, CLIENT_VERSION);
+			ss >> slot.block;
+			slot.block.CacheHash();
+		}
+		catch (std::exception &e) {
+			slot.fFailed = true;
+		}
+		std::vector<unsigned char>().swap(slot.vchRaw);
+	}
+
+	void DecodeThread()
+	{
+		RenameThread("parlay-loadblk-dec");
+		boost::unique_lock<boost::mutex> lock(mutex);
+		while (!fStop)
+		{
+			if (nDecoded == nQueued)
+			{
+				cond.wait(lock);
+				continue;
+			}
+
+			size_t n = nDecoded++;
+			CImportBlock& slot = vBlocks[n % IMPORT_WINDOW];
+			lock.unlock();
+			Decode(slot);
+			lock.lock();
+
+			slot.fReady = true;
+			cond.notify_all();
+		}
+	}
+};
+
 bool LoadExternalBlockFile(FILE* fileIn)
 {
 	int64_t nStart = GetTimeMillis();
 
 	int nLoaded = 0;
 	{
-		try {
-			CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
-			unsigned int nPos = 0;
-			while (nPos != (unsigned int)-1 && blkdat.good())
+		CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
+		CBlockFileImport import(blkdat.Get());
+		import.Start(std::max(1, std::min((int)boost::thread::hardware_concurrency() - 1, IMPORT_MAX_THREADS)));
+		while (CBlockFileImport::CImportBlock* pimport = import.Next())
+		{
+			boost::this_thread::interruption_point();
+			if (pimport->fFailed)
 			{
-				boost::this_thread::interruption_point();
-				unsigned char pchData[65536];
-				do {
-					fseek(blkdat.Get(), nPos, SEEK_SET);
-					int nRead = fread(pchData, 1, sizeof(pchData), blkdat.Get());
-					if (nRead <= 8)
-					{
-						nPos = (unsigned int)-1;
-						break;
-					}
-					void* nFind = memchr(pchData, Params().MessageStart()[0], nRead + 1 - MESSAGE_START_SIZE);
-					if (nFind)
-					{
-						if (memcmp(nFind, Params().MessageStart(), MESSAGE_START_SIZE) == 0)
-						{
-							nPos += ((unsigned char*)nFind - pchData) + MESSAGE_START_SIZE;
-							break;
-						}
-						nPos += ((unsigned char*)nFind - pchData) + 1;
-					}
-					else
-						nPos += sizeof(pchData) - MESSAGE_START_SIZE + 1;
-					boost::this_thread::interruption_point();
-				} while (true);
-				if (nPos == (unsigned int)-1)
-					break;
-				fseek(blkdat.Get(), nPos, SEEK_SET);
-				unsigned int nSize;
-				blkdat >> nSize;
-				if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
-				{
-					CBlock block;
-					blkdat >> block;
-					LOCK(cs_main);
-					if (ProcessBlock(NULL, &block))
-					{
-						nLoaded++;
-						nPos += 4 + nSize;
-					}
-				}
+				LogPrintf("%s() : Deserialize or I/O error caught during load\n",
+					__PRETTY_FUNCTION__);
+				break;
 			}
-		}
-		catch (std::exception &e) {
-			LogPrintf("%s() : Deserialize or I/O error caught during load\n",
-				__PRETTY_FUNCTION__);
+			{
+				LOCK(cs_main);
+				if (ProcessBlock(NULL, &pimport->block))
+					nLoaded++;
+			}
+			import.Release();
+
+			if (nLoaded > 0 && nLoaded % 10000 == 0)
+				LogPrintf("Loaded %i blocks from external file, %.1f blocks/s\n", nLoaded, nLoaded * 1000.0 / std::max((int64_t)1, GetTimeMillis() - nStart));
 		}
 	}
-	LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+	int64_t nElapsed = GetTimeMillis() - nStart;
+	LogPrintf("Loaded %i blocks from external file in %dms, %.1f blocks/s\n", nLoaded, nElapsed, nLoaded * 1000.0 / std::max((int64_t)1, nElapsed));
 	return nLoaded > 0;
 }
 
@@ -3350,13 +3791,13 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
 		bool txInMap = false;
 		txInMap = mempool.exists(inv.hash);
 		return txInMap ||
-			mapOrphanTransactions.count(inv.hash) ||
+			orphanTxPool.Exists(inv.hash) ||
 			txdb.ContainsTx(inv.hash);
 	}
 
 	case MSG_BLOCK:
 		return mapBlockIndex.count(inv.hash) ||
-			mapOrphanBlocks.count(inv.hash);
+			orphanBlockPool.Exists(inv.hash);
 	case MSG_TXLOCK_REQUEST:
 		return mapTxLockReq.count(inv.hash) ||
 			mapTxLockReqRejected.count(inv.hash);
@@ -3393,11 +3834,13 @@ void static ProcessGetData(CNode* pfrom)
 			if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
 			{
 				// Send block from disk
-				map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+				BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
 				if (mi != mapBlockIndex.end())
 				{
+					// Blocks of pruned files are not sent
 					CBlock block;
-					block.ReadFromDisk((*mi).second);
+					if (!block.ReadFromDisk((*mi).second))
+						continue;
 					pfrom->PushMessage("block", block);
 
 					// Trigger them to send a getblocks request for the next batch of inventory
@@ -3750,8 +4193,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 				if (!fImporting)
 					pfrom->AskFor(inv);
 			}
-			else if (inv.type == MSG_BLOCK && mapOrphanBlocks.count(inv.hash)) {
-				PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(inv.hash));
+			else if (inv.type == MSG_BLOCK && orphanBlockPool.Exists(inv.hash)) {
+				PushGetBlocks(pfrom, pindexBest, orphanBlockPool.GetRoot(inv.hash));
 			}
 			else if (nInv == nLastBlock) {
 				// In case we are on a very long side-chain, it is possible that we already have
@@ -3839,7 +4282,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 		if (locator.IsNull())
 		{
 			// If locator is null, return the hashStop block
-			map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+			BlockMap::iterator mi = mapBlockIndex.find(hashStop);
 			if (mi == mapBlockIndex.end())
 				return true;
 			pindex = (*mi).second;
@@ -3868,7 +4311,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 	else if (strCommand == "tx" || strCommand == "dstx")
 	{
 		vector<uint256> vWorkQueue;
-		vector<uint256> vEraseQueue;
 		CTransaction tx;
 
 		//primenode signed transaction
@@ -3943,18 +4385,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 			RelayTransaction(tx, inv.hash);
 			vWorkQueue.push_back(inv.hash);
 
-			// Recursively process any orphan transactions that depended on this one
+			// Process any orphan transactions that depended on this one. An
+			// orphan leaves the pool as soon as it is settled, so it is not
+			// tried again for its other parents.
 			for (unsigned int i = 0; i < vWorkQueue.size(); i++)
 			{
-				map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-				if (itByPrev == mapOrphanTransactionsByPrev.end())
-					continue;
-				for (set<uint256>::iterator mi = itByPrev->second.begin();
-					mi != itByPrev->second.end();
-					++mi)
+				vector<CTransaction> vChildren;
+				orphanTxPool.GetChildren(vWorkQueue[i], vChildren);
+				BOOST_FOREACH(CTransaction& orphanTx, vChildren)
 				{
-					const uint256& orphanTxHash = *mi;
-					CTransaction& orphanTx = mapOrphanTransactions[orphanTxHash];
+					uint256 orphanTxHash = orphanTx.GetHash();
 					bool fMissingInputs2 = false;
 
 					if (AcceptToMemoryPool(mempool, orphanTx, true, &fMissingInputs2))
@@ -3962,29 +4402,26 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 						LogPrint("mempool", "   accepted orphan tx %s\n", orphanTxHash.ToString());
 						RelayTransaction(orphanTx, orphanTxHash);
 						vWorkQueue.push_back(orphanTxHash);
-						vEraseQueue.push_back(orphanTxHash);
+						orphanTxPool.Erase(orphanTxHash);
 					}
 					else if (!fMissingInputs2)
 					{
 						// Has inputs but not accepted to mempool
 						// Probably non-standard or insufficient fee/priority
-						vEraseQueue.push_back(orphanTxHash);
+						orphanTxPool.Erase(orphanTxHash);
 						LogPrint("mempool", "   removed orphan tx %s\n", orphanTxHash.ToString());
 					}
 				}
 			}
-
-			BOOST_FOREACH(uint256 hash, vEraseQueue)
-				EraseOrphanTx(hash);
 		}
 		else if (fMissingInputs)
 		{
-			AddOrphanTx(tx);
+			orphanTxPool.Add(tx, pfrom->GetId());
 
-			// DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-			unsigned int nEvicted = LimitOrphanTxSize(MAX_ORPHAN_TRANSACTIONS);
+			// DoS prevention: do not allow the orphan pool to grow unbounded
+			unsigned int nEvicted = orphanTxPool.Limit(MAX_ORPHAN_TRANSACTIONS, MAX_ORPHAN_TRANSACTIONS_SIZE);
 			if (nEvicted > 0)
-				LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+				LogPrint("mempool", "orphan pool overflow, removed %u tx\n", nEvicted);
 		}
 		if (strCommand == "dstx") {
 			inv = CInv(MSG_DSTX, tx.GetHash());
@@ -15,6 +15,9 @@
 
 #include <list>
 
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
 class CValidationState;
 
 #define START_PRIMENODE_PAYMENTS_TESTNET 1510716600 // Wednesday, November 15, 2017 3:30:00 AM GMT
@@ -38,6 +41,13 @@ class CNode;
 class CReserveKey;
 class CWallet;
 
+/** Block hashes are already uniformly distributed, the low 64 bits make a fine hash */
+struct BlockHasher
+{
+    size_t operator()(const uint256& hash) const { return hash.Get64(); }
+};
+typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+
 /** The maximum allowed size for a serialized block, in bytes (network rule) */
 static const unsigned int MAX_BLOCK_SIZE = 3000000; //3 MB
 /** The maximum size for mined blocks */
@@ -54,8 +64,18 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** The maximum number of orphan transactions kept in memory */
 static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE/100;
+/** Serialized size of all orphan transactions kept in memory */
+static const unsigned int MAX_ORPHAN_TRANSACTIONS_SIZE = 10 * 1000 * 1000;
 /** Default for -maxorphanblocks, maximum number of orphan blocks kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_BLOCKS = 750;
+/** Serialized size of all orphan blocks kept in memory */
+static const unsigned int MAX_ORPHAN_BLOCKS_SIZE = 64 * 1000 * 1000;
+/** Size at which a new block file is started with -prune, so old blocks are deleted in small steps */
+static const unsigned int PRUNE_BLOCKFILE_SIZE = 64 * 1024 * 1024;
+/** Smallest accepted -prune target, in MiB */
+static const uint64_t MIN_PRUNE_TARGET_MB = 256;
+/** Block files holding any of the last this many blocks are never pruned, reorganizations read them back */
+static const int MIN_BLOCKS_TO_KEEP = 2880;
 /** Fees smaller than this (in satoshi) are considered zero fee (for transaction creation) */
 static const int64_t MIN_TX_FEE = 1000;
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying) */
@@ -77,7 +97,7 @@ inline int64_t GetMNCollateral(int nHeight) { return 2500; }
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
-extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+extern BlockMap mapBlockIndex;
 extern std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
 extern CBlockIndex* pindexGenesisBlock;
 extern int nStakeMinConfirmations;
@@ -96,8 +116,8 @@ extern const std::string strMessageMagic;
 extern int64_t nTimeBestReceived;
 extern bool fImporting;
 extern bool fReindex;
-struct COrphanBlock;
-extern std::map<uint256, COrphanBlock*> mapOrphanBlocks;
+extern bool fCoinDB;
+extern uint64_t nPruneTarget;
 extern bool fHaveGUI;
 
 // Settings
@@ -139,6 +159,18 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
 FILE* AppendBlockFile(unsigned int& nFileRet);
 bool LoadBlockIndex(bool fAllowNew=true);
+/** Remember which block files were deleted by -prune, called once the block index is loaded */
+void LoadPrunedBlockFiles(const std::set<unsigned int>& setFiles);
+bool IsBlockFilePruned(unsigned int nFile);
+bool HavePrunedBlockFiles();
+/** Header of a block whose file was pruned, taken from the block index */
+bool ReadPrunedBlockHeader(unsigned int nFile, unsigned int nBlockPos, CBlock& block);
+/** Delete the oldest block files while they take more than nPruneTarget, cs_main must be held */
+void PruneBlockFiles();
+/** Fill the coin database from the transaction index and start maintaining it */
+bool BuildCoinDB();
+/** Stop maintaining the coin database, it is rebuilt when enabled again */
+void DisableCoinDB();
 void PrintBlockTree();
 CBlockIndex* FindBlockByHeight(int nHeight);
 bool ProcessMessages(CNode* pfrom);
@@ -152,8 +184,10 @@ int64_t GetProofOfStakeReward(int nHeight, const CBlockIndex* pindexPrev, int64_
 bool IsInitialBlockDownload();
 bool IsConfirmedInNPrevBlocks(const CTxIndex& txindex, const CBlockIndex* pindexFrom, int nMaxDepth, int& nActualDepth);
 std::string GetWarnings(std::string strFor);
-bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock);
-uint256 WantedByOrphan(const COrphanBlock* pblockOrphan);
+/** Find a transaction in the mempool or the tx index, and unless fScanDisconnected is false in the blocks off the main chain */
+bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fScanDisconnected=true);
+/** Like GetTransaction, but a transaction in a pruned block file is rebuilt from its unspent outputs in the coin database */
+bool GetTransactionOutputs(const uint256 &hash, CTransaction &tx, uint256 &hashBlock);
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake);
 void ThreadStakeMiner(CWallet *pwallet);
 
@@ -240,6 +274,8 @@ enum GetMinFee_mode
 };
 
 typedef std::map<uint256, std::pair<CTxIndex, CTransaction> > MapPrevTx;
+/** Transactions touching each address id, as kept in the address index */
+typedef std::map<uint160, std::vector<uint256> > MapAddrIndex;
 
 int64_t GetMinFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree, enum GetMinFee_mode mode);
 
@@ -403,6 +439,10 @@ public:
 
     bool ReadFromDisk(CTxDB& txdb, const uint256& hash, CTxIndex& txindexRet);
     bool ReadFromDisk(CTxDB& txdb, COutPoint prevout, CTxIndex& txindexRet);
+    /** Read the transaction prevout spends. Once its block is pruned it is rebuilt from the
+        coin database: outputs, time and coinbase/coinstake shape are kept, but not its hash. */
+    bool ReadPrevTx(CTxDB& txdb, COutPoint prevout, CTxIndex& txindexRet);
+    bool ReadPrevTx(CTxDB& txdb, const uint256& hash, const CTxIndex& txindex);
     bool ReadFromDisk(CTxDB& txdb, COutPoint prevout);
     bool ReadFromDisk(COutPoint prevout);
     bool DisconnectInputs(CTxDB& txdb);
@@ -609,6 +649,49 @@ public:
 };
 
 
+/** An unspent output in the coin database (-coindb), keyed by its outpoint.
+ *  Holds what validating a spend needs after the block that created the
+ *  output has been pruned from disk.
+ */
+class CCoin
+{
+public:
+    CTxOut txout;
+    int nHeight;
+    unsigned int nTime;         // time of the transaction
+    bool fCoinBase;
+    bool fCoinStake;
+
+    CCoin()
+    {
+        SetNull();
+    }
+
+    CCoin(const CTransaction& tx, unsigned int n, int nHeightIn)
+        : txout(tx.vout[n]), nHeight(nHeightIn), nTime(tx.nTime), fCoinBase(tx.IsCoinBase()), fCoinStake(tx.IsCoinStake())
+    {
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(txout);
+        READWRITE(nHeight);
+        READWRITE(nTime);
+        READWRITE(fCoinBase);
+        READWRITE(fCoinStake);
+    )
+
+    void SetNull()
+    {
+        txout.SetNull();
+        nHeight = 0;
+        nTime = 0;
+        fCoinBase = false;
+        fCoinStake = false;
+    }
+};
+
+
 
 
 
@@ -642,6 +725,9 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    // memory only, see CacheHash
+    uint256 hashCached;
+    bool fHashCached;
 
     // Denial-of-service detection:
     mutable int nDoS;
@@ -686,6 +772,8 @@ public:
         vtx.clear();
         vchBlockSig.clear();
         vMerkleTree.clear();
+        hashCached = 0;
+        fHashCached = false;
         nDoS = 0;
     }
 
@@ -696,6 +784,8 @@ public:
 
     uint256 GetHash() const
     {
+        if (fHashCached)
+            return hashCached;
         if (nVersion > 6)
             return Hash(BEGIN(nVersion), END(nNonce));
         else
@@ -707,6 +797,16 @@ public:
         return scrypt_blockhash(CVOIDBEGIN(nVersion));
     }
 
+    /** Remember the hash so later GetHash calls are free. Only for blocks
+     *  whose header won't change anymore, such as ones read from a file.
+     */
+    void CacheHash()
+    {
+        fHashCached = false;
+        hashCached = GetHash();
+        fHashCached = true;
+    }
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -832,7 +932,12 @@ public:
         // Open history file to read
         CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), SER_DISK, CLIENT_VERSION);
         if (filein.IsNull())
+        {
+            // Headers of pruned blocks are still in the block index
+            if (!fReadTransactions && ReadPrunedBlockHeader(nFile, nBlockPos, *this))
+                return true;
             return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
+        }
         if (!fReadTransactions)
             filein.nType |= SER_BLOCKHEADERONLY;
 
@@ -885,7 +990,8 @@ public:
     bool AcceptBlock();
     bool SignBlock(CWallet& keystore, int64_t nFees);
     bool CheckBlockSignature() const;
-    void RebuildAddressIndex(CTxDB& txdb);
+    /** Add the transactions of this block to mapAddrIndex, false if the inputs of one couldn't be fetched */
+    bool GetAddressIndex(CTxDB& txdb, MapAddrIndex& mapAddrIndex);
 
 private:
     bool SetBestChainInner(CTxDB& txdb, CBlockIndex *pindexNew);
@@ -906,17 +1012,14 @@ private:
 class CBlockIndex
 {
 public:
+    // Fields used when walking the chain come first, so a walk touches
+    // one cache line per entry. The rest is ordered to avoid padding.
     const uint256* phashBlock;
     CBlockIndex* pprev;
     CBlockIndex* pnext;
-    unsigned int nFile;
-    unsigned int nBlockPos;
-    uint256 nChainTrust; // ppcoin: trust score of block chain
     int nHeight;
-#ifndef LOWMEM
-    int64_t nMint;
-    int64_t nMoneySupply;
-#endif
+    unsigned int nTime;
+    unsigned int nBits;
     unsigned int nFlags;  // ppcoin: block index flags
     enum
     {
@@ -924,23 +1027,31 @@ public:
         BLOCK_STAKE_ENTROPY  = (1 << 1), // entropy bit for stake modifier
         BLOCK_STAKE_MODIFIER = (1 << 2), // regenerated stake modifier
     };
-
     uint64_t nStakeModifier; // hash modifier for proof-of-stake
-#ifndef LOWMEM
-    uint256 bnStakeModifierV2;
-#endif
+    uint256 nChainTrust; // ppcoin: trust score of block chain
+
+    unsigned int nFile;
+    unsigned int nBlockPos;
+
     // proof-of-stake specific fields
-    COutPoint prevoutStake;
     unsigned int nStakeTime;
-
+    COutPoint prevoutStake;
     uint256 hashProof;
 
-    // block header
+    // rest of the block header
     int nVersion;
-    uint256 hashMerkleRoot;
-    unsigned int nTime;
-    unsigned int nBits;
     unsigned int nNonce;
+    uint256 hashMerkleRoot;
+
+#ifndef LOWMEM
+    uint256 bnStakeModifierV2;
+    int64_t nMint;
+    int64_t nMoneySupply;
+#endif
+
+    // Entries are carved out of large chunks and live until shutdown, see main.cpp
+    static void* operator new(size_t nSize);
+    static void operator delete(void*) {}
 
     CBlockIndex()
     {
@@ -1126,6 +1237,69 @@ public:
 };
 
 
+/** Immutable view of the best chain as of one tip.
+
+    A new snapshot is published every time the tip changes, so RPC handlers
+    can look up blocks by height and check main chain membership without
+    holding cs_main. Heights are kept in fixed-size chunks; snapshots share
+    every chunk below the point where they diverge, so publishing only
+    copies the chunk table and the chunks touched by the new blocks.
+    Block index entries are never freed, the pointers stay valid for the
+    lifetime of the process.
+*/
+class CChainSnapshot
+{
+public:
+    CChainSnapshot() : nHeight(-1) {}
+    CChainSnapshot(const CChainSnapshot& prev, CBlockIndex* pindexTip);
+
+    CBlockIndex* Tip() const { return nHeight < 0 ? NULL : (*this)[nHeight]; }
+    int Height() const { return nHeight; }
+
+    /** Main chain block at nHeightIn, or NULL when out of range */
+    CBlockIndex* operator[](int nHeightIn) const
+    {
+        if (nHeightIn < 0 || nHeightIn > nHeight)
+            return NULL;
+        return (*vChunks[nHeightIn / CHUNK_SIZE])[nHeightIn % CHUNK_SIZE];
+    }
+
+    bool Contains(const CBlockIndex* pindex) const
+    {
+        return pindex && (*this)[pindex->nHeight] == pindex;
+    }
+
+    /** Successor of pindex on this chain, or NULL */
+    CBlockIndex* Next(const CBlockIndex* pindex) const
+    {
+        return Contains(pindex) ? (*this)[pindex->nHeight + 1] : NULL;
+    }
+
+    /** Number of confirmations of pindex on this chain, 0 when not on it */
+    int GetDepth(const CBlockIndex* pindex) const
+    {
+        return Contains(pindex) ? nHeight - pindex->nHeight + 1 : 0;
+    }
+
+private:
+    static const int CHUNK_SIZE = 4096;
+
+    int nHeight;
+    std::vector<boost::shared_ptr<std::vector<CBlockIndex*> > > vChunks;
+};
+
+typedef boost::shared_ptr<const CChainSnapshot> CChainSnapshotRef;
+
+/** Snapshot of the current best chain, safe to call without cs_main */
+CChainSnapshotRef GetChainSnapshot();
+/** Publish a new best chain snapshot, called with cs_main held */
+void UpdateChainSnapshot(CBlockIndex* pindexTip);
+/** Find a block index entry without holding cs_main, NULL if unknown */
+CBlockIndex* LookupBlockIndex(const uint256& hash);
+/** Add pindex to mapBlockIndex and point its phashBlock at the map key */
+BlockMap::iterator InsertBlockIndexEntry(const uint256& hash, CBlockIndex* pindex);
+
+
 
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
@@ -1248,7 +1422,7 @@ public:
 
     explicit CBlockLocator(uint256 hashBlock)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
             Set((*mi).second);
     }
@@ -1299,7 +1473,7 @@ public:
         int nStep = 1;
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1318,7 +1492,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1334,7 +1508,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1431,6 +1605,7 @@ protected:
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock, bool fConnect) =0;
     virtual void EraseFromWallet(const uint256 &hash) =0;
     virtual void SetBestChain(const CBlockLocator &locator) =0;
+    virtual void UpdatedBlockTip(int nHeight) =0;
     virtual bool UpdatedTransaction(const uint256 &hash) =0;
     virtual void Inventory(const uint256 &hash) =0;
     virtual void ResendWalletTransactions(bool fForce) =0;
@@ -0,0 +1,303 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "orphanpool.h"
+
+#include "util.h"
+
+using namespace std;
+
+COrphanTxPool orphanTxPool;
+COrphanBlockPool orphanBlockPool;
+
+// Peer with the most orphan bytes, mapPeers must not be empty
+static map<NodeId, COrphanPeer>::iterator LargestPeer(map<NodeId, COrphanPeer>& mapPeers)
+{
+    map<NodeId, COrphanPeer>::iterator itLargest = mapPeers.begin();
+    for (map<NodeId, COrphanPeer>::iterator it = mapPeers.begin(); it != mapPeers.end(); ++it)
+        if (it->second.nBytes > itLargest->second.nBytes)
+            itLargest = it;
+    return itLargest;
+}
+
+static void EraseFromPeer(map<NodeId, COrphanPeer>& mapPeers, NodeId peer, uint64_t nSequence, size_t nSize)
+{
+    map<NodeId, COrphanPeer>::iterator it = mapPeers.find(peer);
+    if (it == mapPeers.end())
+        return;
+    it->second.mapBySequence.erase(nSequence);
+    it->second.nBytes -= nSize;
+    if (it->second.mapBySequence.empty())
+        mapPeers.erase(it);
+}
+
+static void EraseFromIndex(multimap<uint256, uint256>& mapByPrev, const uint256& hashPrev, const uint256& hash)
+{
+    pair<multimap<uint256, uint256>::iterator, multimap<uint256, uint256>::iterator> range = mapByPrev.equal_range(hashPrev);
+    for (multimap<uint256, uint256>::iterator it = range.first; it != range.second; ++it)
+    {
+        if (it->second == hash)
+        {
+            mapByPrev.erase(it);
+            return;
+        }
+    }
+}
+
+//
+// COrphanTxPool
+//
+
+bool COrphanTxPool::Add(const CTransaction& tx, NodeId peer)
+{
+    uint256 hash = tx.GetHash();
+
+    // Ignore big transactions, to avoid a
+    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
+    // large transaction with a missing parent then we assume
+    // it will rebroadcast it later, after the parent transaction(s)
+    // have been mined or received.
+    unsigned int nSize = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
+    if (nSize > 5000)
+    {
+        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", nSize, hash.ToString());
+        return false;
+    }
+
+    LOCK(cs);
+    if (mapOrphans.count(hash))
+        return false;
+
+    COrphanTx& orphan = mapOrphans[hash];
+    orphan.tx = tx;
+    orphan.peer = peer;
+    orphan.nSize = nSize;
+    orphan.nSequence = nSequence++;
+
+    set<uint256> setPrev;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        if (setPrev.insert(txin.prevout.hash).second)
+            mapByPrev.insert(make_pair(txin.prevout.hash, hash));
+
+    COrphanPeer& orphanPeer = mapPeers[peer];
+    orphanPeer.mapBySequence[orphan.nSequence] = hash;
+    orphanPeer.nBytes += nSize;
+    nBytes += nSize;
+
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u, %u bytes)\n", hash.ToString(), mapOrphans.size(), nBytes);
+    return true;
+}
+
+void COrphanTxPool::Erase(OrphanMap::iterator it)
+{
+    const COrphanTx& orphan = it->second;
+    set<uint256> setPrev;
+    BOOST_FOREACH(const CTxIn& txin, orphan.tx.vin)
+        if (setPrev.insert(txin.prevout.hash).second)
+            EraseFromIndex(mapByPrev, txin.prevout.hash, it->first);
+    EraseFromPeer(mapPeers, orphan.peer, orphan.nSequence, orphan.nSize);
+    nBytes -= orphan.nSize;
+    mapOrphans.erase(it);
+}
+
+bool COrphanTxPool::Exists(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapOrphans.count(hash) != 0;
+}
+
+void COrphanTxPool::Erase(const uint256& hash)
+{
+    LOCK(cs);
+    OrphanMap::iterator it = mapOrphans.find(hash);
+    if (it != mapOrphans.end())
+        Erase(it);
+}
+
+void COrphanTxPool::EraseForPeer(NodeId peer)
+{
+    LOCK(cs);
+    map<NodeId, COrphanPeer>::iterator itPeer = mapPeers.find(peer);
+    if (itPeer == mapPeers.end())
+        return;
+    vector<uint256> vErase;
+    for (map<uint64_t, uint256>::const_iterator it = itPeer->second.mapBySequence.begin(); it != itPeer->second.mapBySequence.end(); ++it)
+        vErase.push_back(it->second);
+    BOOST_FOREACH(const uint256& hash, vErase)
+        Erase(mapOrphans.find(hash));
+    LogPrint("mempool", "erased %u orphan tx from peer %d\n", vErase.size(), peer);
+}
+
+void COrphanTxPool::GetChildren(const uint256& hashParent, vector<CTransaction>& vChildren) const
+{
+    LOCK(cs);
+    pair<multimap<uint256, uint256>::const_iterator, multimap<uint256, uint256>::const_iterator> range = mapByPrev.equal_range(hashParent);
+    for (multimap<uint256, uint256>::const_iterator it = range.first; it != range.second; ++it)
+        vChildren.push_back(mapOrphans.find(it->second)->second.tx);
+}
+
+unsigned int COrphanTxPool::Limit(size_t nMaxCount, size_t nMaxBytes)
+{
+    LOCK(cs);
+    unsigned int nEvicted = 0;
+    while (!mapOrphans.empty() && (mapOrphans.size() > nMaxCount || nBytes > nMaxBytes))
+    {
+        map<NodeId, COrphanPeer>::iterator itPeer = LargestPeer(mapPeers);
+        Erase(mapOrphans.find(itPeer->second.mapBySequence.begin()->second));
+        ++nEvicted;
+    }
+    return nEvicted;
+}
+
+size_t COrphanTxPool::Size() const
+{
+    LOCK(cs);
+    return mapOrphans.size();
+}
+
+//
+// COrphanBlockPool
+//
+
+bool COrphanBlockPool::Add(const CBlock& block, NodeId peer)
+{
+    COrphanBlock orphan;
+    orphan.hashBlock = block.GetHash();
+    orphan.hashPrev = block.hashPrevBlock;
+    orphan.stake = block.GetProofOfStake();
+    orphan.peer = peer;
+    {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << block;
+        orphan.vchBlock.assign(ss.begin(), ss.end());
+    }
+
+    LOCK(cs);
+    pair<OrphanMap::iterator, bool> ret = mapOrphans.insert(make_pair(orphan.hashBlock, COrphanBlock()));
+    if (!ret.second)
+        return false;
+    COrphanBlock& stored = ret.first->second;
+    stored.hashBlock = orphan.hashBlock;
+    stored.hashPrev = orphan.hashPrev;
+    stored.stake = orphan.stake;
+    stored.vchBlock.swap(orphan.vchBlock);
+    stored.peer = peer;
+    stored.nSequence = nSequence++;
+
+    mapByPrev.insert(make_pair(stored.hashPrev, stored.hashBlock));
+    if (block.IsProofOfStake())
+        setStakeSeen.insert(stored.stake);
+
+    COrphanPeer& orphanPeer = mapPeers[peer];
+    orphanPeer.mapBySequence[stored.nSequence] = stored.hashBlock;
+    orphanPeer.nBytes += stored.vchBlock.size();
+    nBytes += stored.vchBlock.size();
+    return true;
+}
+
+void COrphanBlockPool::Erase(OrphanMap::iterator it, COrphanBlock* pTaken)
+{
+    COrphanBlock& orphan = it->second;
+    EraseFromIndex(mapByPrev, orphan.hashPrev, orphan.hashBlock);
+    setStakeSeen.erase(orphan.stake);
+    EraseFromPeer(mapPeers, orphan.peer, orphan.nSequence, orphan.vchBlock.size());
+    nBytes -= orphan.vchBlock.size();
+    if (pTaken)
+    {
+        pTaken->hashBlock = orphan.hashBlock;
+        pTaken->hashPrev = orphan.hashPrev;
+        pTaken->stake = orphan.stake;
+        pTaken->peer = orphan.peer;
+        pTaken->nSequence = orphan.nSequence;
+        pTaken->vchBlock.swap(orphan.vchBlock);
+    }
+    mapOrphans.erase(it);
+}
+
+bool COrphanBlockPool::Exists(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapOrphans.count(hash) != 0;
+}
+
+bool COrphanBlockPool::HasChildren(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapByPrev.count(hash) != 0;
+}
+
+bool COrphanBlockPool::StakeSeen(const pair<COutPoint, unsigned int>& stake) const
+{
+    LOCK(cs);
+    return setStakeSeen.count(stake) != 0;
+}
+
+uint256 COrphanBlockPool::GetRoot(const uint256& hash) const
+{
+    LOCK(cs);
+    OrphanMap::const_iterator it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return hash;
+
+    // Work back to the first block in the orphan chain
+    while (true)
+    {
+        OrphanMap::const_iterator itPrev = mapOrphans.find(it->second.hashPrev);
+        if (itPrev == mapOrphans.end())
+            return it->first;
+        it = itPrev;
+    }
+}
+
+uint256 COrphanBlockPool::GetWanted(const uint256& hash) const
+{
+    LOCK(cs);
+    OrphanMap::const_iterator it = mapOrphans.find(GetRoot(hash));
+    return it == mapOrphans.end() ? hash : it->second.hashPrev;
+}
+
+void COrphanBlockPool::TakeChildren(const uint256& hashParent, vector<COrphanBlock>& vChildren)
+{
+    LOCK(cs);
+    vector<uint256> vHash;
+    pair<multimap<uint256, uint256>::iterator, multimap<uint256, uint256>::iterator> range = mapByPrev.equal_range(hashParent);
+    for (multimap<uint256, uint256>::iterator it = range.first; it != range.second; ++it)
+        vHash.push_back(it->second);
+
+    BOOST_FOREACH(const uint256& hash, vHash)
+    {
+        vChildren.push_back(COrphanBlock());
+        Erase(mapOrphans.find(hash), &vChildren.back());
+    }
+}
+
+unsigned int COrphanBlockPool::Limit(size_t nMaxCount, size_t nMaxBytes)
+{
+    LOCK(cs);
+    unsigned int nEvicted = 0;
+    while (!mapOrphans.empty() && (mapOrphans.size() > nMaxCount || nBytes > nMaxBytes))
+    {
+        map<NodeId, COrphanPeer>::iterator itPeer = LargestPeer(mapPeers);
+        OrphanMap::iterator it = mapOrphans.find(itPeer->second.mapBySequence.begin()->second);
+
+        // As long as this block has other orphans depending on it, move to one of those successors.
+        while (true)
+        {
+            multimap<uint256, uint256>::iterator itNext = mapByPrev.find(it->first);
+            if (itNext == mapByPrev.end())
+                break;
+            it = mapOrphans.find(itNext->second);
+        }
+        LogPrint("net", "evicting orphan block %s from peer %d\n", it->first.ToString(), it->second.peer);
+        Erase(it);
+        ++nEvicted;
+    }
+    return nEvicted;
+}
+
+size_t COrphanBlockPool::Size() const
+{
+    LOCK(cs);
+    return mapOrphans.size();
+}
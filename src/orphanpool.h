@@ -0,0 +1,131 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ORPHANPOOL_H
+#define BITCOIN_ORPHANPOOL_H
+
+#include "main.h"
+#include "net.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+/** Orphans a peer has handed us, oldest first, for eviction */
+class COrphanPeer
+{
+public:
+    size_t nBytes;
+    std::map<uint64_t, uint256> mapBySequence;
+
+    COrphanPeer() : nBytes(0) {}
+};
+
+/** Transactions with unknown inputs, held until a parent arrives.
+ *
+ *  The pool has its own lock, so orphans are added, looked up and evicted
+ *  without cs_main. Orphans are indexed by each parent they spend from. It
+ *  is limited in count and in bytes; when full, the peer that accounts for
+ *  the most bytes loses its oldest orphan first.
+ */
+class COrphanTxPool
+{
+private:
+    class COrphanTx
+    {
+    public:
+        CTransaction tx;
+        NodeId peer;
+        unsigned int nSize;
+        uint64_t nSequence;
+    };
+    typedef std::map<uint256, COrphanTx> OrphanMap;
+
+    mutable CCriticalSection cs;
+    OrphanMap mapOrphans;
+    std::multimap<uint256, uint256> mapByPrev;
+    std::map<NodeId, COrphanPeer> mapPeers;
+    size_t nBytes;
+    uint64_t nSequence;
+
+    void Erase(OrphanMap::iterator it);
+
+public:
+    COrphanTxPool() : nBytes(0), nSequence(0) {}
+
+    /** False if the transaction is already there or too large to keep */
+    bool Add(const CTransaction& tx, NodeId peer);
+    bool Exists(const uint256& hash) const;
+    void Erase(const uint256& hash);
+    /** Drop the orphans of a peer that disconnected */
+    void EraseForPeer(NodeId peer);
+    /** Copies of the orphans spending outputs of hashParent */
+    void GetChildren(const uint256& hashParent, std::vector<CTransaction>& vChildren) const;
+    /** Evict orphans until both limits are met, returns the number evicted */
+    unsigned int Limit(size_t nMaxCount, size_t nMaxBytes);
+    size_t Size() const;
+};
+
+/** A block whose parent we don't have yet, kept serialized */
+class COrphanBlock
+{
+public:
+    uint256 hashBlock;
+    uint256 hashPrev;
+    std::pair<COutPoint, unsigned int> stake;
+    std::vector<unsigned char> vchBlock;
+    NodeId peer;
+    uint64_t nSequence;
+};
+
+/** Blocks that can't be connected yet, held until their parent arrives.
+ *
+ *  Like COrphanTxPool it has its own lock, indexes orphans by parent and
+ *  accounts bytes per peer. Eviction only removes orphans no other orphan
+ *  builds on, starting from the oldest orphan of the peer holding the most
+ *  bytes, so chains that are being filled in stay whole.
+ */
+class COrphanBlockPool
+{
+private:
+    typedef std::map<uint256, COrphanBlock> OrphanMap;
+
+    mutable CCriticalSection cs;
+    OrphanMap mapOrphans;
+    std::multimap<uint256, uint256> mapByPrev;
+    std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
+    std::map<NodeId, COrphanPeer> mapPeers;
+    size_t nBytes;
+    uint64_t nSequence;
+
+    // pTaken receives the orphan instead of it being freed
+    void Erase(OrphanMap::iterator it, COrphanBlock* pTaken = NULL);
+
+public:
+    COrphanBlockPool() : nBytes(0), nSequence(0) {}
+
+    /** False if the block is already there */
+    bool Add(const CBlock& block, NodeId peer);
+    bool Exists(const uint256& hash) const;
+    /** Whether some orphan builds on hash */
+    bool HasChildren(const uint256& hash) const;
+    /** Whether an orphan uses this stake (ppcoin duplicate stake check) */
+    bool StakeSeen(const std::pair<COutPoint, unsigned int>& stake) const;
+    /** First block of the orphan chain hash belongs to */
+    uint256 GetRoot(const uint256& hash) const;
+    /** The missing block the orphan chain of hash waits for */
+    uint256 GetWanted(const uint256& hash) const;
+    /** Remove and return the orphans building on hashParent */
+    void TakeChildren(const uint256& hashParent, std::vector<COrphanBlock>& vChildren);
+    /** Evict orphans until both limits are met, returns the number evicted */
+    unsigned int Limit(size_t nMaxCount, size_t nMaxBytes);
+    size_t Size() const;
+};
+
+extern COrphanTxPool orphanTxPool;
+extern COrphanBlockPool orphanBlockPool;
+
+#endif // BITCOIN_ORPHANPOOL_H
@@ -0,0 +1,381 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PREVECTOR_H
+#define BITCOIN_PREVECTOR_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+
+#include <boost/type_traits/is_integral.hpp>
+
+#pragma pack(push, 1)
+/** Implements a drop-in replacement for std::vector<T> which stores up to N
+ *  elements directly (without heap allocation). The types Size and Diff are
+ *  used to store element counts, and can be any unsigned + signed type.
+ *
+ *  Storage layout is either:
+ *  - Direct allocation:
+ *    - Size _size: the number of used elements (between 0 and N)
+ *    - T direct[N]: an array of N elements of type T
+ *      (only the first _size are initialized).
+ *  - Indirect allocation:
+ *    - Size _size: the number of used elements plus N + 1
+ *    - Size capacity: the number of allocated elements
+ *    - T* indirect: a pointer to an array of capacity elements of type T
+ *      (only the first _size are initialized).
+ *
+ *  The data type T must be movable by memmove/realloc().
+ *
+ *  Iterators are plain pointers, and are invalidated by anything that changes
+ *  the size of the container, as well as by swap().
+ */
+template<unsigned int N, typename T, typename Size = uint32_t, typename Diff = int32_t>
+class prevector {
+public:
+    typedef Size size_type;
+    typedef Diff difference_type;
+    typedef T value_type;
+    typedef value_type& reference;
+    typedef const value_type& const_reference;
+    typedef value_type* pointer;
+    typedef const value_type* const_pointer;
+    typedef value_type* iterator;
+    typedef const value_type* const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+private:
+    size_type _size;
+    union direct_or_indirect {
+        char direct[sizeof(T) * N];
+        struct {
+            size_type capacity;
+            char* indirect;
+        } ind;
+    } _union;
+
+    T* direct_ptr(difference_type pos) { return reinterpret_cast<T*>(_union.direct) + pos; }
+    const T* direct_ptr(difference_type pos) const { return reinterpret_cast<const T*>(_union.direct) + pos; }
+    T* indirect_ptr(difference_type pos) { return reinterpret_cast<T*>(_union.ind.indirect) + pos; }
+    const T* indirect_ptr(difference_type pos) const { return reinterpret_cast<const T*>(_union.ind.indirect) + pos; }
+    bool is_direct() const { return _size <= N; }
+
+    void change_capacity(size_type new_capacity) {
+        if (new_capacity <= N) {
+            if (!is_direct()) {
+                T* indirect = indirect_ptr(0);
+                T* src = indirect;
+                T* dst = direct_ptr(0);
+                memcpy(dst, src, size() * sizeof(T));
+                free(indirect);
+                _size -= N + 1;
+            }
+        } else {
+            if (!is_direct()) {
+                _union.ind.indirect = static_cast<char*>(realloc(_union.ind.indirect, ((size_t)sizeof(T)) * new_capacity));
+                if (!_union.ind.indirect)
+                    throw std::bad_alloc();
+                _union.ind.capacity = new_capacity;
+            } else {
+                char* new_indirect = static_cast<char*>(malloc(((size_t)sizeof(T)) * new_capacity));
+                if (!new_indirect)
+                    throw std::bad_alloc();
+                T* src = direct_ptr(0);
+                T* dst = reinterpret_cast<T*>(new_indirect);
+                memcpy(dst, src, size() * sizeof(T));
+                _union.ind.indirect = new_indirect;
+                _union.ind.capacity = new_capacity;
+                _size += N + 1;
+            }
+        }
+    }
+
+    T* item_ptr(difference_type pos) { return is_direct() ? direct_ptr(pos) : indirect_ptr(pos); }
+    const T* item_ptr(difference_type pos) const { return is_direct() ? direct_ptr(pos) : indirect_ptr(pos); }
+
+    // Grow geometrically like std::vector, so repeated push_back stays amortized O(1)
+    void grow(size_type new_size) {
+        if (capacity() < new_size)
+            change_capacity(std::max(new_size, (size_type)(size() + (size() >> 1))));
+    }
+
+    template<typename InputIterator>
+    void assign_dispatch(InputIterator first, InputIterator last, const boost::false_type&) {
+        size_type n = std::distance(first, last);
+        clear();
+        if (capacity() < n)
+            change_capacity(n);
+        iterator dst = item_ptr(0);
+        while (first != last) {
+            new(static_cast<void*>(dst)) T(*first);
+            ++dst;
+            ++first;
+        }
+        _size += n;
+    }
+
+    template<typename Integral>
+    void assign_dispatch(Integral n, Integral val, const boost::true_type&) {
+        assign((size_type)n, (T)val);
+    }
+
+    template<typename InputIterator>
+    void insert_dispatch(iterator pos, InputIterator first, InputIterator last, const boost::false_type&) {
+        size_type p = pos - begin();
+        difference_type count = std::distance(first, last);
+        size_type new_size = size() + count;
+        grow(new_size);
+        T* ptr = item_ptr(p);
+        memmove(ptr + count, ptr, (size() - p) * sizeof(T));
+        _size += count;
+        while (first != last) {
+            new(static_cast<void*>(ptr)) T(*first);
+            ++ptr;
+            ++first;
+        }
+    }
+
+    template<typename Integral>
+    void insert_dispatch(iterator pos, Integral count, Integral value, const boost::true_type&) {
+        insert(pos, (size_type)count, (T)value);
+    }
+
+public:
+    void assign(size_type n, const T& val) {
+        clear();
+        if (capacity() < n)
+            change_capacity(n);
+        for (size_type i = 0; i < n; i++)
+            new(static_cast<void*>(item_ptr(i))) T(val);
+        _size += n;
+    }
+
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last) {
+        assign_dispatch(first, last, boost::is_integral<InputIterator>());
+    }
+
+    prevector() : _size(0) {}
+
+    explicit prevector(size_type n) : _size(0) {
+        resize(n);
+    }
+
+    explicit prevector(size_type n, const T& val) : _size(0) {
+        assign(n, val);
+    }
+
+    template<typename InputIterator>
+    prevector(InputIterator first, InputIterator last) : _size(0) {
+        assign(first, last);
+    }
+
+    prevector(const prevector<N, T, Size, Diff>& other) : _size(0) {
+        assign(other.begin(), other.end());
+    }
+
+    prevector& operator=(const prevector<N, T, Size, Diff>& other) {
+        if (&other == this)
+            return *this;
+        resize(0);
+        assign(other.begin(), other.end());
+        return *this;
+    }
+
+    size_type size() const {
+        return is_direct() ? _size : _size - N - 1;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    iterator begin() { return item_ptr(0); }
+    const_iterator begin() const { return item_ptr(0); }
+    iterator end() { return item_ptr(size()); }
+    const_iterator end() const { return item_ptr(size()); }
+
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    size_t capacity() const {
+        if (is_direct())
+            return N;
+        else
+            return _union.ind.capacity;
+    }
+
+    T& operator[](size_type pos) {
+        return *item_ptr(pos);
+    }
+
+    const T& operator[](size_type pos) const {
+        return *item_ptr(pos);
+    }
+
+    void resize(size_type new_size) {
+        size_type cur_size = size();
+        if (cur_size == new_size)
+            return;
+        if (cur_size > new_size) {
+            erase(item_ptr(new_size), end());
+            return;
+        }
+        if (new_size > capacity())
+            change_capacity(new_size);
+        difference_type increase = new_size - cur_size;
+        T* p = item_ptr(cur_size);
+        for (difference_type i = 0; i < increase; i++)
+            new(static_cast<void*>(p + i)) T();
+        _size += increase;
+    }
+
+    void reserve(size_type new_capacity) {
+        if (new_capacity > capacity())
+            change_capacity(new_capacity);
+    }
+
+    void shrink_to_fit() {
+        change_capacity(size());
+    }
+
+    void clear() {
+        resize(0);
+    }
+
+    iterator insert(iterator pos, const T& value) {
+        size_type p = pos - begin();
+        T copy(value);  // value may live in this container
+        grow(size() + 1);
+        T* ptr = item_ptr(p);
+        memmove(ptr + 1, ptr, (size() - p) * sizeof(T));
+        _size++;
+        new(static_cast<void*>(ptr)) T(copy);
+        return ptr;
+    }
+
+    void insert(iterator pos, size_type count, const T& value) {
+        size_type p = pos - begin();
+        T copy(value);
+        grow(size() + count);
+        T* ptr = item_ptr(p);
+        memmove(ptr + count, ptr, (size() - p) * sizeof(T));
+        _size += count;
+        for (size_type i = 0; i < count; i++)
+            new(static_cast<void*>(ptr + i)) T(copy);
+    }
+
+    /** Like std::vector, [first, last) must not point into this container */
+    template<typename InputIterator>
+    void insert(iterator pos, InputIterator first, InputIterator last) {
+        insert_dispatch(pos, first, last, boost::is_integral<InputIterator>());
+    }
+
+    iterator erase(iterator pos) {
+        return erase(pos, pos + 1);
+    }
+
+    iterator erase(iterator first, iterator last) {
+        iterator p = first;
+        char* endp = (char*)end();
+        while (p != last) {
+            (*p).~T();
+            _size--;
+            ++p;
+        }
+        memmove(first, last, endp - ((char*)last));
+        return first;
+    }
+
+    void push_back(const T& value) {
+        T copy(value);
+        grow(size() + 1);
+        new(static_cast<void*>(item_ptr(size()))) T(copy);
+        _size++;
+    }
+
+    void pop_back() {
+        erase(end() - 1, end());
+    }
+
+    T& front() {
+        return *item_ptr(0);
+    }
+
+    const T& front() const {
+        return *item_ptr(0);
+    }
+
+    T& back() {
+        return *item_ptr(size() - 1);
+    }
+
+    const T& back() const {
+        return *item_ptr(size() - 1);
+    }
+
+    void swap(prevector<N, T, Size, Diff>& other) {
+        std::swap(_union, other._union);
+        std::swap(_size, other._size);
+    }
+
+    ~prevector() {
+        clear();
+        if (!is_direct()) {
+            free(_union.ind.indirect);
+            _union.ind.indirect = NULL;
+        }
+    }
+
+    bool operator==(const prevector<N, T, Size, Diff>& other) const {
+        if (other.size() != size())
+            return false;
+        const_iterator b1 = begin();
+        const_iterator b2 = other.begin();
+        const_iterator e1 = end();
+        while (b1 != e1) {
+            if ((*b1) != (*b2))
+                return false;
+            ++b1;
+            ++b2;
+        }
+        return true;
+    }
+
+    bool operator!=(const prevector<N, T, Size, Diff>& other) const {
+        return !(*this == other);
+    }
+
+    bool operator<(const prevector<N, T, Size, Diff>& other) const {
+        return std::lexicographical_compare(begin(), end(), other.begin(), other.end());
+    }
+
+    /** Heap memory used, 0 while the elements fit inline */
+    size_t allocated_memory() const {
+        if (is_direct())
+            return 0;
+        else
+            return ((size_t)(sizeof(T))) * _union.ind.capacity;
+    }
+
+    value_type* data() {
+        return item_ptr(0);
+    }
+
+    const value_type* data() const {
+        return item_ptr(0);
+    }
+};
+#pragma pack(pop)
+
+#endif // BITCOIN_PREVECTOR_H
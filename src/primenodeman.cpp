@@ -5,6 +5,7 @@
 #include "core.h"
 #include "util.h"
 #include "addrman.h"
+#include "ui_interface.h"
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 
@@ -189,6 +190,22 @@ void DumpPrimenodes()
 
 CPrimenodeMan::CPrimenodeMan() {
     nDsqCount = 0;
+    nNotifiedEnabled = -1;
+    nNotifiedTotal = -1;
+}
+
+void CPrimenodeMan::NotifyCountChanged()
+{
+    AssertLockHeld(cs);
+
+    int nEnabled = CountEnabled();
+    int nTotal = size();
+    if (nEnabled == nNotifiedEnabled && nTotal == nNotifiedTotal)
+        return;
+
+    nNotifiedEnabled = nEnabled;
+    nNotifiedTotal = nTotal;
+    uiInterface.NotifyPrimenodeListChanged(nEnabled, nTotal);
 }
 
 bool CPrimenodeMan::Add(CPrimenode &mn)
@@ -201,6 +218,7 @@ bool CPrimenodeMan::Add(CPrimenode &mn)
     {
         LogPrint("primenode", "CPrimenodeMan: Adding new primenode %s - %i now\n", mn.addr.ToString().c_str(), size() + 1);
         vPrimenodes.push_back(mn);
+        NotifyCountChanged();
         return true;
     }
 
@@ -279,6 +297,8 @@ void CPrimenodeMan::CheckAndRemove()
         }
     }
 
+    NotifyCountChanged();
+
 }
 
 void CPrimenodeMan::Clear()
@@ -289,6 +309,7 @@ void CPrimenodeMan::Clear()
     mWeAskedForPrimenodeList.clear();
     mWeAskedForPrimenodeListEntry.clear();
     nDsqCount = 0;
+    NotifyCountChanged();
 }
 
 int CPrimenodeMan::CountEnabled(int protocolVersion)
@@ -712,7 +733,9 @@ void CPrimenodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataS
         //  - this is expensive, so it's only done once per primenode
         if(!darkSendSigner.IsVinAssociatedWithPubkey(vin, pubkey)) {
             LogPrintf("dsee - Got mismatched pubkey and vin\n");
-            Misbehaving(pfrom->GetId(), 100);
+            // with pruned block files the collateral may simply be unreadable here
+            if(!HavePrunedBlockFiles())
+                Misbehaving(pfrom->GetId(), 100);
             return;
         }
 
@@ -744,8 +767,8 @@ void CPrimenodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataS
             // verify that sig time is legit in past
             // should be at least not earlier than block when 10000 TansferCoin tx got PRIMENODE_MIN_CONFIRMATIONS
             uint256 hashBlock = 0;
-            GetTransaction(vin.prevout.hash, tx, hashBlock);
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+            GetTransactionOutputs(vin.prevout.hash, tx, hashBlock);
+            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
             if (mi != mapBlockIndex.end() && (*mi).second)
             {
                 CBlockIndex* pMNIndex = (*mi).second; // block for 10000 TansferCoin tx -> 1 confirmation
@@ -922,7 +945,9 @@ void CPrimenodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataS
         //  - this is expensive, so it's only done once per primenode
         if(!darkSendSigner.IsVinAssociatedWithPubkey(vin, pubkey)) {
             LogPrintf("dsee+ - Got mismatched pubkey and vin\n");
-            Misbehaving(pfrom->GetId(), 100);
+            // with pruned block files the collateral may simply be unreadable here
+            if(!HavePrunedBlockFiles())
+                Misbehaving(pfrom->GetId(), 100);
             return;
         }
 
@@ -954,8 +979,8 @@ void CPrimenodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataS
             // verify that sig time is legit in past
             // should be at least not earlier than block when 10000 TansferCoin tx got PRIMENODE_MIN_CONFIRMATIONS
             uint256 hashBlock = 0;
-            GetTransaction(vin.prevout.hash, tx, hashBlock);
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+            GetTransactionOutputs(vin.prevout.hash, tx, hashBlock);
+            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
            if (mi != mapBlockIndex.end() && (*mi).second)
             {
                 CBlockIndex* pMNIndex = (*mi).second; // block for 10000 TansferCoin tx -> 1 confirmation
@@ -1206,6 +1231,7 @@ void CPrimenodeMan::Remove(CTxIn vin)
         if((*it).vin == vin){
             LogPrint("primenode", "CPrimenodeMan: Removing Primenode %s - %i now\n", (*it).addr.ToString().c_str(), size() - 1);
             vPrimenodes.erase(it);
+            NotifyCountChanged();
             break;
         } else {
             ++it;
@@ -66,6 +66,12 @@ private:
     std::map<CNetAddr, int64_t> mWeAskedForPrimenodeList;
     // which primenodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForPrimenodeListEntry;
+    // counts last sent to NotifyPrimenodeListChanged
+    int nNotifiedEnabled;
+    int nNotifiedTotal;
+
+    // Tell the UI when the number of enabled or known primenodes changed, cs must be held
+    void NotifyCountChanged();
 
 public:
     // keep track of dsq count to prevent primenodes from gaming darksend queue
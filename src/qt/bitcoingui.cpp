@@ -865,6 +865,9 @@ void BitcoinGUI::incomingTransaction(const QModelIndex & parent, int start, int
         return;
 
     TransactionTableModel *ttm = walletModel->getTransactionTableModel();
+    // Rows inserted while the wallet is being loaded are not new
+    if(ttm->isLoading())
+        return;
 
     qint64 amount = ttm->index(start, TransactionTableModel::Amount, parent)
                     .data(Qt::EditRole).toULongLong();    
@@ -27,20 +27,28 @@ ClientModel::ClientModel(OptionsModel *optionsModel, QObject *parent) :
     cachedNumBlocks(0),
     numBlocksAtStartup(-1),
     cachedPrimenodeCountString(""),
+    nTipHeight(0),
+    nTipTime(0),
+    fTipUpdateQueued(false),
     pollTimer(0)
 {
     peerTableModel = new PeerTableModel(this);
     banTableModel = new BanTableModel(this);
+
+    // Later blocks are pushed by the core through NotifyBlockTip
+    {
+        LOCK(cs_main);
+        nTipHeight = nBestHeight;
+        nTipTime = pindexBest ? pindexBest->GetBlockTime() : Params().GenesisBlock().nTime;
+    }
+    cachedNumBlocks = nTipHeight;
+
+    // Traffic counters have no notification, poll them
     pollTimer = new QTimer(this);
     pollTimer->setInterval(MODEL_UPDATE_DELAY);
     pollTimer->start();
     connect(pollTimer, SIGNAL(timeout()), this, SLOT(updateTimer()));
 
-    pollMnTimer = new QTimer(this);
-    connect(pollMnTimer, SIGNAL(timeout()), this, SLOT(updateMnTimer()));
-    // no need to update as frequent as data for balances/txes/blocks
-    pollMnTimer->start(MODEL_UPDATE_DELAY * 4);
-
     subscribeToCoreSignals();
 }
 
@@ -61,8 +69,8 @@ QString ClientModel::getPrimenodeCountString() const
 
 int ClientModel::getNumBlocks() const
 {
-    LOCK(cs_main);
-    return nBestHeight;
+    LOCK(cs_tip);
+    return nTipHeight;
 }
 
 int ClientModel::getNumBlocksAtStartup()
@@ -83,25 +91,34 @@ quint64 ClientModel::getTotalBytesSent() const
 
 QDateTime ClientModel::getLastBlockDate() const
 {
-    LOCK(cs_main);
-    if (pindexBest)
-        return QDateTime::fromTime_t(pindexBest->GetBlockTime());
-    else
-        return QDateTime::fromTime_t(Params().GenesisBlock().nTime); // Genesis block's time of current network
+    LOCK(cs_tip);
+    return QDateTime::fromTime_t(nTipTime);
 }
 
+bool ClientModel::setBlockTip(int nHeight, int64_t nBlockTime)
+{
+    LOCK(cs_tip);
+    nTipHeight = nHeight;
+    nTipTime = nBlockTime;
+    if (fTipUpdateQueued)
+        return false;
+    fTipUpdateQueued = true;
+    return true;
+}
 
 void ClientModel::updateTimer()
 {
-    // Get required lock upfront. This avoids the GUI from getting stuck on
-    // periodical polls if the core is holding the locks for a longer time -
-    // for example, during a wallet rescan.
-    TRY_LOCK(cs_main, lockMain);
-    if(!lockMain)
-        return;
-    // Some quantities (such as number of blocks) change so fast that we don't want to be notified for each change.
-    // Periodically check and update with a timer.
-    int newNumBlocks = getNumBlocks();
+    emit bytesChanged(getTotalBytesRecv(), getTotalBytesSent());
+}
+
+void ClientModel::updateNumBlocks()
+{
+    int newNumBlocks;
+    {
+        LOCK(cs_tip);
+        fTipUpdateQueued = false;
+        newNumBlocks = nTipHeight;
+    }
 
     if(cachedNumBlocks != newNumBlocks)
     {
@@ -109,19 +126,11 @@ void ClientModel::updateTimer()
 
         emit numBlocksChanged(newNumBlocks);
     }
-
-    emit bytesChanged(getTotalBytesRecv(), getTotalBytesSent());
 }
 
-void ClientModel::updateMnTimer()
+void ClientModel::updatePrimenodeCount(int nEnabled, int nTotal)
 {
-    // Get required lock upfront. This avoids the GUI from getting stuck on
-    // periodical polls if the core is holding the locks for a longer time -
-    // for example, during a wallet rescan.
-    TRY_LOCK(cs_main, lockMain);
-    if(!lockMain)
-        return;
-    QString newPrimenodeCountString = getPrimenodeCountString();
+    QString newPrimenodeCountString = QString::number(nEnabled) + " / " + QString::number(nTotal);
 
     if (cachedPrimenodeCountString != newPrimenodeCountString)
     {
@@ -242,6 +251,20 @@ static void NotifyAlertChanged(ClientModel *clientmodel, const uint256 &hash, Ch
                               Q_ARG(int, status));
 }
 
+static void NotifyBlockTip(ClientModel *clientmodel, int nHeight, int64_t nBlockTime)
+{
+    // Blocks come in quickly during sync, keep at most one update queued
+    if (clientmodel->setBlockTip(nHeight, nBlockTime))
+        QMetaObject::invokeMethod(clientmodel, "updateNumBlocks", Qt::QueuedConnection);
+}
+
+static void NotifyPrimenodeListChanged(ClientModel *clientmodel, int nEnabled, int nTotal)
+{
+    QMetaObject::invokeMethod(clientmodel, "updatePrimenodeCount", Qt::QueuedConnection,
+                              Q_ARG(int, nEnabled),
+                              Q_ARG(int, nTotal));
+}
+
 static void BannedListChanged(ClientModel *clientmodel)
 {
     qDebug() << QString("%1: Requesting update for peer banlist").arg(__func__);
@@ -254,6 +277,8 @@ void ClientModel::subscribeToCoreSignals()
     uiInterface.ShowProgress.connect(boost::bind(ShowProgress, this, _1, _2));
     uiInterface.NotifyNumConnectionsChanged.connect(boost::bind(NotifyNumConnectionsChanged, this, _1));
     uiInterface.NotifyAlertChanged.connect(boost::bind(NotifyAlertChanged, this, _1, _2));
+    uiInterface.NotifyBlockTip.connect(boost::bind(NotifyBlockTip, this, _1, _2));
+    uiInterface.NotifyPrimenodeListChanged.connect(boost::bind(NotifyPrimenodeListChanged, this, _1, _2));
 }
 
 void ClientModel::unsubscribeFromCoreSignals()
@@ -262,5 +287,7 @@ void ClientModel::unsubscribeFromCoreSignals()
     uiInterface.ShowProgress.disconnect(boost::bind(ShowProgress, this, _1, _2));
     uiInterface.NotifyNumConnectionsChanged.disconnect(boost::bind(NotifyNumConnectionsChanged, this, _1));
     uiInterface.NotifyAlertChanged.disconnect(boost::bind(NotifyAlertChanged, this, _1, _2));
+    uiInterface.NotifyBlockTip.disconnect(boost::bind(NotifyBlockTip, this, _1, _2));
+    uiInterface.NotifyPrimenodeListChanged.disconnect(boost::bind(NotifyPrimenodeListChanged, this, _1, _2));
     uiInterface.BannedListChanged.disconnect(boost::bind(BannedListChanged, this));
 }
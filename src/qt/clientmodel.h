@@ -3,6 +3,10 @@
 
 #include <QObject>
 
+#include "sync.h"
+
+#include <stdint.h>
+
 class OptionsModel;
 class AddressTableModel;
 class BanTableModel;
@@ -53,6 +57,9 @@ public:
     QString clientName() const;
     QString formatClientStartupTime() const;
 
+    //! Record a new best block from the core, true if no update is queued for it yet
+    bool setBlockTip(int nHeight, int64_t nBlockTime);
+
 private:
     OptionsModel *optionsModel;
     PeerTableModel *peerTableModel;
@@ -62,8 +69,13 @@ private:
     int numBlocksAtStartup;
     QString cachedPrimenodeCountString;
 
+    // Best block as last pushed by the core, so the GUI never needs cs_main for it
+    mutable CCriticalSection cs_tip;
+    int nTipHeight;
+    int64_t nTipTime;
+    bool fTipUpdateQueued;
+
     QTimer *pollTimer;
-    QTimer *pollMnTimer;
 
     void subscribeToCoreSignals();
     void unsubscribeFromCoreSignals();
@@ -83,7 +95,8 @@ signals:
 
 public slots:
     void updateTimer();
-    void updateMnTimer();
+    void updateNumBlocks();
+    void updatePrimenodeCount(int nEnabled, int nTotal);
     void updateNumConnections(int numConnections);
     void updateAlert(const QString &hash, int status);
     void updateBanlist();
@@ -88,4 +88,7 @@ void DarksendConfig::configure(bool enabled, int coins, int rounds) {
 
     nDarksendRounds = rounds;
     nAnonymizeParlayAmount = coins;
+
+    if (model)
+        model->updateDarksendRounds();
 }
@@ -140,17 +140,9 @@ QList<TransactionRecord> TransactionRecord::decomposeTransaction(const CWallet *
             if(mapValue["DS"] == "1")
             {
                 sub.type = TransactionRecord::Darksent;
-                CTxDestination address;
-                if (ExtractDestination(wtx.vout[0].scriptPubKey, address))
-                {
-                    // Sent to Dash Address
-                    sub.address = CParlayAddress(address).ToString();
-                }
-                else
-                {
-                    // Sent to IP, or other non-address transaction like OP_EVAL
+                // Sent to Dash Address, or else to IP, or other non-address transaction like OP_EVAL
+                if (!ExtractAddressString(wtx.vout[0].scriptPubKey, sub.address))
                     sub.address = mapValue["to"];
-                }
             }
             else
             {
@@ -194,12 +186,10 @@ QList<TransactionRecord> TransactionRecord::decomposeTransaction(const CWallet *
                     continue;
                 }
 
-                CTxDestination address;
-                if (ExtractDestination(txout.scriptPubKey, address))
+                if (ExtractAddressString(txout.scriptPubKey, sub.address))
                 {
                     // Sent to Bitcoin Address
                     sub.type = TransactionRecord::SendToAddress;
-                    sub.address = CParlayAddress(address).ToString();
                 }
                 else
                 {
@@ -244,7 +234,7 @@ void TransactionRecord::updateStatus(const CWalletTx &wtx)
 
     // Find the block the tx is in
     CBlockIndex* pindex = NULL;
-    std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(wtx.hashBlock);
     if (mi != mapBlockIndex.end())
         pindex = (*mi).second;
 
@@ -329,6 +319,21 @@ bool TransactionRecord::statusUpdateNeeded()
     return status.cur_num_blocks != nBestHeight || status.cur_num_ix_locks != nCompleteTXLocks;
 }
 
+bool TransactionRecord::statusSettled() const
+{
+    // Confirmed means past the recommended depth, or mature for generated transactions
+    return status.status == TransactionStatus::Confirmed && status.depth > 0;
+}
+
+void TransactionRecord::updateDepth(int numBlocks)
+{
+    if (numBlocks > status.cur_num_blocks)
+    {
+        status.depth += numBlocks - status.cur_num_blocks;
+        status.cur_num_blocks = numBlocks;
+    }
+}
+
 QString TransactionRecord::getTxID() const
 {
     return formatSubTxId(hash, idx);
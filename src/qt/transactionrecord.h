@@ -17,7 +17,8 @@ class TransactionStatus
 public:
     TransactionStatus():
         countsForBalance(false), sortKey(""),
-        matures_in(0), status(Offline), depth(0), open_for(0), cur_num_blocks(-1)
+        matures_in(0), status(Offline), depth(0), open_for(0), cur_num_blocks(-1),
+        cur_num_ix_locks(-1)
     { }
 
     enum Status {
@@ -143,6 +144,15 @@ public:
     /** Return whether a status update is needed.
      */
     bool statusUpdateNeeded();
+
+    /** Return whether the status can no longer change other than by getting deeper.
+     */
+    bool statusSettled() const;
+
+    /** Advance the depth of a settled status to a new number of blocks, without
+        asking the core.
+     */
+    void updateDepth(int numBlocks);
 };
 
 #endif // TRANSACTIONRECORD_H
@@ -17,6 +17,10 @@
 #include <QIcon>
 #include <QDateTime>
 #include <QDebug>
+#include <QPair>
+#include <QTimer>
+
+#include <set>
 
 // Amount column is right-aligned it contains numbers
 static int column_alignments[] = {
@@ -45,13 +49,18 @@ struct TxLessThan
     }
 };
 
+// Number of wallet transactions decomposed per step of the initial load
+static const unsigned int LOAD_BATCH_SIZE = 1000;
+
 // Private implementation
 class TransactionTablePriv
 {
 public:
     TransactionTablePriv(CWallet *wallet, TransactionTableModel *parent) :
         wallet(wallet),
-        parent(parent)
+        parent(parent),
+        nLoadPos(0),
+        cachedNumBlocks(-1)
     {
     }
 
@@ -64,20 +73,116 @@ public:
      */
     QList<TransactionRecord> cachedWallet;
 
-    /* Query entire wallet anew from core.
+    /* Wallet transactions still to be decomposed into the model, sorted by sha256,
+     * and the position of the next one.
+     */
+    std::vector<uint256> vLoadQueue;
+    size_t nLoadPos;
+
+    /* Transactions in the model whose status can still change other than by depth.
+     * Only these are refreshed and re-sorted when blocks come in.
+     */
+    std::set<uint256> setUnsettled;
+
+    /* Number of blocks the model last heard of, to advance settled records */
+    int cachedNumBlocks;
+
+    /* Query entire wallet anew from core. Only the transaction hashes are taken
+     * here, loadBatch() decomposes them into the model a batch at a time.
      */
     void refreshWallet()
     {
         qDebug() << "TransactionTablePriv::refreshWallet";
         cachedWallet.clear();
+        setUnsettled.clear();
+        vLoadQueue.clear();
+        nLoadPos = 0;
         {
-            LOCK2(cs_main, wallet->cs_wallet);
+            LOCK(wallet->cs_wallet);
+            vLoadQueue.reserve(wallet->mapWallet.size());
             for(std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+                vLoadQueue.push_back(it->first);
+        }
+    }
+
+    bool loading() const
+    {
+        return !vLoadQueue.empty();
+    }
+
+    bool inModel(const uint256 &hash)
+    {
+        QList<TransactionRecord>::iterator lower = qLowerBound(
+            cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
+        return lower != cachedWallet.end() && lower->hash == hash;
+    }
+
+    /* Decompose a wallet transaction with its current status.
+     */
+    QList<TransactionRecord> decompose(const CWalletTx &wtx)
+    {
+        QList<TransactionRecord> records = TransactionRecord::decomposeTransaction(wallet, wtx);
+        for(int i = 0; i < records.size(); ++i)
+        {
+            records[i].updateStatus(wtx);
+            if(!records[i].statusSettled())
+                setUnsettled.insert(records[i].hash);
+        }
+        return records;
+    }
+
+    /* Insert records, sorted by sha256, at their positions in the model.
+     * Records going to the same position are inserted as one block of rows.
+     */
+    void insertRecords(const QList<TransactionRecord> &toInsert)
+    {
+        int i = 0;
+        while(i < toInsert.size())
+        {
+            int pos = qLowerBound(cachedWallet.begin(), cachedWallet.end(), toInsert[i].hash, TxLessThan()) - cachedWallet.begin();
+            int end = i + 1;
+            while(end < toInsert.size() && (pos == cachedWallet.size() || toInsert[end].hash < cachedWallet[pos].hash))
+                ++end;
+
+            parent->beginInsertRows(QModelIndex(), pos, pos+end-i-1);
+            for(int insert_idx = pos; i < end; ++i, ++insert_idx)
+                cachedWallet.insert(insert_idx, toInsert[i]);
+            parent->endInsertRows();
+        }
+    }
+
+    /* Decompose the next batch of the initial load into the model. Returns false
+     * if the core is busy and the batch should be retried later.
+     */
+    bool loadBatch()
+    {
+        QList<TransactionRecord> toInsert;
+        {
+            TRY_LOCK(cs_main, lockMain);
+            if(!lockMain)
+                return false;
+            TRY_LOCK(wallet->cs_wallet, lockWallet);
+            if(!lockWallet)
+                return false;
+
+            cachedNumBlocks = nBestHeight;
+            size_t nEnd = std::min(nLoadPos + LOAD_BATCH_SIZE, vLoadQueue.size());
+            for(; nLoadPos < nEnd; ++nLoadPos)
             {
-                if(TransactionRecord::showTransaction(it->second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                const uint256 &hash = vLoadQueue[nLoadPos];
+                // Already added by a notification that came in while loading
+                if(inModel(hash))
+                    continue;
+                std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
+                if(mi == wallet->mapWallet.end() || !TransactionRecord::showTransaction(mi->second))
+                    continue;
+                toInsert.append(decompose(mi->second));
             }
         }
+        insertRecords(toInsert);
+        if(nLoadPos == vLoadQueue.size())
+            std::vector<uint256>().swap(vLoadQueue);
+        return true;
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -120,17 +225,19 @@ public:
             }
             if(showTransaction)
             {
-                LOCK2(cs_main, wallet->cs_wallet);
-                // Find transaction in wallet
-                std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
-                if(mi == wallet->mapWallet.end())
+                QList<TransactionRecord> toInsert;
                 {
-                    qWarning() << "TransactionTablePriv::updateWallet : Warning: Got CT_NEW, but transaction is not in wallet";
-                    break;
+                    LOCK2(cs_main, wallet->cs_wallet);
+                    // Find transaction in wallet
+                    std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
+                    if(mi == wallet->mapWallet.end())
+                    {
+                        qWarning() << "TransactionTablePriv::updateWallet : Warning: Got CT_NEW, but transaction is not in wallet";
+                        break;
+                    }
+                    toInsert = decompose(mi->second);
                 }
                 // Added -- insert at the right position
-                QList<TransactionRecord> toInsert =
-                        TransactionRecord::decomposeTransaction(wallet, mi->second);
                 if(!toInsert.isEmpty()) /* only if something to insert */
                 {
                     parent->beginInsertRows(QModelIndex(), lowerIndex, lowerIndex+toInsert.size()-1);
@@ -153,15 +260,83 @@ public:
             // Removed -- remove entire transaction from table
             parent->beginRemoveRows(QModelIndex(), lowerIndex, upperIndex-1);
             cachedWallet.erase(lower, upper);
+            setUnsettled.erase(hash);
             parent->endRemoveRows();
             break;
         case CT_UPDATED:
-            // Miscellaneous updates -- nothing to do, status update will take care of this, and is only computed for
-            // visible transactions.
+            // Miscellaneous updates -- the transaction may have been confirmed, conflicted or
+            // abandoned, so refresh its status now rather than waiting for the next block.
+            if(inModel)
+            {
+                {
+                    LOCK2(cs_main, wallet->cs_wallet);
+                    std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
+                    if(mi == wallet->mapWallet.end())
+                        break;
+                    for(QList<TransactionRecord>::iterator it = lower; it != upper; ++it)
+                    {
+                        it->updateStatus(mi->second);
+                        if(!it->statusSettled())
+                            setUnsettled.insert(hash);
+                    }
+                }
+                parent->emitRowsChanged(lowerIndex, upperIndex-1);
+            }
             break;
         }
     }
 
+    /* Blocks or transaction locks came in. Refresh the status of the unsettled
+     * transactions and append the ranges of rows that changed, in order.
+     * Returns false if the core held the locks, nothing was refreshed then.
+     */
+    bool updateConfirmations(QList<QPair<int, int> > &ranges)
+    {
+        TRY_LOCK(cs_main, lockMain);
+        if(!lockMain)
+            return false;
+        TRY_LOCK(wallet->cs_wallet, lockWallet);
+        if(!lockWallet)
+            return false;
+
+        cachedNumBlocks = nBestHeight;
+        std::set<uint256>::iterator it = setUnsettled.begin();
+        while(it != setUnsettled.end())
+        {
+            QList<TransactionRecord>::iterator lower = qLowerBound(
+                cachedWallet.begin(), cachedWallet.end(), *it, TxLessThan());
+            QList<TransactionRecord>::iterator upper = qUpperBound(
+                cachedWallet.begin(), cachedWallet.end(), *it, TxLessThan());
+            std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(*it);
+            if(lower == upper || mi == wallet->mapWallet.end())
+            {
+                setUnsettled.erase(it++);
+                continue;
+            }
+
+            bool fSettled = true;
+            for(QList<TransactionRecord>::iterator rec = lower; rec != upper; ++rec)
+            {
+                rec->updateStatus(mi->second);
+                fSettled = fSettled && rec->statusSettled();
+            }
+
+            // setUnsettled is sorted like the model, so rows only need merging with the last range
+            int first = lower - cachedWallet.begin();
+            int last = upper - cachedWallet.begin() - 1;
+            if(!ranges.isEmpty() && ranges.back().second + 1 == first)
+                ranges.back().second = last;
+            else
+                ranges.append(qMakePair(first, last));
+
+            if(fSettled)
+                setUnsettled.erase(it++);
+            else
+                ++it;
+        }
+        return true;
+    }
+
     int size()
     {
         return cachedWallet.size();
@@ -173,6 +348,14 @@ public:
         {
             TransactionRecord *rec = &cachedWallet[idx];
 
+            // Settled transactions only get deeper as blocks come in, so their
+            // cached status is advanced from the number of blocks alone.
+            if(rec->statusSettled())
+            {
+                rec->updateDepth(cachedNumBlocks);
+                return rec;
+            }
+
             // Get required locks upfront. This avoids the GUI from getting
             // stuck if the core is holding the locks for a longer time - for
             // example, during a wallet rescan.
@@ -223,6 +406,7 @@ TransactionTableModel::TransactionTableModel(CWallet* wallet, WalletModel *paren
     columns << QString() <<  QString() << tr("Date") << tr("Type") << tr("Address") << BitcoinUnits::getAmountColumnTitle(walletModel->getOptionsModel()->getDisplayUnit());
 
     priv->refreshWallet();
+    loadTransactions();
 
     connect(walletModel->getOptionsModel(), SIGNAL(displayUnitChanged(int)), this, SLOT(updateDisplayUnit()));
 
@@ -242,6 +426,11 @@ void TransactionTableModel::updateAmountColumnTitle()
 	emit headerDataChanged(Qt::Horizontal,Amount,Amount);
 }
 
+void TransactionTableModel::setProcessingQueuedTransactions(bool value)
+{
+    walletModel->setProcessingQueuedTransactions(value);
+}
+
 void TransactionTableModel::updateTransaction(const QString &hash, int status, bool showTransaction)
 {
     uint256 updated;
@@ -250,14 +439,43 @@ void TransactionTableModel::updateTransaction(const QString &hash, int status, b
     priv->updateWallet(updated, status, showTransaction);
 }
 
+void TransactionTableModel::loadTransactions()
+{
+    // Decompose the wallet a batch at a time, so the GUI stays responsive while
+    // large wallets load. Back off while the core holds the locks.
+    if(!priv->loadBatch())
+        QTimer::singleShot(MODEL_UPDATE_DELAY, this, SLOT(loadTransactions()));
+    else if(priv->loading())
+        QTimer::singleShot(0, this, SLOT(loadTransactions()));
+}
+
+bool TransactionTableModel::isLoading() const
+{
+    return priv->loading();
+}
+
 void TransactionTableModel::updateConfirmations()
 {
-    // Blocks came in since last poll.
-    // Invalidate status (number of confirmations) and (possibly) description
-    //  for all rows. Qt is smart enough to only actually request the data for the
-    //  visible rows.
-    emit dataChanged(index(0, Status), index(priv->size()-1, Status));
-    emit dataChanged(index(0, ToAddress), index(priv->size()-1, ToAddress));
+    // Blocks came in.
+    // Only transactions that have not settled yet can change status, so only
+    // their rows are invalidated and re-sorted by the filter proxies. Settled
+    // rows just get deeper, views pick that up when they repaint.
+    // The tip notification is sent while the core holds cs_main, so try again
+    // shortly when the locks are taken.
+    QList<QPair<int, int> > ranges;
+    if(!priv->updateConfirmations(ranges))
+    {
+        QTimer::singleShot(MODEL_UPDATE_DELAY, this, SLOT(updateConfirmations()));
+        return;
+    }
+    for(int i = 0; i < ranges.size(); ++i)
+        emitRowsChanged(ranges[i].first, ranges[i].second);
+    emit confirmationsChanged();
+}
+
+void TransactionTableModel::emitRowsChanged(int first, int last)
+{
+    emit dataChanged(index(first, 0), index(last, columns.length()-1));
 }
 
 int TransactionTableModel::rowCount(const QModelIndex &parent) const
@@ -650,7 +868,7 @@ QModelIndex TransactionTableModel::index(int row, int column, const QModelIndex
     TransactionRecord *data = priv->index(row);
     if(data)
     {
-        return createIndex(row, column, priv->index(row));
+        return createIndex(row, column, data);
     }
     return QModelIndex();
 }
@@ -65,6 +65,8 @@ public:
     QVariant data(const QModelIndex &index, int role) const;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
     QModelIndex index(int row, int column, const QModelIndex & parent = QModelIndex()) const;
+    /** Whether the wallet is still being loaded into the model */
+    bool isLoading() const;
 
 private:
     CWallet* wallet;
@@ -86,6 +88,14 @@ private:
     QVariant txStatusDecoration(const TransactionRecord *wtx) const;
     QVariant txWatchonlyDecoration(const TransactionRecord *wtx) const;
     QVariant txAddressDecoration(const TransactionRecord *wtx) const;
+    void emitRowsChanged(int first, int last);
+
+signals:
+    /** Blocks came in, settled rows got deeper without a dataChanged */
+    void confirmationsChanged();
+
+private slots:
+    void loadTransactions();
 
 public slots:
     /* New transaction, or transaction changed status */
@@ -94,6 +104,8 @@ public slots:
     void updateDisplayUnit();
     /** Updates the column title to "Amount (DisplayUnit)" and emits headerDataChanged() signal for table headers to react. */
     void updateAmountColumnTitle();
+    /* Needed to update the wallet model's fProcessingQueuedTransactions in order with the queued notifications */
+    void setProcessingQueuedTransactions(bool value);
 
     friend class TransactionTablePriv;
 };
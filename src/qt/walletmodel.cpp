@@ -25,28 +25,27 @@
 
 #include <QDebug>
 #include <QSet>
-#include <QTimer>
 
 using namespace std;
 
+Q_DECLARE_METATYPE(CWalletBalances)
+
 WalletModel::WalletModel(CWallet *wallet, OptionsModel *optionsModel, QObject *parent) :
     QObject(parent), wallet(wallet),
     fProcessingQueuedTransactions(false),
+    fBlockTipUpdateQueued(false),
     optionsModel(optionsModel), addressTableModel(0), transactionTableModel(0),
-    cachedBalance(0), cachedStake(0), cachedUnconfirmedBalance(0), cachedImmatureBalance(0),
-    cachedEncryptionStatus(Unencrypted),
-    cachedNumBlocks(0)
+    cachedEncryptionStatus(Unencrypted)
 {
     fHaveWatchOnly = wallet->HaveWatchOnly();
-    fForceCheckBalanceChanged = false;
+    // Start from what the pages show, so the first push is compared with real amounts
+    wallet->GetBalances(cachedBalances);
 
     addressTableModel = new AddressTableModel(wallet, this);
     transactionTableModel = new TransactionTableModel(wallet, this);
 
-    // This timer will be fired repeatedly to update the balance
-    pollTimer = new QTimer(this);
-    connect(pollTimer, SIGNAL(timeout()), this, SLOT(pollBalanceChanged()));
-    pollTimer->start(MODEL_UPDATE_DELAY);
+    // Balances, blocks and darksend settings are pushed, nothing is polled
+    connect(optionsModel, SIGNAL(darksendRoundsChanged(int)), this, SLOT(updateDarksendRounds()));
 
     subscribeToCoreSignals();
 }
@@ -127,75 +126,33 @@ void WalletModel::updateStatus()
         emit encryptionStatusChanged(newEncryptionStatus);
 }
 
-void WalletModel::pollBalanceChanged()
+bool WalletModel::queueBlockTipUpdate()
 {
-    // Get required locks upfront. This avoids the GUI from getting stuck on
-    // periodical polls if the core is holding the locks for a longer time -
-    // for example, during a wallet rescan.
-    TRY_LOCK(cs_main, lockMain);
-    if(!lockMain)
-        return;
-    TRY_LOCK(wallet->cs_wallet, lockWallet);
-    if(!lockWallet)
-        return;
-
-    if(fForceCheckBalanceChanged || nBestHeight != cachedNumBlocks || nDarksendRounds != cachedDarksendRounds || cachedTxLocks != nCompleteTXLocks)
-    {
-        fForceCheckBalanceChanged = false;
+    return !fBlockTipUpdateQueued.exchange(true);
+}
 
-        // Balance and number of transactions might have changed
-        cachedNumBlocks = nBestHeight;
-        cachedDarksendRounds = nDarksendRounds;
+void WalletModel::updateBlockTip()
+{
+    fBlockTipUpdateQueued = false;
 
-        checkBalanceChanged();
-        if(transactionTableModel)
-            transactionTableModel->updateConfirmations();
-    }
+    // Confirmations changed, the balances follow from the wallet
+    if(transactionTableModel)
+        transactionTableModel->updateConfirmations();
 }
 
-void WalletModel::checkBalanceChanged()
+void WalletModel::updateBalances(const CWalletBalances &balances)
 {
-    TRY_LOCK(cs_main, lockMain);
-    if(!lockMain) return;
-
-    CAmount newBalance = getBalance();
-    CAmount newStake = getStake();
-    CAmount newUnconfirmedBalance = getUnconfirmedBalance();
-    CAmount newImmatureBalance = getImmatureBalance();
-    CAmount newAnonymizedBalance = getAnonymizedBalance();
-    CAmount newWatchOnlyBalance = 0;
-    CAmount newWatchOnlyStake = 0;
-    CAmount newWatchUnconfBalance = 0;
-    CAmount newWatchImmatureBalance = 0;
-    if (haveWatchOnly())
-    {
-        newWatchOnlyBalance = getWatchBalance();
-        newWatchOnlyStake = getWatchStake();
-        newWatchUnconfBalance = getWatchUnconfirmedBalance();
-        newWatchImmatureBalance = getWatchImmatureBalance();
-    }
+    if(balances == cachedBalances)
+        return;
 
-    if(cachedBalance != newBalance || cachedStake != newStake || cachedUnconfirmedBalance != newUnconfirmedBalance || cachedImmatureBalance != newImmatureBalance || cachedAnonymizedBalance != newAnonymizedBalance ||
-        cachedTxLocks != nCompleteTXLocks || cachedWatchOnlyBalance != newWatchOnlyBalance || cachedWatchOnlyStake != newWatchOnlyStake || cachedWatchUnconfBalance != newWatchUnconfBalance || cachedWatchImmatureBalance != newWatchImmatureBalance)
-    {
-        cachedBalance = newBalance;
-        cachedStake = newStake;
-        cachedUnconfirmedBalance = newUnconfirmedBalance;
-        cachedImmatureBalance = newImmatureBalance;
-        cachedAnonymizedBalance = newAnonymizedBalance;
-        cachedTxLocks = nCompleteTXLocks;
-        cachedWatchOnlyBalance = newWatchOnlyBalance;
-        cachedWatchUnconfBalance = newWatchUnconfBalance;
-        cachedWatchImmatureBalance = newWatchImmatureBalance;
-        emit balanceChanged(newBalance, newStake, newUnconfirmedBalance, newImmatureBalance, newAnonymizedBalance,
-            newWatchOnlyBalance, newWatchOnlyStake, newWatchUnconfBalance, newWatchImmatureBalance);
-    }
+    cachedBalances = balances;
+    emit balanceChanged(balances.nBalance, balances.nStake, balances.nUnconfirmed, balances.nImmature, balances.nAnonymized,
+        balances.nWatchOnly, balances.nWatchOnlyStake, balances.nWatchOnlyUnconfirmed, balances.nWatchOnlyImmature);
 }
 
-void WalletModel::updateTransaction()
+void WalletModel::updateDarksendRounds()
 {
-    // Balance and number of transactions might have changed
-    fForceCheckBalanceChanged = true;
+    wallet->MarkBalancesDirty();
 }
 
 void WalletModel::updateAddressBook(const QString &address, const QString &label, bool isMine, int status)
@@ -207,6 +164,7 @@ void WalletModel::updateAddressBook(const QString &address, const QString &label
 void WalletModel::updateWatchOnlyFlag(bool fHaveWatchonly)
 {
     fHaveWatchOnly = fHaveWatchonly;
+    wallet->MarkBalancesDirty();
     emit notifyWatchonlyChanged(fHaveWatchonly);
 }
 
@@ -543,7 +501,6 @@ WalletModel::SendCoinsReturn WalletModel::sendCoins(WalletModelTransaction &tran
         }
         emit coinsSent(wallet, rcp, transaction_array);
     }
-    checkBalanceChanged(); // update balance immediately, otherwise there could be a short noticeable delay until pollBalanceChanged hits
 
     return SendCoinsReturn(OK);
 }
@@ -670,52 +627,26 @@ static void NotifyAddressBookChanged(WalletModel *walletmodel, CWallet *wallet,
     }
 }
 
-// queue notifications to show a non freezing progress dialog e.g. for rescan
-static bool fQueueNotifications = false;
-static std::vector<std::pair<uint256, ChangeType> > vQueueNotifications;
-static void NotifyTransactionChanged(WalletModel *walletmodel, CWallet *wallet, const uint256 &hash, ChangeType status)
-{
-    if (fQueueNotifications)
-    {
-        vQueueNotifications.push_back(make_pair(hash, status));
-        return;
-    }
-
-    QString strHash = QString::fromStdString(hash.GetHex());
-
-    qDebug() << "NotifyTransactionChanged : " + strHash + " status= " + QString::number(status);
-    QMetaObject::invokeMethod(walletmodel, "updateTransaction", Qt::QueuedConnection/*,
-                              Q_ARG(QString, strHash),
-                              Q_ARG(int, status)*/);
-}
-
 static void ShowProgress(WalletModel *walletmodel, const std::string &title, int nProgress)
 {
     // emits signal "showProgress"
     QMetaObject::invokeMethod(walletmodel, "showProgress", Qt::QueuedConnection,
                               Q_ARG(QString, QString::fromStdString(title)),
                               Q_ARG(int, nProgress));
-    if (nProgress == 0)
-    	fQueueNotifications = true;
-
-    if (nProgress == 100)
-    {
-          fQueueNotifications = false;
-        BOOST_FOREACH(const PAIRTYPE(uint256, ChangeType)& notification, vQueueNotifications)
-            NotifyTransactionChanged(walletmodel, NULL, notification.first, notification.second);
-        if (vQueueNotifications.size() > 10) // prevent balloon spam, show maximum 10 balloons
-            QMetaObject::invokeMethod(walletmodel, "setProcessingQueuedTransactions", Qt::QueuedConnection, Q_ARG(bool, true));
-        for (unsigned int i = 0; i < vQueueNotifications.size(); ++i)
-        {
-            if (vQueueNotifications.size() - i <= 10)
-                QMetaObject::invokeMethod(walletmodel, "setProcessingQueuedTransactions", Qt::QueuedConnection, Q_ARG(bool, false));
+}
 
-            NotifyTransactionChanged(walletmodel, NULL, vQueueNotifications[i].first, vQueueNotifications[i].second);
-        }
-        std::vector<std::pair<uint256, ChangeType> >().swap(vQueueNotifications); // clear
-    }
+static void NotifyBalancesChanged(WalletModel *walletmodel, CWallet *wallet, const CWalletBalances &balances)
+{
+    QMetaObject::invokeMethod(walletmodel, "updateBalances", Qt::QueuedConnection,
+                              Q_ARG(CWalletBalances, balances));
 }
 
+static void NotifyBlockTip(WalletModel *walletmodel, int nHeight, int64_t nBlockTime)
+{
+    // Blocks come in quickly during sync, keep at most one update queued
+    if (walletmodel->queueBlockTipUpdate())
+        QMetaObject::invokeMethod(walletmodel, "updateBlockTip", Qt::QueuedConnection);
+}
 
 static void NotifyWatchonlyChanged(WalletModel *walletmodel, bool fHaveWatchonly)
 {
@@ -725,12 +656,15 @@ static void NotifyWatchonlyChanged(WalletModel *walletmodel, bool fHaveWatchonly
 
 void WalletModel::subscribeToCoreSignals()
 {
+    qRegisterMetaType<CWalletBalances>("CWalletBalances");
+
     // Connect signals to wallet
     wallet->NotifyStatusChanged.connect(boost::bind(&NotifyKeyStoreStatusChanged, this, _1));
     wallet->NotifyAddressBookChanged.connect(boost::bind(NotifyAddressBookChanged, this, _1, _2, _3, _4, _5));
-    wallet->NotifyTransactionChanged.connect(boost::bind(NotifyTransactionChanged, this, _1, _2, _3));
     wallet->ShowProgress.connect(boost::bind(ShowProgress, this, _1, _2));
-    wallet->NotifyWatchonlyChanged.disconnect(boost::bind(NotifyWatchonlyChanged, this, _1));
+    wallet->NotifyWatchonlyChanged.connect(boost::bind(NotifyWatchonlyChanged, this, _1));
+    wallet->NotifyBalancesChanged.connect(boost::bind(NotifyBalancesChanged, this, _1, _2));
+    uiInterface.NotifyBlockTip.connect(boost::bind(NotifyBlockTip, this, _1, _2));
 }
 
 void WalletModel::unsubscribeFromCoreSignals()
@@ -738,9 +672,10 @@ void WalletModel::unsubscribeFromCoreSignals()
     // Disconnect signals from wallet
     wallet->NotifyStatusChanged.disconnect(boost::bind(&NotifyKeyStoreStatusChanged, this, _1));
     wallet->NotifyAddressBookChanged.disconnect(boost::bind(NotifyAddressBookChanged, this, _1, _2, _3, _4, _5));
-    wallet->NotifyTransactionChanged.disconnect(boost::bind(NotifyTransactionChanged, this, _1, _2, _3));
     wallet->ShowProgress.disconnect(boost::bind(ShowProgress, this, _1, _2));
     wallet->NotifyWatchonlyChanged.disconnect(boost::bind(NotifyWatchonlyChanged, this, _1));
+    wallet->NotifyBalancesChanged.disconnect(boost::bind(NotifyBalancesChanged, this, _1, _2));
+    uiInterface.NotifyBlockTip.disconnect(boost::bind(NotifyBlockTip, this, _1, _2));
 }
 
 // WalletModel::UnlockContext implementation
@@ -838,10 +773,10 @@ void WalletModel::listCoins(std::map<QString, std::vector<COutput> >& mapCoins)
             cout = COutput(&wallet->mapWallet[cout.tx->vin[0].prevout.hash], cout.tx->vin[0].prevout.n, 0, true);
         }
 
-        CTxDestination address;
-        if(!out.fSpendable || !ExtractDestination(cout.tx->vout[cout.i].scriptPubKey, address))
+        std::string strAddress;
+        if(!out.fSpendable || !ExtractAddressString(cout.tx->vout[cout.i].scriptPubKey, strAddress))
             continue;
-        mapCoins[QString::fromStdString(CParlayAddress(address).ToString())].push_back(out);
+        mapCoins[QString::fromStdString(strAddress)].push_back(out);
     }
 }
 
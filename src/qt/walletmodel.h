@@ -29,10 +29,6 @@ class COutPoint;
 class uint256;
 class CCoinControl;
 
-QT_BEGIN_NAMESPACE
-class QTimer;
-QT_END_NAMESPACE
-
 class SendCoinsRecipient
 {
 public:
@@ -196,12 +192,14 @@ public:
     void unlockCoin(COutPoint& output);
     void listLockedCoins(std::vector<COutPoint>& vOutpts);
     bool processingQueuedTransactions() { return fProcessingQueuedTransactions; }
+    /** Note a new best block from the core, true if no update is queued for it yet */
+    bool queueBlockTipUpdate();
 
 private:
     CWallet *wallet;
     bool fHaveWatchOnly;
-    bool fForceCheckBalanceChanged;
     bool fProcessingQueuedTransactions;
+    boost::atomic<bool> fBlockTipUpdateQueued;
 
     // Wallet has an options model for wallet-specific options
     // (transaction fee, for example)
@@ -211,26 +209,11 @@ private:
     TransactionTableModel *transactionTableModel;
 
     // Cache some values to be able to detect changes
-    CAmount cachedBalance;
-    CAmount cachedStake;
-    CAmount cachedUnconfirmedBalance;
-    CAmount cachedImmatureBalance;
-    CAmount cachedAnonymizedBalance;
-    CAmount cachedWatchOnlyBalance;
-    CAmount cachedWatchOnlyStake;
-    CAmount cachedWatchUnconfBalance;
-    CAmount cachedWatchImmatureBalance;
-    CAmount cachedNumTransactions;
+    CWalletBalances cachedBalances;
     EncryptionStatus cachedEncryptionStatus;
-    int cachedNumBlocks;
-    int cachedTxLocks;
-    int cachedDarksendRounds;
-
-    QTimer *pollTimer;
 
     void subscribeToCoreSignals();
     void unsubscribeFromCoreSignals();
-    void checkBalanceChanged();
 
 signals:
     // Signal that balance in wallet changed
@@ -260,14 +243,16 @@ signals:
 public slots:
     /* Wallet status might have changed */
     void updateStatus();
-    /* New transaction, or transaction changed status */
-    void updateTransaction();
+    /* Balances pushed by the wallet - emit 'balanceChanged' if they changed */
+    void updateBalances(const CWalletBalances &balances);
+    /* New best block */
+    void updateBlockTip();
+    /* Darksend rounds setting changed, the anonymized balance depends on it */
+    void updateDarksendRounds();
     /* New, updated or removed address book entry */
     void updateAddressBook(const QString &address, const QString &label, bool isMine, int status);
     /* Watch-only added */
     void updateWatchOnlyFlag(bool fHaveWatchonly);
-    /* Current, immature or unconfirmed balance might have changed - emit 'balanceChanged' if so */
-    void pollBalanceChanged();
     /* Needed to update fProcessingQueuedTransactions through a QueuedConnection */
     void setProcessingQueuedTransactions(bool value) { fProcessingQueuedTransactions = value; }
 
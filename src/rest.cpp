@@ -0,0 +1,278 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpcserver.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+using namespace json_spirit;
+
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail, JSONWriter& writer);
+
+//
+// Read-only REST interface, served next to JSON-RPC when -rest is set.
+//
+//   /rest/block/<hash>.<bin|hex|json>
+//   /rest/tx/<txid>.<bin|hex|json>
+//   /rest/headers/<count>/<hash>.<bin|hex|json>
+//
+// Binary replies are the network serialization. Blocks are copied
+// straight out of blk%04u.dat without being deserialized.
+//
+
+enum RESTFormat
+{
+    RF_BINARY,
+    RF_HEX,
+    RF_JSON,
+};
+
+static const struct
+{
+    RESTFormat rf;
+    const char* name;
+    const char* contentType;
+} vRESTFormats[] =
+{
+    { RF_BINARY, "bin",  "application/octet-stream" },
+    { RF_HEX,    "hex",  "text/plain" },
+    { RF_JSON,   "json", "application/json" },
+};
+
+/** Most headers a single /rest/headers request returns */
+static const int MAX_REST_HEADERS_RESULTS = 2000;
+
+class RESTError
+{
+public:
+    RESTError(int nStatusIn, const string& strMessageIn) : nStatus(nStatusIn), strMessage(strMessageIn) {}
+
+    int nStatus;
+    string strMessage;
+};
+
+static int ParseFormat(string& strParam)
+{
+    size_t nDot = strParam.rfind('.');
+    if (nDot == string::npos)
+        throw RESTError(HTTP_NOT_FOUND, "output format not found (available: bin, hex, json)");
+
+    string strFormat = strParam.substr(nDot + 1);
+    strParam = strParam.substr(0, nDot);
+    for (unsigned int i = 0; i < sizeof(vRESTFormats) / sizeof(vRESTFormats[0]); i++)
+        if (strFormat == vRESTFormats[i].name)
+            return i;
+    throw RESTError(HTTP_NOT_FOUND, "output format not found (available: bin, hex, json)");
+}
+
+static uint256 ParseHash(const string& strHash)
+{
+    if (strHash.size() != 64 || !IsHex(strHash))
+        throw RESTError(HTTP_BAD_REQUEST, "Invalid hash: " + strHash);
+    uint256 hash;
+    hash.SetHex(strHash);
+    return hash;
+}
+
+/** Serialized block exactly as stored in the block file */
+static bool ReadRawBlock(const CBlockIndex* pindex, string& strRet)
+{
+    // The block size is written just before the block itself
+    if (pindex->nBlockPos < sizeof(unsigned int))
+        return false;
+    CAutoFile filein = CAutoFile(OpenBlockFile(pindex->nFile, pindex->nBlockPos - sizeof(unsigned int), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+
+    unsigned int nSize = 0;
+    try {
+        filein >> nSize;
+    }
+    catch (std::exception &e) {
+        return false;
+    }
+    if (nSize == 0 || nSize > MAX_BLOCK_SIZE)
+        return false;
+
+    strRet.resize(nSize);
+    return fread(&strRet[0], 1, nSize, filein.Get()) == nSize;
+}
+
+static void SendReply(std::ostream& stream, int nFormat, const string& strBinary, bool fKeepAlive)
+{
+    string strReply = vRESTFormats[nFormat].rf == RF_HEX ? HexStr(strBinary.begin(), strBinary.end()) + "\n" : strBinary;
+    stream << HTTPReply(HTTP_OK, strReply, fKeepAlive, vRESTFormats[nFormat].contentType) << std::flush;
+}
+
+static void RESTBlock(std::ostream& stream, const vector<string>& vParams, int nProto, bool fKeepAlive)
+{
+    if (vParams.size() != 1)
+        throw RESTError(HTTP_BAD_REQUEST, "Usage: /rest/block/<hash>.<bin|hex|json>");
+    string strHash = vParams[0];
+    int nFormat = ParseFormat(strHash);
+    uint256 hash = ParseHash(strHash);
+
+    CBlockIndex* pindex = LookupBlockIndex(hash);
+    if (!pindex)
+        throw RESTError(HTTP_NOT_FOUND, strHash + " not found");
+
+    if (vRESTFormats[nFormat].rf != RF_JSON)
+    {
+        string strBlock;
+        if (!ReadRawBlock(pindex, strBlock))
+            throw RESTError(HTTP_NOT_FOUND, strHash + " not available");
+        SendReply(stream, nFormat, strBlock, fKeepAlive);
+        return;
+    }
+
+    CBlock block;
+    if (!block.ReadFromDisk(pindex, true))
+        throw RESTError(HTTP_NOT_FOUND, strHash + " not available");
+
+    // Chunked transfer encoding is HTTP/1.1 only, older clients get the whole reply with its length
+    if (nProto < 1)
+    {
+        std::ostringstream os;
+        JSONStreamWriter writer(os);
+        blockToJSON(block, pindex, true, writer);
+        os << "\n";
+        stream << HTTPReply(HTTP_OK, os.str(), fKeepAlive) << std::flush;
+        return;
+    }
+
+    HTTPChunkedStreamBuf buf(stream, HTTP_OK, fKeepAlive);
+    std::ostream os(&buf);
+    JSONStreamWriter writer(os);
+    blockToJSON(block, pindex, true, writer);
+    os << "\n";
+    buf.Finish();
+}
+
+static void RESTTx(std::ostream& stream, const vector<string>& vParams, int nProto, bool fKeepAlive)
+{
+    if (vParams.size() != 1)
+        throw RESTError(HTTP_BAD_REQUEST, "Usage: /rest/tx/<txid>.<bin|hex|json>");
+    string strHash = vParams[0];
+    int nFormat = ParseFormat(strHash);
+    uint256 hash = ParseHash(strHash);
+
+    // Anyone can ask, so only the mempool and the tx index are searched, not
+    // the blocks off the main chain that GetTransaction walks under cs_main
+    CTransaction tx;
+    uint256 hashBlock = 0;
+    if (!GetTransaction(hash, tx, hashBlock, false))
+        throw RESTError(HTTP_NOT_FOUND, strHash + " not found");
+
+    if (vRESTFormats[nFormat].rf != RF_JSON)
+    {
+        CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+        ssTx << tx;
+        SendReply(stream, nFormat, ssTx.str(), fKeepAlive);
+        return;
+    }
+
+    Object result;
+    TxToJSON(tx, hashBlock, result);
+    stream << HTTPReply(HTTP_OK, write_string(Value(result), false) + "\n", fKeepAlive) << std::flush;
+}
+
+static Object blockheaderToJSON(const CBlockIndex* pindex, const CChainSnapshot& chain)
+{
+    Object result;
+    result.push_back(Pair("hash", pindex->GetBlockHash().GetHex()));
+    result.push_back(Pair("confirmations", chain.Contains(pindex) ? chain.GetDepth(pindex) : -1));
+    result.push_back(Pair("height", pindex->nHeight));
+    result.push_back(Pair("version", pindex->nVersion));
+    result.push_back(Pair("merkleroot", pindex->hashMerkleRoot.GetHex()));
+    result.push_back(Pair("time", (int64_t)pindex->GetBlockTime()));
+    result.push_back(Pair("nonce", (uint64_t)pindex->nNonce));
+    result.push_back(Pair("bits", strprintf("%08x", pindex->nBits)));
+    result.push_back(Pair("difficulty", GetDifficulty(pindex)));
+    result.push_back(Pair("chaintrust", leftTrim(pindex->nChainTrust.GetHex(), '0')));
+    if (pindex->pprev)
+        result.push_back(Pair("previousblockhash", pindex->pprev->GetBlockHash().GetHex()));
+    if (CBlockIndex* pnext = chain.Next(pindex))
+        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+    return result;
+}
+
+static void RESTHeaders(std::ostream& stream, const vector<string>& vParams, int nProto, bool fKeepAlive)
+{
+    if (vParams.size() != 2)
+        throw RESTError(HTTP_BAD_REQUEST, "Usage: /rest/headers/<count>/<hash>.<bin|hex|json>");
+    string strHash = vParams[1];
+    int nFormat = ParseFormat(strHash);
+    uint256 hash = ParseHash(strHash);
+
+    int nCount = atoi(vParams[0]);
+    if (nCount < 1 || nCount > MAX_REST_HEADERS_RESULTS)
+        throw RESTError(HTTP_BAD_REQUEST, strprintf("Header count out of range: %s", vParams[0]));
+
+    CBlockIndex* pindex = LookupBlockIndex(hash);
+    if (!pindex)
+        throw RESTError(HTTP_NOT_FOUND, strHash + " not found");
+
+    // The requested block and the main chain blocks following it
+    CChainSnapshotRef chain = GetChainSnapshot();
+    vector<const CBlockIndex*> vHeaders;
+    for (; pindex && (int)vHeaders.size() < nCount; pindex = chain->Next(pindex))
+        vHeaders.push_back(pindex);
+
+    if (vRESTFormats[nFormat].rf != RF_JSON)
+    {
+        CDataStream ssHeaders(SER_NETWORK | SER_BLOCKHEADERONLY, PROTOCOL_VERSION);
+        BOOST_FOREACH(const CBlockIndex* pheader, vHeaders)
+            ssHeaders << pheader->GetBlockHeader();
+        SendReply(stream, nFormat, ssHeaders.str(), fKeepAlive);
+        return;
+    }
+
+    Array result;
+    BOOST_FOREACH(const CBlockIndex* pheader, vHeaders)
+        result.push_back(blockheaderToJSON(pheader, *chain));
+    stream << HTTPReply(HTTP_OK, write_string(Value(result), false) + "\n", fKeepAlive) << std::flush;
+}
+
+static const struct
+{
+    const char* prefix;
+    void (*handler)(std::ostream& stream, const vector<string>& vParams, int nProto, bool fKeepAlive);
+} vRESTHandlers[] =
+{
+    { "/rest/block/",   RESTBlock },
+    { "/rest/tx/",      RESTTx },
+    { "/rest/headers/", RESTHeaders },
+};
+
+bool HTTPReq_REST(std::ostream& stream, const string& strURI, int nProto, bool fKeepAlive)
+{
+    try
+    {
+        for (unsigned int i = 0; i < sizeof(vRESTHandlers) / sizeof(vRESTHandlers[0]); i++)
+        {
+            string strPrefix = vRESTHandlers[i].prefix;
+            if (strURI.compare(0, strPrefix.size(), strPrefix) != 0)
+                continue;
+
+            vector<string> vParams;
+            string strParams = strURI.substr(strPrefix.size());
+            boost::split(vParams, strParams, boost::is_any_of("/"));
+            vRESTHandlers[i].handler(stream, vParams, nProto, fKeepAlive);
+            return true;
+        }
+        throw RESTError(HTTP_NOT_FOUND, "not found");
+    }
+    catch (RESTError& re)
+    {
+        stream << HTTPReply(re.nStatus, re.strMessage + "\r\n", false, "text/plain") << std::flush;
+        return false;
+    }
+}
@@ -106,60 +106,69 @@ double GetPoSKernelPS()
     return result;
 }
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail)
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail, JSONWriter& writer)
 {
-    Object result;
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
+    CChainSnapshotRef chain = GetChainSnapshot();
+
+    writer.BeginObject();
+    writer.Write("hash", block.GetHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (blockindex->IsInMainChain())
-        confirmations = nBestHeight - blockindex->nHeight + 1;
-    result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+    if (chain->Contains(blockindex))
+        confirmations = chain->GetDepth(blockindex);
+    writer.Write("confirmations", confirmations);
+    writer.Write("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.Write("height", blockindex->nHeight);
+    writer.Write("version", block.nVersion);
+    writer.Write("merkleroot", block.hashMerkleRoot.GetHex());
 #ifndef LOWMEM
-    result.push_back(Pair("mint", ValueFromAmount(blockindex->nMint)));
+    writer.Write("mint", ValueFromAmount(blockindex->nMint));
 #endif
-    result.push_back(Pair("moneysupply", ValueFromAmount(blockindex->nMoneySupply)));
-    result.push_back(Pair("time", (int64_t)block.GetBlockTime()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("blocktrust", leftTrim(blockindex->GetBlockTrust().GetHex(), '0')));
-    result.push_back(Pair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0')));
+    writer.Write("moneysupply", ValueFromAmount(blockindex->nMoneySupply));
+    writer.Write("time", (int64_t)block.GetBlockTime());
+    writer.Write("nonce", (uint64_t)block.nNonce);
+    writer.Write("bits", strprintf("%08x", block.nBits));
+    writer.Write("difficulty", GetDifficulty(blockindex));
+    writer.Write("blocktrust", leftTrim(blockindex->GetBlockTrust().GetHex(), '0'));
+    writer.Write("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0'));
     if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    if (blockindex->pnext)
-        result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
-
-    result.push_back(Pair("flags", strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": "")));
-    result.push_back(Pair("proofhash", blockindex->hashProof.GetHex()));
-    result.push_back(Pair("entropybit", (int)blockindex->GetStakeEntropyBit()));
-    result.push_back(Pair("modifier", strprintf("%016x", blockindex->nStakeModifier)));
-    Array txinfo;
+        writer.Write("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+    if (CBlockIndex* pnext = chain->Next(blockindex))
+        writer.Write("nextblockhash", pnext->GetBlockHash().GetHex());
+
+    writer.Write("flags", strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": ""));
+    writer.Write("proofhash", blockindex->hashProof.GetHex());
+    writer.Write("entropybit", (int)blockindex->GetStakeEntropyBit());
+    writer.Write("modifier", strprintf("%016x", blockindex->nStakeModifier));
+    writer.Key("tx");
+    writer.BeginArray();
     BOOST_FOREACH (const CTransaction& tx, block.vtx)
     {
         if (fPrintTransactionDetail)
         {
+            // One transaction at a time, so a streamed reply stays small
             Object entry;
 
             entry.push_back(Pair("txid", tx.GetHash().GetHex()));
             TxToJSON(tx, 0, entry);
 
-            txinfo.push_back(entry);
+            writer.Write(entry);
         }
         else
-            txinfo.push_back(tx.GetHash().GetHex());
+            writer.Write(tx.GetHash().GetHex());
     }
-
-    result.push_back(Pair("tx", txinfo));
+    writer.EndArray();
 
     if (block.IsProofOfStake())
-        result.push_back(Pair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end())));
+        writer.Write("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end()));
+    writer.EndObject();
+}
 
-    return result;
+Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail)
+{
+    JSONValueWriter writer;
+    blockToJSON(block, blockindex, fPrintTransactionDetail, writer);
+    return writer.GetValue().get_obj();
 }
 
 Value getbestblockhash(const Array& params, bool fHelp)
@@ -169,7 +178,8 @@ Value getbestblockhash(const Array& params, bool fHelp)
             "getbestblockhash\n"
             "Returns the hash of the best block in the longest block chain.");
 
-    return hashBestChain.GetHex();
+    CBlockIndex* pindexTip = GetChainSnapshot()->Tip();
+    return pindexTip ? pindexTip->GetBlockHash().GetHex() : uint256(0).GetHex();
 }
 
 Value getblockcount(const Array& params, bool fHelp)
@@ -179,7 +189,7 @@ Value getblockcount(const Array& params, bool fHelp)
             "getblockcount\n"
             "Returns the number of blocks in the longest block chain.");
 
-    return nBestHeight;
+    return GetChainSnapshot()->Height();
 }
 
 
@@ -222,10 +232,10 @@ Value getblockhash(const Array& params, bool fHelp)
             "Returns hash of block in best-block-chain at <index>.");
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
+    CBlockIndex* pblockindex = (*GetChainSnapshot())[nHeight];
+    if (!pblockindex)
         throw runtime_error("Block number out of range.");
 
-    CBlockIndex* pblockindex = FindBlockByHeight(nHeight);
     return pblockindex->phashBlock->GetHex();
 }
 
@@ -237,17 +247,28 @@ Value getblock(const Array& params, bool fHelp)
             "txinfo optional to print more detailed tx info\n"
             "Returns details of a block with given block-hash.");
 
+    JSONValueWriter writer;
+    getblock(params, writer);
+    return writer.GetValue();
+}
+
+void getblock(const Array& params, JSONWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2)
+        getblock(params, true); // throws the usage text
+
     std::string strHash = params[0].get_str();
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-    block.ReadFromDisk(pblockindex, true);
+    if (!block.ReadFromDisk(pblockindex, true))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false, writer);
 }
 
 Value getblockbynumber(const Array& params, bool fHelp)
@@ -258,21 +279,26 @@ Value getblockbynumber(const Array& params, bool fHelp)
             "txinfo optional to print more detailed tx info\n"
             "Returns details of a block with given block-number.");
 
+    JSONValueWriter writer;
+    getblockbynumber(params, writer);
+    return writer.GetValue();
+}
+
+void getblockbynumber(const Array& params, JSONWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2)
+        getblockbynumber(params, true); // throws the usage text
+
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
+    CBlockIndex* pblockindex = (*GetChainSnapshot())[nHeight];
+    if (!pblockindex)
         throw runtime_error("Block number out of range.");
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
-
-    uint256 hash = *pblockindex->phashBlock;
-
-    pblockindex = mapBlockIndex[hash];
-    block.ReadFromDisk(pblockindex, true);
+    if (!block.ReadFromDisk(pblockindex, true))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false, writer);
 }
 
 // ppcoin: get information of sync-checkpoint
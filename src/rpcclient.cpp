@@ -167,6 +167,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "searchrawtransactions", 1 },
     { "searchrawtransactions", 2 },
     { "searchrawtransactions", 3 },
+    { "getlockstats", 1 },
 };
 
 class CRPCConvertTable
@@ -483,7 +483,7 @@ Value primenode(const Array& params, bool fHelp)
         if(activePrimenode.status == PRIMENODE_SYNC_IN_PROCESS) return "sync in process. Must wait until client is synced to start.";
 
         CTxIn vin = CTxIn();
-        CPubKey pubkey = CScript();
+        CPubKey pubkey;
         CKey key;
         bool found = activePrimenode.GetPrimeNodeVin(vin, pubkey, key);
         if(!found){
@@ -279,3 +279,147 @@ Value spork(const Array& params, bool fHelp)
         + HelpRequiringPassphrase());
 }
 
+
+struct CLockStatsTotal
+{
+    std::string strName;
+    uint64_t nAcquired;
+    uint64_t nContended;
+    uint64_t nTryFailed;
+    uint64_t vWait[LOCKSTATS_BUCKETS], nWaitTotal, nWaitMax;
+    uint64_t vHold[LOCKSTATS_BUCKETS], nHoldTotal, nHoldMax;
+
+    CLockStatsTotal(const std::string& strNameIn) : strName(strNameIn), nAcquired(0), nContended(0), nTryFailed(0),
+        nWaitTotal(0), nWaitMax(0), nHoldTotal(0), nHoldMax(0)
+    {
+        memset(vWait, 0, sizeof(vWait));
+        memset(vHold, 0, sizeof(vHold));
+    }
+
+    void Add(const CLockSite& site)
+    {
+        nAcquired += site.nAcquired;
+        nContended += site.nContended;
+        nTryFailed += site.nTryFailed;
+        for (int i = 0; i < LOCKSTATS_BUCKETS; i++)
+        {
+            vWait[i] += site.wait.vCount[i];
+            vHold[i] += site.hold.vCount[i];
+        }
+        nWaitTotal += site.wait.nTotal;
+        nWaitMax = std::max(nWaitMax, (uint64_t)site.wait.nMax);
+        nHoldTotal += site.hold.nTotal;
+        nHoldMax = std::max(nHoldMax, (uint64_t)site.hold.nMax);
+    }
+};
+
+static bool CompareLockStatsByHold(const CLockStatsTotal& a, const CLockStatsTotal& b)
+{
+    return a.nHoldTotal + a.nWaitTotal > b.nHoldTotal + b.nWaitTotal;
+}
+
+static Object LockTimesToJSON(const uint64_t* vCount, uint64_t nTotal, uint64_t nMax, uint64_t nAcquired)
+{
+    int nBuckets = LOCKSTATS_BUCKETS;
+    while (nBuckets > 0 && vCount[nBuckets - 1] == 0)
+        nBuckets--;
+    Array histogram;
+    for (int i = 0; i < nBuckets; i++)
+        histogram.push_back((boost::int64_t)vCount[i]);
+
+    Object obj;
+    obj.push_back(Pair("total_us", (boost::int64_t)nTotal));
+    obj.push_back(Pair("avg_us", nAcquired ? (double)nTotal / nAcquired : 0.0));
+    obj.push_back(Pair("max_us", (boost::int64_t)nMax));
+    obj.push_back(Pair("histogram", histogram));
+    return obj;
+}
+
+static Object LockStatsToJSON(const CLockStatsTotal& total)
+{
+    Object obj;
+    obj.push_back(Pair("name", total.strName));
+    obj.push_back(Pair("acquired", (boost::int64_t)total.nAcquired));
+    obj.push_back(Pair("contended", (boost::int64_t)total.nContended));
+    obj.push_back(Pair("tryfailed", (boost::int64_t)total.nTryFailed));
+    obj.push_back(Pair("wait", LockTimesToJSON(total.vWait, total.nWaitTotal, total.nWaitMax, total.nAcquired)));
+    obj.push_back(Pair("hold", LockTimesToJSON(total.vHold, total.nHoldTotal, total.nHoldMax, total.nAcquired)));
+    return obj;
+}
+
+/** "pwalletMain->cs_wallet" and "wallet.cs_wallet" both count as cs_wallet */
+static std::string LockBaseName(const std::string& strName)
+{
+    size_t nPos = strName.find_last_of(".>");
+    return nPos == std::string::npos ? strName : strName.substr(nPos + 1);
+}
+
+Value getlockstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "getlockstats [on|off|reset] [count=20]\n"
+            "Lock contention profile of LOCK/LOCK2/TRY_LOCK, per lock and for the <count>\n"
+            "acquisition sites with the most time spent waiting for and holding their lock.\n"
+            "on/off start and stop recording (also see -lockstats), reset clears all counters.\n"
+            "Times are in microseconds. Histogram entry 0 counts times under 1us,\n"
+            "entry i times from 2^(i-1) up to 2^i us.");
+
+    if (params.size() > 0)
+    {
+        string strCommand = params[0].get_str();
+        if (strCommand == "on")
+            fLockStats = true;
+        else if (strCommand == "off")
+            fLockStats = false;
+        else if (strCommand == "reset")
+        {
+            std::vector<CLockSite*> vSites;
+            GetLockSites(vSites);
+            BOOST_FOREACH(CLockSite* psite, vSites)
+                psite->Reset();
+        }
+        else
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown command: " + strCommand);
+    }
+    int nCount = params.size() > 1 ? params[1].get_int() : 20;
+
+    std::vector<CLockSite*> vSites;
+    GetLockSites(vSites);
+
+    std::map<std::string, CLockStatsTotal> mapLocks;
+    std::vector<CLockStatsTotal> vSiteTotals;
+    BOOST_FOREACH(const CLockSite* psite, vSites)
+    {
+        if (psite->nAcquired == 0 && psite->nTryFailed == 0)
+            continue;
+
+        std::string strLock = LockBaseName(psite->pszName);
+        std::map<std::string, CLockStatsTotal>::iterator it = mapLocks.find(strLock);
+        if (it == mapLocks.end())
+            it = mapLocks.insert(make_pair(strLock, CLockStatsTotal(strLock))).first;
+        it->second.Add(*psite);
+
+        vSiteTotals.push_back(CLockStatsTotal(strprintf("%s %s:%d", psite->pszName, psite->pszFile, psite->nLine)));
+        vSiteTotals.back().Add(*psite);
+    }
+
+    std::vector<CLockStatsTotal> vLockTotals;
+    for (std::map<std::string, CLockStatsTotal>::iterator it = mapLocks.begin(); it != mapLocks.end(); ++it)
+        vLockTotals.push_back(it->second);
+    std::sort(vLockTotals.begin(), vLockTotals.end(), CompareLockStatsByHold);
+    std::sort(vSiteTotals.begin(), vSiteTotals.end(), CompareLockStatsByHold);
+
+    Array locks;
+    BOOST_FOREACH(const CLockStatsTotal& total, vLockTotals)
+        locks.push_back(LockStatsToJSON(total));
+    Array sites;
+    for (int i = 0; i < (int)vSiteTotals.size() && i < nCount; i++)
+        sites.push_back(LockStatsToJSON(vSiteTotals[i]));
+
+    Object result;
+    result.push_back(Pair("enabled", (bool)fLockStats));
+    result.push_back(Pair("locks", locks));
+    result.push_back(Pair("sites", sites));
+    return result;
+}
@@ -58,7 +58,17 @@ static string rfc1123Time()
     return DateTimeStrFormat("%a, %d %b %Y %H:%M:%S +0000", GetTime());
 }
 
-string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
+static const char* HTTPStatusText(int nStatus)
+{
+    if (nStatus == HTTP_OK) return "OK";
+    if (nStatus == HTTP_BAD_REQUEST) return "Bad Request";
+    if (nStatus == HTTP_FORBIDDEN) return "Forbidden";
+    if (nStatus == HTTP_NOT_FOUND) return "Not Found";
+    if (nStatus == HTTP_INTERNAL_SERVER_ERROR) return "Internal Server Error";
+    return "";
+}
+
+string HTTPReply(int nStatus, const string& strMsg, bool keepalive, const char* pszContentType)
 {
     if (nStatus == HTTP_UNAUTHORIZED)
         return strprintf("HTTP/1.0 401 Authorization Required\r\n"
@@ -77,31 +87,89 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
             "</HEAD>\r\n"
             "<BODY><H1>401 Unauthorized.</H1></BODY>\r\n"
             "</HTML>\r\n", rfc1123Time(), FormatFullVersion());
-    const char *cStatus;
-         if (nStatus == HTTP_OK) cStatus = "OK";
-    else if (nStatus == HTTP_BAD_REQUEST) cStatus = "Bad Request";
-    else if (nStatus == HTTP_FORBIDDEN) cStatus = "Forbidden";
-    else if (nStatus == HTTP_NOT_FOUND) cStatus = "Not Found";
-    else if (nStatus == HTTP_INTERNAL_SERVER_ERROR) cStatus = "Internal Server Error";
-    else cStatus = "";
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
             "Date: %s\r\n"
             "Connection: %s\r\n"
             "Content-Length: %u\r\n"
-            "Content-Type: application/json\r\n"
+            "Content-Type: %s\r\n"
             "Server: Parlay-json-rpc/%s\r\n"
             "\r\n"
             "%s",
         nStatus,
-        cStatus,
+        HTTPStatusText(nStatus),
         rfc1123Time(),
         keepalive ? "keep-alive" : "close",
         strMsg.size(),
+        pszContentType,
         FormatFullVersion(),
         strMsg);
 }
 
+string HTTPReplyChunkedHeader(int nStatus, bool keepalive)
+{
+    return strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: application/json\r\n"
+            "Server: Parlay-json-rpc/%s\r\n"
+            "\r\n",
+        nStatus,
+        HTTPStatusText(nStatus),
+        rfc1123Time(),
+        keepalive ? "keep-alive" : "close",
+        FormatFullVersion());
+}
+
+HTTPChunkedStreamBuf::HTTPChunkedStreamBuf(std::ostream& streamIn, int nStatus, bool fKeepAlive, size_t nChunkSize) :
+    stream(streamIn), strHeader(HTTPReplyChunkedHeader(nStatus, fKeepAlive)), vBuf(nChunkSize), fStarted(false)
+{
+    // Keep one byte spare for the character passed to overflow()
+    setp(&vBuf[0], &vBuf[0] + vBuf.size() - 1);
+}
+
+void HTTPChunkedStreamBuf::SendChunk()
+{
+    if (!fStarted)
+    {
+        stream << strHeader;
+        fStarted = true;
+    }
+    std::ptrdiff_t n = pptr() - pbase();
+    if (n > 0)
+    {
+        stream << strprintf("%x\r\n", (unsigned int)n);
+        stream.write(pbase(), n);
+        stream << "\r\n";
+    }
+    setp(&vBuf[0], &vBuf[0] + vBuf.size() - 1);
+}
+
+int HTTPChunkedStreamBuf::overflow(int c)
+{
+    if (c != traits_type::eof())
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    SendChunk();
+    return stream ? traits_type::not_eof(c) : traits_type::eof();
+}
+
+int HTTPChunkedStreamBuf::sync()
+{
+    // Only Finish() sends a partial chunk
+    return 0;
+}
+
+void HTTPChunkedStreamBuf::Finish()
+{
+    SendChunk();
+    stream << "0\r\n\r\n" << std::flush;
+}
+
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          string& http_method, string& http_uri)
 {
@@ -206,6 +274,31 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         }
         strMessageRet = string(vch.begin(), vch.end());
     }
+    else if (mapHeadersRet.count("transfer-encoding") && mapHeadersRet["transfer-encoding"] == "chunked")
+    {
+        // Chunks until the zero length one, then an optional trailer
+        string str;
+        while (true)
+        {
+            std::getline(stream, str);
+            if (!stream)
+                return HTTP_INTERNAL_SERVER_ERROR;
+            size_t nChunk = strtoul(str.c_str(), NULL, 16);
+            if (nChunk == 0)
+                break;
+            size_t ptr = strMessageRet.size();
+            if (ptr + nChunk > max_size)
+                return HTTP_INTERNAL_SERVER_ERROR;
+            strMessageRet.resize(ptr + nChunk);
+            stream.read(&strMessageRet[ptr], nChunk);
+            std::getline(stream, str);
+            if (!stream) // Connection lost while reading
+                return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        do
+            std::getline(stream, str);
+        while (stream && !str.empty() && str != "\r");
+    }
 
     string sConHdr = mapHeadersRet["connection"];
 
@@ -257,6 +350,105 @@ string JSONRPCReply(const Value& result, const Value& error, const Value& id)
     return write_string(Value(reply), false) + "\n";
 }
 
+void JSONValueWriter::BeginObject()
+{
+    stack.push_back(Frame());
+    stack.back().fObject = true;
+}
+
+void JSONValueWriter::BeginArray()
+{
+    stack.push_back(Frame());
+    stack.back().fObject = false;
+}
+
+void JSONValueWriter::EndObject()
+{
+    assert(!stack.empty() && stack.back().fObject);
+    Value value(stack.back().obj);
+    stack.pop_back();
+    Write(value);
+}
+
+void JSONValueWriter::EndArray()
+{
+    assert(!stack.empty() && !stack.back().fObject);
+    Value value(stack.back().arr);
+    stack.pop_back();
+    Write(value);
+}
+
+void JSONValueWriter::Key(const string& strKey)
+{
+    assert(!stack.empty() && stack.back().fObject);
+    stack.back().strKey = strKey;
+}
+
+void JSONValueWriter::Write(const Value& value)
+{
+    if (stack.empty())
+        result = value;
+    else if (stack.back().fObject)
+        stack.back().obj.push_back(Pair(stack.back().strKey, value));
+    else
+        stack.back().arr.push_back(value);
+}
+
+void JSONStreamWriter::Separator()
+{
+    if (fAfterKey)
+    {
+        fAfterKey = false;
+        return;
+    }
+    if (!vFirst.empty())
+    {
+        if (!vFirst.back())
+            stream << ',';
+        vFirst.back() = false;
+    }
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separator();
+    stream << '{';
+    vFirst.push_back(true);
+}
+
+void JSONStreamWriter::EndObject()
+{
+    vFirst.pop_back();
+    stream << '}';
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separator();
+    stream << '[';
+    vFirst.push_back(true);
+}
+
+void JSONStreamWriter::EndArray()
+{
+    vFirst.pop_back();
+    stream << ']';
+}
+
+void JSONStreamWriter::Key(const string& strKey)
+{
+    Separator();
+    write_stream(Value(strKey), stream, false);
+    stream << ':';
+    fAfterKey = true;
+}
+
+void JSONStreamWriter::Write(const Value& value)
+{
+    Separator();
+    write_stream(value, stream, false);
+}
+
 Object JSONRPCError(int code, const string& message)
 {
     Object error;
@@ -12,6 +12,7 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/asio.hpp>
@@ -125,8 +126,112 @@ private:
     boost::asio::ssl::stream<typename Protocol::socket>& stream;
 };
 
+/** Receives a JSON document piece by piece.
+
+    Handlers that can produce large results write into one of these instead
+    of returning a json_spirit::Value, so the reply does not have to be held
+    in memory as a whole. Keys are only valid directly inside an object.
+*/
+class JSONWriter
+{
+public:
+    virtual ~JSONWriter() {}
+
+    virtual void BeginObject() = 0;
+    virtual void EndObject() = 0;
+    virtual void BeginArray() = 0;
+    virtual void EndArray() = 0;
+    virtual void Key(const std::string& strKey) = 0;
+    /** Write a complete value, scalar or subtree */
+    virtual void Write(const json_spirit::Value& value) = 0;
+
+    void Write(const std::string& strKey, const json_spirit::Value& value)
+    {
+        Key(strKey);
+        Write(value);
+    }
+};
+
+/** Builds a json_spirit::Value, for callers that need the result as a whole */
+class JSONValueWriter : public JSONWriter
+{
+public:
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& strKey);
+    void Write(const json_spirit::Value& value);
+    using JSONWriter::Write;
+
+    const json_spirit::Value& GetValue() const { return result; }
+
+private:
+    struct Frame
+    {
+        bool fObject;
+        json_spirit::Object obj;
+        json_spirit::Array arr;
+        std::string strKey;
+    };
+
+    std::list<Frame> stack;
+    json_spirit::Value result;
+};
+
+/** Writes compact JSON text to a stream as it is produced */
+class JSONStreamWriter : public JSONWriter
+{
+public:
+    JSONStreamWriter(std::ostream& streamIn) : stream(streamIn), fAfterKey(false) {}
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& strKey);
+    void Write(const json_spirit::Value& value);
+    using JSONWriter::Write;
+
+private:
+    void Separator();
+
+    std::ostream& stream;
+    std::vector<bool> vFirst;
+    bool fAfterKey;
+};
+
+/** Stream buffer that sends an HTTP/1.1 reply with chunked transfer encoding.
+
+    Output is collected into chunks of nChunkSize bytes. The reply header
+    only goes out with the first chunk, so as long as Started() is false
+    the reply can still be abandoned in favour of an error reply.
+*/
+class HTTPChunkedStreamBuf : public std::streambuf
+{
+public:
+    HTTPChunkedStreamBuf(std::ostream& streamIn, int nStatus, bool fKeepAlive, size_t nChunkSize = 64 * 1024);
+
+    bool Started() const { return fStarted; }
+    /** Send what is left and the terminating chunk */
+    void Finish();
+
+protected:
+    int overflow(int c);
+    int sync();
+
+private:
+    void SendChunk();
+
+    std::ostream& stream;
+    std::string strHeader;
+    std::vector<char> vBuf;
+    bool fStarted;
+};
+
 std::string HTTPPost(const std::string& strMsg, const std::map<std::string,std::string>& mapRequestHeaders);
-std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive);
+std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive, const char* pszContentType = "application/json");
+std::string HTTPReplyChunkedHeader(int nStatus, bool keepalive);
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          std::string& http_method, std::string& http_uri);
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto);
@@ -5,6 +5,7 @@
 
 #include <boost/assign/list_of.hpp>
 
+#include "addrindex.h"
 #include "base58.h"
 #include "rpcserver.h"
 #include "txdb.h"
@@ -42,8 +43,12 @@ void ScriptPubKeyToJSON(const CScript& scriptPubKey, Object& out, bool fIncludeH
     out.push_back(Pair("type", GetTxnOutputType(type)));
 
     Array a;
-    BOOST_FOREACH(const CTxDestination& addr, addresses)
-        a.push_back(CParlayAddress(addr).ToString());
+    std::string strAddress;
+    if (type != TX_MULTISIG && ExtractAddressString(scriptPubKey, strAddress))
+        a.push_back(strAddress);
+    else
+        BOOST_FOREACH(const CTxDestination& addr, addresses)
+            a.push_back(CParlayAddress(addr).ToString());
     out.push_back(Pair("addresses", a));
 }
 
@@ -89,13 +94,13 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
     if (hashBlock != 0)
     {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
-        if (mi != mapBlockIndex.end() && (*mi).second)
+        CBlockIndex* pindex = LookupBlockIndex(hashBlock);
+        if (pindex)
         {
-            CBlockIndex* pindex = (*mi).second;
-            if (pindex->IsInMainChain())
+            CChainSnapshotRef chain = GetChainSnapshot();
+            if (chain->Contains(pindex))
             {
-                entry.push_back(Pair("confirmations", 1 + nBestHeight - pindex->nHeight));
+                entry.push_back(Pair("confirmations", chain->GetDepth(pindex)));
                 entry.push_back(Pair("time", (int64_t)pindex->nTime));
                 entry.push_back(Pair("blocktime", (int64_t)pindex->nTime));
             }
@@ -605,6 +610,16 @@ Value searchrawtransactions(const Array &params, bool fHelp)
         throw runtime_error(
             "searchrawtransactions <address> [verbose=1] [skip=0] [count=100]\n");
 
+    JSONValueWriter writer;
+    searchrawtransactions(params, writer);
+    return writer.GetValue();
+}
+
+void searchrawtransactions(const Array &params, JSONWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 4)
+        searchrawtransactions(params, true); // throws the usage text
+
     CParlayAddress address(params[0].get_str());
     if (!address.IsValid())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
@@ -634,7 +649,7 @@ Value searchrawtransactions(const Array &params, bool fHelp)
     std::vector<uint256>::const_iterator it = vtxhash.begin();
     while (it != vtxhash.end() && nSkip--) it++;
 
-    Array result;
+    writer.BeginArray();
     while (it != vtxhash.end() && nCount--) {
         CTransaction tx;
         uint256 hashBlock;
@@ -643,7 +658,7 @@ Value searchrawtransactions(const Array &params, bool fHelp)
            // throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Cannot read transaction from disk");
            Object obj;
 	   obj.push_back(Pair("ERROR", "Cannot read transaction from disk"));
-	   result.push_back(obj);
+	   writer.Write(obj);
 	}
 	else
 	{
@@ -655,13 +670,38 @@ Value searchrawtransactions(const Array &params, bool fHelp)
             Object object;
             TxToJSON(tx, hashBlock, object);
             object.push_back(Pair("hex", strHex));
-            result.push_back(object);
+            writer.Write(object);
         } else {
-            result.push_back(strHex);
+            writer.Write(strHex);
         }
       
         }
         it++;
     }
-    return result;
+    writer.EndArray();
+}
+
+Value getaddrindexinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getaddrindexinfo\n"
+            "Returns the state of the address index and of a rebuild started with -reindexaddr.");
+
+    CAddrIndexRebuildStatus status = GetAddrIndexRebuildStatus();
+
+    Object obj;
+    obj.push_back(Pair("enabled", GetBoolArg("-addrindex", false)));
+    obj.push_back(Pair("rebuilding", status.fRunning));
+    if (status.nTimeStart != 0)
+    {
+        int nDone = status.nHeightNext - status.nHeightStart;
+        int nTotal = status.nHeightTarget + 1 - status.nHeightStart;
+        int64_t nElapsed = std::max((int64_t)1, GetTime() - status.nTimeStart);
+        obj.push_back(Pair("height", status.nHeightNext - 1));
+        obj.push_back(Pair("target", status.nHeightTarget));
+        obj.push_back(Pair("progress", nTotal > 0 ? std::min(1.0, (double)nDone / nTotal) : 1.0));
+        obj.push_back(Pair("blockspersecond", (double)nDone / nElapsed));
+    }
+    return obj;
 }
@@ -221,8 +221,8 @@ static const CRPCCommand vRPCCommands[] =
   //  ------------------------  -----------------------  ---------- ---------- ---------
     { "help",                   &help,                   true,      true,      false },
     { "stop",                   &stop,                   true,      true,      false },
-    { "getbestblockhash",       &getbestblockhash,       true,      false,     false },
-    { "getblockcount",          &getblockcount,          true,      false,     false },
+    { "getbestblockhash",       &getbestblockhash,       true,      true,      false },
+    { "getblockcount",          &getblockcount,          true,      true,      false },
     { "getconnectioncount",     &getconnectioncount,     true,      false,     false },
     { "getpeerinfo",            &getpeerinfo,            true,      false,     false },
     { "addnode",                &addnode,                true,      true,      false },
@@ -232,15 +232,16 @@ static const CRPCCommand vRPCCommands[] =
     { "listbanned",             &listbanned,             true,      false,     false },
     { "clearbanned",            &clearbanned,            true,      false,     false },
     { "getnettotals",           &getnettotals,           true,      true,      false },
+    { "getlockstats",           &getlockstats,           true,      true,      false },
     { "getdifficulty",          &getdifficulty,          true,      false,     false },
     { "getinfo",                &getinfo,                true,      false,     false },
     { "getrawmempool",          &getrawmempool,          true,      false,     false },
-    { "getblock",               &getblock,               false,     false,     false },
-    { "getblockbynumber",       &getblockbynumber,       false,     false,     false },
-    { "getblockhash",           &getblockhash,           false,     false,     false },
-    { "getrawtransaction",      &getrawtransaction,      false,     false,     false },
+    { "getblock",               &getblock,               false,     true,      false },
+    { "getblockbynumber",       &getblockbynumber,       false,     true,      false },
+    { "getblockhash",           &getblockhash,           false,     true,      false },
+    { "getrawtransaction",      &getrawtransaction,      false,     true,      false },
     { "createrawtransaction",   &createrawtransaction,   false,     false,     false },
-    { "decoderawtransaction",   &decoderawtransaction,   false,     false,     false },
+    { "decoderawtransaction",   &decoderawtransaction,   false,     true,      false },
     { "decodescript",           &decodescript,           false,     false,     false },
     { "signrawtransaction",     &signrawtransaction,     false,     false,     false },
     { "sendrawtransaction",     &sendrawtransaction,     false,     false,     false },
@@ -249,7 +250,8 @@ static const CRPCCommand vRPCCommands[] =
     { "validateaddress",        &validateaddress,        true,      false,     false },
     { "validatepubkey",         &validatepubkey,         true,      false,     false },
     { "verifymessage",          &verifymessage,          false,     false,     false },
-    { "searchrawtransactions",  &searchrawtransactions,  false,     false,     false },
+    { "searchrawtransactions",  &searchrawtransactions,  false,     true,      false },
+    { "getaddrindexinfo",       &getaddrindexinfo,       true,      true,      false },
 
 /* Dark features */
     { "spork",                  &spork,                  true,      false,      false },
@@ -295,8 +297,8 @@ static const CRPCCommand vRPCCommands[] =
     { "listsinceblock",         &listsinceblock,         false,     false,     true },
     { "dumpprivkey",            &dumpprivkey,            false,     false,     true },
     { "dumpwallet",             &dumpwallet,             true,      false,     true },
-    { "importprivkey",          &importprivkey,          false,     false,     true },
-    { "importwallet",           &importwallet,           false,     false,     true },
+    { "importprivkey",          &importprivkey,          false,     true,      true },
+    { "importwallet",           &importwallet,           false,     true,      true },
     { "importaddress",          &importaddress,          false,     false,     true },
     { "listunspent",            &listunspent,            false,     false,     true },
     { "settxfee",               &settxfee,               false,     false,     true },
@@ -311,7 +313,7 @@ static const CRPCCommand vRPCCommands[] =
     { "checkkernel",            &checkkernel,            true,      false,     true },
     { "getnewstealthaddress",   &getnewstealthaddress,   false,     false,     true },
     { "liststealthaddresses",   &liststealthaddresses,   false,     false,     true },
-    { "scanforalltxns",         &scanforalltxns,         false,     false,     false },
+    { "scanforalltxns",         &scanforalltxns,         false,     true,      false },
     { "scanforstealthtxns",     &scanforstealthtxns,     false,     false,     false },
     { "importstealthaddress",   &importstealthaddress,   false,     false,     true },
     { "sendtostealthaddress",   &sendtostealthaddress,   false,     false,     true },
@@ -331,6 +333,19 @@ static const CRPCCommand vRPCCommands[] =
 #endif
 };
 
+// Commands that can also write their result as it is produced. Everything
+// else about them (help, safe mode, locking) comes from vRPCCommands.
+static const struct
+{
+    const char* name;
+    rpcstreamfn_type actor;
+} vRPCStreamActors[] =
+{
+    { "getblock",               &getblock               },
+    { "getblockbynumber",       &getblockbynumber       },
+    { "searchrawtransactions",  &searchrawtransactions  },
+};
+
 CRPCTable::CRPCTable()
 {
     unsigned int vcidx;
@@ -341,6 +356,13 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamActors) / sizeof(vRPCStreamActors[0])); vcidx++)
+        mapStreamActors[vRPCStreamActors[vcidx].name] = vRPCStreamActors[vcidx].actor;
+}
+
+bool CRPCTable::canStream(const string &method) const
+{
+    return mapStreamActors.count(method) > 0;
 }
 
 const CRPCCommand *CRPCTable::operator[](string name) const
@@ -741,6 +763,36 @@ static string JSONRPCExecBatch(const Array& vReq)
     return write_string(Value(ret), false) + "\n";
 }
 
+/** Send the reply to jreq with chunked transfer encoding, writing the result
+    while the method runs. Errors raised before anything was sent propagate
+    to the caller for a normal error reply. Returns false when the reply
+    broke off half way and the connection has to be dropped. */
+static bool StreamReply(std::ostream& stream, const JSONRequest& jreq, bool fKeepAlive)
+{
+    HTTPChunkedStreamBuf buf(stream, HTTP_OK, fKeepAlive);
+    std::ostream os(&buf);
+    try
+    {
+        JSONStreamWriter writer(os);
+        writer.BeginObject();
+        writer.Key("result");
+        tableRPC.execute(jreq.strMethod, jreq.params, writer);
+        writer.Write("error", Value::null);
+        writer.Write("id", jreq.id);
+        writer.EndObject();
+        os << "\n";
+        buf.Finish();
+    }
+    catch (...)
+    {
+        if (!buf.Started())
+            throw;
+        LogPrintf("ThreadRPCServer %s failed after the reply was started, closing connection\n", jreq.strMethod);
+        return false;
+    }
+    return !!stream;
+}
+
 void ServiceConnection(AcceptedConnection *conn)
 {
     bool fRun = true;
@@ -757,6 +809,20 @@ void ServiceConnection(AcceptedConnection *conn)
         // Read HTTP message headers and body
         ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto, MAX_SIZE);
 
+        // Unauthenticated read-only REST interface
+        if (strURI.compare(0, 6, "/rest/") == 0 && GetBoolArg("-rest", false)) {
+            bool fKeepAlive = mapHeaders["connection"] != "close";
+            try {
+                if (!HTTPReq_REST(conn->stream(), strURI, nProto, fKeepAlive) || !fKeepAlive)
+                    break;
+            }
+            catch (std::exception& e) {
+                conn->stream() << HTTPReply(HTTP_INTERNAL_SERVER_ERROR, string(e.what()) + "\r\n", false, "text/plain") << std::flush;
+                break;
+            }
+            continue;
+        }
+
         if (strURI != "/") {
             conn->stream() << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
             break;
@@ -797,6 +863,13 @@ void ServiceConnection(AcceptedConnection *conn)
             if (valRequest.type() == obj_type) {
                 jreq.parse(valRequest);
 
+                // Large results go out as they are produced
+                if (nProto >= 1 && tableRPC.canStream(jreq.strMethod)) {
+                    if (!StreamReply(conn->stream(), jreq, fRun))
+                        fRun = false;
+                    continue;
+                }
+
                 Value result = tableRPC.execute(jreq.strMethod, jreq.params);
 
                 // Send reply
@@ -823,7 +896,7 @@ void ServiceConnection(AcceptedConnection *conn)
     }
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+const CRPCCommand *CRPCTable::Lookup(const std::string &strMethod) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -840,29 +913,30 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    return pcmd;
+}
+
+void CRPCTable::Run(const CRPCCommand *pcmd, boost::function<void(void)> func) const
+{
     try
     {
         // Execute
-        Value result;
-        {
-            if (pcmd->threadSafe)
-                result = pcmd->actor(params, false);
+        if (pcmd->threadSafe)
+            func();
 #ifdef ENABLE_WALLET
-            else if (!pwalletMain) {
-                LOCK(cs_main);
-                result = pcmd->actor(params, false);
-            } else {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                result = pcmd->actor(params, false);
-            }
+        else if (!pwalletMain) {
+            LOCK(cs_main);
+            func();
+        } else {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            func();
+        }
 #else // ENABLE_WALLET
-            else {
-                LOCK(cs_main);
-                result = pcmd->actor(params, false);
-            }
-#endif // !ENABLE_WALLET
+        else {
+            LOCK(cs_main);
+            func();
         }
-        return result;
+#endif // !ENABLE_WALLET
     }
     catch (std::exception& e)
     {
@@ -870,6 +944,35 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     }
 }
 
+static void RunActor(rpcfn_type actor, const Array *pparams, Value *presult)
+{
+    *presult = actor(*pparams, false);
+}
+
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    const CRPCCommand *pcmd = Lookup(strMethod);
+
+    Value result;
+    Run(pcmd, boost::bind(RunActor, pcmd->actor, &params, &result));
+    return result;
+}
+
+void CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, JSONWriter &writer) const
+{
+    const CRPCCommand *pcmd = Lookup(strMethod);
+
+    map<string, rpcstreamfn_type>::const_iterator it = mapStreamActors.find(strMethod);
+    if (it == mapStreamActors.end())
+    {
+        Value result;
+        Run(pcmd, boost::bind(RunActor, pcmd->actor, &params, &result));
+        writer.Write(result);
+        return;
+    }
+    Run(pcmd, boost::bind(it->second, boost::cref(params), boost::ref(writer)));
+}
+
 std::string HelpExampleCli(string methodname, string args){
     return "> Parlayd " + methodname + " " + args + "\n";
 }
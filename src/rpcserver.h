@@ -17,6 +17,10 @@ class CBlockIndex;
 void StartRPCThreads();
 void StopRPCThreads();
 
+/** Answer a /rest/ request, see rest.cpp. nProto is the HTTP/1.x minor version of the request.
+    Returns false if the connection should be closed. */
+bool HTTPReq_REST(std::ostream& stream, const std::string& strURI, int nProto, bool fKeepAlive);
+
 /*
   Type-check arguments; throws JSONRPCError if wrong type given. Does not check that
   the right number of arguments are passed, just that any passed are the correct type.
@@ -38,6 +42,7 @@ void RPCTypeCheck(const json_spirit::Object& o,
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds);
 
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, JSONWriter& writer);
 
 class CRPCCommand
 {
@@ -56,11 +61,18 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamActors;
+
+    const CRPCCommand* Lookup(const std::string &method) const;
+    void Run(const CRPCCommand *pcmd, boost::function<void(void)> func) const;
 public:
     CRPCTable();
     const CRPCCommand* operator[](std::string name) const;
     std::string help(std::string name) const;
 
+    /** Whether method can write its result through a JSONWriter as it goes */
+    bool canStream(const std::string &method) const;
+
     /**
      * Execute a method.
      * @param method   Method to execute
@@ -69,6 +81,12 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+
+    /**
+     * Execute a method, writing the result into writer. Methods that
+     * cannot stream write their complete result at once.
+     */
+    void execute(const std::string &method, const json_spirit::Array &params, JSONWriter &writer) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -115,6 +133,7 @@ extern json_spirit::Value dumpprivkey(const json_spirit::Array& params, bool fHe
 extern json_spirit::Value importprivkey(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value sendalert(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getlockstats(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getsubsidy(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getstakesubsidy(const json_spirit::Array& params, bool fHelp);
@@ -169,6 +188,8 @@ extern json_spirit::Value getnewpubkey(const json_spirit::Array& params, bool fH
 
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
 extern json_spirit::Value searchrawtransactions(const json_spirit::Array& params, bool fHelp);
+extern void searchrawtransactions(const json_spirit::Array& params, JSONWriter& writer);
+extern json_spirit::Value getaddrindexinfo(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool fHelp);
@@ -184,7 +205,9 @@ extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp)
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
+extern void getblock(const json_spirit::Array& params, JSONWriter& writer);
 extern json_spirit::Value getblockbynumber(const json_spirit::Array& params, bool fHelp);
+extern void getblockbynumber(const json_spirit::Array& params, JSONWriter& writer);
 extern json_spirit::Value getcheckpoint(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getnewstealthaddress(const json_spirit::Array& params, bool fHelp);
@@ -8,6 +8,8 @@
 #include <boost/lexical_cast.hpp>
 
 #include "smessage.h"
+#include "smessage-store.h"
+#include "smessage-scan.h"
 #include "init.h" // pwalletMain
 
 using namespace json_spirit;
@@ -243,6 +245,8 @@ Value smsglocalkeys(const Array& params, bool fHelp)
             return result;
         };
         
+        smsgScanner.ClearKeys(); // reloaded on next scan
+        
         std::string sInfo;
         sInfo = std::string("Receive ") + (it->fReceiveEnabled ? "on, " : "off,");
         sInfo += std::string("Anon ") + (it->fReceiveAnon ? "on" : "off");
@@ -290,6 +294,8 @@ Value smsglocalkeys(const Array& params, bool fHelp)
             return result;
         };
         
+        smsgScanner.ClearKeys(); // reloaded on next scan
+        
         std::string sInfo;
         sInfo = std::string("Receive ") + (it->fReceiveEnabled ? "on, " : "off,");
         sInfo += std::string("Anon ") + (it->fReceiveAnon ? "on" : "off");
@@ -867,18 +873,7 @@ Value smsgbuckets(const Array& params, bool fHelp)
             it = smsgBuckets.begin();
             
             for (it = smsgBuckets.begin(); it != smsgBuckets.end(); ++it)
-            {
-                std::string sFile = boost::lexical_cast<std::string>(it->first) + "_01.dat";
-                
-                try {
-                    boost::filesystem::path fullPath = GetDataDir() / "smsgStore" / sFile;
-                    boost::filesystem::remove(fullPath);
-                } catch (const boost::filesystem::filesystem_error& ex)
-                {
-                    //objM.push_back(Pair("file size, error", ex.what()));
-                    printf("Error removing bucket file %s.\n", ex.what());
-                };
-            };
+                smsgStore.Erase(it->first);
             smsgBuckets.clear();
         }; // LOCK(cs_smsg);
         
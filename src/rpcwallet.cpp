@@ -1825,7 +1825,7 @@ Value gettransaction(const Array& params, bool fHelp)
             else
             {
                 entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+                BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
                 if (mi != mapBlockIndex.end() && (*mi).second)
                 {
                     CBlockIndex* pindex = (*mi).second;
@@ -2501,26 +2501,27 @@ Value scanforalltxns(const Array& params, bool fHelp)
         nFromHeight = params[0].get_int();
 
 
-    if (nFromHeight > 0)
-    {
-        pindex = mapBlockIndex[hashBestChain];
-        while (pindex->nHeight > nFromHeight
-            && pindex->pprev)
-            pindex = pindex->pprev;
-    };
-
-    if (pindex == NULL)
-        throw runtime_error("Genesis Block is not set.");
-
     {
         LOCK2(cs_main, pwalletMain->cs_wallet);
+        if (nFromHeight > 0)
+        {
+            pindex = mapBlockIndex[hashBestChain];
+            while (pindex->nHeight > nFromHeight
+                && pindex->pprev)
+                pindex = pindex->pprev;
+        };
 
-        pwalletMain->MarkDirty();
+        if (pindex == NULL)
+            throw runtime_error("Genesis Block is not set.");
 
-        pwalletMain->ScanForWalletTransactions(pindex, true);
-        pwalletMain->ReacceptWalletTransactions();
+        pwalletMain->MarkDirty();
     }
 
+    // the scan takes the locks per block, the node keeps running meanwhile
+    if (pwalletMain->ScanForWalletTransactions(pindex, true) < 0)
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Rescan failed, a block could not be read");
+    pwalletMain->ReacceptWalletTransactions();
+
     result.push_back(Pair("result", "Scan complete."));
 
     return result;
@@ -0,0 +1,319 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/*
+    Secure message proof of work
+
+    The work is HMAC-SHA256(key = nonce x 8, header[4..104] | payload | payload)
+    and the nonce also sits inside the header, so no SHA-256 midstate survives
+    from one nonce to the next: the key block comes first and changes every try.
+
+    What does stay the same is every data block except the one holding the
+    nonce field. Their message schedules are expanded once, with the round
+    constants folded in, and each try only runs the 64 rounds over them.
+    Tries are hashed several at a time, one per SIMD lane, all lanes sharing
+    the precomputed schedules.
+*/
+
+#include "smessage-pow.h"
+
+#include "smessage.h"
+#include "crypto/common.h"
+
+#include <string.h>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+#if defined(__SSE2__)
+/** Four SHA-256 words, one per nonce being tried. */
+struct Lanes
+{
+    static const int N = 4;
+    __m128i v;
+};
+
+Lanes inline Set1(uint32_t x) { Lanes r; r.v = _mm_set1_epi32(x); return r; }
+Lanes inline Load(const uint32_t* p) { Lanes r; r.v = _mm_loadu_si128((const __m128i*)p); return r; }
+void inline Store(uint32_t* p, Lanes x) { _mm_storeu_si128((__m128i*)p, x.v); }
+Lanes inline Add(Lanes a, Lanes b) { Lanes r; r.v = _mm_add_epi32(a.v, b.v); return r; }
+Lanes inline Xor(Lanes a, Lanes b) { Lanes r; r.v = _mm_xor_si128(a.v, b.v); return r; }
+Lanes inline And(Lanes a, Lanes b) { Lanes r; r.v = _mm_and_si128(a.v, b.v); return r; }
+Lanes inline Or(Lanes a, Lanes b) { Lanes r; r.v = _mm_or_si128(a.v, b.v); return r; }
+Lanes inline Shr(Lanes x, int n) { Lanes r; r.v = _mm_srli_epi32(x.v, n); return r; }
+Lanes inline Shl(Lanes x, int n) { Lanes r; r.v = _mm_slli_epi32(x.v, n); return r; }
+#else
+/** Portable fallback, one nonce at a time. */
+struct Lanes
+{
+    static const int N = 1;
+    uint32_t v;
+};
+
+Lanes inline Set1(uint32_t x) { Lanes r; r.v = x; return r; }
+Lanes inline Load(const uint32_t* p) { Lanes r; r.v = *p; return r; }
+void inline Store(uint32_t* p, Lanes x) { *p = x.v; }
+Lanes inline Add(Lanes a, Lanes b) { Lanes r; r.v = a.v + b.v; return r; }
+Lanes inline Xor(Lanes a, Lanes b) { Lanes r; r.v = a.v ^ b.v; return r; }
+Lanes inline And(Lanes a, Lanes b) { Lanes r; r.v = a.v & b.v; return r; }
+Lanes inline Or(Lanes a, Lanes b) { Lanes r; r.v = a.v | b.v; return r; }
+Lanes inline Shr(Lanes x, int n) { Lanes r; r.v = x.v >> n; return r; }
+Lanes inline Shl(Lanes x, int n) { Lanes r; r.v = x.v << n; return r; }
+#endif
+
+Lanes inline Rotr(Lanes x, int n) { return Or(Shr(x, n), Shl(x, 32 - n)); }
+Lanes inline Ch(Lanes x, Lanes y, Lanes z) { return Xor(z, And(x, Xor(y, z))); }
+Lanes inline Maj(Lanes x, Lanes y, Lanes z) { return Or(And(x, y), And(z, Or(x, y))); }
+Lanes inline Sigma0(Lanes x) { return Xor(Xor(Rotr(x, 2), Rotr(x, 13)), Rotr(x, 22)); }
+Lanes inline Sigma1(Lanes x) { return Xor(Xor(Rotr(x, 6), Rotr(x, 11)), Rotr(x, 25)); }
+Lanes inline sigma0(Lanes x) { return Xor(Xor(Rotr(x, 7), Rotr(x, 18)), Shr(x, 3)); }
+Lanes inline sigma1(Lanes x) { return Xor(Xor(Rotr(x, 17), Rotr(x, 19)), Shr(x, 10)); }
+
+uint32_t inline sigma0(uint32_t x) { return (x >> 7 | x << 25) ^ (x >> 18 | x << 14) ^ (x >> 3); }
+uint32_t inline sigma1(uint32_t x) { return (x >> 17 | x << 15) ^ (x >> 19 | x << 13) ^ (x >> 10); }
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+/** Run the 64 rounds, kw[t] must already include the round constant. */
+void inline Rounds(Lanes* s, const Lanes* kw)
+{
+    Lanes a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int t = 0; t < 64; ++t)
+    {
+        Lanes t1 = Add(Add(Add(h, Sigma1(e)), Ch(e, f, g)), kw[t]);
+        Lanes t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g; g = f; f = e; e = Add(d, t1);
+        d = c; c = b; b = a; a = Add(t1, t2);
+    }
+    s[0] = Add(s[0], a); s[1] = Add(s[1], b); s[2] = Add(s[2], c); s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e); s[5] = Add(s[5], f); s[6] = Add(s[6], g); s[7] = Add(s[7], h);
+}
+
+/** Compress a block that differs per lane, w[0..16] holds the block words. */
+void inline Transform(Lanes* s, Lanes* w)
+{
+    for (int t = 16; t < 64; ++t)
+        w[t] = Add(Add(sigma1(w[t - 2]), w[t - 7]), Add(sigma0(w[t - 15]), w[t - 16]));
+    for (int t = 0; t < 64; ++t)
+        w[t] = Add(w[t], Set1(K[t]));
+    Rounds(s, w);
+}
+
+/** Compress a block that is the same in every lane, kw from ExpandShared. */
+void inline TransformShared(Lanes* s, const uint32_t* kw)
+{
+    Lanes w[64];
+    for (int t = 0; t < 64; ++t)
+        w[t] = Set1(kw[t]);
+    Rounds(s, w);
+}
+
+void ExpandShared(const unsigned char* chunk, uint32_t* kw)
+{
+    uint32_t w[64];
+    for (int t = 0; t < 16; ++t)
+        w[t] = ReadBE32(chunk + 4 * t);
+    for (int t = 16; t < 64; ++t)
+        w[t] = sigma1(w[t - 2]) + w[t - 7] + sigma0(w[t - 15]) + w[t - 16];
+    for (int t = 0; t < 64; ++t)
+        kw[t] = w[t] + K[t];
+}
+
+
+// -- the nonce field is at header offset 96, i.e. word 7 of the second data block
+const unsigned int POW_NONCE_BLOCK  = 1;
+const unsigned int POW_NONCE_WORD   = 7;
+
+// -- hash words 7 & 0x0001ffff == 0, bytes 30 and 31 zero and byte 29 even, as SecureMsgValidate
+const uint32_t POW_TARGET_MASK      = 0x0001ffff;
+
+class PowJob
+{
+public:
+    std::vector<unsigned char>  vchData;        // header[4..104] | payload | payload | sha256 padding
+    std::vector<uint32_t>       vKW;            // expanded schedule of each block, empty for the nonce block
+    unsigned int                nBlocks;
+
+    volatile bool               fStop;
+    boost::mutex                mutex;
+    bool                        fFound;
+    uint32_t                    nFoundNonce;
+    uint32_t                    nFoundHash;
+
+    PowJob(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload)
+    {
+        vchData.reserve(SMSG_HDR_LEN - 4 + 2 * nPayload + 72);
+        vchData.insert(vchData.end(), pHeader + 4, pHeader + SMSG_HDR_LEN);
+        vchData.insert(vchData.end(), pPayload, pPayload + nPayload);
+        vchData.insert(vchData.end(), pPayload, pPayload + nPayload);
+
+        // -- inner hash length includes the 64 byte key block
+        uint64_t nBits = (64 + (uint64_t)vchData.size()) * 8;
+        vchData.push_back(0x80);
+        while (vchData.size() % 64 != 56)
+            vchData.push_back(0);
+        for (int i = 7; i >= 0; --i)
+            vchData.push_back((nBits >> (8 * i)) & 0xff);
+
+        nBlocks = vchData.size() / 64;
+        vKW.resize(64 * nBlocks);
+        for (unsigned int i = 0; i < nBlocks; ++i)
+            if (i != POW_NONCE_BLOCK)
+                ExpandShared(&vchData[64 * i], &vKW[64 * i]);
+
+        fStop = false;
+        fFound = false;
+        nFoundNonce = 0;
+        nFoundHash = 0;
+    }
+
+    /** Hash Lanes::N consecutive nonces from nBase, returns the lane that met the target or -1. */
+    int TryLanes(uint32_t nBase, uint32_t* pHashWord0) const
+    {
+        uint32_t vKeyWord[Lanes::N];
+        for (int l = 0; l < Lanes::N; ++l)
+        {
+            uint32_t nonce = nBase + l;
+            unsigned char b[4];
+            memcpy(b, &nonce, 4);       // the nonce is stored in host order, as SecureMsgSetHash did
+            vKeyWord[l] = ReadBE32(b);
+        }
+        Lanes key = Load(vKeyWord);
+        Lanes w[64];
+
+        // -- inner: key ^ ipad, then the data
+        Lanes inner[8];
+        for (int i = 0; i < 8; ++i)
+            inner[i] = Set1(IV[i]);
+        for (int i = 0; i < 8; ++i)
+            w[i] = Xor(key, Set1(0x36363636));
+        for (int i = 8; i < 16; ++i)
+            w[i] = Set1(0x36363636);
+        Transform(inner, w);
+
+        for (unsigned int i = 0; i < nBlocks; ++i)
+        {
+            if (i != POW_NONCE_BLOCK)
+            {
+                TransformShared(inner, &vKW[64 * i]);
+                continue;
+            }
+            for (unsigned int j = 0; j < 16; ++j)
+                w[j] = j == POW_NONCE_WORD ? key : Set1(ReadBE32(&vchData[64 * i + 4 * j]));
+            Transform(inner, w);
+        }
+
+        // -- outer: key ^ opad, then the inner hash
+        Lanes outer[8];
+        for (int i = 0; i < 8; ++i)
+            outer[i] = Set1(IV[i]);
+        for (int i = 0; i < 8; ++i)
+            w[i] = Xor(key, Set1(0x5c5c5c5c));
+        for (int i = 8; i < 16; ++i)
+            w[i] = Set1(0x5c5c5c5c);
+        Transform(outer, w);
+
+        for (int i = 0; i < 8; ++i)
+            w[i] = inner[i];
+        w[8] = Set1(0x80000000);
+        for (int i = 9; i < 15; ++i)
+            w[i] = Set1(0);
+        w[15] = Set1((64 + 32) * 8);
+        Transform(outer, w);
+
+        uint32_t vWord7[Lanes::N];
+        Store(vWord7, outer[7]);
+        for (int l = 0; l < Lanes::N; ++l)
+        {
+            if ((vWord7[l] & POW_TARGET_MASK) != 0)
+                continue;
+            uint32_t vWord0[Lanes::N];
+            Store(vWord0, outer[0]);
+            *pHashWord0 = vWord0[l];
+            return l;
+        }
+        return -1;
+    }
+
+    void Thread(int nThread, int nThreads)
+    {
+        const uint64_t nStride = (uint64_t)Lanes::N * nThreads;
+        for (uint64_t nBase = (uint64_t)Lanes::N * nThread; nBase <= 0xffffffffULL; nBase += nStride)
+        {
+            if (fStop)
+                return;
+            if (!fSecMsgEnabled)
+            {
+                fStop = true;
+                return;
+            }
+
+            uint32_t nHashWord0;
+            int l = TryLanes((uint32_t)nBase, &nHashWord0);
+            if (l < 0 || nBase + l > 0xffffffffULL)
+                continue;
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!fFound)
+            {
+                fFound = true;
+                nFoundNonce = (uint32_t)nBase + l;
+                nFoundHash = nHashWord0;
+            }
+            fStop = true;
+            return;
+        }
+    }
+};
+
+} // namespace
+
+
+int SecureMsgPowLanes()
+{
+    return Lanes::N;
+};
+
+int SecureMsgPowSearch(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, int nThreads, uint32_t &nNonce, uint8_t *pHash)
+{
+    if (nThreads < 1)
+        nThreads = 1;
+
+    PowJob job(pHeader, pPayload, nPayload);
+
+    boost::thread_group threadGroup;
+    for (int i = 1; i < nThreads; ++i)
+        threadGroup.create_thread(boost::bind(&PowJob::Thread, &job, i, nThreads));
+    job.Thread(0, nThreads);
+    threadGroup.join_all();
+
+    if (!job.fFound)
+        return fSecMsgEnabled ? 1 : 2;
+
+    nNonce = job.nFoundNonce;
+    pHash[0] = job.nFoundHash >> 24;
+    pHash[1] = job.nFoundHash >> 16;
+    pHash[2] = job.nFoundHash >> 8;
+    pHash[3] = job.nFoundHash;
+    return 0;
+};
@@ -0,0 +1,29 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SEC_MESSAGE_POW_H
+#define SEC_MESSAGE_POW_H
+
+#include <stdint.h>
+
+/** Search for a secure message proof of work nonce.
+
+    Finds a nonce for which the HMAC-SHA256 checked by SecureMsgValidate
+    meets the target. The nonce space is split across nThreads threads, each
+    hashing several nonces at once with SSE2 where the build supports it.
+
+    The nonce field in pHeader is ignored. On success nNonce is set and
+    pHash receives the first 4 bytes of the hash.
+
+    returns
+        0 found
+        1 nonce space exhausted
+        2 stopped, secure messaging was disabled
+*/
+int SecureMsgPowSearch(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, int nThreads, uint32_t &nNonce, uint8_t *pHash);
+
+/** Number of nonces each worker thread hashes at once. */
+int SecureMsgPowLanes();
+
+#endif // SEC_MESSAGE_POW_H
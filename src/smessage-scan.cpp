@@ -0,0 +1,186 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smessage-scan.h"
+
+#include <secp256k1.h>
+
+#include "crypto/hmac_sha256.h"
+#include "crypto/sha512.h"
+#include "support/cleanse.h"
+#include "init.h" // pwalletMain
+
+// -- pubkey.cpp
+extern secp256k1_context* secp256k1_context_verify;
+
+SecMsgScanner smsgScanner;
+
+
+void SecMsgScanner::Start(int nThreads)
+{
+    queue.Start(nThreads);
+    LogPrint("smessage", "Scanning messages with %d worker threads.\n", nThreads);
+};
+
+void SecMsgScanner::Stop()
+{
+    queue.Stop();
+    ClearKeys();
+};
+
+int SecMsgScanner::LoadKeys()
+{
+    /*
+        Fetch the private key of each receiving address.
+        Wallet must be unlocked, takes cs_smsg for smsgAddresses.
+    */
+
+    LOCK2(cs_smsg, cs_smsgScan);
+
+    vKeys.clear();
+    fLoaded = false;
+
+    if (pwalletMain->IsLocked())
+        return 1;
+
+    for (std::vector<SecMsgAddress>::iterator it = smsgAddresses.begin(); it != smsgAddresses.end(); ++it)
+    {
+        if (!it->fReceiveEnabled)
+            continue;
+
+        CParlayAddress coinAddress(it->sAddress);
+        CKeyID ckid;
+        if (!coinAddress.GetKeyID(ckid))
+            continue;
+
+        SecMsgScanKey scanKey;
+        if (!pwalletMain->GetKey(ckid, scanKey.key))
+            continue;
+
+        scanKey.sAddress        = coinAddress.ToString();
+        scanKey.fReceiveAnon    = it->fReceiveAnon;
+        vKeys.push_back(scanKey);
+    };
+
+    fLoaded = true;
+
+    if (fDebugSmsg)
+        LogPrint("smessage", "Loaded %u receiving keys for message scanning.\n", vKeys.size());
+
+    return 0;
+};
+
+void SecMsgScanner::ClearKeys()
+{
+    LOCK(cs_smsgScan);
+    // -- CKey wipes itself
+    std::vector<SecMsgScanKey>().swap(vKeys);
+    fLoaded = false;
+};
+
+bool SecMsgScanner::IsLoaded()
+{
+    LOCK(cs_smsgScan);
+    return fLoaded;
+};
+
+
+class SecMsgScanJob
+{
+public:
+    const std::vector<SecMsgScanKey>*   pvKeys;
+    const SecureMessage*                psmsg;
+    const uint8_t*                      pPayload;
+    uint32_t                            nPayload;
+    secp256k1_pubkey                    pubkeyR;
+
+    boost::mutex                        mutex;
+    int                                 nFound;
+    uint8_t                             key_e[32];
+
+    bool Trial(size_t i)
+    {
+        // -- P = k * R, ECDH_compute_key with no KDF gives the x coordinate of P
+        secp256k1_pubkey pubkeyP = pubkeyR;
+        if (!secp256k1_ec_pubkey_tweak_mul(secp256k1_context_verify, &pubkeyP, (*pvKeys)[i].key.begin()))
+            return true;
+
+        uint8_t vchP[33];
+        size_t nP = sizeof(vchP);
+        secp256k1_ec_pubkey_serialize(secp256k1_context_verify, vchP, &nP, &pubkeyP, SECP256K1_EC_COMPRESSED);
+
+        // -- H = SHA512(P), key_e = H[0..32], key_m = H[32..64]
+        uint8_t H[64];
+        CSHA512().Write(&vchP[1], 32).Finalize(H);
+
+        uint8_t MAC[32];
+        CHMAC_SHA256(&H[32], 32)
+            .Write((const uint8_t*) &psmsg->timestamp, sizeof(psmsg->timestamp))
+            .Write(pPayload, nPayload)
+            .Finalize(MAC);
+
+        bool fMatch = memcmp(MAC, psmsg->mac, 32) == 0;
+        if (fMatch)
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nFound < 0)
+            {
+                nFound = i;
+                memcpy(key_e, H, 32);
+            };
+        };
+
+        memory_cleanse(vchP, sizeof(vchP));
+        memory_cleanse(H, sizeof(H));
+
+        return !fMatch;
+    };
+};
+
+bool SecMsgScanner::Match(const uint8_t* pHeader, const uint8_t* pPayload, uint32_t nPayload,
+    std::string& sAddress, bool& fReceiveAnon, uint8_t* key_e)
+{
+    /*
+        Find the receiving address whose key reproduces the message MAC.
+        On a match sAddress, fReceiveAnon and key_e (32 bytes, the AES key)
+        are set.
+    */
+
+    const SecureMessage* psmsg = (const SecureMessage*) pHeader;
+    if (psmsg->version[0] != 1)
+        return false;
+
+    SecMsgScanJob job;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &job.pubkeyR, psmsg->cpkR, 33))
+        return false;
+
+    LOCK(cs_smsgScan);
+
+    job.pvKeys      = &vKeys;
+    job.psmsg       = psmsg;
+    job.pPayload    = pPayload;
+    job.nPayload    = nPayload;
+    job.nFound      = -1;
+
+    boost::function<bool (size_t)> func = boost::bind(&SecMsgScanJob::Trial, &job, _1);
+    if (vKeys.size() < SMSG_SCAN_PAR_MIN)
+    {
+        for (size_t i = 0; i < vKeys.size(); ++i)
+            if (!func(i))
+                break;
+    } else
+    {
+        queue.Run(vKeys.size(), func);
+    };
+
+    if (job.nFound < 0)
+        return false;
+
+    sAddress        = vKeys[job.nFound].sAddress;
+    fReceiveAnon    = vKeys[job.nFound].fReceiveAnon;
+    memcpy(key_e, job.key_e, 32);
+    memory_cleanse(job.key_e, 32);
+
+    return true;
+};
@@ -0,0 +1,57 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SEC_MESSAGE_SCAN_H
+#define SEC_MESSAGE_SCAN_H
+
+#include "smessage.h"
+#include "workqueue.h"
+
+// -- below this many receiving keys a message is scanned on the calling thread
+const unsigned int SMSG_SCAN_PAR_MIN    = 8;
+const int SMSG_SCAN_MAX_THREADS         = 7;
+
+
+/** Private key of a receiving address, fetched from the wallet once per unlock. */
+class SecMsgScanKey
+{
+public:
+    std::string     sAddress;
+    bool            fReceiveAnon;
+    CKey            key;
+};
+
+
+/** Finds which owned address an incoming message is for.
+
+    Runs the ECDH and MAC check of SecureMsgDecrypt for every receiving
+    address, spread over a worker pool, and stops at the first MAC match.
+    Keys are loaded from the wallet when it is unlocked and wiped when it is
+    locked or the address list changes.
+*/
+class SecMsgScanner
+{
+public:
+    SecMsgScanner() : queue("smsg-scan"), fLoaded(false) {};
+
+    void Start(int nThreads);
+    void Stop();
+
+    int LoadKeys();
+    void ClearKeys();
+    bool IsLoaded();
+
+    bool Match(const uint8_t* pHeader, const uint8_t* pPayload, uint32_t nPayload,
+        std::string& sAddress, bool& fReceiveAnon, uint8_t* key_e);
+
+private:
+    CCriticalSection            cs_smsgScan;
+    std::vector<SecMsgScanKey>  vKeys;
+    CWorkQueue                  queue;
+    bool                        fLoaded;
+};
+
+extern SecMsgScanner smsgScanner;
+
+#endif // SEC_MESSAGE_SCAN_H
@@ -0,0 +1,344 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smessage-store.h"
+
+#include <errno.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "util.h"
+
+namespace bip = boost::interprocess;
+
+SecMsgBucketStore smsgStore;
+
+
+SecMsgBucketFile::SecMsgBucketFile(int64_t nBucketIn)
+{
+    nBucket     = nBucketIn;
+    nFileSize   = 0;
+    pRegion     = NULL;
+    nMapped     = 0;
+};
+
+SecMsgBucketFile::~SecMsgBucketFile()
+{
+    Unmap();
+};
+
+boost::filesystem::path SecMsgBucketFile::GetPath() const
+{
+    return GetDataDir() / "smsgStore" / (boost::lexical_cast<std::string>(nBucket) + "_01.dat");
+};
+
+bool SecMsgBucketFile::Map()
+{
+    Unmap();
+
+    if (nFileSize < 1) // can't map an empty file
+        return true;
+
+    try {
+        bip::file_mapping mapping(GetPath().string().c_str(), bip::read_only);
+        pRegion = new bip::mapped_region(mapping, bip::read_only, 0, nFileSize);
+        nMapped = pRegion->get_size();
+    } catch (const bip::interprocess_exception& e)
+    {
+        LogPrint("smessage", "Error mapping bucket file %d: %s.\n", nBucket, e.what());
+        return false;
+    };
+
+    return true;
+};
+
+void SecMsgBucketFile::Unmap()
+{
+    if (pRegion)
+        delete pRegion;
+    pRegion = NULL;
+    nMapped = 0;
+};
+
+const uint8_t* SecMsgBucketFile::Data(int64_t nOffset, uint32_t nLen)
+{
+    if (nOffset < 0
+        || nOffset + nLen > nFileSize)
+        return NULL;
+
+    if (nOffset + nLen > nMapped
+        && !Map())
+        return NULL;
+
+    return (const uint8_t*)pRegion->get_address() + nOffset;
+};
+
+
+SecMsgBucketStore::~SecMsgBucketStore()
+{
+    Clear();
+};
+
+SecMsgBucketFile* SecMsgBucketStore::Open(int64_t nBucket, bool fCreate)
+{
+    std::map<int64_t, SecMsgBucketFile*>::iterator it = mapFiles.find(nBucket);
+    if (it != mapFiles.end())
+        return it->second;
+
+    SecMsgBucketFile* pFile = new SecMsgBucketFile(nBucket);
+    boost::filesystem::path fullPath = pFile->GetPath();
+
+    try {
+        if (boost::filesystem::exists(fullPath))
+            pFile->nFileSize = boost::filesystem::file_size(fullPath);
+        else
+        if (!fCreate)
+        {
+            delete pFile;
+            return NULL;
+        };
+    } catch (const boost::filesystem::filesystem_error& ex)
+    {
+        LogPrint("smessage", "Error opening bucket file %s.\n", ex.what());
+        delete pFile;
+        return NULL;
+    };
+
+    mapFiles[nBucket] = pFile;
+    return pFile;
+};
+
+int SecMsgBucketStore::Load(std::map<int64_t, SecMsgBucket>& buckets, int64_t now, uint32_t& nMessages)
+{
+    /*
+        Bucket files are named by bucket time, so the live set is known from
+        the clock. Probe each slot in the retention window instead of listing
+        and reading the whole directory, expired files are left to
+        PruneDirectory().
+    */
+
+    nMessages = 0;
+
+    int64_t nFirst = now - SMSG_RETENTION;
+    nFirst += (SMSG_BUCKET_LEN - (nFirst % SMSG_BUCKET_LEN)) % SMSG_BUCKET_LEN;
+    int64_t nLast = now + SMSG_TIME_LEEWAY;
+    nLast -= nLast % SMSG_BUCKET_LEN;
+
+    for (int64_t nBucket = nFirst; nBucket <= nLast; nBucket += SMSG_BUCKET_LEN)
+    {
+        SecMsgBucketFile* pFile = Open(nBucket, false);
+        if (!pFile)
+            continue;
+
+        if (!pFile->Map())
+        {
+            // -- can be temporary (address space, a lock held on windows), keep the file
+            LogPrintf("Error mapping bucket file %d, skipped.\n", nBucket);
+            mapFiles.erase(nBucket);
+            delete pFile;
+            continue;
+        };
+
+        std::set<SecMsgToken>& tokenSet = buckets[nBucket].setTokens;
+
+        int64_t ofs = 0;
+        while (ofs + SMSG_HDR_LEN <= pFile->nFileSize)
+        {
+            const uint8_t* pHeader = pFile->Data(ofs, SMSG_HDR_LEN);
+            const SecureMessage* psmsg = (const SecureMessage*) pHeader;
+            const uint8_t* pPayload = pFile->Data(ofs + SMSG_HDR_LEN, psmsg->nPayload);
+            if (!pPayload)
+            {
+                LogPrint("smessage", "Bucket file %d is truncated at %d.\n", nBucket, ofs);
+                break;
+            };
+
+            pFile->vOffsets.push_back(ofs);
+            if (psmsg->nPayload >= 8)
+                tokenSet.insert(SecMsgToken(psmsg->timestamp, (uint8_t*)pPayload, psmsg->nPayload, ofs));
+
+            ofs += SMSG_HDR_LEN + psmsg->nPayload;
+        };
+
+        buckets[nBucket].hashBucket();
+        nMessages += tokenSet.size();
+
+        if (fDebugSmsg)
+            LogPrint("smessage", "Bucket %d contains %u messages.\n", nBucket, tokenSet.size());
+    };
+
+    return 0;
+};
+
+int SecMsgBucketStore::Append(int64_t nBucket, const uint8_t* pHeader, const uint8_t* pPayload, uint32_t nPayload, int64_t& nOffset)
+{
+    SecMsgBucketFile* pFile = Open(nBucket, true);
+    if (!pFile)
+        return 1;
+
+    FILE *fp;
+    errno = 0;
+    if (!(fp = fopen(pFile->GetPath().string().c_str(), "ab")))
+        return errorN(1, "fopen failed: %s.", strerror(errno));
+
+    // -- on windows ftell will always return 0 after fopen(ab), call fseek to set.
+    errno = 0;
+    if (fseek(fp, 0, SEEK_END) != 0)
+    {
+        fclose(fp);
+        return errorN(1, "fseek failed: %s.", strerror(errno));
+    };
+
+    nOffset = ftell(fp);
+
+    if (fwrite(pHeader, sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN
+        || fwrite(pPayload, sizeof(uint8_t), nPayload, fp) != nPayload)
+    {
+        fclose(fp);
+        return errorN(1, "fwrite failed: %s.", strerror(errno));
+    };
+
+    fclose(fp);
+
+    pFile->nFileSize = nOffset + SMSG_HDR_LEN + nPayload;
+    pFile->vOffsets.push_back(nOffset);
+
+    return 0;
+};
+
+int SecMsgBucketStore::Get(int64_t nBucket, int64_t nOffset, const uint8_t*& pHeader, const uint8_t*& pPayload, uint32_t& nPayload)
+{
+    std::map<int64_t, SecMsgBucketFile*>::iterator it = mapFiles.find(nBucket);
+    if (it == mapFiles.end())
+        return errorN(1, "%s: No file for bucket %d.", __func__, nBucket);
+
+    SecMsgBucketFile* pFile = it->second;
+    if (!(pHeader = pFile->Data(nOffset, SMSG_HDR_LEN)))
+        return errorN(1, "%s: Offset %d is outside bucket %d.", __func__, nOffset, nBucket);
+
+    nPayload = ((const SecureMessage*) pHeader)->nPayload;
+    if (!(pPayload = pFile->Data(nOffset + SMSG_HDR_LEN, nPayload)))
+        return errorN(1, "%s: Message at %d overruns bucket %d.", __func__, nOffset, nBucket);
+
+    // -- the map may have been grown while fetching the payload
+    pHeader = pPayload - SMSG_HDR_LEN;
+
+    return 0;
+};
+
+int SecMsgBucketStore::AppendTo(int64_t nBucket, int64_t nOffset, std::vector<uint8_t>& vchOut)
+{
+    const uint8_t* pHeader;
+    const uint8_t* pPayload;
+    uint32_t nPayload;
+
+    if (Get(nBucket, nOffset, pHeader, pPayload, nPayload) != 0)
+        return 1;
+
+    // -- header and payload are contiguous in the file
+    try {
+        vchOut.insert(vchOut.end(), pHeader, pPayload + nPayload);
+    } catch (std::exception& e)
+    {
+        return errorN(1, "%s: Could not grow output to %u bytes, %s.", __func__, vchOut.size() + SMSG_HDR_LEN + nPayload, e.what());
+    };
+
+    return 0;
+};
+
+const std::vector<int64_t>* SecMsgBucketStore::GetOffsets(int64_t nBucket) const
+{
+    std::map<int64_t, SecMsgBucketFile*>::const_iterator it = mapFiles.find(nBucket);
+    if (it == mapFiles.end())
+        return NULL;
+    return &it->second->vOffsets;
+};
+
+int64_t SecMsgBucketStore::GetFileSize(int64_t nBucket) const
+{
+    std::map<int64_t, SecMsgBucketFile*>::const_iterator it = mapFiles.find(nBucket);
+    if (it == mapFiles.end())
+        return 0;
+    return it->second->nFileSize;
+};
+
+void SecMsgBucketStore::Erase(int64_t nBucket)
+{
+    boost::filesystem::path fullPath;
+
+    std::map<int64_t, SecMsgBucketFile*>::iterator it = mapFiles.find(nBucket);
+    if (it != mapFiles.end())
+    {
+        // -- unmap before removing, windows won't delete a mapped file
+        fullPath = it->second->GetPath();
+        delete it->second;
+        mapFiles.erase(it);
+    } else
+    {
+        fullPath = SecMsgBucketFile(nBucket).GetPath();
+    };
+
+    try {
+        boost::filesystem::remove(fullPath);
+    } catch (const boost::filesystem::filesystem_error& ex)
+    {
+        LogPrint("smessage", "Error removing bucket file %s.\n", ex.what());
+    };
+};
+
+void SecMsgBucketStore::Clear()
+{
+    for (std::map<int64_t, SecMsgBucketFile*>::iterator it = mapFiles.begin(); it != mapFiles.end(); ++it)
+        delete it->second;
+    mapFiles.clear();
+};
+
+void SecMsgBucketStore::PruneDirectory(int64_t cutoffTime)
+{
+    /*
+        Remove bucket files that expired while the node was not running.
+        Only file names are examined.
+    */
+
+    boost::filesystem::path pathSmsgDir = GetDataDir() / "smsgStore";
+
+    try {
+        if (!boost::filesystem::is_directory(pathSmsgDir))
+            return;
+
+        boost::filesystem::directory_iterator itend;
+        for (boost::filesystem::directory_iterator itd(pathSmsgDir); itd != itend; ++itd)
+        {
+            std::string fileName = itd->path().filename().string();
+            if (!boost::algorithm::ends_with(fileName, ".dat"))
+                continue;
+
+            size_t sep = fileName.find_first_of("_");
+            if (sep == std::string::npos)
+                continue;
+
+            int64_t fileTime;
+            try {
+                fileTime = boost::lexical_cast<int64_t>(fileName.substr(0, sep));
+            } catch (const boost::bad_lexical_cast&)
+            {
+                continue;
+            };
+
+            if (fileTime >= cutoffTime
+                || mapFiles.count(fileTime))
+                continue;
+
+            LogPrint("smessage", "Dropping file %s, expired.\n", fileName.c_str());
+            boost::filesystem::remove(itd->path());
+        };
+    } catch (const boost::filesystem::filesystem_error& ex)
+    {
+        LogPrint("smessage", "Error pruning message store %s.\n", ex.what());
+    };
+};
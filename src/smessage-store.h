@@ -0,0 +1,74 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SEC_MESSAGE_STORE_H
+#define SEC_MESSAGE_STORE_H
+
+#include "smessage.h"
+
+#include <boost/filesystem/path.hpp>
+
+namespace boost { namespace interprocess { class mapped_region; } }
+
+
+/** One smsgStore/<bucket>_01.dat file, held as a read-only memory map.
+ *  Messages are only ever appended, the map is grown lazily when a read
+ *  reaches past the mapped range.
+ */
+class SecMsgBucketFile
+{
+public:
+    SecMsgBucketFile(int64_t nBucketIn);
+    ~SecMsgBucketFile();
+
+    boost::filesystem::path GetPath() const;
+
+    bool Map();
+    void Unmap();
+
+    // -- pointer to nLen bytes at nOffset, NULL if outside the file
+    const uint8_t* Data(int64_t nOffset, uint32_t nLen);
+
+    int64_t                     nBucket;
+    int64_t                     nFileSize;      // bytes on disk, the map may be shorter
+    std::vector<int64_t>        vOffsets;       // start of each message, in file order
+
+private:
+    boost::interprocess::mapped_region* pRegion;
+    int64_t                     nMapped;
+};
+
+
+/** Owns the bucket files of smsgBuckets.
+ *  Callers must hold cs_smsg, pointers returned by Get are valid until the
+ *  next call on the same bucket.
+ */
+class SecMsgBucketStore
+{
+public:
+    SecMsgBucketStore() {};
+    ~SecMsgBucketStore();
+
+    int Load(std::map<int64_t, SecMsgBucket>& buckets, int64_t now, uint32_t& nMessages);
+
+    int Append(int64_t nBucket, const uint8_t* pHeader, const uint8_t* pPayload, uint32_t nPayload, int64_t& nOffset);
+    int AppendTo(int64_t nBucket, int64_t nOffset, std::vector<uint8_t>& vchOut);
+    int Get(int64_t nBucket, int64_t nOffset, const uint8_t*& pHeader, const uint8_t*& pPayload, uint32_t& nPayload);
+
+    const std::vector<int64_t>* GetOffsets(int64_t nBucket) const;
+    int64_t GetFileSize(int64_t nBucket) const;
+
+    void Erase(int64_t nBucket);
+    void Clear();
+    void PruneDirectory(int64_t cutoffTime);
+
+private:
+    SecMsgBucketFile* Open(int64_t nBucket, bool fCreate);
+
+    std::map<int64_t, SecMsgBucketFile*> mapFiles;
+};
+
+extern SecMsgBucketStore smsgStore;
+
+#endif // SEC_MESSAGE_STORE_H
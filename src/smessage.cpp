@@ -31,6 +31,9 @@ Notes:
 */
 
 #include "smessage.h"
+#include "smessage-store.h"
+#include "smessage-scan.h"
+#include "smessage-pow.h"
 
 #include <stdint.h>
 #include <time.h>
@@ -81,6 +84,8 @@ CCriticalSection cs_smsg;
 CCriticalSection cs_smsgDB;
 CCriticalSection cs_smsgThreads;
 
+static int SecureMsgDecryptPayload(const std::string &address, const uint8_t *key_e, uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload, MessageData &msg);
+
 leveldb::DB *smsgDB = NULL;
 
 
@@ -345,7 +350,7 @@ bool SecMsgDB::ReadPK(CKeyID& addr, CPubKey& pubkey)
     };
 
     try {
-        CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+        CSpanReader ssValue(strValue.data(), strValue.size(), SER_DISK, CLIENT_VERSION);
         ssValue >> pubkey;
     } catch (std::exception& e) {
         LogPrint("smessage", "SecMsgDB::ReadPK() unserialize threw: %s.\n", e.what());
@@ -595,7 +600,11 @@ void ThreadSecureMsg()
         {
             LOCK(cs_smsg);
             
-            for (std::map<int64_t, SecMsgBucket>::iterator it(smsgBuckets.begin()); it != smsgBuckets.end(); it++)
+            // -- files that expired while the node was down are not in smsgBuckets
+            if (nLoop == 1)
+                smsgStore.PruneDirectory(cutoffTime);
+            
+            for (std::map<int64_t, SecMsgBucket>::iterator it(smsgBuckets.begin()); it != smsgBuckets.end(); )
             {
                 //if (fDebugSmsg)
                 //    LogPrint("smessage", "Checking bucket %d", size %u \n", it->first, it->second.setTokens.size());
@@ -604,23 +613,11 @@ void ThreadSecureMsg()
                     if (fDebugSmsg)
                         LogPrint("smessage", "Removing bucket %d \n", it->first);
 
-                    std::string fileName = boost::lexical_cast<std::string>(it->first);
-
-                    fs::path fullPath = GetDataDir() / "smsgStore" / (fileName + "_01.dat");
-                    if (fs::exists(fullPath))
-                    {
-                        try { fs::remove(fullPath);
-                        } catch (const fs::filesystem_error& ex)
-                        {
-                            LogPrint("smessage", "Error removing bucket file %s.\n", ex.what());
-                        };
-                    } else
-                    {
-                        LogPrint("smessage", "Path %s does not exist \n", fullPath.string().c_str());
-                    };
+                    smsgStore.Erase(it->first);
                     
                     // -- look for a wl file, it stores incoming messages when wallet is locked
-                    fullPath = GetDataDir() / "smsgStore" / (fileName + "_01_wl.dat");
+                    std::string fileName = boost::lexical_cast<std::string>(it->first);
+                    fs::path fullPath = GetDataDir() / "smsgStore" / (fileName + "_01_wl.dat");
                     if (fs::exists(fullPath))
                     {
                         try { fs::remove(fullPath);
@@ -630,7 +627,8 @@ void ThreadSecureMsg()
                         };
                     };
 
-                    smsgBuckets.erase(it);
+                    smsgBuckets.erase(it++);
+                    continue;
                 } else
                 if (it->second.nLockCount > 0) // -- tick down nLockCount, so will eventually expire if peer never sends data
                 {
@@ -644,6 +642,7 @@ void ThreadSecureMsg()
                     }; // if (it->second.nLockCount == 0)
                     
                 }; // ! if (it->first < cutoffTime)
+                ++it;
             };
         } // cs_smsg
         
@@ -767,7 +766,7 @@ void ThreadSecureMsgPow()
 int SecureMsgBuildBucketSet()
 {
     /*
-        Build the bucket set by scanning the files in the smsgStore dir.
+        Build the bucket set by mapping the bucket files in the retention window.
 
         smsgBuckets should be empty
     */
@@ -775,134 +774,16 @@ int SecureMsgBuildBucketSet()
     if (fDebugSmsg)
         LogPrint("smessage", "SecureMsgBuildBucketSet()\n");
 
-    int64_t  now            = GetTime();
-    uint32_t nFiles         = 0;
+    int64_t  mStart         = GetTimeMillis();
     uint32_t nMessages      = 0;
 
-    fs::path pathSmsgDir = GetDataDir() / "smsgStore";
-    fs::directory_iterator itend;
-
-
-    if (!fs::exists(pathSmsgDir)
-        || !fs::is_directory(pathSmsgDir))
-    {
-        LogPrint("smessage", "Message store directory does not exist.\n");
-        return 0; // not an error
-    }
-
-
-    for (fs::directory_iterator itd(pathSmsgDir) ; itd != itend ; ++itd)
     {
-        if (!fs::is_regular_file(itd->status()))
-            continue;
-
-        std::string fileType = (*itd).path().extension().string();
-
-        if (fileType.compare(".dat") != 0)
-            continue;
-
-        std::string fileName = (*itd).path().filename().string();
-
-
-        if (fDebugSmsg)
-            LogPrint("smessage", "Processing file: %s.\n", fileName.c_str());
-
-        nFiles++;
-
-        // TODO files must be split if > 2GB
-        // time_noFile.dat
-        size_t sep = fileName.find_first_of("_");
-        if (sep == std::string::npos)
-            continue;
-
-        std::string stime = fileName.substr(0, sep);
-
-        int64_t fileTime = boost::lexical_cast<int64_t>(stime);
-
-        if (fileTime < now - SMSG_RETENTION)
-        {
-            LogPrint("smessage", "Dropping file %s, expired.\n", fileName.c_str());
-            try {
-                fs::remove((*itd).path());
-            } catch (const fs::filesystem_error& ex)
-            {
-                LogPrint("smessage", "Error removing bucket file %s, %s.\n", fileName.c_str(), ex.what());
-            };
-            continue;
-        };
-
-        if (boost::algorithm::ends_with(fileName, "_wl.dat"))
-        {
-            if (fDebugSmsg)
-                LogPrint("smessage", "Skipping wallet locked file: %s.\n", fileName.c_str());
-            continue;
-        };
-
-        size_t nTokenSetSize = 0;
-        SecureMessage smsg;
-        {
-            LOCK(cs_smsg);
-            
-            std::set<SecMsgToken>& tokenSet = smsgBuckets[fileTime].setTokens;
-            
-            FILE *fp;
-
-            if (!(fp = fopen((*itd).path().string().c_str(), "rb")))
-            {
-                LogPrint("smessage", "Error opening file: %s\n", strerror(errno));
-                continue;
-            };
-
-            for (;;)
-            {
-                long int ofs = ftell(fp);
-                SecMsgToken token;
-                token.offset = ofs;
-                errno = 0;
-                if (fread(&smsg.hash[0], sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN)
-                {
-                    if (errno != 0)
-                    {
-                        LogPrint("smessage", "fread header failed: %s\n", strerror(errno));
-                    } else
-                    {
-                        //LogPrint("smessage", "End of file.\n");
-                    };
-                    break;
-                };
-                token.timestamp = smsg.timestamp;
-
-                if (smsg.nPayload < 8)
-                    continue;
-
-                if (fread(token.sample, sizeof(uint8_t), 8, fp) != 8)
-                {
-                    LogPrint("smessage", "fread data failed: %s\n", strerror(errno));
-                    break;
-                };
-
-                if (fseek(fp, smsg.nPayload-8, SEEK_CUR) != 0)
-                {
-                    LogPrint("smessage", "fseek, strerror: %s.\n", strerror(errno));
-                    break;
-                };
-
-                tokenSet.insert(token);
-            };
-
-            fclose(fp);
-            
-            smsgBuckets[fileTime].hashBucket();
-            
-            nTokenSetSize = tokenSet.size();
-        } // LOCK(cs_smsg);
-        
-        nMessages += nTokenSetSize;
-        if (fDebugSmsg)
-            LogPrint("smessage", "Bucket %d contains %u messages.\n", fileTime, nTokenSetSize);
-    };
+        LOCK(cs_smsg);
+        if (smsgStore.Load(smsgBuckets, GetTime(), nMessages) != 0)
+            return 1;
+    } // LOCK(cs_smsg);
 
-    LogPrint("smessage", "Processed %u files, loaded %u buckets containing %u messages.\n", nFiles, smsgBuckets.size(), nMessages);
+    LogPrint("smessage", "Loaded %u buckets containing %u messages in %d ms.\n", smsgBuckets.size(), nMessages, GetTimeMillis() - mStart);
 
     return 0;
 };
@@ -1099,6 +980,12 @@ int SecureMsgWriteIni()
 };
 
 
+static void SecureMsgStartScanner()
+{
+    int nThreads = GetArg("-smsgscanthreads", std::min((int)boost::thread::hardware_concurrency() - 1, SMSG_SCAN_MAX_THREADS));
+    smsgScanner.Start(std::max(nThreads, 0));
+};
+
 /** called from AppInit2() in init.cpp */
 bool SecureMsgStart(bool fDontStart, bool fScanChain)
 {
@@ -1134,6 +1021,7 @@ bool SecureMsgStart(bool fDontStart, bool fScanChain)
         return false;
     };
     
+    SecureMsgStartScanner();
     threadGroupSmsg.create_thread(boost::bind(&TraceThread<void (*)()>, "smsg", &ThreadSecureMsg));
     threadGroupSmsg.create_thread(boost::bind(&TraceThread<void (*)()>, "smsg-pow", &ThreadSecureMsgPow));
     
@@ -1155,6 +1043,12 @@ bool SecureMsgShutdown()
     
     threadGroupSmsg.interrupt_all();
     threadGroupSmsg.join_all();
+    smsgScanner.Stop();
+
+    {
+        LOCK(cs_smsg);
+        smsgStore.Clear();
+    }
 
     if (smsgDB)
     {
@@ -1202,6 +1096,7 @@ bool SecureMsgEnable()
     } // cs_smsg
     
     // -- start threads
+    SecureMsgStartScanner();
     threadGroupSmsg.create_thread(boost::bind(&TraceThread<void (*)()>, "smsg", &ThreadSecureMsg));
     threadGroupSmsg.create_thread(boost::bind(&TraceThread<void (*)()>, "smsg-pow", &ThreadSecureMsgPow));
     
@@ -1242,6 +1137,7 @@ bool SecureMsgDisable()
         
         threadGroupSmsg.interrupt_all();
         threadGroupSmsg.join_all();
+        smsgScanner.Stop();
         
         // -- clear smsgBuckets
         std::map<int64_t, SecMsgBucket>::iterator it;
@@ -1251,6 +1147,7 @@ bool SecureMsgDisable()
             it->second.setTokens.clear();
         };
         smsgBuckets.clear();
+        smsgStore.Clear();
         smsgAddresses.clear();
     } // cs_smsg
     
@@ -1598,7 +1495,6 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
         if (vchData.size() < 8)
             return false;
 
-        std::vector<uint8_t> vchOne;
         std::vector<uint8_t> vchBunch;
 
         vchBunch.resize(4+8); // nmessages + bucketTime
@@ -1639,14 +1535,11 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
                 } else
                 {
                     //LogPrint("smessage", "Have message at %d.\n", it->offset); // DEBUG
-                    token.offset = it->offset;
-                    //LogPrint("smessage", "winb before SecureMsgRetrieve %d.\n", token.timestamp);
 
-                    // -- place in vchOne so if SecureMsgRetrieve fails it won't corrupt vchBunch
-                    if (SecureMsgRetrieve(token, vchOne) == 0)
+                    // -- copied straight from the bucket map, vchBunch is untouched on failure
+                    if (smsgStore.AppendTo(time, it->offset, vchBunch) == 0)
                     {
                         nBunch++;
-                        vchBunch.insert(vchBunch.end(), vchOne.begin(), vchOne.end()); // append
                     } else
                     {
                         LogPrint("smessage", "SecureMsgRetrieve failed %d.\n", token.timestamp);
@@ -2159,111 +2052,34 @@ bool SecureMsgScanBuckets()
         return false;
 
     int64_t  mStart         = GetTimeMillis();
-    int64_t  now            = GetTime();
-    uint32_t nFiles         = 0;
+    uint32_t nBuckets       = 0;
     uint32_t nMessages      = 0;
     uint32_t nFoundMessages = 0;
 
-    fs::path pathSmsgDir = GetDataDir() / "smsgStore";
-    fs::directory_iterator itend;
-
-    if (!fs::exists(pathSmsgDir)
-        || !fs::is_directory(pathSmsgDir))
     {
-        LogPrint("smessage", "Message store directory does not exist.\n");
-        return 0; // not an error
-    };
-
-    SecureMessage smsg;
-    std::vector<uint8_t> vchData;
-
-    for (fs::directory_iterator itd(pathSmsgDir) ; itd != itend ; ++itd)
-    {
-        if (!fs::is_regular_file(itd->status()))
-            continue;
-
-        std::string fileType = (*itd).path().extension().string();
-
-        if (fileType.compare(".dat") != 0)
-            continue;
-
-        std::string fileName = (*itd).path().filename().string();
-
-
-        if (fDebugSmsg)
-            LogPrint("smessage", "Processing file: %s.\n", fileName.c_str());
-
-        nFiles++;
-
-        // TODO files must be split if > 2GB
-        // time_noFile.dat
-        size_t sep = fileName.find_first_of("_");
-        if (sep == std::string::npos)
-            continue;
-
-        std::string stime = fileName.substr(0, sep);
-
-        int64_t fileTime = boost::lexical_cast<int64_t>(stime);
+        LOCK(cs_smsg);
 
-        if (fileTime < now - SMSG_RETENTION)
+        for (std::map<int64_t, SecMsgBucket>::iterator itb = smsgBuckets.begin(); itb != smsgBuckets.end(); ++itb)
         {
-            LogPrint("smessage", "Dropping file %s, expired.\n", fileName.c_str());
-            try {
-                fs::remove((*itd).path());
-            } catch (const fs::filesystem_error& ex)
-            {
-                LogPrint("smessage", "Error removing bucket file %s, %s.\n", fileName.c_str(), ex.what());
-            };
-            continue;
-        };
+            const std::vector<int64_t>* pvOffsets = smsgStore.GetOffsets(itb->first);
+            if (!pvOffsets)
+                continue;
 
-        if (boost::algorithm::ends_with(fileName, "_wl.dat"))
-        {
             if (fDebugSmsg)
-                LogPrint("smessage", "Skipping wallet locked file: %s.\n", fileName.c_str());
-            continue;
-        };
+                LogPrint("smessage", "Processing bucket: %d.\n", itb->first);
 
-        {
-            LOCK(cs_smsg);
-            FILE *fp;
-            errno = 0;
-            if (!(fp = fopen((*itd).path().string().c_str(), "rb")))
-            {
-                LogPrint("smessage", "Error opening file: %s\n", strerror(errno));
-                continue;
-            };
+            nBuckets++;
 
-            for (;;)
+            for (std::vector<int64_t>::const_iterator it = pvOffsets->begin(); it != pvOffsets->end(); ++it)
             {
-                errno = 0;
-                if (fread(&smsg.hash[0], sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN)
-                {
-                    if (errno != 0)
-                    {
-                        LogPrint("smessage", "fread header failed: %s\n", strerror(errno));
-                    } else
-                    {
-                        //LogPrint("smessage", "End of file.\n");
-                    };
-                    break;
-                };
-
-                try { vchData.resize(smsg.nPayload); } catch (std::exception& e)
-                {
-                    LogPrint("smessage", "SecureMsgWalletUnlocked(): Could not resize vchData, %u, %s\n", smsg.nPayload, e.what());
-                    fclose(fp);
-                    return 1;
-                };
-
-                if (fread(&vchData[0], sizeof(uint8_t), smsg.nPayload, fp) != smsg.nPayload)
-                {
-                    LogPrint("smessage", "fread data failed: %s\n", strerror(errno));
+                const uint8_t* pHeader;
+                const uint8_t* pPayload;
+                uint32_t nPayload;
+                if (smsgStore.Get(itb->first, *it, pHeader, pPayload, nPayload) != 0)
                     break;
-                };
 
                 // -- don't report to gui,
-                int rv = SecureMsgScanMessage(&smsg.hash[0], &vchData[0], smsg.nPayload, false);
+                int rv = SecureMsgScanMessage((uint8_t*)pHeader, (uint8_t*)pPayload, nPayload, false);
 
                 if (rv == 0)
                 {
@@ -2276,21 +2092,10 @@ bool SecureMsgScanBuckets()
 
                 nMessages ++;
             };
+        };
+    } // cs_smsg
 
-            fclose(fp);
-
-            // -- remove wl file when scanned
-            try {
-                fs::remove((*itd).path());
-            } catch (const boost::filesystem::filesystem_error& ex)
-            {
-                LogPrint("smessage", "Error removing wl file %s - %s\n", fileName.c_str(), ex.what());
-                return 1;
-            };
-        } // cs_smsg
-    };
-
-    LogPrint("smessage", "Processed %u files, scanned %u messages, received %u messages.\n", nFiles, nMessages, nFoundMessages);
+    LogPrint("smessage", "Processed %u buckets, scanned %u messages, received %u messages.\n", nBuckets, nMessages, nFoundMessages);
     LogPrint("smessage", "Took %d ms\n", GetTimeMillis() - mStart);
 
     return true;
@@ -2313,6 +2118,9 @@ int SecureMsgWalletUnlocked()
         return 1;
     };
 
+    // -- fetch receiving keys once, rather than per message scanned
+    smsgScanner.LoadKeys();
+
     int64_t  now            = GetTime();
     uint32_t nFiles         = 0;
     uint32_t nMessages      = 0;
@@ -2442,6 +2250,20 @@ int SecureMsgWalletUnlocked()
     return 0;
 };
 
+int SecureMsgWalletLocked()
+{
+    /*
+    When the wallet is locked, wipe the receiving keys held for scanning.
+    */
+    if (!fSecMsgEnabled)
+        return 0;
+
+    LogPrint("smessage", "SecureMsgWalletLocked()\n");
+
+    smsgScanner.ClearKeys();
+    return 0;
+};
+
 int SecureMsgWalletKeyChanged(std::string sAddress, std::string sLabel, ChangeType mode)
 {
     if (!fSecMsgEnabled)
@@ -2472,6 +2294,7 @@ int SecureMsgWalletKeyChanged(std::string sAddress, std::string sLabel, ChangeTy
                 break;
         }
 
+        smsgScanner.ClearKeys(); // reloaded on next scan
     } // cs_smsg
 
 
@@ -2509,42 +2332,33 @@ int SecureMsgScanMessage(uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload,
         return 3;
     };
 
+    if (!smsgScanner.IsLoaded()
+        && smsgScanner.LoadKeys() != 0)
+        return 1;
+
     std::string addressTo;
     MessageData msg; // placeholder
     bool fOwnMessage = false;
+    bool fReceiveAnon;
+    uint8_t key_e[32];
 
-    for (std::vector<SecMsgAddress>::iterator it = smsgAddresses.begin(); it != smsgAddresses.end(); ++it)
+    if (smsgScanner.Match(pHeader, pPayload, nPayload, addressTo, fReceiveAnon, key_e))
     {
-        if (!it->fReceiveEnabled)
-            continue;
-
-        CParlayAddress coinAddress(it->sAddress);
-        addressTo = coinAddress.ToString();
+        if (fDebugSmsg)
+            LogPrint("smessage", "Decrypted message with %s.\n", addressTo.c_str());
 
-        if (!it->fReceiveAnon)
+        if (fReceiveAnon)
         {
-            // -- have to do full decrypt to see address from
-            if (SecureMsgDecrypt(false, addressTo, pHeader, pPayload, nPayload, msg) == 0)
-            {
-                if (fDebugSmsg)
-                    LogPrint("smessage", "Decrypted message with %s.\n", addressTo.c_str());
-
-                if (msg.sFromAddress.compare("anon") != 0)
-                    fOwnMessage = true;
-                break;
-            };
+            fOwnMessage = true;
         } else
         {
-
-            if (SecureMsgDecrypt(true, addressTo, pHeader, pPayload, nPayload, msg) == 0)
-            {
-                if (fDebugSmsg)
-                    LogPrint("smessage", "Decrypted message with %s.\n", addressTo.c_str());
-
+            // -- have to do full decrypt to see address from
+            if (SecureMsgDecryptPayload(addressTo, key_e, pHeader, pPayload, nPayload, msg) == 0
+                && msg.sFromAddress.compare("anon") != 0)
                 fOwnMessage = true;
-                break;
-            };
-        }
+        };
+
+        memory_cleanse(key_e, sizeof(key_e));
     };
 
     if (fOwnMessage)
@@ -2734,62 +2548,10 @@ int SecureMsgRetrieve(SecMsgToken &token, std::vector<uint8_t>& vchData)
 
     // -- has cs_smsg lock from SecureMsgReceiveData
 
-    fs::path pathSmsgDir = GetDataDir() / "smsgStore";
-
-    //LogPrint("smessage", "token.offset %d.\n", token.offset); // DEBUG
     int64_t bucket = token.timestamp - (token.timestamp % SMSG_BUCKET_LEN);
-    std::string fileName = boost::lexical_cast<std::string>(bucket) + "_01.dat";
-    fs::path fullpath = pathSmsgDir / fileName;
-
-    //LogPrint("smessage", "bucket %d.\n", bucket);
-    //LogPrint("smessage", "bucket d %d.\n", bucket);
-    //LogPrint("smessage", "fileName %s.\n", fileName.c_str());
-
-    FILE *fp;
-    errno = 0;
-    if (!(fp = fopen(fullpath.string().c_str(), "rb")))
-    {
-        LogPrint("smessage", "Error opening file: %s\nPath %s\n", strerror(errno), fullpath.string().c_str());
-        return 1;
-    };
-
-    errno = 0;
-    if (fseek(fp, token.offset, SEEK_SET) != 0)
-    {
-        LogPrint("smessage", "fseek, strerror: %s.\n", strerror(errno));
-        fclose(fp);
-        return 1;
-    };
-
-    SecureMessage smsg;
-    errno = 0;
-    if (fread(&smsg.hash[0], sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN)
-    {
-        LogPrint("smessage", "fread header failed: %s\n", strerror(errno));
-        fclose(fp);
-        return 1;
-    };
 
-    try {
-        vchData.resize(SMSG_HDR_LEN + smsg.nPayload);
-    } catch (std::exception& e) {
-        LogPrint("smessage", "SecureMsgRetrieve(): Could not resize vchData, %u, %s\n", SMSG_HDR_LEN + smsg.nPayload, e.what());
-        return 1;
-    };
-
-    memcpy(&vchData[0], &smsg.hash[0], SMSG_HDR_LEN);
-    errno = 0;
-    if (fread(&vchData[SMSG_HDR_LEN], sizeof(uint8_t), smsg.nPayload, fp) != smsg.nPayload)
-    {
-        LogPrint("smessage", "fread data failed: %s. Wanted %u bytes.\n", strerror(errno), smsg.nPayload);
-        fclose(fp);
-        return 1;
-    };
-
-
-    fclose(fp);
-
-    return 0;
+    vchData.clear();
+    return smsgStore.AppendTo(bucket, token.offset, vchData);
 };
 
 int SecureMsgReceive(CNode* pfrom, std::vector<uint8_t>& vchData)
@@ -2992,7 +2754,6 @@ int SecureMsgStore(uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload, bool
     SecureMessage* psmsg = (SecureMessage*) pHeader;
 
 
-    long int ofs;
     fs::path pathSmsgDir;
     try {
         pathSmsgDir = GetDataDir() / "smsgStore";
@@ -3048,36 +2809,8 @@ int SecureMsgStore(uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload, bool
         return 1;
     };
 
-    std::string fileName = boost::lexical_cast<std::string>(bucket) + "_01.dat";
-    fs::path fullpath = pathSmsgDir / fileName;
-
-    FILE *fp;
-    errno = 0;
-    if (!(fp = fopen(fullpath.string().c_str(), "ab")))
-    {
-        return errorN(1, "fopen failed: %s.", strerror(errno));
-    };
-
-    // -- on windows ftell will always return 0 after fopen(ab), call fseek to set.
-    errno = 0;
-    if (fseek(fp, 0, SEEK_END) != 0)
-    {
-        return errorN(1, "fseek failed: %s.", strerror(errno));
-    };
-
-
-    ofs = ftell(fp);
-
-    if (fwrite(pHeader, sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN
-        || fwrite(pPayload, sizeof(uint8_t), nPayload, fp) != nPayload)
-    {
-        fclose(fp);
-        return errorN(1, "fwrite failed: %s.", strerror(errno));
-    };
-
-    fclose(fp);
-
-    token.offset = ofs;
+    if (smsgStore.Append(bucket, pHeader, pPayload, nPayload, token.offset) != 0)
+        return 1;
 
     //LogPrint("smessage", "token.offset: %d\n", token.offset); // DEBUG
     tokenSet.insert(token);
@@ -3180,94 +2913,33 @@ int SecureMsgSetHash(uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload)
     SecureMessage* psmsg = (SecureMessage*) pHeader;
 
     int64_t nStart = GetTimeMillis();
-    uint8_t civ[32];
-    uint8_t sha256Hash[32];
 
-    bool found = false;
-    HMAC_CTX ctx;
-    HMAC_CTX_init(&ctx);
+    int nThreads = GetArg("-smsgpowthreads", boost::thread::hardware_concurrency());
 
     uint32_t nonse = 0;
+    uint8_t hash[4];
+    int rv = SecureMsgPowSearch(pHeader, pPayload, nPayload, nThreads, nonse, hash);
 
-    //CBigNum bnTarget(2);
-    //bnTarget = bnTarget.pow(256 - 40);
-
-    // -- break for HMAC_CTX_cleanup
-    for (;;)
-    {
-        if (!fSecMsgEnabled)
-           break;
-
-        //psmsg->timestamp = GetTime();
-        //memcpy(&psmsg->timestamp, &now, 8);
-        memcpy(&psmsg->nonse[0], &nonse, 4);
-
-        for (int i = 0; i < 32; i+=4)
-            memcpy(civ+i, &nonse, 4);
-
-        uint32_t nBytes;
-        if (!HMAC_Init_ex(&ctx, &civ[0], 32, EVP_sha256(), NULL)
-            || !HMAC_Update(&ctx, (uint8_t*) pHeader+4, SMSG_HDR_LEN-4)
-            || !HMAC_Update(&ctx, (uint8_t*) pPayload, nPayload)
-            || !HMAC_Update(&ctx, pPayload, nPayload)
-            || !HMAC_Final(&ctx, sha256Hash, &nBytes)
-            //|| !HMAC_Final(&ctx, &vchHash[0], &nBytes)
-            || nBytes != 32)
-            break;
-
-        /*
-        if (CBigNum(vchHash) <= bnTarget)
-        {
-            found = true;
-            if (fDebugSmsg)
-                LogPrint("smessage", "Match %u\n", nonse);
-            break;
-        };
-        */
-
-        if (sha256Hash[31] == 0
-            && sha256Hash[30] == 0
-            && (~(sha256Hash[29]) & ((1<<0) || (1<<1) || (1<<2)) ))
-        //    && sha256Hash[29] == 0)
-        {
-            found = true;
-            //if (fDebugSmsg)
-            //    LogPrint("smessage", "Match %u\n", nonse);
-            break;
-        }
-
-        //if (nonse >= UINT32_MAX)
-        if (nonse >= 4294967295U)
-        {
-            if (fDebugSmsg)
-                LogPrint("smessage", "No match %u\n", nonse);
-            break;
-            //return 1;
-        }
-        nonse++;
-    };
-
-    HMAC_CTX_cleanup(&ctx);
-
-    if (!fSecMsgEnabled)
+    if (rv == 2)
     {
         if (fDebugSmsg)
             LogPrint("smessage", "SecureMsgSetHash() stopped, shutdown detected.\n");
         return 2;
     };
 
-    if (!found)
+    if (rv != 0)
     {
         if (fDebugSmsg)
-            LogPrint("smessage", "SecureMsgSetHash() failed, took %d ms, nonse %u\n", GetTimeMillis() - nStart, nonse);
+            LogPrint("smessage", "SecureMsgSetHash() failed, took %d ms, no nonse found\n", GetTimeMillis() - nStart);
         return 1;
     };
 
-    memcpy(psmsg->hash, sha256Hash, 4);
-    //memcpy(psmsg->hash, &vchHash[0], 4);
+    memcpy(&psmsg->nonse[0], &nonse, 4);
+    memcpy(psmsg->hash, hash, 4);
 
     if (fDebugSmsg)
-        LogPrint("smessage", "SecureMsgSetHash() took %d ms, nonse %u\n", GetTimeMillis() - nStart, nonse);
+        LogPrint("smessage", "SecureMsgSetHash() took %d ms, nonse %u, %d threads x %d lanes\n",
+            GetTimeMillis() - nStart, nonse, nThreads, SecureMsgPowLanes());
 
     return 0;
 };
@@ -3822,6 +3494,22 @@ int SecureMsgDecrypt(bool fTestOnly, std::string &address, uint8_t *pHeader, uin
     if (fTestOnly)
         return 0;
 
+    return SecureMsgDecryptPayload(address, &key_e[0], pHeader, pPayload, nPayload, msg);
+};
+
+static int SecureMsgDecryptPayload(const std::string &address, const uint8_t *key_e, uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload, MessageData &msg)
+{
+    /* Decrypt and verify the payload of a message whose MAC has been matched
+
+        key_e is the 32 byte AES key derived in SecureMsgDecrypt
+
+        returns
+            1       Error
+            8       Could not allocate memory
+    */
+
+    SecureMessage* psmsg = (SecureMessage*) pHeader;
+
     SecMsgCrypter crypter;
     crypter.SetKey(key_e, psmsg->iv);
     std::vector<uint8_t> vchPayload;
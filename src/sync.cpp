@@ -7,6 +7,90 @@
 #include "util.h"
 
 #include <boost/foreach.hpp>
+#include <boost/thread/once.hpp>
+
+#ifndef WIN32
+#include <time.h>
+#endif
+
+volatile bool fLockStats = false;
+
+int64_t LockStatsTime()
+{
+#ifdef WIN32
+    static LARGE_INTEGER nFrequency;
+    if (nFrequency.QuadPart == 0)
+        QueryPerformanceFrequency(&nFrequency);
+    LARGE_INTEGER nCounter;
+    QueryPerformanceCounter(&nCounter);
+    return nCounter.QuadPart * 1000000 / nFrequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void CLockTimeHistogram::Add(int64_t nMicros)
+{
+    if (nMicros < 0)
+        nMicros = 0;
+    int nBucket = 0;
+    while (nBucket < LOCKSTATS_BUCKETS - 1 && nMicros >> nBucket)
+        nBucket++;
+    vCount[nBucket]++;
+    nTotal += nMicros;
+    uint64_t nPrevMax = nMax.load(boost::memory_order_relaxed);
+    while ((uint64_t)nMicros > nPrevMax && !nMax.compare_exchange_weak(nPrevMax, nMicros, boost::memory_order_relaxed))
+        ;
+}
+
+void CLockTimeHistogram::Reset()
+{
+    for (int i = 0; i < LOCKSTATS_BUCKETS; i++)
+        vCount[i] = 0;
+    nTotal = 0;
+    nMax = 0;
+}
+
+// Allocated on first use and never freed, lock sites are function-local
+// statics and can be constructed at any point, including during static
+// initialization.
+static boost::mutex* pmutexLockSites = NULL;
+static std::vector<CLockSite*>* pvLockSites = NULL;
+
+static void LockSitesInit()
+{
+    pmutexLockSites = new boost::mutex();
+    pvLockSites = new std::vector<CLockSite*>();
+}
+
+static boost::once_flag lockSitesInitFlag = BOOST_ONCE_INIT;
+
+CLockSite::CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn) :
+    pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn)
+{
+    Reset();
+    boost::call_once(&LockSitesInit, lockSitesInitFlag);
+    boost::mutex::scoped_lock lock(*pmutexLockSites);
+    pvLockSites->push_back(this);
+}
+
+void CLockSite::Reset()
+{
+    nAcquired = 0;
+    nContended = 0;
+    nTryFailed = 0;
+    wait.Reset();
+    hold.Reset();
+}
+
+void GetLockSites(std::vector<CLockSite*>& vSites)
+{
+    boost::call_once(&LockSitesInit, lockSitesInitFlag);
+    boost::mutex::scoped_lock lock(*pmutexLockSites);
+    vSites = *pvLockSites;
+}
 
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
@@ -8,6 +8,10 @@
 
 #include "threadsafety.h"
 
+#include <stdint.h>
+#include <vector>
+
+#include <boost/atomic.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -100,16 +104,80 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/** Lock profiling, see -lockstats and the getlockstats RPC */
+extern volatile bool fLockStats;
+
+/** Number of power-of-two microsecond buckets in a CLockTimeHistogram */
+static const int LOCKSTATS_BUCKETS = 24;
+
+/** Monotonic clock in microseconds for lock timing */
+int64_t LockStatsTime();
+
+class CLockTimeHistogram
+{
+public:
+    /** Bucket 0 counts times under 1us, bucket i times in [2^(i-1), 2^i) us */
+    boost::atomic<uint64_t> vCount[LOCKSTATS_BUCKETS];
+    boost::atomic<uint64_t> nTotal;
+    boost::atomic<uint64_t> nMax;
+
+    CLockTimeHistogram() { Reset(); }
+    void Add(int64_t nMicros);
+    void Reset();
+};
+
+/** Counters for one LOCK/LOCK2/TRY_LOCK call site. Sites are static objects
+    created by the lock macros and register themselves on construction. */
+class CLockSite
+{
+public:
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+
+    boost::atomic<uint64_t> nAcquired;
+    boost::atomic<uint64_t> nContended;
+    boost::atomic<uint64_t> nTryFailed;
+    CLockTimeHistogram wait;
+    CLockTimeHistogram hold;
+
+    CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn);
+    void Reset();
+};
+
+/** All lock sites constructed so far */
+void GetLockSites(std::vector<CLockSite*>& vSites);
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template<typename Mutex>
 class CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    CLockSite* psite;
+    int64_t nAcquiredTime;
+
+    void EnterProfiled()
+    {
+        int64_t nStart = LockStatsTime();
+        bool fContended = !lock.try_lock();
+        if (fContended)
+            lock.lock();
+        nAcquiredTime = LockStatsTime();
+        psite->nAcquired++;
+        if (fContended)
+            psite->nContended++;
+        psite->wait.Add(nAcquiredTime - nStart);
+    }
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (psite && fLockStats)
+        {
+            EnterProfiled();
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock())
         {
@@ -127,11 +195,22 @@ private:
         lock.try_lock();
         if (!lock.owns_lock())
             LeaveCritical();
+        if (psite && fLockStats)
+        {
+            if (lock.owns_lock())
+            {
+                nAcquiredTime = LockStatsTime();
+                psite->nAcquired++;
+                psite->wait.Add(0);
+            }
+            else
+                psite->nTryFailed++;
+        }
         return lock.owns_lock();
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, CLockSite* psiteIn = NULL) : lock(mutexIn, boost::defer_lock), psite(psiteIn), nAcquiredTime(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -142,7 +221,11 @@ public:
     ~CMutexLock()
     {
         if (lock.owns_lock())
+        {
+            if (nAcquiredTime)
+                psite->hold.Add(LockStatsTime() - nAcquiredTime);
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -153,9 +236,9 @@ public:
 
 typedef CMutexLock<CCriticalSection> CCriticalBlock;
 
-#define LOCK(cs) CCriticalBlock criticalblock(cs, #cs, __FILE__, __LINE__)
-#define LOCK2(cs1,cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__),criticalblock2(cs2, #cs2, __FILE__, __LINE__)
-#define TRY_LOCK(cs,name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
+#define LOCK(cs) static CLockSite locksite(#cs, __FILE__, __LINE__); CCriticalBlock criticalblock(cs, #cs, __FILE__, __LINE__, false, &locksite)
+#define LOCK2(cs1,cs2) static CLockSite locksite1(#cs1, __FILE__, __LINE__), locksite2(#cs2, __FILE__, __LINE__); CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__, false, &locksite1),criticalblock2(cs2, #cs2, __FILE__, __LINE__, false, &locksite2)
+#define TRY_LOCK(cs,name) static CLockSite locksite_##name(#cs, __FILE__, __LINE__); CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true, &locksite_##name)
 
 #define ENTER_CRITICAL_SECTION(cs) \
     { \
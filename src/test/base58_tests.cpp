@@ -9,6 +9,47 @@
 using namespace json_spirit;
 extern Array read_json(const std::string& filename);
 
+// Reference copy of the vector-based encoder that base58.cpp replaced
+static std::string EncodeBase58Reference(const unsigned char* pbegin, const unsigned char* pend)
+{
+    int zeroes = 0;
+    while (pbegin != pend && *pbegin == 0) {
+        pbegin++;
+        zeroes++;
+    }
+    std::vector<unsigned char> b58((pend - pbegin) * 138 / 100 + 1);
+    while (pbegin != pend) {
+        int carry = *pbegin;
+        for (std::vector<unsigned char>::reverse_iterator it = b58.rbegin(); it != b58.rend(); it++) {
+            carry += 256 * (*it);
+            *it = carry % 58;
+            carry /= 58;
+        }
+        assert(carry == 0);
+        pbegin++;
+    }
+    std::vector<unsigned char>::iterator it = b58.begin();
+    while (it != b58.end() && *it == 0)
+        it++;
+    std::string str;
+    str.reserve(zeroes + (b58.end() - it));
+    str.assign(zeroes, '1');
+    while (it != b58.end())
+        str += "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz"[*(it++)];
+    return str;
+}
+
+static std::vector<unsigned char> RandomBytes(size_t nSize)
+{
+    std::vector<unsigned char> vch(nSize);
+    for (size_t i = 0; i < nSize; i++)
+        vch[i] = insecure_rand();
+    // Give about a quarter of the inputs some leading zero bytes
+    if (nSize > 0 && insecure_rand() % 4 == 0)
+        memset(&vch[0], 0, insecure_rand() % nSize + 1);
+    return vch;
+}
+
 BOOST_AUTO_TEST_SUITE(base58_tests)
 
 // Goal: test low-level base58 encoding functionality
@@ -255,6 +296,72 @@ BOOST_AUTO_TEST_CASE(base58_keys_invalid)
     }
 }
 
+// Goal: check that cached address strings match uncached encoding, also across networks
+BOOST_AUTO_TEST_CASE(base58_ExtractAddressString)
+{
+    CKeyID keyID(uint160(ParseHex("65a16059864a2fdbc7c99a4723a8395bc6f188eb")));
+    CScript scriptPubKey = GetScriptForDestination(keyID);
+    std::string strAddress;
+
+    BOOST_CHECK(ExtractAddressString(scriptPubKey, strAddress));
+    BOOST_CHECK_EQUAL(strAddress, CParlayAddress(keyID).ToString());
+    BOOST_CHECK(ExtractAddressString(scriptPubKey, strAddress));
+    BOOST_CHECK_EQUAL(strAddress, CParlayAddress(keyID).ToString());
+
+    SelectParams(CChainParams::TESTNET);
+    BOOST_CHECK(ExtractAddressString(scriptPubKey, strAddress));
+    BOOST_CHECK_EQUAL(strAddress, CParlayAddress(keyID).ToString());
+    SelectParams(CChainParams::MAIN);
+
+    CScript scriptNonStandard = CScript() << OP_RETURN;
+    BOOST_CHECK(!ExtractAddressString(scriptNonStandard, strAddress));
+}
+
+// Goal: check random inputs against the old encoder and for round trips, also with surrounding spaces
+BOOST_AUTO_TEST_CASE(base58_random_roundtrip)
+{
+    seed_insecure_rand(true);
+    for (int i = 0; i < 10000; i++)
+    {
+        std::vector<unsigned char> vch = RandomBytes(insecure_rand() % 301);
+        const unsigned char* pbegin = vch.empty() ? NULL : &vch[0];
+        std::string str = EncodeBase58(pbegin, pbegin + vch.size());
+        BOOST_REQUIRE_EQUAL(str, EncodeBase58Reference(pbegin, pbegin + vch.size()));
+
+        std::vector<unsigned char> vchDecoded;
+        BOOST_REQUIRE(DecodeBase58(str, vchDecoded));
+        BOOST_REQUIRE(vchDecoded == vch);
+        BOOST_REQUIRE(DecodeBase58(" \t" + str + "\n ", vchDecoded));
+        BOOST_REQUIRE(vchDecoded == vch);
+    }
+}
+
+// Goal: report encode and decode times for address-sized payloads, the times are not checked
+BOOST_AUTO_TEST_CASE(base58_timing)
+{
+    const int nCount = 100000;
+    seed_insecure_rand(true);
+    std::vector<std::vector<unsigned char> > vPayloads;
+    for (int i = 0; i < 1000; i++)
+        vPayloads.push_back(RandomBytes(25));
+    std::vector<std::string> vEncoded(vPayloads.size());
+
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nCount; i++)
+        vEncoded[i % vPayloads.size()] = EncodeBase58(vPayloads[i % vPayloads.size()]);
+    int64_t nEncode = GetTimeMicros() - nStart;
+
+    std::vector<unsigned char> vchDecoded;
+    bool fDecoded = true;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nCount; i++)
+        fDecoded &= DecodeBase58(vEncoded[i % vEncoded.size()], vchDecoded);
+    int64_t nDecode = GetTimeMicros() - nStart;
+    BOOST_CHECK(fDecoded);
+
+    BOOST_TEST_MESSAGE(strprintf("base58 on 25-byte payloads: encode %.3fus, decode %.3fus",
+                                 nEncode / (double)nCount, nDecode / (double)nCount));
+}
 
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -1,9 +1,15 @@
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 #include <limits>
 
 #include "bignum.h"
+#include "chainparams.h"
+#include "kernel.h"
+#include "main.h"
 #include "util.h"
 
+using namespace std;
+
 BOOST_AUTO_TEST_SUITE(bignum_tests)
 
 // Unfortunately there's no standard way of preventing a function from being
@@ -122,4 +128,223 @@ BOOST_AUTO_TEST_CASE(bignum_setint64)
     }
 }
 
+// The target math moved from CBigNum to uint256 and uint512. The tests below
+// check the fixed-width code against the CBigNum code it replaced.
+
+static uint256 RandomUint256()
+{
+    uint256 n;
+    for (int i = 0; i < 8; i++)
+        n = (n << 32) | uint256(insecure_rand());
+    // Spread the sizes so short and long operands both get tested
+    return n >> (insecure_rand() % 256);
+}
+
+static CBigNum ToBigNum(const uint512& n)
+{
+    CBigNum bn;
+    bn.SetHex(n.GetHex());
+    return bn;
+}
+
+// Every exponent with edge and random mantissas, each with and without the sign bit
+static vector<unsigned int> CompactValues()
+{
+    static const unsigned int pnMantissa[] = {
+        0x000000, 0x000001, 0x00007f, 0x000080, 0x0000ff, 0x000100,
+        0x007fff, 0x008000, 0x00ffff, 0x010000, 0x123456, 0x7fffff };
+    vector<unsigned int> vCompact;
+    for (unsigned int nSize = 0; nSize < 256; nSize++)
+    {
+        for (unsigned int i = 0; i < sizeof(pnMantissa) / sizeof(pnMantissa[0]); i++)
+        {
+            vCompact.push_back((nSize << 24) | pnMantissa[i]);
+            vCompact.push_back((nSize << 24) | 0x00800000 | pnMantissa[i]);
+        }
+        int nRandom = nSize <= 36 ? 1000 : 20;
+        for (int i = 0; i < nRandom; i++)
+            vCompact.push_back((nSize << 24) | (insecure_rand() & 0x00ffffff));
+    }
+    return vCompact;
+}
+
+BOOST_AUTO_TEST_CASE(bignum_compact_equivalence)
+{
+    seed_insecure_rand(true);
+    vector<unsigned int> vCompact = CompactValues();
+    BOOST_FOREACH(unsigned int nCompact, vCompact)
+    {
+        CBigNum bn;
+        bn.SetCompact(nCompact);
+        bool fNegative, fOverflow;
+        uint256 n;
+        n.SetCompact(nCompact, &fNegative, &fOverflow);
+
+        BOOST_CHECK_MESSAGE(fNegative == (bn < 0), strprintf("negative flag of %08x", nCompact));
+        BOOST_CHECK_MESSAGE(fOverflow == (BN_num_bits(&bn) > 256), strprintf("overflow flag of %08x", nCompact));
+        if (fOverflow)
+            continue;
+
+        // getuint256 drops the sign, so it compares the magnitude
+        BOOST_CHECK_MESSAGE(n == bn.getuint256(), strprintf("value of %08x", nCompact));
+        BOOST_CHECK_MESSAGE(n.GetCompact(fNegative) == bn.GetCompact(), strprintf("round trip of %08x", nCompact));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bignum_mul_div_equivalence)
+{
+    seed_insecure_rand(true);
+    for (int i = 0; i < 20000; i++)
+    {
+        uint256 a = RandomUint256();
+        uint256 b = RandomUint256();
+        CBigNum bnA(a), bnB(b);
+
+        // uint256 keeps the low 256 bits of a product, as getuint256 does
+        BOOST_CHECK((a * b) == (bnA * bnB).getuint256());
+        BOOST_CHECK(ToBigNum(uint512(a) * uint512(b)) == bnA * bnB);
+
+        uint32_t n32 = insecure_rand();
+        uint256 c = a;
+        c *= n32;
+        BOOST_CHECK(c == (bnA * CBigNum((uint64_t)n32)).getuint256());
+
+        if (b != 0)
+        {
+            BOOST_CHECK((a / b) == (bnA / bnB).getuint256());
+            BOOST_CHECK(ToBigNum(uint512(a) / uint512(b)) == bnA / bnB);
+        }
+    }
+
+    uint256 a = RandomUint256();
+    BOOST_CHECK_THROW(a /= uint256(0), uint_error);
+}
+
+BOOST_AUTO_TEST_CASE(bignum_block_trust_equivalence)
+{
+    seed_insecure_rand(true);
+    vector<unsigned int> vCompact = CompactValues();
+    BOOST_FOREACH(unsigned int nCompact, vCompact)
+    {
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nCompact);
+        uint256 nTrust = 0;
+        if (bnTarget > 0)
+            nTrust = ((CBigNum(1) << 256) / (bnTarget + 1)).getuint256();
+
+        CBlockIndex index;
+        index.nBits = nCompact;
+        BOOST_CHECK_MESSAGE(index.GetBlockTrust() == nTrust, strprintf("block trust of %08x", nCompact));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bignum_check_proof_of_work_equivalence)
+{
+    seed_insecure_rand(true);
+    CBigNum bnLimit(Params().ProofOfWorkLimit());
+    vector<unsigned int> vCompact = CompactValues();
+    BOOST_FOREACH(unsigned int nCompact, vCompact)
+    {
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nCompact);
+        for (int i = 0; i < 4; i++)
+        {
+            uint256 hash = RandomUint256();
+            bool fValid = !(bnTarget <= 0 || bnTarget > bnLimit) && !(hash > bnTarget.getuint256());
+            BOOST_CHECK_MESSAGE(CheckProofOfWork(hash, nCompact) == fValid, strprintf("proof of work for %08x", nCompact));
+        }
+    }
+}
+
+// GetNextTargetRequired as it was written with CBigNum
+static unsigned int NextTargetBigNum(unsigned int nBitsPrev, int64_t nActualSpacing, const CBigNum& bnTargetLimit)
+{
+    if (nActualSpacing < 0)
+        nActualSpacing = TARGET_SPACING;
+    CBigNum bnNew;
+    bnNew.SetCompact(nBitsPrev);
+    int64_t nInterval = (25 * 60) / TARGET_SPACING;
+    bnNew *= ((nInterval - 1) * TARGET_SPACING + nActualSpacing + nActualSpacing);
+    bnNew /= ((nInterval + 1) * TARGET_SPACING);
+    if (bnNew <= 0 || bnNew > bnTargetLimit)
+        bnNew = bnTargetLimit;
+    return bnNew.GetCompact();
+}
+
+BOOST_AUTO_TEST_CASE(bignum_next_target_equivalence)
+{
+    seed_insecure_rand(true);
+    static const int64_t pnSpacing[] = { -1000, -1, 0, 1, TARGET_SPACING, 25 * 60, 86400, 0xffffffffLL };
+    vector<unsigned int> vCompact = CompactValues();
+    for (int fProofOfStake = 0; fProofOfStake < 2; fProofOfStake++)
+    {
+        CBigNum bnTargetLimit(fProofOfStake ? ~uint256(0) >> 20 : Params().ProofOfWorkLimit());
+
+        // The retarget only looks at the last two blocks of the same kind
+        CBlockIndex index[3];
+        for (int i = 0; i < 3; i++)
+        {
+            index[i].nHeight = i;
+            index[i].pprev = i ? &index[i - 1] : NULL;
+            if (fProofOfStake)
+                index[i].SetProofOfStake();
+        }
+        index[1].nTime = 0x80000000;
+
+        BOOST_FOREACH(unsigned int nCompact, vCompact)
+        {
+            index[2].nBits = nCompact;
+            for (unsigned int i = 0; i < sizeof(pnSpacing) / sizeof(pnSpacing[0]); i++)
+            {
+                index[2].nTime = index[1].nTime + pnSpacing[i];
+                int64_t nActualSpacing = index[2].GetBlockTime() - index[1].GetBlockTime();
+                BOOST_CHECK_MESSAGE(GetNextTargetRequired(&index[2], fProofOfStake) == NextTargetBigNum(nCompact, nActualSpacing, bnTargetLimit),
+                    strprintf("next target for %08x after %d seconds", nCompact, nActualSpacing));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bignum_stake_kernel_equivalence)
+{
+    seed_insecure_rand(true);
+    static const int64_t pnValue[] = { 0, 1, COIN, 1000 * COIN, MAX_MONEY };
+
+    CBlockIndex indexPrev;
+    indexPrev.nStakeModifier = 0x0123456789abcdefULL;
+
+    CTransaction txPrev;
+    txPrev.nTime = 1500000000;
+    txPrev.vout.resize(1);
+    COutPoint prevout(RandomUint256(), 0);
+    unsigned int nTimeBlockFrom = txPrev.nTime;
+
+    int nPassed = 0;
+    for (int i = 0; i < 20000; i++)
+    {
+        // Big targets, so that the weighted target often needs more than 256 bits
+        unsigned int nBits = ((29 + insecure_rand() % 4) << 24) | (insecure_rand() & 0x007fffff);
+        txPrev.vout[0].nValue = i < 5 ? pnValue[i] : (int64_t)(insecure_rand() % (MAX_MONEY / COIN)) * COIN;
+        unsigned int nTimeTx = nTimeBlockFrom + nStakeMinAge + i;
+
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nBits);
+        bnTarget *= CBigNum(txPrev.vout[0].nValue);
+
+        uint256 hashProofOfStake, targetProofOfStake;
+        bool fPassed = CheckStakeKernelHash(&indexPrev, nBits, nTimeBlockFrom, txPrev, prevout, nTimeTx, hashProofOfStake, targetProofOfStake);
+        BOOST_CHECK(targetProofOfStake == bnTarget.getuint256());
+        BOOST_CHECK(fPassed == !(CBigNum(hashProofOfStake) > bnTarget));
+        nPassed += fPassed;
+    }
+    // Both outcomes were exercised
+    BOOST_CHECK(nPassed > 0 && nPassed < 20000);
+
+    // A negative or oversized nBits is refused outright
+    uint256 hashProofOfStake, targetProofOfStake;
+    txPrev.vout[0].nValue = COIN;
+    BOOST_CHECK(!CheckStakeKernelHash(&indexPrev, 0x1d800001, nTimeBlockFrom, txPrev, prevout, nTimeBlockFrom + nStakeMinAge, hashProofOfStake, targetProofOfStake));
+    BOOST_CHECK(!CheckStakeKernelHash(&indexPrev, 0x23010000, nTimeBlockFrom, txPrev, prevout, nTimeBlockFrom + nStakeMinAge, hashProofOfStake, targetProofOfStake));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,167 @@
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "walletlog.h"
+#include "util.h"
+#include "version.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(walletlog_tests)
+
+static void CommitRecord(CWalletLog& log, const string& strKey, const string& strValue)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION);
+    ssKey << strKey;
+    ssValue << strValue;
+    CWalletLogBatch batch;
+    batch.Write(ssKey, ssValue);
+    BOOST_CHECK(log.Commit(batch, true));
+}
+
+static bool ReadRecord(CWalletLog& log, const string& strKey, string& strValue)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION);
+    ssKey << strKey;
+    if (!log.Read(ssKey, ssValue))
+        return false;
+    ssValue >> strValue;
+    return true;
+}
+
+static void WriteByte(const boost::filesystem::path& path, uint64_t nPos, char ch)
+{
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE(fseek(file, nPos, SEEK_SET) == 0);
+    BOOST_REQUIRE(fputc(ch, file) == ch);
+    fclose(file);
+}
+
+// Three batches, one per reopen, so the offset of each batch is the file size before it
+static void CreateLog(const boost::filesystem::path& path, vector<uint64_t>& vBatchPos)
+{
+    const char* pszKeys[] = { "a", "b", "c" };
+    vBatchPos.clear();
+    for (int i = 0; i < 3; i++)
+    {
+        CWalletLog log(path);
+        BOOST_REQUIRE(log.Open());
+        vBatchPos.push_back(boost::filesystem::file_size(path));
+        CommitRecord(log, pszKeys[i], string("value ") + pszKeys[i]);
+        log.Close();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_corrupt_middle_batch)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    vector<uint64_t> vBatchPos;
+    CreateLog(path, vBatchPos);
+    uint64_t nSize = boost::filesystem::file_size(path);
+
+    // A bad frame header with more batches after it is corruption, not a torn write
+    WriteByte(path, vBatchPos[1], 0);
+    {
+        CWalletLog log(path);
+        BOOST_CHECK(!log.Open());
+    }
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), nSize);
+
+    // Undo the damage and every batch is still there
+    WriteByte(path, vBatchPos[1], 0x5e);
+    {
+        CWalletLog log(path);
+        BOOST_REQUIRE(log.Open());
+        string strValue;
+        BOOST_CHECK(ReadRecord(log, "a", strValue) && strValue == "value a");
+        BOOST_CHECK(ReadRecord(log, "b", strValue) && strValue == "value b");
+        BOOST_CHECK(ReadRecord(log, "c", strValue) && strValue == "value c");
+        BOOST_CHECK_EQUAL(log.GetRecordCount(), 3U);
+    }
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_torn_last_batch)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    vector<uint64_t> vBatchPos;
+    CreateLog(path, vBatchPos);
+
+    // Cut the last batch short, it is dropped and the ones before it kept
+    boost::filesystem::resize_file(path, vBatchPos[2] + 5);
+    {
+        CWalletLog log(path);
+        BOOST_REQUIRE(log.Open());
+        string strValue;
+        BOOST_CHECK(ReadRecord(log, "b", strValue) && strValue == "value b");
+        BOOST_CHECK(!ReadRecord(log, "c", strValue));
+    }
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), vBatchPos[2]);
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_zero_tail)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    vector<uint64_t> vBatchPos;
+    CreateLog(path, vBatchPos);
+    uint64_t nSize = boost::filesystem::file_size(path);
+
+    // A crash can leave zeros where the last batch should be, that's a torn write too
+    boost::filesystem::resize_file(path, nSize + 100);
+    {
+        CWalletLog log(path);
+        BOOST_REQUIRE(log.Open());
+        BOOST_CHECK_EQUAL(log.GetRecordCount(), 3U);
+    }
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), nSize);
+
+    // Same for a frame header followed by a zeroed payload
+    boost::filesystem::resize_file(path, nSize + 100);
+    for (uint64_t nPos = vBatchPos[2] + 8; nPos < nSize; nPos++)
+        WriteByte(path, nPos, 0);
+    {
+        CWalletLog log(path);
+        BOOST_REQUIRE(log.Open());
+        BOOST_CHECK_EQUAL(log.GetRecordCount(), 2U);
+    }
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), vBatchPos[2]);
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(walletlog_salvage)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    vector<uint64_t> vBatchPos;
+    CreateLog(path, vBatchPos);
+    WriteByte(path, vBatchPos[1], 0);
+
+    // Salvaging keeps the batches before the damage and a copy of the original
+    {
+        CWalletLog log(path);
+        BOOST_CHECK(!log.Open());
+        BOOST_REQUIRE(log.Open(true));
+        string strValue;
+        BOOST_CHECK(ReadRecord(log, "a", strValue) && strValue == "value a");
+        BOOST_CHECK(!ReadRecord(log, "b", strValue));
+    }
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), vBatchPos[1]);
+
+    int nBackups = 0;
+    string strPrefix = path.filename().string() + ".";
+    boost::filesystem::directory_iterator itend;
+    for (boost::filesystem::directory_iterator it(path.parent_path()); it != itend; ++it)
+    {
+        string strName = it->path().filename().string();
+        if (strName.compare(0, strPrefix.size(), strPrefix) == 0)
+        {
+            nBackups++;
+            boost::filesystem::remove(it->path());
+        }
+    }
+    BOOST_CHECK_EQUAL(nBackups, 1);
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 // file license.txt or http://www.opensource.org/licenses/mit-license.php.
 
 #include <map>
+#include <set>
 
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
@@ -219,6 +220,195 @@ bool CTxDB::WriteAddrIndex(uint160 addrHash, uint256 txHash)
     }
 }
 
+// Merges the transactions collected for a range of blocks into the address
+// index and records nHeightNext as the rebuild progress, in one batch. The
+// current entries are read before the batch is opened, with a batch active
+// every Read would scan the whole batch first.
+bool CTxDB::WriteAddrIndexRange(const MapAddrIndex& mapAddrIndex, int nHeightNext)
+{
+    assert(!activeBatch);
+
+    std::vector<std::pair<uint160, std::vector<uint256> > > vChanged;
+    vChanged.reserve(mapAddrIndex.size());
+    for (MapAddrIndex::const_iterator it = mapAddrIndex.begin(); it != mapAddrIndex.end(); ++it)
+    {
+        std::vector<uint256> txHashes;
+        ReadAddrIndex(it->first, txHashes);
+        size_t nOld = txHashes.size();
+
+        std::set<uint256> setHave(txHashes.begin(), txHashes.end());
+        BOOST_FOREACH(const uint256& txHash, it->second)
+            if (setHave.insert(txHash).second)
+                txHashes.push_back(txHash);
+
+        if (txHashes.size() != nOld)
+        {
+            vChanged.push_back(std::make_pair(it->first, std::vector<uint256>()));
+            vChanged.back().second.swap(txHashes);
+        }
+    }
+
+    if (!TxnBegin())
+        return false;
+    for (unsigned int i = 0; i < vChanged.size(); i++)
+        Write(make_pair(string("adr"), vChanged[i].first), vChanged[i].second);
+    WriteAddrIndexHeight(nHeightNext);
+    return TxnCommit();
+}
+
+// Records written per batch while the coin database is built
+static const unsigned int COINDB_BUILD_BATCH = 10000;
+
+// Erases every key whose type string is strType, in batches.
+bool CTxDB::EraseType(const string& strType)
+{
+    assert(!activeBatch);
+
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << strType;
+    iterator->Seek(ssStartKey.str());
+
+    unsigned int nBatch = 0;
+    TxnBegin();
+    for (; iterator->Valid(); iterator->Next())
+    {
+        CSpanReader ssKey(iterator->key().data(), iterator->key().size(), SER_DISK, CLIENT_VERSION);
+        string strKeyType;
+        ssKey >> strKeyType;
+        if (strKeyType != strType)
+            break;
+        activeBatch->Delete(iterator->key());
+        if (++nBatch == COINDB_BUILD_BATCH)
+        {
+            if (!TxnCommit())
+                break;
+            TxnBegin();
+            nBatch = 0;
+        }
+    }
+    delete iterator;
+    return activeBatch ? TxnCommit() : false;
+}
+
+// Fills the coin database with the unspent outputs in the transaction index,
+// replacing what an unfinished earlier build left behind. The blocks near the
+// tip also get undo records, so they can still be disconnected afterwards.
+bool CTxDB::BuildCoinDB()
+{
+    assert(!activeBatch);
+
+    if (!EraseType("coin") || !EraseType("coinundo"))
+        return error("BuildCoinDB() : erasing old entries failed");
+
+    // Blocks by file position, for the height of each transaction
+    map<pair<unsigned int, unsigned int>, int> mapBlockPos;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        mapBlockPos[make_pair(item.second->nFile, item.second->nBlockPos)] = item.second->nHeight;
+
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << make_pair(string("tx"), uint256(0));
+    iterator->Seek(ssStartKey.str());
+
+    uint64_t nCoins = 0;
+    unsigned int nBatch = 0;
+    TxnBegin();
+    for (; iterator->Valid(); iterator->Next())
+    {
+        boost::this_thread::interruption_point();
+        CSpanReader ssKey(iterator->key().data(), iterator->key().size(), SER_DISK, CLIENT_VERSION);
+        string strType;
+        ssKey >> strType;
+        if (strType != "tx")
+            break;
+        uint256 hash;
+        ssKey >> hash;
+        CTxIndex txindex;
+        CSpanReader ssValue(iterator->value().data(), iterator->value().size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> txindex;
+
+        bool fUnspent = false;
+        BOOST_FOREACH(const CDiskTxPos& posSpent, txindex.vSpent)
+            fUnspent |= posSpent.IsNull();
+        if (!fUnspent)
+            continue;
+
+        CTransaction tx;
+        if (!tx.ReadFromDisk(txindex.pos))
+        {
+            delete iterator;
+            TxnAbort();
+            return error("BuildCoinDB() : reading transaction %s failed", hash.ToString());
+        }
+        map<pair<unsigned int, unsigned int>, int>::const_iterator mi = mapBlockPos.find(make_pair(txindex.pos.nFile, txindex.pos.nBlockPos));
+        int nHeight = mi == mapBlockPos.end() ? 0 : mi->second;
+        for (unsigned int n = 0; n < tx.vout.size() && n < txindex.vSpent.size(); n++)
+        {
+            if (!txindex.vSpent[n].IsNull())
+                continue;
+            WriteCoin(COutPoint(hash, n), CCoin(tx, n, nHeight));
+            nCoins++;
+            nBatch++;
+        }
+        if (nBatch >= COINDB_BUILD_BATCH)
+        {
+            if (!TxnCommit())
+            {
+                delete iterator;
+                return error("BuildCoinDB() : writing coins failed");
+            }
+            TxnBegin();
+            nBatch = 0;
+        }
+    }
+    delete iterator;
+    if (!TxnCommit())
+        return error("BuildCoinDB() : writing coins failed");
+
+    // Undo records for the last blocks of the best chain
+    int nUndo = 0;
+    for (CBlockIndex* pindex = pindexBest; pindex && pindex->pprev && nUndo < MIN_BLOCKS_TO_KEEP; pindex = pindex->pprev, nUndo++)
+    {
+        boost::this_thread::interruption_point();
+        CBlock block;
+        if (!block.ReadFromDisk(pindex))
+            return error("BuildCoinDB() : reading block %s failed", pindex->GetBlockHash().ToString());
+
+        set<uint256> setInBlock;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            setInBlock.insert(tx.GetHash());
+
+        vector<pair<COutPoint, CCoin> > vUndo;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        {
+            if (tx.IsCoinBase())
+                continue;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            {
+                if (setInBlock.count(txin.prevout.hash))
+                    continue;
+                CTransaction txPrev;
+                CTxIndex txindex;
+                if (!txPrev.ReadFromDisk(*this, txin.prevout, txindex))
+                    return error("BuildCoinDB() : reading input %s of block %s failed", txin.prevout.ToString(), pindex->GetBlockHash().ToString());
+                map<pair<unsigned int, unsigned int>, int>::const_iterator mi = mapBlockPos.find(make_pair(txindex.pos.nFile, txindex.pos.nBlockPos));
+                vUndo.push_back(make_pair(txin.prevout, CCoin(txPrev, txin.prevout.n, mi == mapBlockPos.end() ? 0 : mi->second)));
+            }
+        }
+        if (!WriteCoinUndo(pindex->GetBlockHash(), vUndo))
+            return error("BuildCoinDB() : writing undo record failed");
+    }
+
+    LogPrintf("BuildCoinDB() : %u unspent outputs, undo records for %d blocks\n", nCoins, nUndo);
+    return Write(string("coindb"), 1);
+}
+
+bool CTxDB::DisableCoinDB()
+{
+    return Erase(string("coindb"));
+}
+
 bool CTxDB::ReadAddrIndex(uint160 addrHash, std::vector<uint256>& txHashes)
 {
     return Read(make_pair(string("adr"), addrHash), txHashes);
@@ -311,7 +501,7 @@ static CBlockIndex *InsertBlockIndex(uint256 hash)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
@@ -319,8 +509,7 @@ static CBlockIndex *InsertBlockIndex(uint256 hash)
     CBlockIndex* pindexNew = new CBlockIndex();
     if (!pindexNew)
         throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
-    mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
+    InsertBlockIndexEntry(hash, pindexNew);
 
     return pindexNew;
 }
@@ -344,11 +533,9 @@ bool CTxDB::LoadBlockIndex()
     while (iterator->Valid())
     {
         boost::this_thread::interruption_point();
-        // Unpack keys and values.
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.write(iterator->key().data(), iterator->key().size());
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        ssValue.write(iterator->value().data(), iterator->value().size());
+        // Unpack keys and values straight out of the iterator's slices.
+        CSpanReader ssKey(iterator->key().data(), iterator->key().size(), SER_DISK, CLIENT_VERSION);
+        CSpanReader ssValue(iterator->value().data(), iterator->value().size(), SER_DISK, CLIENT_VERSION);
         string strType;
         ssKey >> strType;
         // Did we reach the end of the data to read?
@@ -430,6 +617,7 @@ bool CTxDB::LoadBlockIndex()
     pindexBest = mapBlockIndex[hashBestChain];
     nBestHeight = pindexBest->nHeight;
     nBestChainTrust = pindexBest->nChainTrust;
+    UpdateChainSnapshot(pindexBest);
 
     LogPrintf("LoadBlockIndex(): hashBestChain=%s  height=%d  trust=%s  date=%s\n",
       hashBestChain.ToString(), nBestHeight, CBigNum(nBestChainTrust).ToString(),
@@ -440,6 +628,12 @@ bool CTxDB::LoadBlockIndex()
     ReadBestInvalidTrust(bnBestInvalidTrust);
     nBestInvalidTrust = bnBestInvalidTrust.getuint256();
 
+    // Block files deleted by -prune, and whether the coin database is kept up to date
+    set<unsigned int> setPrunedFiles;
+    if (ReadPrunedFiles(setPrunedFiles))
+        LoadPrunedBlockFiles(setPrunedFiles);
+    fCoinDB = HaveCoinDB();
+
     // Verify blocks in the best chain
     int nCheckLevel = GetArg("-checklevel", 1);
     int nCheckDepth = GetArg( "-checkblocks", 500);
@@ -453,7 +647,7 @@ bool CTxDB::LoadBlockIndex()
     for (CBlockIndex* pindex = pindexBest; pindex && pindex->pprev; pindex = pindex->pprev)
     {
         boost::this_thread::interruption_point();
-        if (pindex->nHeight < nBestHeight-nCheckDepth)
+        if (pindex->nHeight < nBestHeight-nCheckDepth || IsBlockFilePruned(pindex->nFile))
             break;
         CBlock block;
         if (!block.ReadFromDisk(pindex))
@@ -477,7 +671,7 @@ bool CTxDB::LoadBlockIndex()
                 if (ReadTxIndex(hashTx, txindex))
                 {
                     // check level 3: checker transaction hashes
-                    if (nCheckLevel>2 || pindex->nFile != txindex.pos.nFile || pindex->nBlockPos != txindex.pos.nBlockPos)
+                    if ((nCheckLevel>2 || pindex->nFile != txindex.pos.nFile || pindex->nBlockPos != txindex.pos.nBlockPos) && !IsBlockFilePruned(txindex.pos.nFile))
                     {
                         // either an error or a duplicate transaction
                         CTransaction txFound;
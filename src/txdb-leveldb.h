@@ -9,6 +9,7 @@
 #include "main.h"
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -87,8 +88,7 @@ protected:
         }
         // Unserialize value
         try {
-            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(),
-                                SER_DISK, CLIENT_VERSION);
+            CSpanReader ssValue(strValue.data(), strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
         }
         catch (std::exception &e) {
@@ -183,8 +183,77 @@ public:
         return Write(std::string("version"), nVersion);
     }
 
+    // Coin database (-coindb), present once "coindb" is written
+    bool HaveCoinDB()
+    {
+        return Exists(std::string("coindb"));
+    }
+
+    bool ReadCoin(const COutPoint& outpoint, CCoin& coin)
+    {
+        return Read(make_pair(std::string("coin"), outpoint), coin);
+    }
+
+    bool WriteCoin(const COutPoint& outpoint, const CCoin& coin)
+    {
+        return Write(make_pair(std::string("coin"), outpoint), coin);
+    }
+
+    bool EraseCoin(const COutPoint& outpoint)
+    {
+        return Erase(make_pair(std::string("coin"), outpoint));
+    }
+
+    // Coins spent by a block, restored when it is disconnected
+    bool ReadCoinUndo(const uint256& hashBlock, std::vector<std::pair<COutPoint, CCoin> >& vUndo)
+    {
+        return Read(make_pair(std::string("coinundo"), hashBlock), vUndo);
+    }
+
+    bool WriteCoinUndo(const uint256& hashBlock, const std::vector<std::pair<COutPoint, CCoin> >& vUndo)
+    {
+        return Write(make_pair(std::string("coinundo"), hashBlock), vUndo);
+    }
+
+    bool EraseCoinUndo(const uint256& hashBlock)
+    {
+        return Erase(make_pair(std::string("coinundo"), hashBlock));
+    }
+
+    bool BuildCoinDB();
+    bool DisableCoinDB();
+
+    // Block files deleted by -prune
+    bool ReadPrunedFiles(std::set<unsigned int>& setFiles)
+    {
+        return Read(std::string("prunedfiles"), setFiles);
+    }
+
+    bool WritePrunedFiles(const std::set<unsigned int>& setFiles)
+    {
+        return Write(std::string("prunedfiles"), setFiles);
+    }
+
     bool ReadAddrIndex(uint160 addrHash, std::vector<uint256>& txHashes);
     bool WriteAddrIndex(uint160 addrHash, uint256 txHash);
+    bool WriteAddrIndexRange(const MapAddrIndex& mapAddrIndex, int nHeightNext);
+
+    // Next block height of an unfinished address index rebuild
+    bool ReadAddrIndexHeight(int& nHeight)
+    {
+        return Read(std::string("addrindexheight"), nHeight);
+    }
+
+    bool WriteAddrIndexHeight(int nHeight)
+    {
+        return Write(std::string("addrindexheight"), nHeight);
+    }
+
+    bool EraseAddrIndexHeight()
+    {
+        return Erase(std::string("addrindexheight"));
+    }
+
     bool ReadTxIndex(uint256 hash, CTxIndex& txindex);
     bool UpdateTxIndex(uint256 hash, const CTxIndex& txindex);
     bool AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight);
@@ -202,6 +271,7 @@ public:
     bool LoadBlockIndex();
 private:
     bool LoadBlockIndexGuts();
+    bool EraseType(const std::string& strType);
 };
 
 
@@ -88,6 +88,15 @@ public:
     /** Number of network connections changed. */
     boost::signals2::signal<void (int newNumConnections)> NotifyNumConnectionsChanged;
 
+    /**
+     * New best block.
+     * @note called with lock cs_main held.
+     */
+    boost::signals2::signal<void (int nHeight, int64_t nBlockTime)> NotifyBlockTip;
+
+    /** Number of enabled or known primenodes changed. */
+    boost::signals2::signal<void (int nEnabled, int nTotal)> NotifyPrimenodeListChanged;
+
     /**
      * New, updated or cancelled alert.
      * @note called with lock cs_mapAlerts held.
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_UINT256_H
 #define BITCOIN_UINT256_H
 
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -21,6 +22,13 @@ inline signed char HexDigit(char c)
     return p_util_hexdigit[(unsigned char)c];
 }
 
+/** Errors thrown by the uint classes */
+class uint_error : public std::runtime_error
+{
+public:
+    explicit uint_error(const std::string& str) : std::runtime_error(str) {}
+};
+
 /** Base class without constructors for uint256 and uint160.
  * This makes the compiler let u use it in a union.
  */
@@ -215,6 +223,84 @@ public:
         return ret;
     }
 
+    base_uint& operator*=(uint32_t b32)
+    {
+        uint64_t carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64_t n = carry + (uint64_t)b32 * pn[i];
+            pn[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    base_uint& operator*=(const base_uint& b)
+    {
+        // Schoolbook multiplication, truncated to BITS
+        base_uint a;
+        for (int i = 0; i < WIDTH; i++)
+            a.pn[i] = 0;
+        for (int j = 0; j < WIDTH; j++)
+        {
+            if (pn[j] == 0)
+                continue;
+            uint64_t carry = 0;
+            for (int i = 0; i + j < WIDTH; i++)
+            {
+                uint64_t n = carry + a.pn[i + j] + (uint64_t)pn[j] * b.pn[i];
+                a.pn[i + j] = n & 0xffffffff;
+                carry = n >> 32;
+            }
+        }
+        *this = a;
+        return *this;
+    }
+
+    base_uint& operator/=(const base_uint& b)
+    {
+        // Shift-and-subtract long division
+        base_uint div = b;
+        base_uint num = *this;
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+        int num_bits = num.bits();
+        int div_bits = div.bits();
+        if (div_bits == 0)
+            throw uint_error("base_uint::operator/= : division by zero");
+        if (div_bits > num_bits)
+            return *this;
+        int shift = num_bits - div_bits;
+        div <<= shift;
+        while (shift >= 0)
+        {
+            if (num >= div)
+            {
+                num -= div;
+                pn[shift / 32] |= (1U << (shift & 31));
+            }
+            div >>= 1;
+            shift--;
+        }
+        return *this;
+    }
+
+    /** Position of the highest set bit plus one, or zero for zero */
+    unsigned int bits() const
+    {
+        for (int pos = WIDTH - 1; pos >= 0; pos--)
+        {
+            if (pn[pos])
+            {
+                for (int nbits = 31; nbits > 0; nbits--)
+                    if (pn[pos] & (1U << nbits))
+                        return 32 * pos + nbits + 1;
+                return 32 * pos + 1;
+            }
+        }
+        return 0;
+    }
+
 
     friend inline bool operator<(const base_uint& a, const base_uint& b)
     {
@@ -582,6 +668,57 @@ public:
         else
             *this = 0;
     }
+
+    /** Decode the "compact" nBits format: an exponent byte giving the
+     * length in bytes, followed by a 23 bit mantissa and a sign bit, like
+     * an OpenSSL MPI. Values that need more than 256 bits set *pfOverflow.
+     */
+    uint256& SetCompact(unsigned int nCompact, bool* pfNegative = NULL, bool* pfOverflow = NULL)
+    {
+        int nSize = nCompact >> 24;
+        unsigned int nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8 * (3 - nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8 * (nSize - 3);
+        }
+        if (pfNegative)
+            *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
+        if (pfOverflow)
+            *pfOverflow = nWord != 0 && ((nSize > 34) ||
+                                         (nWord > 0xff && nSize > 33) ||
+                                         (nWord > 0xffff && nSize > 32));
+        return *this;
+    }
+
+    unsigned int GetCompact(bool fNegative = false) const
+    {
+        int nSize = (bits() + 7) / 8;
+        unsigned int nCompact = 0;
+        if (nSize <= 3)
+            nCompact = Get64() << 8 * (3 - nSize);
+        else
+        {
+            uint256 bn = *this;
+            bn >>= 8 * (nSize - 3);
+            nCompact = bn.Get64();
+        }
+        // The 0x00800000 bit denotes the sign, so if it is already set
+        // divide the mantissa by 256 and increase the exponent.
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        nCompact |= nSize << 24;
+        nCompact |= (fNegative && (nCompact & 0x007fffff) ? 0x00800000 : 0);
+        return nCompact;
+    }
 };
 
 inline bool operator==(const uint256& a, uint64_t b)                         { return (base_uint256)a == b; }
@@ -596,6 +733,8 @@ inline const uint256 operator&(const base_uint256& a, const base_uint256& b) { r
 inline const uint256 operator|(const base_uint256& a, const base_uint256& b) { return uint256(a) |= b; }
 inline const uint256 operator+(const base_uint256& a, const base_uint256& b) { return uint256(a) += b; }
 inline const uint256 operator-(const base_uint256& a, const base_uint256& b) { return uint256(a) -= b; }
+inline const uint256 operator*(const base_uint256& a, const base_uint256& b) { return uint256(a) *= b; }
+inline const uint256 operator/(const base_uint256& a, const base_uint256& b) { return uint256(a) /= b; }
 
 inline bool operator<(const base_uint256& a, const uint256& b)          { return (base_uint256)a <  (base_uint256)b; }
 inline bool operator<=(const base_uint256& a, const uint256& b)         { return (base_uint256)a <= (base_uint256)b; }
@@ -699,6 +838,12 @@ public:
             *this = 0;
     }
 
+    explicit uint512(const uint256& b)
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = i < uint256::WIDTH ? b.pn[i] : 0;
+    }
+
     uint256 trim256() const
     {
         uint256 ret;
@@ -721,6 +866,8 @@ inline const uint512 operator&(const base_uint512& a, const base_uint512& b) { r
 inline const uint512 operator|(const base_uint512& a, const base_uint512& b) { return uint512(a) |= b; }
 inline const uint512 operator+(const base_uint512& a, const base_uint512& b) { return uint512(a) += b; }
 inline const uint512 operator-(const base_uint512& a, const base_uint512& b) { return uint512(a) -= b; }
+inline const uint512 operator*(const base_uint512& a, const base_uint512& b) { return uint512(a) *= b; }
+inline const uint512 operator/(const base_uint512& a, const base_uint512& b) { return uint512(a) /= b; }
 
 inline bool operator<(const base_uint512& a, const uint512& b)          { return (base_uint512)a <  (base_uint512)b; }
 inline bool operator<=(const base_uint512& a, const uint512& b)         { return (base_uint512)a <= (base_uint512)b; }
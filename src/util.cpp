@@ -37,6 +37,7 @@ namespace boost {
 #include <boost/filesystem/fstream.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
 #include <openssl/crypto.h>
 #include <openssl/rand.h>
 #include <openssl/err.h>
@@ -270,6 +271,217 @@ bool LogAcceptCategory(const char* category)
     return true;
 }
 
+//
+// Asynchronous debug.log writer
+//
+// Once StartDebugLogWriter() has been called, LogPrintStr appends to a
+// buffer owned by the calling thread and returns without taking a lock or
+// touching the file. ThreadLogWriter drains all buffers into debug.log in
+// batches. Lines from different threads can therefore be reordered within
+// one flush interval, lines from the same thread never are.
+//
+
+static const size_t LOG_BUFFER_SIZE = 128 * 1024;
+static const int LOG_FLUSH_INTERVAL_MS = 100;
+
+/** Log output of one thread. The owning thread is the only producer and
+    FlushDebugLog, under mutexDebugLog, the only consumer. */
+class CLogBuffer
+{
+public:
+    CLogBuffer() : vBuf(LOG_BUFFER_SIZE), nHead(0), nTail(0), nDropped(0), fOrphan(false), fStartedNewLine(true), nTimestamp(-1) {}
+
+    /** Producer side, false when there is no room for str */
+    bool Push(const std::string& str)
+    {
+        size_t nPos = nHead.load(boost::memory_order_relaxed);
+        if (vBuf.size() - (nPos - nTail.load(boost::memory_order_acquire)) < str.size())
+            return false;
+        size_t nOffset = nPos % vBuf.size();
+        size_t nFirst = std::min(str.size(), vBuf.size() - nOffset);
+        memcpy(&vBuf[nOffset], str.data(), nFirst);
+        memcpy(&vBuf[0], str.data() + nFirst, str.size() - nFirst);
+        nHead.store(nPos + str.size(), boost::memory_order_release);
+        return true;
+    }
+
+    /** Consumer side, write out everything pushed so far */
+    void Drain(FILE* file)
+    {
+        size_t nPos = nTail.load(boost::memory_order_relaxed);
+        size_t nEnd = nHead.load(boost::memory_order_acquire);
+        if (nPos == nEnd)
+            return;
+        size_t nOffset = nPos % vBuf.size();
+        size_t nFirst = std::min(nEnd - nPos, vBuf.size() - nOffset);
+        fwrite(&vBuf[nOffset], 1, nFirst, file);
+        if (nEnd - nPos > nFirst)
+            fwrite(&vBuf[0], 1, nEnd - nPos - nFirst, file);
+        nTail.store(nEnd, boost::memory_order_release);
+    }
+
+    size_t Used() const { return nHead.load(boost::memory_order_relaxed) - nTail.load(boost::memory_order_relaxed); }
+    bool Empty() const { return Used() == 0; }
+
+    std::vector<char> vBuf;
+    boost::atomic<size_t> nHead;
+    boost::atomic<size_t> nTail;
+    boost::atomic<unsigned int> nDropped;
+    boost::atomic<bool> fOrphan;     // owning thread has exited
+
+    // Only used by the owning thread
+    bool fStartedNewLine;
+    int64_t nTimestamp;
+    std::string strTimestamp;
+};
+
+static volatile bool fLogAsync = false;
+static int64_t nLogRotateSize = 0;
+static std::list<CLogBuffer*>* plistLogBuffers = NULL; // guarded by mutexDebugLog
+static boost::mutex* mutexLogWriter = NULL;
+static boost::condition_variable* condLogWriter = NULL;
+
+static void ReleaseLogBuffer(CLogBuffer* pbuf)
+{
+    // The writer deletes it once the rest has been written out
+    pbuf->fOrphan = true;
+}
+
+static boost::thread_specific_ptr<CLogBuffer> ptrLogBuffer(ReleaseLogBuffer);
+
+static CLogBuffer* GetLogBuffer()
+{
+    CLogBuffer* pbuf = ptrLogBuffer.get();
+    if (pbuf == NULL)
+    {
+        pbuf = new CLogBuffer();
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        plistLogBuffers->push_back(pbuf);
+        ptrLogBuffer.reset(pbuf);
+    }
+    return pbuf;
+}
+
+static void ReopenDebugLog()
+{
+    boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+    if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
+        setbuf(fileout, NULL); // unbuffered
+}
+
+void FlushDebugLog()
+{
+    if (!fLogAsync)
+        return;
+
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        ReopenDebugLog();
+    }
+
+    std::list<CLogBuffer*>::iterator it = plistLogBuffers->begin();
+    while (it != plistLogBuffers->end())
+    {
+        CLogBuffer* pbuf = *it;
+        unsigned int nDropped = pbuf->nDropped.exchange(0);
+        pbuf->Drain(fileout);
+        if (nDropped)
+            fprintf(fileout, "*** %u log messages dropped, log buffer full ***\n", nDropped);
+        if (pbuf->fOrphan && pbuf->Empty())
+        {
+            delete pbuf;
+            it = plistLogBuffers->erase(it);
+        }
+        else
+            ++it;
+    }
+
+    // Start a new file once this one has grown past -logrotatesize
+    if (nLogRotateSize > 0 && ftell(fileout) > nLogRotateSize)
+    {
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        boost::filesystem::path pathOld = GetDataDir() / "debug.log.1";
+        try {
+            boost::filesystem::remove(pathOld);
+            boost::filesystem::rename(pathDebug, pathOld);
+        } catch (boost::filesystem::filesystem_error &e) {
+            fprintf(fileout, "Failed to rotate debug.log: %s\n", e.what());
+        }
+        ReopenDebugLog();
+    }
+}
+
+static void ThreadLogWriter()
+{
+    RenameThread("parlay-logwriter");
+
+    while (true)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(*mutexLogWriter);
+            condLogWriter->timed_wait(lock, boost::posix_time::milliseconds(LOG_FLUSH_INTERVAL_MS));
+        }
+        FlushDebugLog();
+    }
+}
+
+void StartDebugLogWriter()
+{
+    if (fPrintToConsole || !fPrintToDebugLog || !GetBoolArg("-logasync", true))
+        return;
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    if (fileout == NULL || fLogAsync)
+        return;
+
+    nLogRotateSize = GetArg("-logrotatesize", 0) * 1000000;
+    plistLogBuffers = new std::list<CLogBuffer*>();
+    mutexLogWriter = new boost::mutex();
+    condLogWriter = new boost::condition_variable();
+    boost::thread(&ThreadLogWriter).detach();
+    fLogAsync = true;
+}
+
+static int LogPushAsync(const std::string &str)
+{
+    CLogBuffer* pbuf = GetLogBuffer();
+
+    const std::string* pstr = &str;
+    std::string strLine;
+    if (fLogTimestamps && pbuf->fStartedNewLine)
+    {
+        // Formatting the time is the expensive part, do it once per second
+        int64_t nTime = GetTime();
+        if (nTime != pbuf->nTimestamp)
+        {
+            pbuf->nTimestamp = nTime;
+            pbuf->strTimestamp = DateTimeStrFormat("%Y-%m-%d %H:%M:%S ", nTime);
+        }
+        strLine = pbuf->strTimestamp + str;
+        pstr = &strLine;
+    }
+    pbuf->fStartedNewLine = !str.empty() && str[str.size()-1] == '\n';
+
+    if (pstr->size() > LOG_BUFFER_SIZE / 2)
+    {
+        // Too big to queue, write it directly after what is already queued
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        pbuf->Drain(fileout);
+        return fwrite(pstr->data(), 1, pstr->size(), fileout);
+    }
+
+    if (!pbuf->Push(*pstr))
+    {
+        pbuf->nDropped++;
+        return 0;
+    }
+    if (pbuf->Used() > LOG_BUFFER_SIZE / 2)
+        condLogWriter->notify_one();
+    return str.size();
+}
+
 int LogPrintStr(const std::string &str)
 {
     int ret = 0; // Returns total number of characters written
@@ -286,14 +498,15 @@ int LogPrintStr(const std::string &str)
         if (fileout == NULL)
             return ret;
 
+        if (fLogAsync)
+            return LogPushAsync(str);
+
         boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
 
         // reopen the log file, if requested
         if (fReopenDebugLog) {
             fReopenDebugLog = false;
-            boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-            if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                setbuf(fileout, NULL); // unbuffered
+            ReopenDebugLog();
         }
 
         // Debug print useful for profiling
@@ -154,6 +154,10 @@ void RandAddSeedPerfmon();
 bool LogAcceptCategory(const char* category);
 /* Send a string to the log output */
 int LogPrintStr(const std::string &str);
+/* Hand debug.log writes to a background thread from now on */
+void StartDebugLogWriter();
+/* Write out everything queued for debug.log */
+void FlushDebugLog();
 
 #define LogPrintf(...) LogPrint(NULL, __VA_ARGS__)
 
@@ -227,6 +227,7 @@ bool CWallet::Lock()
             sxAddr.spend_secret = sxAddrTemp.spend_secret;
         };
     }
+    SecureMsgWalletLocked();
     return LockKeyStore();
 };
 
@@ -322,6 +323,12 @@ void CWallet::SetBestChain(const CBlockLocator& loc)
     walletdb.WriteBestBlock(loc);
 }
 
+void CWallet::UpdatedBlockTip(int nHeight)
+{
+    // Confirmations and maturity moved
+    MarkBalancesDirty();
+}
+
 bool CWallet::SetMinVersion(enum WalletFeature nVersion, CWalletDB* pwalletdbIn, bool fExplicit)
 {
     LOCK(cs_wallet); // nWalletVersion
@@ -459,6 +466,91 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::MarkCoinsDirty(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+    if (mi == mapWallet.end())
+        return;
+    mapWalletCoins[hash] = &(*mi).second;
+    setWalletCoinsDirty.insert(hash);
+    MarkBalancesDirty();
+}
+
+// The transaction itself and everything it spends
+void CWallet::MarkCoinsDirty(const CTransaction& tx)
+{
+    MarkCoinsDirty(tx.GetHash());
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        MarkCoinsDirty(txin.prevout.hash);
+}
+
+// An output of ours only counts as gone once a transaction in the main chain
+// spends it, a spend that is still in the mempool can be dropped without the
+// wallet being told.
+bool CWallet::HasUnspentCoins(const uint256& hash, const CWalletTx& wtx) const
+{
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        if (IsMine(wtx.vout[i]) == ISMINE_NO)
+            continue;
+        if (!wtx.IsSpent(i))
+            return true;
+
+        bool fSpent = false;
+        pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+        range = mapTxSpends.equal_range(COutPoint(hash, i));
+        for (TxSpends::const_iterator it = range.first; it != range.second && !fSpent; ++it)
+        {
+            map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+            fSpent = mit != mapWallet.end() && mit->second.IsInMainChain();
+        }
+        if (!fSpent)
+            return true;
+    }
+    return false;
+}
+
+const CWallet::WalletCoinMap& CWallet::GetWalletCoins() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // A reorganisation can take back the spends that let transactions drop
+    // out, start over unless the chain only grew since the last call.
+    if (!fWalletCoinsRebuild && pindexBest != pindexWalletCoins)
+    {
+        CBlockIndex* pindex = pindexBest;
+        while (pindex && pindexWalletCoins && pindex->nHeight > pindexWalletCoins->nHeight)
+            pindex = pindex->pprev;
+        if (pindex != pindexWalletCoins)
+            fWalletCoinsRebuild = true;
+    }
+    pindexWalletCoins = pindexBest;
+
+    if (fWalletCoinsRebuild)
+    {
+        mapWalletCoins.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            if (HasUnspentCoins((*it).first, (*it).second))
+                mapWalletCoins.insert(make_pair((*it).first, &(*it).second));
+        setWalletCoinsDirty.clear();
+        fWalletCoinsRebuild = false;
+        LogPrint("wallet", "GetWalletCoins() : %u of %u transactions hold unspent outputs\n", mapWalletCoins.size(), mapWallet.size());
+        return mapWalletCoins;
+    }
+
+    BOOST_FOREACH(const uint256& hash, setWalletCoinsDirty)
+    {
+        WalletCoinMap::iterator mi = mapWalletCoins.find(hash);
+        if (mi != mapWalletCoins.end() && !HasUnspentCoins(hash, *(*mi).second))
+            mapWalletCoins.erase(mi);
+    }
+    setWalletCoinsDirty.clear();
+
+    return mapWalletCoins;
+}
+
 
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
@@ -588,6 +680,7 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        fWalletCoinsRebuild = true;
     }
 }
 
@@ -615,6 +708,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext();
             wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+            AddToSpends(hash);
+            EraseDarksendRounds(hash);
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (wtxIn.hashBlock != 0)
@@ -695,6 +790,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        MarkCoinsDirty(wtx);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -778,8 +874,21 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
-            CWalletDB(strWalletFile).EraseTx(hash);
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+        {
+            std::vector<CTxIn> vin = (*mi).second.vin;
+            CWalletDB walletdb(strWalletFile);
+            bool fTxn = walletdb.TxnBegin();
+            EraseDarksendRounds(hash, &walletdb);
+            mapWalletCoins.erase(hash);
+            mapWallet.erase(mi);
+            BOOST_FOREACH(const CTxIn& txin, vin)
+                MarkCoinsDirty(txin.prevout.hash);
+            walletdb.EraseTx(hash);
+            if (fTxn)
+                walletdb.TxnCommit();
+        }
     }
     return;
 }
@@ -815,11 +924,71 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
     return 0;
 }
 
-// Recursively determine the rounds of a given input (How deep is the Darksend chain for a given input)
-int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
+int CWallet::CacheDarksendRounds(const COutPoint& outpoint, int nRounds, CWalletDB* pwalletdb) const
+{
+    mapDarksendRounds[outpoint] = nRounds;
+    if (pwalletdb)
+        pwalletdb->WriteDarksendRounds(outpoint, nRounds);
+    LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", outpoint.hash.ToString(), outpoint.n, nRounds);
+    return nRounds;
+}
+
+// Forget the rounds of every output descending from hash. The wallet file
+// entries are erased through pwalletdb, or in a transaction of their own
+// when it is NULL.
+void CWallet::EraseDarksendRounds(const uint256& hash, CWalletDB* pwalletdb)
 {
-    static std::map<uint256, CTransaction> mDenomWtxes;
+    AssertLockHeld(cs_wallet);
+
+    std::vector<COutPoint> vErased;
+    std::vector<uint256> vStack;
+    std::set<uint256> setSeen;
+    vStack.push_back(hash);
+    while (!vStack.empty())
+    {
+        uint256 hashTx = vStack.back();
+        vStack.pop_back();
+        if (!setSeen.insert(hashTx).second)
+            continue;
 
+        std::map<COutPoint, signed char>::iterator mi = mapDarksendRounds.lower_bound(COutPoint(hashTx, 0));
+        while (mi != mapDarksendRounds.end() && mi->first.hash == hashTx)
+        {
+            vErased.push_back(mi->first);
+            mapDarksendRounds.erase(mi++);
+        }
+
+        map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(hashTx);
+        if (mit == mapWallet.end())
+            continue;
+        for (unsigned int i = 0; i < mit->second.vout.size(); i++)
+        {
+            pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+            range = mapTxSpends.equal_range(COutPoint(hashTx, i));
+            for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+                vStack.push_back(it->second);
+        }
+    }
+
+    if (vErased.empty() || !fFileBacked)
+        return;
+    if (pwalletdb)
+    {
+        BOOST_FOREACH(const COutPoint& outpoint, vErased)
+            pwalletdb->EraseDarksendRounds(outpoint);
+        return;
+    }
+    CWalletDB walletdb(strWalletFile);
+    bool fTxn = walletdb.TxnBegin();
+    BOOST_FOREACH(const COutPoint& outpoint, vErased)
+        walletdb.EraseDarksendRounds(outpoint);
+    if (fTxn)
+        walletdb.TxnCommit();
+}
+
+// Recursively determine the rounds of a given input (How deep is the Darksend chain for a given input)
+int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds, CWalletDB* pwalletdb) const
+{
     if(rounds >= 16) return 15; // 16 rounds max
 
     uint256 hash = in.prevout.hash;
@@ -828,19 +997,10 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
     const CWalletTx* wtx = GetWalletTx(hash);
     if(wtx != NULL)
     {
-        std::map<uint256, CTransaction>::const_iterator mdwi = mDenomWtxes.find(hash);
-        // not known yet, let's add it
-        if(mdwi == mDenomWtxes.end())
-        {
-            LogPrint("darksend", "GetInputDarksendRounds INSERTING %s\n", hash.ToString());
-            mDenomWtxes[hash] = CTransaction(*wtx);
-        }
-        // found and it's not an initial value, just return it
-        else if(mDenomWtxes[hash].vout[nout].nRounds != -10)
-        {
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
-
+        // found, just return it
+        std::map<COutPoint, signed char>::const_iterator mi = mapDarksendRounds.find(in.prevout);
+        if(mi != mapDarksendRounds.end())
+            return mi->second;
 
         // bounds check
         if(nout >= wtx->vout.size())
@@ -851,19 +1011,11 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
         }
 
         if(pwalletMain->IsCollateralAmount(wtx->vout[nout].nValue))
-        {
-            mDenomWtxes[hash].vout[nout].nRounds = -3;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+            return CacheDarksendRounds(in.prevout, -3, pwalletdb);
 
         //make sure the final output is non-denominate
         if(/*rounds == 0 && */!IsDenominatedAmount(wtx->vout[nout].nValue)) //NOT DENOM
-        {
-            mDenomWtxes[hash].vout[nout].nRounds = -2;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+            return CacheDarksendRounds(in.prevout, -2, pwalletdb);
 
         bool fAllDenoms = true;
         BOOST_FOREACH(CTxOut out, wtx->vout)
@@ -872,11 +1024,7 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
         }
         // this one is denominated but there is another non-denominated output found in the same tx
         if(!fAllDenoms)
-        {
-            mDenomWtxes[hash].vout[nout].nRounds = 0;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+            return CacheDarksendRounds(in.prevout, 0, pwalletdb);
 
         int nShortest = -10; // an initial value, should be no way to get this by calculations
         bool fDenomFound = false;
@@ -885,7 +1033,7 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
         {
             if(IsMine(in2))
             {
-                int n = GetRealInputDarksendRounds(in2, rounds+1);
+                int n = GetRealInputDarksendRounds(in2, rounds+1, pwalletdb);
                 // denom found, find the shortest chain or initially assign nShortest with the first found value
                 if(n >= 0 && (n < nShortest || nShortest == -10))
                 {
@@ -894,11 +1042,10 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
                 }
             }
         }
-        mDenomWtxes[hash].vout[nout].nRounds = fDenomFound
+        return CacheDarksendRounds(in.prevout, fDenomFound
                 ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
-                : 0;            // too bad, we are the fist one in that chain
-        LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-        return mDenomWtxes[hash].vout[nout].nRounds;
+                : 0,            // too bad, we are the fist one in that chain
+                pwalletdb);
     }
 
     return rounds-1;
@@ -907,7 +1054,21 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
 // respect current settings
 int CWallet::GetInputDarksendRounds(CTxIn in) const {
     LOCK(cs_wallet);
-    int realDarksendRounds = GetRealInputDarksendRounds(in, 0);
+    int realDarksendRounds;
+    std::map<COutPoint, signed char>::const_iterator mi = mapDarksendRounds.find(in.prevout);
+    if (mi != mapDarksendRounds.end() && GetWalletTx(in.prevout.hash) != NULL)
+        realDarksendRounds = mi->second;
+    else if (fFileBacked)
+    {
+        // A miss usually walks a chain of inputs, cache all of them in one transaction
+        CWalletDB walletdb(strWalletFile);
+        bool fTxn = walletdb.TxnBegin();
+        realDarksendRounds = GetRealInputDarksendRounds(in, 0, &walletdb);
+        if (fTxn)
+            walletdb.TxnCommit();
+    }
+    else
+        realDarksendRounds = GetRealInputDarksendRounds(in, 0, NULL);
     return realDarksendRounds > nDarksendRounds ? nDarksendRounds : realDarksendRounds;
 }
 
@@ -1160,35 +1321,266 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+// Blocks a rescan may have read ahead of the one being applied
+static const unsigned int RESCAN_WINDOW = 64;
+static const int RESCAN_MAX_THREADS = 4;
+
+/** Read-ahead for ScanForWalletTransactions.
+
+    Worker threads read blocks from disk and mark the transactions that pay to
+    the keystore or carry an OP_RETURN (possible stealth payment). They take
+    no lock besides the keystore's. The scanning thread applies the blocks in
+    chain order, looking at the unmarked transactions only to see if they are
+    already in the wallet or spend from it.
+*/
+class CWalletRescan
+{
+public:
+    class CScanBlock
+    {
+    public:
+        CBlockIndex* pindex;
+        CBlock block;
+        std::vector<uint256> vHash;
+        std::vector<char> vfCandidate;
+        bool fReadFailed;
+        bool fReady;
+
+        CScanBlock() : pindex(NULL), fReadFailed(false), fReady(false) {}
+    };
+
+    CWalletRescan(const CWallet* pwalletIn) : pwallet(pwalletIn), vBlocks(RESCAN_WINDOW), nRead(0), nApplied(0), fStop(false) {}
+
+    ~CWalletRescan()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        cond.notify_all();
+        threadGroup.join_all();
+    }
+
+    void Start(int nThreads)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CWalletRescan::Thread, this));
+    }
+
+    /** Queue a block for reading, false while the read list is full. */
+    bool Push(CBlockIndex* pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (vIndex.size() - nApplied >= RESCAN_WINDOW)
+            return false;
+        vIndex.push_back(pindex);
+        cond.notify_all();
+        return true;
+    }
+
+    size_t Pending()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return vIndex.size() - nApplied;
+    }
+
+    size_t Read()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return nRead;
+    }
+
+    /** Wait for the next block in chain order, Release() it when done. */
+    CScanBlock& Next()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CScanBlock& slot = vBlocks[nApplied % RESCAN_WINDOW];
+        while (!slot.fReady)
+            cond.wait(lock);
+        return slot;
+    }
+
+    void Release()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vBlocks[nApplied % RESCAN_WINDOW].fReady = false;
+        nApplied++;
+        cond.notify_all();
+    }
+
+private:
+    const CWallet* pwallet;
+    boost::thread_group threadGroup;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<CBlockIndex*> vIndex;
+    std::vector<CScanBlock> vBlocks;
+    size_t nRead;
+    size_t nApplied;
+    bool fStop;
+
+    void Filter(CScanBlock& scanBlock)
+    {
+        // A block that can't be read, for example one in a pruned file, ends the rescan
+        scanBlock.fReadFailed = !scanBlock.block.ReadFromDisk(scanBlock.pindex, true);
+        if (scanBlock.fReadFailed)
+            scanBlock.block.SetNull();
+
+        const std::vector<CTransaction>& vtx = scanBlock.block.vtx;
+        scanBlock.vHash.resize(vtx.size());
+        scanBlock.vfCandidate.assign(vtx.size(), false);
+        for (unsigned int i = 0; i < vtx.size(); i++)
+        {
+            scanBlock.vHash[i] = vtx[i].GetHash();
+            BOOST_FOREACH(const CTxOut& txout, vtx[i].vout)
+            {
+                if ((txout.scriptPubKey.size() > 0 && txout.scriptPubKey[0] == OP_RETURN)
+                    || pwallet->IsMine(txout) != ISMINE_NO)
+                {
+                    scanBlock.vfCandidate[i] = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    void Thread()
+    {
+        RenameThread("parlay-rescan");
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fStop)
+        {
+            if (nRead == vIndex.size() || nRead >= nApplied + RESCAN_WINDOW)
+            {
+                cond.wait(lock);
+                continue;
+            }
+
+            // -- the slot is ours until fReady, block n - RESCAN_WINDOW has been released
+            size_t n = nRead++;
+            CScanBlock& slot = vBlocks[n % RESCAN_WINDOW];
+            slot.pindex = vIndex[n];
+            lock.unlock();
+            Filter(slot);
+            lock.lock();
+
+            slot.fReady = true;
+            cond.notify_all();
+        }
+    }
+};
+
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
-// exist in the wallet will be updated.
+// exist in the wallet will be updated. Returns -1 if a block could not
+// be read.
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
+    int64_t nStart = GetTimeMillis();
+    int64_t nNow = GetTime();
 
-    CBlockIndex* pindex = pindexStart;
+    int64_t nTimeFirstKeyScan;
+    int nStartHeight, nEndHeight;
     {
         LOCK2(cs_main, cs_wallet);
-        while (pindex)
+        nTimeFirstKeyScan = nTimeFirstKey;
+        nStartHeight = pindexStart ? pindexStart->nHeight : 0;
+        nEndHeight = nBestHeight;
+    }
+
+    CWalletRescan rescan(this);
+    rescan.Start(std::max(1, std::min((int)boost::thread::hardware_concurrency(), RESCAN_MAX_THREADS)));
+
+    ShowProgress(_("Rescanning..."), 0);
+
+    // Blocks read before a stealth payment was added get every transaction
+    // checked, the key it adds may own outputs the readers skipped.
+    size_t nFullCheck = 0;
+    size_t nApplied = 0;
+    bool fFailed = false;
+
+    CBlockIndex* pindexNext = pindexStart;
+    for (;;)
+    {
+        // keep the readers fed
+        if (pindexNext && rescan.Pending() < RESCAN_WINDOW)
         {
-            // no need to read and scan block, if block was created before
-            // our wallet birthday (as adjusted for block time variability)
-            if (nTimeFirstKey && (pindex->nTime < (nTimeFirstKey - 7200))) {
-                pindex = pindex->pnext;
-                continue;
+            LOCK(cs_main);
+            while (pindexNext)
+            {
+                // no need to read and scan block, if block was created before
+                // our wallet birthday (as adjusted for block time variability)
+                if (nTimeFirstKeyScan && (pindexNext->nTime < (nTimeFirstKeyScan - 7200))) {
+                    pindexNext = pindexNext->pnext;
+                    continue;
+                }
+                if (!rescan.Push(pindexNext))
+                    break;
+                pindexNext = pindexNext->pnext;
             }
+        }
+
+        if (rescan.Pending() == 0)
+            break;
+
+        CWalletRescan::CScanBlock& scanBlock = rescan.Next();
+        int nHeight = scanBlock.pindex->nHeight;
+        nApplied++;
+
+        if (scanBlock.fReadFailed)
+        {
+            error("ScanForWalletTransactions() : cannot read block %s at height %d", scanBlock.pindex->GetBlockHash().ToString(), nHeight);
+            rescan.Release();
+            fFailed = true;
+            break;
+        }
 
-            CBlock block;
-            block.ReadFromDisk(pindex, true);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+        {
+            LOCK2(cs_main, cs_wallet);
+
+            // a block reorganised away while it was being read is skipped, its
+            // transactions are seen again from the new chain through SyncTransaction
+            bool fMainChain = scanBlock.pindex->IsInMainChain();
+            const std::vector<CTransaction>& vtx = scanBlock.block.vtx;
+            for (unsigned int i = 0; fMainChain && i < vtx.size(); i++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                const CTransaction& tx = vtx[i];
+                bool fCandidate = scanBlock.vfCandidate[i] || nApplied <= nFullCheck || mapWallet.count(scanBlock.vHash[i]);
+                for (unsigned int j = 0; !fCandidate && j < tx.vin.size(); j++)
+                    fCandidate = mapWallet.count(tx.vin[j].prevout.hash);
+                if (!fCandidate)
+                    continue;
+
+                if (!AddToWalletIfInvolvingMe(tx, &scanBlock.block, fUpdate))
+                    continue;
+                ret++;
+
+                BOOST_FOREACH(const CTxOut& txout, tx.vout)
+                    if (txout.scriptPubKey.size() > 0 && txout.scriptPubKey[0] == OP_RETURN)
+                        nFullCheck = rescan.Read();
             }
-            pindex = pindex->pnext;
         }
+        rescan.Release();
+
+        if (nApplied % 100 == 0 && nEndHeight > nStartHeight)
+            ShowProgress("", std::max(1, std::min(99, (int)((nHeight - nStartHeight) * 100 / (nEndHeight - nStartHeight)))));
+        if (GetTime() >= nNow + 60)
+        {
+            nNow = GetTime();
+            LogPrintf("Still rescanning. At block %d.\n", nHeight);
+        }
+    }
+
+    ShowProgress("", 100);
+
+    if (fFailed)
+    {
+        LogPrintf("ScanForWalletTransactions() : stopped after %u blocks, %d transactions found\n", nApplied, ret);
+        return -1;
     }
+    LogPrintf("ScanForWalletTransactions() : %u blocks, %d transactions found in %dms\n", nApplied, ret, GetTimeMillis() - nStart);
     return ret;
 }
 
@@ -1245,6 +1637,7 @@ void CWallet::ReacceptWalletTransactions()
                 {
                     LogPrintf("ReacceptWalletTransactions found spent coin %s PAR %s\n", FormatMoney(wtx.GetCredit(ISMINE_ALL)), wtx.GetHash().ToString());
                     wtx.MarkDirty();
+                    MarkCoinsDirty(wtxid);
                     wtx.WriteToDisk();
                 }
             }
@@ -1258,7 +1651,7 @@ void CWallet::ReacceptWalletTransactions()
         if (!vMissingTx.empty())
         {
             // TODO: optimize this to scan just part of the block chain?
-            if (ScanForWalletTransactions(pindexGenesisBlock))
+            if (ScanForWalletTransactions(pindexGenesisBlock) > 0)
                 fRepeat = true;  // Found missing transactions: re-do re-accept.
         }
     }
@@ -1362,9 +1755,10 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1378,9 +1772,10 @@ CAmount CWallet::GetStake() const
 {
     CAmount nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    const WalletCoinMap& mapCoins = GetWalletCoins();
+    for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
     {
-        const CWalletTx* pcoin = &(*it).second;
+        const CWalletTx* pcoin = (*it).second;
         if (pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
             nTotal += CWallet::GetCredit(*pcoin, ISMINE_ALL);
     }
@@ -1391,9 +1786,10 @@ CAmount CWallet::GetNewMint() const
 {
     CAmount nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    const WalletCoinMap& mapCoins = GetWalletCoins();
+    for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
     {
-        const CWalletTx* pcoin = &(*it).second;
+        const CWalletTx* pcoin = (*it).second;
         if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
             nTotal += CWallet::GetCredit(*pcoin, ISMINE_ALL);
     }
@@ -1407,9 +1803,10 @@ CAmount CWallet::GetAnonymizableBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
 
             if (pcoin->IsTrusted())
                nTotal += pcoin->GetAnonymizableCredit();
@@ -1426,9 +1823,10 @@ CAmount CWallet::GetAnonymizedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
 
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAnonymizedCredit();
@@ -1449,9 +1847,10 @@ double CWallet::GetAverageAnonymizedRounds() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
 
             uint256 hash = (*it).first;
 
@@ -1483,9 +1882,10 @@ CAmount CWallet::GetNormalizedAnonymizedBalance() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
 
             uint256 hash = (*it).first;
 
@@ -1512,9 +1912,10 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
 
             nTotal += pcoin->GetDenominatedCredit(unconfirmed);
         }
@@ -1527,9 +1928,10 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
             if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1542,9 +1944,10 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -1556,9 +1959,10 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1571,9 +1975,10 @@ CAmount CWallet::GetWatchOnlyStake() const
 {
     CAmount nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    const WalletCoinMap& mapCoins = GetWalletCoins();
+    for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
     {
-        const CWalletTx* pcoin = &(*it).second;
+        const CWalletTx* pcoin = (*it).second;
         if (pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
             nTotal += CWallet::GetCredit(*pcoin, ISMINE_WATCH_ONLY);
     }
@@ -1585,9 +1990,10 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
             if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1600,15 +2006,96 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
     return nTotal;
 }
 
+// All of the balances above in one walk of the wallet coins
+void CWallet::GetBalances(CWalletBalances& balances) const
+{
+    balances.SetNull();
+    bool fWatchOnly = HaveWatchOnly();
+
+    LOCK2(cs_main, cs_wallet);
+    const WalletCoinMap& mapCoins = GetWalletCoins();
+    for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
+    {
+        const CWalletTx* pcoin = (*it).second;
+        int nDepth = pcoin->GetDepthInMainChain();
+        bool fTrusted = pcoin->IsTrusted();
+        bool fUnconfirmed = !IsFinalTx(*pcoin) || (!fTrusted && nDepth == 0);
+        bool fStake = pcoin->IsCoinStake() && nDepth > 0 && pcoin->GetBlocksToMaturity() > 0;
+
+        if (fTrusted)
+        {
+            balances.nBalance += pcoin->GetAvailableCredit();
+            if (!fLiteMode)
+                balances.nAnonymized += pcoin->GetAnonymizedCredit();
+        }
+        if (fUnconfirmed)
+            balances.nUnconfirmed += pcoin->GetAvailableCredit();
+        if (fStake)
+            balances.nStake += CWallet::GetCredit(*pcoin, ISMINE_ALL);
+        balances.nImmature += pcoin->GetImmatureCredit();
+
+        if (!fWatchOnly)
+            continue;
+        if (fTrusted)
+            balances.nWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
+        if (fUnconfirmed)
+            balances.nWatchOnlyUnconfirmed += pcoin->GetAvailableWatchOnlyCredit();
+        if (fStake)
+            balances.nWatchOnlyStake += CWallet::GetCredit(*pcoin, ISMINE_WATCH_ONLY);
+        balances.nWatchOnlyImmature += pcoin->GetImmatureWatchOnlyCredit();
+    }
+}
+
+void CWallet::MarkBalancesDirty()
+{
+    boost::unique_lock<boost::mutex> lock(mutexBalances);
+    fBalancesDirty = true;
+    condBalances.notify_one();
+}
+
+void CWallet::WaitBalancesDirty()
+{
+    boost::unique_lock<boost::mutex> lock(mutexBalances);
+    while (!fBalancesDirty)
+        condBalances.wait(lock);
+    fBalancesDirty = false;
+}
+
+// Wait this long after a change before computing the balances, so a burst of
+// blocks or transactions (sync, rescan, sending) is pushed once
+static const int BALANCES_NOTIFY_DELAY = 250;
+
+void ThreadNotifyBalances(CWallet* pwallet)
+{
+    RenameThread("parlay-balances");
+
+    while (true)
+    {
+        pwallet->WaitBalancesDirty();
+        MilliSleep(BALANCES_NOTIFY_DELAY);
+
+        // Nobody to tell, e.g. no GUI
+        if (pwallet->NotifyBalancesChanged.empty())
+            continue;
+
+        // Listeners drop pushes that match what they show, the thread keeps
+        // no copy that could go stale while nobody was listening
+        CWalletBalances balances;
+        pwallet->GetBalances(balances);
+        pwallet->NotifyBalancesChanged(pwallet, balances);
+    }
+}
+
 // populate vCoins with vector of available COutputs.
 void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, AvailableCoinsType coin_type, bool useIX) const
 {
@@ -1616,9 +2103,10 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
 
             if (!IsFinalTx(*pcoin))
                 continue;
@@ -1673,9 +2161,10 @@ void CWallet::AvailableCoinsMN(vector<COutput>& vCoins, bool fOnlyConfirmed, con
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
 
             if (!IsFinalTx(*pcoin))
                 continue;
@@ -1729,9 +2218,10 @@ void CWallet::AvailableCoinsForStaking(vector<COutput>& vCoins, unsigned int nSp
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const WalletCoinMap& mapCoins = GetWalletCoins();
+        for (WalletCoinMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
 
             int nDepth = pcoin->GetDepthInMainChain();
             if (nDepth < 1)
@@ -3341,7 +3831,7 @@ uint64_t CWallet::GetStakeWeight() const
 bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, int64_t nFees, CTransaction& txNew, CKey& key)
 {
     CBlockIndex* pindexPrev = pindexBest;
-    CBigNum bnTargetPerCoinDay;
+    uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(nBits);
 
     txNew.vin.clear();
@@ -3668,6 +4158,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, std:
                 CWalletTx &coin = mapWallet[txin.prevout.hash];
                 coin.BindWallet(this);
                 coin.MarkSpent(txin.prevout.n);
+                MarkCoinsDirty(txin.prevout.hash);
                 coin.WriteToDisk();
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
@@ -3986,6 +4477,134 @@ bool CWallet::SetDefaultKey(const CPubKey &vchPubKey)
     return true;
 }
 
+// Keys written per wallet transaction while the keypool is filled
+static const unsigned int KEYPOOL_BATCH_SIZE = 1000;
+static const int KEYPOOL_MAX_THREADS = 8;
+// Smallest share of a batch worth a thread of its own
+static const unsigned int KEYPOOL_KEYS_PER_THREAD = 32;
+
+/** A keypool key made by a worker thread. The secret is already in the form
+    the wallet stores it: encrypted if the wallet is, DER encoded otherwise. */
+class CPoolKey
+{
+public:
+    CKey key;
+    CPubKey pubkey;
+    CPrivKey vchPrivKey;
+    std::vector<unsigned char> vchCryptedSecret;
+};
+
+static void MakePoolKeys(std::vector<CPoolKey>& vKeys, size_t nBegin, size_t nEnd, bool fCompressed, const CKeyingMaterial* pMasterKey, char* pfOk)
+{
+    for (size_t i = nBegin; i < nEnd; i++)
+    {
+        CPoolKey& poolKey = vKeys[i];
+        poolKey.key.MakeNewKey(fCompressed);
+        poolKey.pubkey = poolKey.key.GetPubKey();
+        assert(poolKey.key.VerifyPubKey(poolKey.pubkey));
+
+        if (!pMasterKey)
+        {
+            poolKey.vchPrivKey = poolKey.key.GetPrivKey();
+            continue;
+        }
+        CKeyingMaterial vchSecret(poolKey.key.begin(), poolKey.key.end());
+        if (!EncryptSecret(*pMasterKey, vchSecret, poolKey.pubkey.GetHash(), poolKey.vchCryptedSecret))
+        {
+            *pfOk = false;
+            return;
+        }
+    }
+}
+
+void CWallet::AddKeysToPool(CWalletDB& walletdb, int64_t nFirst, unsigned int nKeys, unsigned int nTotal)
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata
+    if (nKeys == 0)
+        return;
+
+    bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+    if (fCompressed)
+        SetMinVersion(FEATURE_COMPRPUBKEY);
+
+    // The workers encrypt with their own copy, the wallet can't be locked
+    // meanwhile as that takes cs_wallet
+    bool fCrypted = IsCrypted();
+    CKeyingMaterial vMasterKeyCopy;
+    if (fCrypted)
+    {
+        LOCK(cs_KeyStore);
+        vMasterKeyCopy = vMasterKey;
+    }
+
+    int nMaxThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), KEYPOOL_MAX_THREADS));
+    bool fShowProgress = nKeys > KEYPOOL_BATCH_SIZE;
+    if (fShowProgress)
+        ShowProgress(_("Generating keys..."), 0);
+
+    int64_t nStart = GetTimeMillis();
+    unsigned int nDone = 0;
+    while (nDone < nKeys)
+    {
+        std::vector<CPoolKey> vKeys(std::min(KEYPOOL_BATCH_SIZE, nKeys - nDone));
+
+        int nThreads = std::max(1, std::min(nMaxThreads, (int)(vKeys.size() / KEYPOOL_KEYS_PER_THREAD)));
+        std::vector<char> vfOk(nThreads, true);
+        size_t nPerThread = (vKeys.size() + nThreads - 1) / nThreads;
+        boost::thread_group threadGroup;
+        for (int i = 1; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&MakePoolKeys, boost::ref(vKeys), std::min(vKeys.size(), i * nPerThread),
+                std::min(vKeys.size(), (i + 1) * nPerThread), fCompressed, fCrypted ? &vMasterKeyCopy : NULL, &vfOk[i]));
+        MakePoolKeys(vKeys, 0, std::min(vKeys.size(), nPerThread), fCompressed, fCrypted ? &vMasterKeyCopy : NULL, &vfOk[0]);
+        threadGroup.join_all();
+        if (std::count(vfOk.begin(), vfOk.end(), false) > 0)
+            throw runtime_error("AddKeysToPool() : encrypting generated key failed");
+
+        // Keys, metadata and pool entries of the batch go to disk together,
+        // the in-memory key store only learns of them once that succeeded
+        int64_t nCreationTime = GetTime();
+        CKeyMetadata meta(nCreationTime);
+        if (!walletdb.TxnBegin())
+            throw runtime_error("AddKeysToPool() : could not begin wallet transaction");
+        for (unsigned int i = 0; i < vKeys.size(); i++)
+        {
+            const CPoolKey& poolKey = vKeys[i];
+            bool fWritten = fCrypted ? walletdb.WriteCryptedKey(poolKey.pubkey, poolKey.vchCryptedSecret, meta)
+                                     : walletdb.WriteKey(poolKey.pubkey, poolKey.vchPrivKey, meta);
+            if (!fWritten || !walletdb.WritePool(nFirst + nDone + i, CKeyPool(poolKey.pubkey)))
+            {
+                walletdb.TxnAbort();
+                throw runtime_error("AddKeysToPool() : writing generated key failed");
+            }
+        }
+        if (!walletdb.TxnCommit())
+            throw runtime_error("AddKeysToPool() : writing generated keys failed");
+
+        if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
+            nTimeFirstKey = nCreationTime;
+        for (unsigned int i = 0; i < vKeys.size(); i++)
+        {
+            const CPoolKey& poolKey = vKeys[i];
+            mapKeyMetadata[poolKey.pubkey.GetID()] = meta;
+            bool fAdded = fCrypted ? CCryptoKeyStore::AddCryptedKey(poolKey.pubkey, poolKey.vchCryptedSecret)
+                                   : CBasicKeyStore::AddKeyPubKey(poolKey.key, poolKey.pubkey);
+            if (!fAdded)
+                throw runtime_error("AddKeysToPool() : AddKey failed");
+            setKeyPool.insert(nFirst + nDone + i);
+        }
+        nDone += vKeys.size();
+
+        LogPrintf("keypool added keys %d to %d, size=%u\n", nFirst + nDone - vKeys.size(), nFirst + nDone - 1, setKeyPool.size());
+        double dProgress = 100.f * (nTotal - nKeys + nDone) / nTotal;
+        uiInterface.InitMessage(strprintf(_("Loading wallet... (%3.2f %%)"), dProgress));
+        if (fShowProgress)
+            ShowProgress("", std::max(1, std::min(99, (int)(100 * nDone / nKeys))));
+    }
+    if (fShowProgress)
+        ShowProgress("", 100);
+    LogPrint("wallet", "AddKeysToPool() : generated %u keys on %d threads in %dms\n", nKeys, nMaxThreads, GetTimeMillis() - nStart);
+}
+
 //
 // Mark old keypool keys as used,
 // and generate all new keys
@@ -4010,12 +4629,7 @@ bool CWallet::NewKeyPool()
         else
             nKeys = max(GetArg("-keypool", 100), (int64_t)0);
 
-        for (int i = 0; i < nKeys; i++)
-        {
-            int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
-        }
+        AddKeysToPool(walletdb, 1, nKeys, nKeys);
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
     }
     return true;
@@ -4042,18 +4656,12 @@ bool CWallet::TopUpKeyPool(unsigned int nSize)
         else
             nTargetSize = max(GetArg("-keypool", 100), (int64_t)0);
 
-        while (setKeyPool.size() < (nTargetSize + 1))
+        if (setKeyPool.size() < (nTargetSize + 1))
         {
             int64_t nEnd = 1;
             if (!setKeyPool.empty())
                 nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error("TopUpKeyPool() : writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
-            double dProgress = 100.f * nEnd / (nTargetSize + 1);
-            std::string strMsg = strprintf(_("Loading wallet... (%3.2f %%)"), dProgress);
-            uiInterface.InitMessage(strMsg);
+            AddKeysToPool(walletdb, nEnd, nTargetSize + 1 - setKeyPool.size(), nTargetSize + 1);
         }
     }
     return true;
@@ -4320,6 +4928,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 if (!fCheckOnly)
                 {
                     pcoin->MarkUnspent(n);
+                    MarkCoinsDirty(pcoin->GetHash());
                     pcoin->WriteToDisk();
                 }
             }
@@ -4332,6 +4941,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 if (!fCheckOnly)
                 {
                     pcoin->MarkSpent(n);
+                    MarkCoinsDirty(pcoin->GetHash());
                     pcoin->WriteToDisk();
                 }
             }
@@ -4355,6 +4965,7 @@ void CWallet::DisableTransaction(const CTransaction &tx)
             if (txin.prevout.n < prev.vout.size() && IsMine(prev.vout[txin.prevout.n]))
             {
                 prev.MarkUnspent(txin.prevout.n);
+                MarkCoinsDirty(txin.prevout.hash);
                 prev.WriteToDisk();
             }
         }
@@ -4426,6 +5037,7 @@ bool CWallet::UpdatedTransaction(const uint256 &hashTx)
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hashTx);
         if (mi != mapWallet.end()){
             NotifyTransactionChanged(this, hashTx, CT_UPDATED);
+            MarkBalancesDirty();
             return true;
         }
     }
@@ -4497,7 +5109,7 @@ void CWallet::GetKeyBirthTimes(std::map<CKeyID, int64_t> &mapKeyBirth) const {
     for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); it++) {
         // iterate over all wallet transactions...
         const CWalletTx &wtx = (*it).second;
-        std::map<uint256, CBlockIndex*>::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
+        BlockMap::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
         if (blit != mapBlockIndex.end() && blit->second->IsInMainChain()) {
             // ... which are already in a block
             int nHeight = blit->second->nHeight;
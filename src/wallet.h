@@ -38,6 +38,45 @@ class CWalletDB;
 typedef std::map<CKeyID, CStealthKeyMetadata> StealthKeyMetaMap;
 typedef std::map<std::string, std::string> mapValue_t;
 
+/** The balances of a wallet, computed in one pass for NotifyBalancesChanged */
+class CWalletBalances
+{
+public:
+    CAmount nBalance;
+    CAmount nStake;
+    CAmount nUnconfirmed;
+    CAmount nImmature;
+    CAmount nAnonymized;
+    CAmount nWatchOnly;
+    CAmount nWatchOnlyStake;
+    CAmount nWatchOnlyUnconfirmed;
+    CAmount nWatchOnlyImmature;
+
+    CWalletBalances()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nBalance = nStake = nUnconfirmed = nImmature = nAnonymized = 0;
+        nWatchOnly = nWatchOnlyStake = nWatchOnlyUnconfirmed = nWatchOnlyImmature = 0;
+    }
+
+    friend bool operator==(const CWalletBalances& a, const CWalletBalances& b)
+    {
+        return a.nBalance == b.nBalance && a.nStake == b.nStake && a.nUnconfirmed == b.nUnconfirmed &&
+               a.nImmature == b.nImmature && a.nAnonymized == b.nAnonymized && a.nWatchOnly == b.nWatchOnly &&
+               a.nWatchOnlyStake == b.nWatchOnlyStake && a.nWatchOnlyUnconfirmed == b.nWatchOnlyUnconfirmed &&
+               a.nWatchOnlyImmature == b.nWatchOnlyImmature;
+    }
+
+    friend bool operator!=(const CWalletBalances& a, const CWalletBalances& b)
+    {
+        return !(a == b);
+    }
+};
+
 /** (client) version numbers for particular wallet features */
 enum WalletFeature
 {
@@ -111,6 +150,40 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    // Transactions that may still hold an unspent output of ours. The coin and
+    // balance queries walk these instead of all of mapWallet. A transaction is
+    // rechecked when it or one of its spenders changes and dropped once every
+    // output of ours is spent in the main chain, see GetWalletCoins.
+    typedef std::map<uint256, const CWalletTx*> WalletCoinMap;
+    mutable WalletCoinMap mapWalletCoins;
+    mutable std::set<uint256> setWalletCoinsDirty;
+    mutable CBlockIndex* pindexWalletCoins;
+    mutable bool fWalletCoinsRebuild;
+
+    void MarkCoinsDirty(const uint256& hash);
+    void MarkCoinsDirty(const CTransaction& tx);
+    bool HasUnspentCoins(const uint256& hash, const CWalletTx& wtx) const;
+    const WalletCoinMap& GetWalletCoins() const;
+
+    // Darksend rounds of wallet outputs, filled in by GetRealInputDarksendRounds
+    // and kept in the wallet file. Entries of the descendants of a transaction
+    // are dropped when it is added or erased, as their ancestry changed.
+    // Writes go through pwalletdb so a whole lookup or erase shares one transaction.
+    mutable std::map<COutPoint, signed char> mapDarksendRounds;
+    int CacheDarksendRounds(const COutPoint& outpoint, int nRounds, CWalletDB* pwalletdb) const;
+    void EraseDarksendRounds(const uint256& hash, CWalletDB* pwalletdb = NULL);
+
+    // Generate nKeys keys on worker threads and add them to the keypool as
+    // entries nFirst onwards, writing each batch in one wallet transaction.
+    // nTotal is only used for the progress shown.
+    void AddKeysToPool(CWalletDB& walletdb, int64_t nFirst, unsigned int nKeys, unsigned int nTotal);
+
+    // Set when a block or wallet transaction may have changed the balances,
+    // ThreadNotifyBalances waits on it.
+    boost::mutex mutexBalances;
+    boost::condition_variable condBalances;
+    bool fBalancesDirty;
+
 public:
     /// Main wallet lock.
     /// This lock protects all the fields added by CWallet
@@ -172,6 +245,9 @@ public:
         nTimeFirstKey = 0;
         nLastFilteredHeight = 0;
         fWalletUnlockAnonymizeOnly = false;
+        pindexWalletCoins = NULL;
+        fWalletCoinsRebuild = true;
+        fBalancesDirty = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -272,6 +348,11 @@ public:
     double GetAverageAnonymizedRounds() const;
     CAmount GetNormalizedAnonymizedBalance() const;
     CAmount GetDenominatedBalance(bool unconfirmed=false) const;
+    void GetBalances(CWalletBalances& balances) const;
+    /** Have ThreadNotifyBalances recompute the balances */
+    void MarkBalancesDirty();
+    /** Wait for MarkBalancesDirty and clear the mark */
+    void WaitBalancesDirty();
 
     bool CreateTransaction(const std::vector<std::pair<CScript, int64_t> >& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, int64_t& nFeeRet, int32_t& nChangePos, std::string& strFailReason, const CCoinControl *coinControl=NULL, AvailableCoinsType coin_type=ALL_COINS, bool useIX=false);
     bool CreateTransaction(CScript scriptPubKey, int64_t nValue, std::string& sNarr, CWalletTx& wtxNew, CReserveKey& reservekey, int64_t& nFeeRet, const CCoinControl *coinControl=NULL);
@@ -313,8 +394,10 @@ public:
     std::set< std::set<CTxDestination> > GetAddressGroupings();
     std::map<CTxDestination, int64_t> GetAddressBalances();
 
-    // get the Darksend chain depth for a given input
-    int GetRealInputDarksendRounds(CTxIn in, int rounds) const;
+    // get the Darksend chain depth for a given input, caching new results through pwalletdb
+    int GetRealInputDarksendRounds(CTxIn in, int rounds, CWalletDB* pwalletdb) const;
+    // Adds a rounds index entry, without saving it to disk (used by LoadWallet)
+    void LoadDarksendRounds(const COutPoint& outpoint, int nRounds) { mapDarksendRounds[outpoint] = nRounds; }
     // respect current settings
     int GetInputDarksendRounds(CTxIn in) const;
 
@@ -390,6 +473,7 @@ public:
         return nChange;
     }
     void SetBestChain(const CBlockLocator& loc);
+    void UpdatedBlockTip(int nHeight);
 
     DBErrors LoadWallet(bool& fFirstRunRet);
 
@@ -449,8 +533,16 @@ public:
 
     /** Watch-only address added */
     boost::signals2::signal<void (bool fHaveWatchOnly)> NotifyWatchonlyChanged;
+
+    /** Wallet balances changed.
+     * @note called from ThreadNotifyBalances without locks held.
+     */
+    boost::signals2::signal<void (CWallet *wallet, const CWalletBalances &balances)> NotifyBalancesChanged;
 };
 
+/** Push the wallet balances to NotifyBalancesChanged whenever they may have changed */
+void ThreadNotifyBalances(CWallet* pwallet);
+
 /** A key allocated from the key pool. */
 class CReserveKey
 {
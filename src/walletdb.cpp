@@ -138,6 +138,18 @@ bool CWalletDB::EraseWatchOnly(const CScript &dest)
     return Erase(std::make_pair(std::string("watchs"), dest));
 }
 
+bool CWalletDB::WriteDarksendRounds(const COutPoint& outpoint, int nRounds)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("dsrounds"), outpoint), (signed char)nRounds);
+}
+
+bool CWalletDB::EraseDarksendRounds(const COutPoint& outpoint)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("dsrounds"), outpoint));
+}
+
 bool CWalletDB::WriteBestBlock(const CBlockLocator& locator)
 {
     nWalletDBUpdated++;
@@ -220,7 +232,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit() : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -614,6 +626,14 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             ssValue >> pwallet->nOrderPosNext;
         }
+        else if (strType == "dsrounds")
+        {
+            COutPoint outpoint;
+            ssKey >> outpoint;
+            signed char nRounds;
+            ssValue >> nRounds;
+            pwallet->LoadDarksendRounds(outpoint, nRounds);
+        }
     } catch (...)
     {
         return false;
@@ -645,7 +665,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -747,6 +767,7 @@ void ThreadFlushWalletDB(const string& strFile)
     if (!GetBoolArg("-flushwallet", true))
         return;
 
+    CWalletLog* plog = GetWalletLog(strFile);
     unsigned int nLastSeen = nWalletDBUpdated;
     unsigned int nLastFlushed = nWalletDBUpdated;
     int64_t nLastWalletUpdate = GetTime();
@@ -762,6 +783,17 @@ void ThreadFlushWalletDB(const string& strFile)
 
         if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2)
         {
+            if (plog)
+            {
+                // One fsync for the whole burst, compacting if it left mostly dead records
+                boost::this_thread::interruption_point();
+                nLastFlushed = nWalletDBUpdated;
+                int64_t nStart = GetTimeMillis();
+                plog->Flush(true);
+                LogPrint("db", "Flushed %s %dms\n", strFile, GetTimeMillis() - nStart);
+                continue;
+            }
+
             TRY_LOCK(bitdb.cs_db,lockDb);
             if (lockDb)
             {
@@ -801,6 +833,18 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+
+    if (CWalletLog* plog = GetWalletLog(wallet.strWalletFile))
+    {
+        filesystem::path pathDest(strDest);
+        if (filesystem::is_directory(pathDest))
+            pathDest /= wallet.strWalletFile;
+        if (!plog->Backup(pathDest))
+            return false;
+        LogPrintf("copied %s to %s\n", wallet.strWalletFile, pathDest.string());
+        return true;
+    }
+
     while (true)
     {
         {
@@ -837,6 +881,72 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
     return false;
 }
 
+//
+// Copy every record of a Berkeley DB wallet into a new wallet log.
+// The log is built under a temporary name, so an interrupted migration
+// is simply started over on the next run.
+//
+bool CWalletDB::MigrateToLog(const std::string& strFrom, const std::string& strTo)
+{
+    int64_t nStart = GetTimeMillis();
+    filesystem::path pathTo = GetDataDir() / strTo;
+    filesystem::path pathTmp = GetDataDir() / (strTo + ".migrate");
+    filesystem::remove(pathTmp);
+
+    LogPrintf("Migrating %s to %s...\n", strFrom, strTo);
+    unsigned int nRecords = 0;
+    bool fSuccess = true;
+    {
+        CWalletLog log(pathTmp);
+        if (!log.Open())
+            return false;
+
+        CWalletDB db(strFrom, "r");
+        CDBCursor* pcursor = db.GetCursor();
+        if (!pcursor)
+            return error("CWalletDB::MigrateToLog() : cannot create DB cursor on %s", strFrom);
+
+        CWalletLogBatch batch;
+        while (fSuccess)
+        {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = db.ReadAtCursor(pcursor, ssKey, ssValue);
+            if (ret == DB_NOTFOUND)
+                break;
+            if (ret != 0)
+            {
+                fSuccess = error("CWalletDB::MigrateToLog() : error reading %s", strFrom);
+                break;
+            }
+            batch.Write(ssKey, ssValue);
+            nRecords++;
+            if (batch.size() >= WALLETLOG_COPY_BATCH_SIZE)
+            {
+                fSuccess = log.Commit(batch);
+                batch.clear();
+            }
+        }
+        pcursor->close();
+
+        if (fSuccess)
+            fSuccess = log.Commit(batch, true);
+        db.Close();
+        bitdb.CloseDb(strFrom);
+    }
+
+    if (fSuccess && !RenameOver(pathTmp, pathTo))
+        fSuccess = error("CWalletDB::MigrateToLog() : cannot rename %s to %s", pathTmp.string(), pathTo.string());
+    if (!fSuccess)
+    {
+        filesystem::remove(pathTmp);
+        return false;
+    }
+
+    LogPrintf("Migrated %u records from %s to %s, %dms\n", nRecords, strFrom, strTo, GetTimeMillis() - nStart);
+    return true;
+}
+
 //
 // Try to (very carefully!) recover wallet.dat if there is a problem.
 //
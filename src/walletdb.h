@@ -123,6 +123,9 @@ public:
     bool WriteWatchOnly(const CScript &script);
     bool EraseWatchOnly(const CScript &script);
 
+    bool WriteDarksendRounds(const COutPoint& outpoint, int nRounds);
+    bool EraseDarksendRounds(const COutPoint& outpoint);
+
     bool WriteBestBlock(const CBlockLocator& locator);
     bool ReadBestBlock(CBlockLocator& locator);
 
@@ -152,6 +155,7 @@ public:
     DBErrors LoadWallet(CWallet* pwallet);
     static bool Recover(CDBEnv& dbenv, std::string filename, bool fOnlyKeys);
     static bool Recover(CDBEnv& dbenv, std::string filename);
+    static bool MigrateToLog(const std::string& strFrom, const std::string& strTo);
 };
 
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
@@ -0,0 +1,666 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "walletlog.h"
+
+#include "hash.h"
+#include "util.h"
+#include "version.h"
+
+#ifdef WIN32
+#include <io.h> /* for _get_osfhandle */
+#endif
+
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/version.hpp>
+
+using namespace std;
+
+enum
+{
+    RECORD_WRITE = 1,
+    RECORD_ERASE = 2,
+};
+
+static const char pchWalletLogMagic[8] = { 'p', 'a', 'r', 'l', 'a', 'y', 'w', 'l' };
+static const int WALLETLOG_VERSION = 1;
+static const unsigned int WALLETLOG_HEADER_SIZE = sizeof(pchWalletLogMagic) + sizeof(int);
+static const unsigned int WALLETLOG_BATCH_MAGIC = 0xb47c1d5e;
+/** magic and payload size before each batch, checksum after it */
+static const unsigned int WALLETLOG_FRAME_SIZE = 12;
+/** Don't bother compacting files smaller than this */
+static const uint64_t WALLETLOG_COMPACT_MIN_SIZE = 4 * 1024 * 1024;
+
+
+static unsigned int Checksum(const CDataStream& ss)
+{
+    uint256 hash = Hash(ss.begin(), ss.end());
+    unsigned int nChecksum;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    return nChecksum;
+}
+
+static bool FileSeek(FILE* file, uint64_t nPos)
+{
+#ifdef WIN32
+    return _fseeki64(file, nPos, SEEK_SET) == 0;
+#else
+    return fseeko(file, nPos, SEEK_SET) == 0;
+#endif
+}
+
+// FileCommit, on a descriptor that other threads keep appending to
+static void FileSync(int fd)
+{
+#ifdef WIN32
+    FlushFileBuffers((HANDLE)_get_osfhandle(fd));
+#else
+    fsync(fd);
+#endif
+}
+
+// Nothing but zeros from nFrom to the end of the file, as a crash can leave
+// behind when the file size reached the disk before the data did
+static bool IsZeroTail(FILE* file, uint64_t nFrom)
+{
+    if (!FileSeek(file, nFrom))
+        return false;
+    char pch[4096];
+    size_t nRead;
+    while ((nRead = fread(pch, 1, sizeof(pch), file)) > 0)
+        for (size_t i = 0; i < nRead; i++)
+            if (pch[i] != 0)
+                return false;
+    return !ferror(file);
+}
+
+static bool WriteHeader(FILE* file)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.write(pchWalletLogMagic, sizeof(pchWalletLogMagic));
+    ss << WALLETLOG_VERSION;
+    return fwrite(&ss[0], 1, ss.size(), file) == ss.size();
+}
+
+
+//
+// CWalletLogBatch
+//
+
+CWalletLogBatch::CWalletLogBatch() : ssPayload(SER_DISK, CLIENT_VERSION)
+{
+}
+
+void CWalletLogBatch::Write(const CDataStream& ssKey, const CDataStream& ssValue)
+{
+    CRecord rec;
+    rec.nType = RECORD_WRITE;
+    rec.vchKey.assign(ssKey.begin(), ssKey.end());
+    ssPayload << rec.nType << rec.vchKey;
+    WriteCompactSize(ssPayload, ssValue.size());
+    rec.nValuePos = ssPayload.size();
+    rec.nValueSize = ssValue.size();
+    if (!ssValue.empty())
+        ssPayload.write(&ssValue[0], ssValue.size());
+    vRecords.push_back(rec);
+}
+
+void CWalletLogBatch::Erase(const CDataStream& ssKey)
+{
+    CRecord rec;
+    rec.nType = RECORD_ERASE;
+    rec.vchKey.assign(ssKey.begin(), ssKey.end());
+    rec.nValuePos = 0;
+    rec.nValueSize = 0;
+    ssPayload << rec.nType << rec.vchKey;
+    vRecords.push_back(rec);
+}
+
+int CWalletLogBatch::Find(const vector<unsigned char>& vchKey, CDataStream& ssValue) const
+{
+    for (vector<CRecord>::const_reverse_iterator it = vRecords.rbegin(); it != vRecords.rend(); ++it)
+    {
+        if (it->vchKey != vchKey)
+            continue;
+        if (it->nType == RECORD_ERASE)
+            return -1;
+        ssValue.clear();
+        if (it->nValueSize)
+            ssValue.write(&ssPayload[it->nValuePos], it->nValueSize);
+        return 1;
+    }
+    return 0;
+}
+
+void CWalletLogBatch::clear()
+{
+    ssPayload.clear();
+    vRecords.clear();
+}
+
+
+//
+// CWalletLog
+//
+
+CWalletLog::CWalletLog(const boost::filesystem::path& pathIn) :
+    path(pathIn), fileAppend(NULL), fileRead(NULL), fFailed(false),
+    nFileSize(0), nLiveBytes(0), nCommitted(0), nSynced(0)
+{
+}
+
+CWalletLog::~CWalletLog()
+{
+    Close();
+}
+
+bool CWalletLog::Open(bool fSalvage)
+{
+    LOCK2(cs_sync, cs);
+    if (fileAppend)
+        return true;
+
+    if (!boost::filesystem::exists(path))
+    {
+        FILE* file = fopen(path.string().c_str(), "wb");
+        if (!file)
+            return error("CWalletLog::Open : cannot create %s", path.string());
+        bool fOk = WriteHeader(file);
+        FileCommit(file);
+        fclose(file);
+        if (!fOk)
+            return error("CWalletLog::Open : cannot write to %s", path.string());
+    }
+
+    if (!Load(fSalvage))
+        return false;
+
+    fileRead = fopen(path.string().c_str(), "rb");
+    fileAppend = fopen(path.string().c_str(), "ab");
+    if (!fileRead || !fileAppend)
+    {
+        Close();
+        return error("CWalletLog::Open : cannot open %s", path.string());
+    }
+    fFailed = false;
+    return true;
+}
+
+void CWalletLog::Close()
+{
+    LOCK2(cs_sync, cs);
+    if (fileAppend)
+    {
+        FileCommit(fileAppend);
+        fclose(fileAppend);
+        fileAppend = NULL;
+    }
+    if (fileRead)
+    {
+        fclose(fileRead);
+        fileRead = NULL;
+    }
+    nSynced = nCommitted;
+    mapIndex.clear();
+}
+
+bool CWalletLog::Load(bool fSalvage)
+{
+    int64_t nStart = GetTimeMillis();
+    mapIndex.clear();
+    nLiveBytes = 0;
+
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return error("CWalletLog::Load : cannot open %s", path.string());
+
+    CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+    ssHeader.resize(WALLETLOG_HEADER_SIZE);
+    int nVersion = 0;
+    if (fread(&ssHeader[0], 1, ssHeader.size(), file) != ssHeader.size() ||
+        memcmp(&ssHeader[0], pchWalletLogMagic, sizeof(pchWalletLogMagic)) != 0)
+    {
+        fclose(file);
+        return error("CWalletLog::Load : %s is not a wallet log", path.string());
+    }
+    ssHeader.ignore(sizeof(pchWalletLogMagic));
+    ssHeader >> nVersion;
+    if (nVersion > WALLETLOG_VERSION)
+    {
+        fclose(file);
+        return error("CWalletLog::Load : %s has unsupported version %d", path.string(), nVersion);
+    }
+
+    boost::system::error_code ec;
+    uint64_t nDiskSize = boost::filesystem::file_size(path, ec);
+    if (ec)
+    {
+        fclose(file);
+        return error("CWalletLog::Load : cannot get the size of %s : %s", path.string(), ec.message());
+    }
+
+    uint64_t nPos = WALLETLOG_HEADER_SIZE;
+    unsigned int nBatches = 0;
+    bool fTorn = false;
+    std::string strDamage;          // damage that can't be a torn write
+    CDataStream ssPayload(SER_DISK, CLIENT_VERSION);
+    while (true)
+    {
+        char pchFrame[8];
+        size_t nRead = fread(pchFrame, 1, sizeof(pchFrame), file);
+        if (nRead == 0 && feof(file))
+            break;
+        if (nRead != sizeof(pchFrame))
+        {
+            fTorn = true;
+            break;
+        }
+
+        CDataStream ssFrame(pchFrame, pchFrame + sizeof(pchFrame), SER_DISK, CLIENT_VERSION);
+        unsigned int nMagic, nSize;
+        ssFrame >> nMagic >> nSize;
+        if (nMagic != WALLETLOG_BATCH_MAGIC || nSize > MAX_SIZE)
+        {
+            // Only a frame that runs past the end of the file, or a zeroed tail, can be a torn write
+            if (nPos + WALLETLOG_FRAME_SIZE + nSize <= nDiskSize && !IsZeroTail(file, nPos))
+                strDamage = "bad batch header";
+            fTorn = true;
+            break;
+        }
+
+        ssPayload.clear();
+        ssPayload.resize(nSize + sizeof(unsigned int));
+        if (fread(&ssPayload[0], 1, ssPayload.size(), file) != ssPayload.size())
+        {
+            fTorn = true;
+            break;
+        }
+        CDataStream ssChecksum(&ssPayload[nSize], &ssPayload[nSize] + sizeof(unsigned int), SER_DISK, CLIENT_VERSION);
+        unsigned int nChecksum;
+        ssChecksum >> nChecksum;
+        ssPayload.resize(nSize);
+        if (nChecksum != Checksum(ssPayload))
+        {
+            // A torn write can only damage the last batch, anything else is corruption
+            if (fgetc(file) != EOF && !IsZeroTail(file, nPos + 8))
+                strDamage = "checksum mismatch";
+            fTorn = true;
+            break;
+        }
+
+        // Apply the batch only once all of it parsed
+        vector<pair<vector<unsigned char>, CPos> > vRecords;
+        try {
+            while (!ssPayload.empty())
+            {
+                unsigned char nType;
+                pair<vector<unsigned char>, CPos> record;
+                ssPayload >> nType >> record.first;
+                record.second.nPos = 0;
+                record.second.nSize = 0;
+                if (nType == RECORD_WRITE)
+                {
+                    record.second.nSize = ReadCompactSize(ssPayload);
+                    record.second.nPos = nPos + 8 + (nSize - ssPayload.size());
+                    ssPayload.ignore(record.second.nSize);
+                }
+                else if (nType != RECORD_ERASE)
+                    throw runtime_error("unknown record type");
+                vRecords.push_back(record);
+            }
+        }
+        catch (std::exception &e) {
+            strDamage = strprintf("bad record in batch (%s)", e.what());
+            fTorn = true;
+            break;
+        }
+
+        for (unsigned int i = 0; i < vRecords.size(); i++)
+        {
+            const vector<unsigned char>& vchKey = vRecords[i].first;
+            IndexMap::iterator mi = mapIndex.find(vchKey);
+            if (mi != mapIndex.end())
+            {
+                nLiveBytes -= vchKey.size() + mi->second.nSize;
+                mapIndex.erase(mi);
+            }
+            if (vRecords[i].second.nPos != 0)
+            {
+                mapIndex.insert(vRecords[i]);
+                nLiveBytes += vchKey.size() + vRecords[i].second.nSize;
+            }
+        }
+
+        nPos += WALLETLOG_FRAME_SIZE + nSize;
+        nBatches++;
+    }
+    fclose(file);
+
+    // -salvagewallet keeps the batches before the damage, after saving a copy of the file
+    if (!strDamage.empty())
+    {
+        if (!fSalvage)
+            return error("CWalletLog::Load : %s at offset %u in %s", strDamage, nPos, path.string());
+
+        boost::filesystem::path pathBackup = path.parent_path() / strprintf("%s.%d.bak", path.filename().string(), GetTime());
+        try {
+            boost::filesystem::copy_file(path, pathBackup);
+        } catch (const boost::filesystem::filesystem_error& e) {
+            return error("CWalletLog::Load : cannot back up %s : %s", path.string(), e.what());
+        }
+        LogPrintf("CWalletLog::Load : %s at offset %u in %s, salvaged %u batches, original saved as %s\n",
+            strDamage, nPos, path.string(), nBatches, pathBackup.string());
+    }
+
+    if (fTorn)
+    {
+        LogPrintf("CWalletLog::Load : discarding incomplete batch at offset %u in %s\n", nPos, path.string());
+        try {
+            boost::filesystem::resize_file(path, nPos);
+        } catch (const boost::filesystem::filesystem_error& e) {
+            return error("CWalletLog::Load : cannot truncate %s : %s", path.string(), e.what());
+        }
+    }
+
+    nFileSize = nPos;
+    LogPrintf("Loaded %u records in %u batches from %s, %u of %u bytes live, %dms\n",
+        mapIndex.size(), nBatches, path.filename().string(), nLiveBytes, nFileSize, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CWalletLog::ReadValue(const CPos& pos, CDataStream& ssValue)
+{
+    ssValue.clear();
+    if (pos.nSize == 0)
+        return true;
+    ssValue.resize(pos.nSize);
+    if (!fileRead || !FileSeek(fileRead, pos.nPos) || fread(&ssValue[0], 1, pos.nSize, fileRead) != pos.nSize)
+        return error("CWalletLog::ReadValue : cannot read %u bytes at offset %u in %s", pos.nSize, pos.nPos, path.string());
+    return true;
+}
+
+bool CWalletLog::Read(const CDataStream& ssKey, CDataStream& ssValue, const CWalletLogBatch* pbatch)
+{
+    vector<unsigned char> vchKey(ssKey.begin(), ssKey.end());
+    if (pbatch)
+    {
+        int nFound = pbatch->Find(vchKey, ssValue);
+        if (nFound != 0)
+            return nFound > 0;
+    }
+
+    LOCK(cs);
+    IndexMap::const_iterator mi = mapIndex.find(vchKey);
+    if (mi == mapIndex.end())
+        return false;
+    return ReadValue(mi->second, ssValue);
+}
+
+bool CWalletLog::Exists(const CDataStream& ssKey, const CWalletLogBatch* pbatch)
+{
+    vector<unsigned char> vchKey(ssKey.begin(), ssKey.end());
+    if (pbatch)
+    {
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        int nFound = pbatch->Find(vchKey, ssValue);
+        if (nFound != 0)
+            return nFound > 0;
+    }
+
+    LOCK(cs);
+    return mapIndex.count(vchKey) > 0;
+}
+
+bool CWalletLog::ReadNext(const vector<unsigned char>& vchFrom, bool fInclusive, CDataStream& ssKey, CDataStream& ssValue)
+{
+    LOCK(cs);
+    IndexMap::const_iterator mi = fInclusive ? mapIndex.lower_bound(vchFrom) : mapIndex.upper_bound(vchFrom);
+    if (mi == mapIndex.end())
+        return false;
+    ssKey.clear();
+    if (!mi->first.empty())
+        ssKey.write((const char*)&mi->first[0], mi->first.size());
+    return ReadValue(mi->second, ssValue);
+}
+
+bool CWalletLog::WriteBatch(FILE* file, uint64_t& nPos, const CWalletLogBatch& batch, IndexMap& index, uint64_t& nLive)
+{
+    if (batch.empty())
+        return true;
+    if (batch.size() > MAX_SIZE)
+        return error("CWalletLog::WriteBatch : batch of %u bytes is too large", batch.size());
+
+    CDataStream ssFrame(SER_DISK, CLIENT_VERSION);
+    ssFrame << WALLETLOG_BATCH_MAGIC << (unsigned int)batch.ssPayload.size();
+    CDataStream ssChecksum(SER_DISK, CLIENT_VERSION);
+    ssChecksum << Checksum(batch.ssPayload);
+
+    if (fwrite(&ssFrame[0], 1, ssFrame.size(), file) != ssFrame.size() ||
+        fwrite(&batch.ssPayload.begin()[0], 1, batch.ssPayload.size(), file) != batch.ssPayload.size() ||
+        fwrite(&ssChecksum[0], 1, ssChecksum.size(), file) != ssChecksum.size())
+        return false;
+
+    uint64_t nPayloadPos = nPos + ssFrame.size();
+    BOOST_FOREACH(const CWalletLogBatch::CRecord& rec, batch.vRecords)
+    {
+        IndexMap::iterator mi = index.find(rec.vchKey);
+        if (mi != index.end())
+        {
+            nLive -= rec.vchKey.size() + mi->second.nSize;
+            if (rec.nType == RECORD_ERASE)
+                index.erase(mi);
+        }
+        if (rec.nType == RECORD_WRITE)
+        {
+            CPos& pos = index[rec.vchKey];
+            pos.nPos = nPayloadPos + rec.nValuePos;
+            pos.nSize = rec.nValueSize;
+            nLive += rec.vchKey.size() + rec.nValueSize;
+        }
+    }
+    nPos += WALLETLOG_FRAME_SIZE + batch.ssPayload.size();
+    return true;
+}
+
+bool CWalletLog::Commit(const CWalletLogBatch& batch, bool fSync)
+{
+    if (batch.empty())
+        return true;
+
+    uint64_t nSeq;
+    {
+        LOCK(cs);
+        if (!fileAppend || fFailed)
+            return false;
+        if (!WriteBatch(fileAppend, nFileSize, batch, mapIndex, nLiveBytes) || fflush(fileAppend) != 0)
+        {
+            // Part of the batch may be in the file, nothing can be appended after it
+            fFailed = true;
+            return error("CWalletLog::Commit : write to %s failed", path.string());
+        }
+        nSeq = ++nCommitted;
+    }
+    return !fSync || Sync(nSeq);
+}
+
+bool CWalletLog::Sync(uint64_t nSeq)
+{
+    LOCK(cs_sync);
+    // Another thread's fsync may already have covered this batch
+    if (nSynced >= nSeq)
+        return true;
+
+    int fd;
+    uint64_t nTarget;
+    {
+        LOCK(cs);
+        if (!fileAppend)
+            return false;
+        fd = fileno(fileAppend);
+        nTarget = nCommitted;
+    }
+    // Appends go on while the disk catches up, they are picked up by the next sync
+    FileSync(fd);
+    nSynced = nTarget;
+    return true;
+}
+
+bool CWalletLog::Flush(bool fAllowCompact)
+{
+    uint64_t nSeq;
+    {
+        LOCK(cs);
+        nSeq = nCommitted;
+    }
+    if (!Sync(nSeq))
+        return false;
+
+    bool fCompact;
+    {
+        LOCK(cs);
+        fCompact = nFileSize > WALLETLOG_COMPACT_MIN_SIZE && nLiveBytes < nFileSize / 2;
+    }
+    if (fAllowCompact && fCompact)
+        return Compact();
+    return true;
+}
+
+bool CWalletLog::Compact(const char* pszSkip)
+{
+    LOCK2(cs_sync, cs);
+    if (!fileAppend)
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    boost::filesystem::path pathTmp = path.string() + ".compact";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("CWalletLog::Compact : cannot create %s", pathTmp.string());
+
+    // Copy the live records in key order, so a full load reads the file front to back
+    IndexMap mapNew;
+    uint64_t nPos = WALLETLOG_HEADER_SIZE;
+    uint64_t nLive = 0;
+    size_t nSkip = pszSkip ? strlen(pszSkip) : 0;
+    CWalletLogBatch batch;
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    bool fOk = WriteHeader(file);
+    for (IndexMap::const_iterator mi = mapIndex.begin(); fOk && mi != mapIndex.end(); ++mi)
+    {
+        const vector<unsigned char>& vchKey = mi->first;
+        if (vchKey.empty() || (nSkip && memcmp(&vchKey[0], pszSkip, std::min(vchKey.size(), nSkip)) == 0))
+            continue;
+        if (!ReadValue(mi->second, ssValue))
+        {
+            fOk = false;
+            break;
+        }
+        ssKey.clear();
+        ssKey.write((const char*)&vchKey[0], vchKey.size());
+        batch.Write(ssKey, ssValue);
+        if (batch.size() >= WALLETLOG_COPY_BATCH_SIZE)
+        {
+            fOk = WriteBatch(file, nPos, batch, mapNew, nLive);
+            batch.clear();
+        }
+    }
+    if (fOk)
+        fOk = WriteBatch(file, nPos, batch, mapNew, nLive);
+    if (fOk)
+        FileCommit(file);
+    fclose(file);
+    if (!fOk)
+    {
+        boost::filesystem::remove(pathTmp);
+        return error("CWalletLog::Compact : cannot write %s", pathTmp.string());
+    }
+
+    fclose(fileAppend);
+    fclose(fileRead);
+    fileAppend = fileRead = NULL;
+    bool fRenamed = RenameOver(pathTmp, path);
+    fileRead = fopen(path.string().c_str(), "rb");
+    fileAppend = fopen(path.string().c_str(), "ab");
+    if (!fileRead || !fileAppend)
+    {
+        fFailed = true;
+        return error("CWalletLog::Compact : cannot reopen %s", path.string());
+    }
+    if (!fRenamed)
+    {
+        boost::filesystem::remove(pathTmp);
+        return error("CWalletLog::Compact : cannot replace %s", path.string());
+    }
+
+    LogPrintf("Compacted %s from %u to %u bytes, %dms\n", path.filename().string(), nFileSize, nPos, GetTimeMillis() - nStart);
+    mapIndex.swap(mapNew);
+    nFileSize = nPos;
+    nLiveBytes = nLive;
+    nSynced = nCommitted;
+    fFailed = false;
+    return true;
+}
+
+bool CWalletLog::Backup(const boost::filesystem::path& pathDest)
+{
+    LOCK2(cs_sync, cs);
+    if (!fileAppend)
+        return false;
+    FileCommit(fileAppend);
+    nSynced = nCommitted;
+
+    try {
+#if BOOST_VERSION >= 104000
+        boost::filesystem::copy_file(path, pathDest, boost::filesystem::copy_option::overwrite_if_exists);
+#else
+        boost::filesystem::copy_file(path, pathDest);
+#endif
+    } catch (const boost::filesystem::filesystem_error& e) {
+        return error("CWalletLog::Backup : cannot copy %s to %s : %s", path.string(), pathDest.string(), e.what());
+    }
+    return true;
+}
+
+size_t CWalletLog::GetRecordCount()
+{
+    LOCK(cs);
+    return mapIndex.size();
+}
+
+
+static CCriticalSection cs_mapWalletLogs;
+static map<string, CWalletLog*> mapWalletLogs;
+
+bool OpenWalletLog(const string& strFile, bool fSalvage)
+{
+    LOCK(cs_mapWalletLogs);
+    if (mapWalletLogs.count(strFile))
+        return true;
+
+    CWalletLog* plog = new CWalletLog(GetDataDir() / strFile);
+    if (!plog->Open(fSalvage))
+    {
+        delete plog;
+        return false;
+    }
+    mapWalletLogs[strFile] = plog;
+    return true;
+}
+
+CWalletLog* GetWalletLog(const string& strFile)
+{
+    LOCK(cs_mapWalletLogs);
+    map<string, CWalletLog*>::iterator mi = mapWalletLogs.find(strFile);
+    return mi == mapWalletLogs.end() ? NULL : mi->second;
+}
+
+void CloseWalletLogs()
+{
+    LOCK(cs_mapWalletLogs);
+    for (map<string, CWalletLog*>::iterator mi = mapWalletLogs.begin(); mi != mapWalletLogs.end(); ++mi)
+        delete mi->second;
+    mapWalletLogs.clear();
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLETLOG_H
+#define BITCOIN_WALLETLOG_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Payload bytes per batch when copying many records into a log at once */
+static const unsigned int WALLETLOG_COPY_BATCH_SIZE = 1000000;
+
+/** Records written to a CWalletLog together, see CWalletLog::Commit.
+ *  Keys and values are the same serialized streams CDB hands to Berkeley DB.
+ */
+class CWalletLogBatch
+{
+public:
+    CWalletLogBatch();
+
+    void Write(const CDataStream& ssKey, const CDataStream& ssValue);
+    void Erase(const CDataStream& ssKey);
+
+    /** Latest change to vchKey in this batch: 1 written (ssValue is set), -1 erased, 0 untouched */
+    int Find(const std::vector<unsigned char>& vchKey, CDataStream& ssValue) const;
+
+    bool empty() const { return vRecords.empty(); }
+    unsigned int size() const { return ssPayload.size(); }
+    void clear();
+
+private:
+    friend class CWalletLog;
+
+    struct CRecord
+    {
+        unsigned char nType;
+        std::vector<unsigned char> vchKey;
+        unsigned int nValuePos;     // offset into ssPayload
+        unsigned int nValueSize;
+    };
+
+    CDataStream ssPayload;
+    std::vector<CRecord> vRecords;
+};
+
+/** Append-only, checksummed store of wallet records, an alternative to
+ *  keeping the wallet in Berkeley DB (-walletbackend=log).
+ *
+ *  The file is a sequence of batches, each framed by a magic number, the
+ *  payload size and a checksum of the payload. A damaged last batch, or a
+ *  zero-filled tail, is taken to be a torn write and truncated away on
+ *  open, so every batch is applied entirely or not at all. Damage anywhere
+ *  else fails the open and leaves the file as it is, unless fSalvage asks
+ *  to keep the batches before it (-salvagewallet).
+ *
+ *  Only keys and the file positions of their values are kept in memory.
+ *  Overwritten and erased records stay in the file until Compact copies
+ *  the live ones to a fresh file.
+ */
+class CWalletLog
+{
+public:
+    CWalletLog(const boost::filesystem::path& pathIn);
+    ~CWalletLog();
+
+    bool Open(bool fSalvage = false);
+    void Close();
+
+    bool Read(const CDataStream& ssKey, CDataStream& ssValue, const CWalletLogBatch* pbatch = NULL);
+    bool Exists(const CDataStream& ssKey, const CWalletLogBatch* pbatch = NULL);
+
+    /** Key and value of the first record at or after vchFrom (after it if !fInclusive), in key order */
+    bool ReadNext(const std::vector<unsigned char>& vchFrom, bool fInclusive, CDataStream& ssKey, CDataStream& ssValue);
+
+    /** Append batch to the log. Writes from several threads share a single
+     *  fsync when fSync is set (group commit), otherwise the data reaches
+     *  the disk on the next Flush.
+     */
+    bool Commit(const CWalletLogBatch& batch, bool fSync = false);
+
+    /** fsync everything committed so far, then compact if most of the file is dead records */
+    bool Flush(bool fAllowCompact);
+
+    /** Rewrite the log with only its live records, dropping keys that start with pszSkip */
+    bool Compact(const char* pszSkip = NULL);
+
+    bool Backup(const boost::filesystem::path& pathDest);
+
+    const boost::filesystem::path& GetPath() const { return path; }
+    size_t GetRecordCount();
+
+private:
+    struct CPos
+    {
+        uint64_t nPos;
+        unsigned int nSize;
+    };
+    typedef std::map<std::vector<unsigned char>, CPos> IndexMap;
+
+    boost::filesystem::path path;
+    FILE* fileAppend;
+    FILE* fileRead;
+    bool fFailed;
+
+    IndexMap mapIndex;
+    uint64_t nFileSize;
+    uint64_t nLiveBytes;
+
+    uint64_t nCommitted;            // batches appended
+    uint64_t nSynced;               // batches known to be on disk
+
+    CCriticalSection cs;            // index and files
+    CCriticalSection cs_sync;       // held across fsync, and while files are reopened
+
+    bool Load(bool fSalvage);
+    bool ReadValue(const CPos& pos, CDataStream& ssValue);
+    bool WriteBatch(FILE* file, uint64_t& nPos, const CWalletLogBatch& batch, IndexMap& index, uint64_t& nLive);
+    bool Sync(uint64_t nSeq);
+};
+
+/** Open strFile in the data directory as a wallet log; CDB uses it from then on */
+bool OpenWalletLog(const std::string& strFile, bool fSalvage = false);
+/** The open log for strFile, or NULL if strFile is kept in Berkeley DB */
+CWalletLog* GetWalletLog(const std::string& strFile);
+void CloseWalletLogs();
+
+#endif // BITCOIN_WALLETLOG_H
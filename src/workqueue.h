@@ -0,0 +1,148 @@
+// Copyright (c) 2017 The Parlay developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WORKQUEUE_H
+#define BITCOIN_WORKQUEUE_H
+
+#include "util.h"
+
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+/** Fixed pool of worker threads for data-parallel jobs.
+ *
+ *  Run(n, f) calls f(i) for every i in [0, n) and returns when all calls are
+ *  done. The calling thread takes part in the work, so a queue with no
+ *  workers simply runs the job inline. A job stops early as soon as any f(i)
+ *  returns false, items not yet started are skipped.
+ *
+ *  Items are claimed one at a time under the queue mutex, callers with very
+ *  cheap items should hand out ranges instead.
+ */
+class CWorkQueue
+{
+private:
+    std::string strName;
+    boost::thread_group* pthreadGroup;
+    int nWorkers;
+
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condMaster;
+
+    // -- state of the running job, protected by mutex
+    const boost::function<bool (size_t)>* pfunc;
+    size_t nTotal;
+    size_t nNext;
+    int nActive;
+    bool fCancel;
+    bool fStop;
+    unsigned int nJob;
+
+    // -- serialises callers of Run
+    boost::mutex mutexRun;
+
+    /** Claim and run items until the job is exhausted, mutex must be held. */
+    void Work(boost::unique_lock<boost::mutex>& lock)
+    {
+        while (pfunc && !fCancel && nNext < nTotal)
+        {
+            size_t i = nNext++;
+            nActive++;
+            const boost::function<bool (size_t)>& func = *pfunc;
+            lock.unlock();
+            bool fOk = func(i);
+            lock.lock();
+            nActive--;
+            if (!fOk)
+                fCancel = true;
+        }
+        if (nActive == 0)
+            condMaster.notify_one();
+    }
+
+    void Thread()
+    {
+        RenameThread(("parlay-" + strName).c_str());
+        boost::unique_lock<boost::mutex> lock(mutex);
+        unsigned int nSeen = nJob;
+        while (!fStop)
+        {
+            if (nSeen == nJob)
+            {
+                condWorker.wait(lock);
+                continue;
+            }
+            nSeen = nJob;
+            Work(lock);
+        }
+    }
+
+public:
+    CWorkQueue(const std::string& strNameIn) : strName(strNameIn), pthreadGroup(NULL), nWorkers(0), pfunc(NULL),
+        nTotal(0), nNext(0), nActive(0), fCancel(false), fStop(false), nJob(0) {}
+
+    ~CWorkQueue()
+    {
+        Stop();
+    }
+
+    void Start(int nThreads)
+    {
+        Stop();
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = false;
+        pthreadGroup = new boost::thread_group();
+        for (nWorkers = 0; nWorkers < nThreads; nWorkers++)
+            pthreadGroup->create_thread(boost::bind(&CWorkQueue::Thread, this));
+    }
+
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWorker.notify_all();
+        if (pthreadGroup)
+        {
+            pthreadGroup->join_all();
+            delete pthreadGroup;
+            pthreadGroup = NULL;
+        }
+        nWorkers = 0;
+    }
+
+    int Workers() const
+    {
+        return nWorkers;
+    }
+
+    /** Returns false if the job was cut short by an item returning false. */
+    bool Run(size_t n, const boost::function<bool (size_t)>& func)
+    {
+        boost::unique_lock<boost::mutex> lockRun(mutexRun);
+        boost::unique_lock<boost::mutex> lock(mutex);
+
+        pfunc = &func;
+        nTotal = n;
+        nNext = 0;
+        fCancel = false;
+        nJob++;
+        if (nWorkers > 0 && n > 1)
+            condWorker.notify_all();
+
+        Work(lock);
+        while (nActive > 0)
+            condMaster.wait(lock);
+
+        pfunc = NULL;
+        return !fCancel;
+    }
+};
+
+#endif // BITCOIN_WORKQUEUE_H